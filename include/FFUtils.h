@@ -92,6 +92,8 @@ public:
     bool SetOutColorFormat(ImColorFormat clrfmt);
     bool SetOutDataType(ImDataType dtype);
     bool SetResizeInterpolateMode(ImInterpolateMode interp);
+    // Slice threading of the persistent SwsContext, it requires libswscale 6 or later
+    bool SetSwsThreadCount(uint32_t threadCount);
     bool ConvertImage(const AVFrame* avfrm, ImGui::ImMat& outMat, double timestamp);
 
     uint32_t GetOutWidth() const { return m_outWidth; }
@@ -99,6 +101,7 @@ public:
     ImColorFormat GetOutColorFormat() const { return m_outClrFmt; }
     ImDataType GetOutDataType() const { return m_outDataType; }
     ImInterpolateMode GetResizeInterpolateMode() const { return m_resizeInterp; }
+    uint32_t GetSwsThreadCount() const { return m_swsThreadCount; }
 
     void SetUseVulkanConverter(bool use) { m_useVulkanComponents = use; }
 
@@ -117,6 +120,7 @@ private:
     bool m_useVulkanComponents;
     SwsContext* m_swsCtx{nullptr};
     int m_swsFlags{0};
+    uint32_t m_swsThreadCount{1};
     int m_swsInWidth{0}, m_swsInHeight{0};
     AVPixelFormat m_swsInFormat{AV_PIX_FMT_NONE};
     AVPixelFormat m_swsOutFormat{AV_PIX_FMT_RGBA};
@@ -246,6 +250,10 @@ struct OpenVideoDecoderOptions
     AVPixelFormat useHwOutputPixfmt{AV_PIX_FMT_NONE};
     AVPixelFormat forceOutputPixfmt{AV_PIX_FMT_NONE};
     MediaCore::HwaccelManager::Holder hHwaMgr;
+    // for preview purpose: decode at 1/(2^lowres) resolution, clamped to the decoder's capability, software decoder only
+    int lowres{0};
+    AVDiscard skipLoopFilter{AVDISCARD_DEFAULT};
+    int threadCount{8};                             // threads of the software decoder
 };
 struct OpenVideoDecoderResult
 {
@@ -255,6 +263,47 @@ struct OpenVideoDecoderResult
     std::string errMsg;
 };
 bool OpenVideoDecoder(const AVFormatContext* pAvfmtCtx, int videoStreamIndex, OpenVideoDecoderOptions* options, OpenVideoDecoderResult* result, bool needValidation = true);
+// The largest 'lowres' value(up to 3) which still decodes a picture not smaller than the output size. 0 if the output size is unspecified.
+int CalcLowresForOutputSize(int srcWidth, int srcHeight, uint32_t outWidth, uint32_t outHeight);
+// Scaling threads used for the preview images when not specified: a quarter of the cores within [1, 4], since the decoders
+// and the other preview generators compete for the same cores.
+uint32_t GetDefaultSwsThreadCount();
+
+// Decode the picture of a single image file, e.g. one file of an image sequence. The decoder context is reused for the following
+// files as long as their codec and size stay the same, so the stream info is only probed for the first file. If the file has an
+// attached picture(embedded thumbnail) not smaller than the wanted size, it's decoded instead of the main picture.
+class ImageFileDecoder
+{
+public:
+    ImageFileDecoder() = default;
+    ~ImageFileDecoder();
+
+    ImageFileDecoder(const ImageFileDecoder&) = delete;
+    ImageFileDecoder& operator=(const ImageFileDecoder&) = delete;
+
+    // 'lowres' of the options is overridden, it's calculated from the wanted size and the size of each stream a decoder is opened for
+    void SetDecoderOptions(const OpenVideoDecoderOptions& options) { m_decOpts = m_thumbDecOpts = options; }
+    void SetWantedSize(uint32_t width, uint32_t height) { m_wantedWidth = width; m_wantedHeight = height; }
+    SelfFreeAVFramePtr DecodeFile(const std::string& filePath);
+    int GetLowres() const { return m_decCtx ? m_decCtx->lowres : 0; }
+
+    std::string GetError() const { return m_errMsg; }
+
+private:
+    bool OpenDecoder(AVCodecContext** ppDecCtx, OpenVideoDecoderOptions& decOpts, const AVFormatContext* avfmtCtx, int stmIdx);
+    SelfFreeAVFramePtr DecodePicture(AVCodecContext* decCtx, AVFormatContext* avfmtCtx, int stmIdx, const AVPacket* attachedPic);
+
+private:
+    OpenVideoDecoderOptions m_decOpts;
+    uint32_t m_wantedWidth{0}, m_wantedHeight{0};
+    AVCodecContext* m_decCtx{nullptr};
+    int m_decSrcWidth{0}, m_decSrcHeight{0};
+    // the embedded thumbnails are decoded by their own decoder, with the 'lowres' of their own size
+    OpenVideoDecoderOptions m_thumbDecOpts;
+    AVCodecContext* m_thumbDecCtx{nullptr};
+    int m_thumbSrcWidth{0}, m_thumbSrcHeight{0};
+    std::string m_errMsg;
+};
 
 // A function to copy pcm data from one buffer to another, with the considering of sample format and buffer state
 uint32_t CopyPcmDataEx(uint8_t channels, uint8_t bytesPerSample, uint32_t copySamples,
@@ -24,6 +24,7 @@
 #include "MediaCore.h"
 #include "MediaData.h"
 #include "MediaInfo.h"
+#include "MediaParser.h"
 #include "Logger.h"
 
 namespace MediaCore
@@ -94,6 +95,78 @@ struct MediaEncoder
 
     static MEDIACORE_API bool FindEncoder(const std::string& codecName, std::vector<Description>& encoderDescList);
 
+    struct Statistics
+    {
+        int64_t vidInputStallMillisec{0};   // total time that 'EncodeVideoFrame()' is blocked by a full input queue
+        uint32_t vidInputStallCount{0};
+        uint32_t vidInputQueueMaxSize{0};
+        uint32_t vidInputQueuePeakSize{0};
+        double vidInputQueueAvgSize{0};     // average queue occupancy sampled on each enqueue
+        int64_t audInputStallMillisec{0};   // total time that 'EncodeAudioSamples()' is blocked by a full input queue
+        uint32_t audInputStallCount{0};
+        uint32_t audInputQueueMaxSize{0};
+        uint32_t audInputQueuePeakSize{0};
+        double audInputQueueAvgSize{0};
+        int64_t vidConvertWaitMillisec{0};  // total time that the video encoding thread waits for the conversion workers
+        uint32_t vidConverterThreadCount{0};
+        int64_t muxIdleWaitMillisec{0};     // total time that the muxing thread waits for encoded packets
+        uint32_t vidPassthroughSegmentCount{0};     // segments copied by 'CopyVideoPackets()'
+        uint32_t vidPassthroughPacketCount{0};
+        uint32_t vidStaticFrameCount{0};    // input frames found identical to the previous one
+        uint32_t vidStaticFrameDropped{0};  // static frames not sent to the encoder (variable frame rate output)
+        int64_t ioWaitMillisec{0};          // total time that the muxing thread is blocked by the output I/O
+        int64_t ioWriteMillisec{0};         // total time spent in writing the output file by the I/O thread
+        int64_t ioBytesWritten{0};
+        uint32_t vidImageSeqEncoderCount{0};    // parallel encoders of the image sequence output, 0 means not used
+        uint32_t vidImageSeqFileCount{0};
+        int64_t vidImageSeqSyncMillisec{0};     // total time spent in flushing the image files to the storage
+        uint32_t vidEncoderThreadCount{0};  // 0 means the encoder chooses by itself
+        std::string vidEncoderThreadType;   // 'frame', 'slice', 'frame+slice', 'auto' or 'none'
+        int64_t elapsedMillisec{0};         // from 'Start()' to the end of 'FinishEncoding()'
+        float renderUtilization{0};         // fraction of the elapsed time the caller spends on producing video frames, i.e. not blocked by the encoder
+        float convertUtilization{0};        // averaged over the conversion threads
+        float encodeUtilization{0};         // fraction of the elapsed time spent inside the video encoder's send/receive calls
+        float muxUtilization{0};
+
+        friend MEDIACORE_API std::ostream& operator<<(std::ostream& os, const Statistics& stats);
+    };
+
+    struct OutputIoOptions
+    {
+        bool asyncIo{false};                // write local output files through large buffers on a dedicated I/O thread
+        uint32_t bufferSize{4*1024*1024};
+        uint32_t bufferCount{4};
+        bool directIo{false};               // bypass the page cache (O_DIRECT) where it is supported
+        bool fragmentedMp4{false};          // write fragmented mp4/mov, so the output can be read while it is being written
+    };
+
+    struct ImageSequenceOptions
+    {
+        uint32_t encoderCount{0};           // number of parallel encoders, 0 means one for each CPU core
+        bool syncFiles{false};              // flush each image to the storage (fsync) on a dedicated thread, pipelined with the encoding
+    };
+
+    struct VideoThreadingOptions
+    {
+        enum ThreadType
+        {
+            THREAD_TYPE_DEFAULT = 0,        // let the encoder decide
+            THREAD_TYPE_FRAME,
+            THREAD_TYPE_SLICE,              // lower latency, usually lower throughput than frame threading
+            THREAD_TYPE_FRAME_SLICE,
+        };
+        uint32_t threadCount{0};            // 0 leaves the thread count to the encoder
+        ThreadType threadType{THREAD_TYPE_DEFAULT};
+        bool autoTune{false};               // ignore 'threadCount', and give the encoder as many cores as it needs to keep pace with the render pipeline
+    };
+
+    // Must be called before 'Open()'.
+    virtual bool SetOutputIoOptions(const OutputIoOptions& opts) = 0;
+    // An image sequence output (an url with a frame number pattern like 'frame_%05d.png') using an intra-only codec (png, tiff,
+    // dpx, exr...) encodes the frames with several encoder contexts in parallel, and writes each image directly to the file
+    // numbered by its input order. It falls back to the single encoder when there's an audio stream or the encoder is a
+    // hardware one. Must be called before 'Start()'.
+    virtual bool SetImageSequenceOptions(const ImageSequenceOptions& opts) = 0;
     virtual bool Open(const std::string& url) = 0;
     virtual bool Close() = 0;
     virtual bool ConfigureVideoStream(const std::string& codecName,
@@ -108,6 +181,21 @@ struct MediaEncoder
     virtual bool EncodeVideoFrame(ImGui::ImMat& vmat, bool wait = true) = 0;
     virtual bool EncodeAudioSamples(uint8_t* buf, uint32_t size, bool wait = true) = 0;
     virtual bool EncodeAudioSamples(ImGui::ImMat& amat, bool wait = true) = 0;
+    // Hint that the frame at 'pos' (in milliseconds) is identical to the previous input frame, e.g. a paused timeline segment.
+    // It's handled like a static frame found by 'EnableStaticFrameDedup()', without converting or comparing any image.
+    // It fails if no video frame has been sent since 'Start()' or the last 'CopyVideoPackets()', since there's nothing to repeat.
+    virtual bool EncodeRepeatedVideoFrame(int64_t pos, bool wait = true) = 0;
+    // Smart-render passthrough: copy the compressed video packets in [srcStartPts, srcEndPts) of the best video stream of
+    // 'hParser' into the output, placing 'srcStartPts' at 'dstStartMts' of the output. 'srcStartPts' must be a key frame.
+    // All the video frames sent before are flushed out of the encoder, which is reopened after the copy, so that the following
+    // frames start a new GOP. The source must pass 'CheckVideoPassthrough()', the length prefixed H.264/HEVC packets of a mp4/mkv
+    // source are converted into AnnexB like the encoder's output. Use an encoder configuration without B-frames to keep the
+    // decoding timestamps monotonic across the splice points.
+    virtual bool CopyVideoPackets(MediaParser::Holder hParser, int64_t srcStartPts, int64_t srcEndPts, int64_t dstStartMts) = 0;
+    // Check the best video stream of 'hParser' is encoded with the same codec, profile, level and parameter sets (the extradata)
+    // as this encoder, so its packets can be spliced with the encoded ones. 'GetError()' tells the mismatch. The encoder must
+    // have its video stream configured.
+    virtual bool CheckVideoPassthrough(MediaParser::Holder hParser) = 0;
 
     virtual bool IsOpened() const = 0;
     virtual bool HasVideo() const = 0;
@@ -116,6 +204,20 @@ struct MediaEncoder
 
     virtual bool IsHwAccelEnabled() const = 0;
     virtual void EnableHwAccel(bool enable) = 0;
+    // Threading of a software video encoder (libx264, libx265...). By default the encoder creates a thread for each core, which
+    // competes with the reader and compositor threads of the render pipeline. With 'autoTune', the split of the cores is decided
+    // by the render and encoding throughput measured in the previous exports of the same codec and frame size in this process.
+    // An 'extraOpts' entry named 'threads' overrides these options. Must be called before 'ConfigureVideoStream()'.
+    virtual bool SetVideoThreadingOptions(const VideoThreadingOptions& opts) = 0;
+    // Set the number of threads converting input frames into the encoder's pixel format, 0 means auto.
+    // Must be called before 'ConfigureVideoStream()'.
+    virtual void SetVideoConverterThreadCount(uint32_t count) = 0;
+    // Detect input frames identical to the previous one by a hash of the input image, taken before the color conversion.
+    // If the output format supports variable frame rate, static frames are dropped and the previous frame lasts longer;
+    // otherwise the previous encoder input is sent again. Either way a static frame is neither converted nor uploaded.
+    // Must be called before 'Start()'.
+    virtual void EnableStaticFrameDedup(bool enable) = 0;
+    virtual Statistics GetStatistics() const = 0;
     virtual std::string GetError() const = 0;
 };
 }
\ No newline at end of file
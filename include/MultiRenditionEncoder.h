@@ -0,0 +1,66 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "immat.h"
+#include "MediaCore.h"
+#include "MediaEncoder.h"
+#include "Logger.h"
+
+namespace MediaCore
+{
+// Encode one stream of video frames and audio samples into several outputs (an ABR ladder).
+// The input image is color converted once for the largest rendition, smaller renditions with the same
+// pixel format are downscaled from the next larger one. Every output converts or downscales its frames on its own
+// worker thread and runs its own MediaEncoder, so the outputs are processed in parallel.
+struct MultiRenditionEncoder
+{
+    using Holder = std::shared_ptr<MultiRenditionEncoder>;
+    static MEDIACORE_API Holder CreateInstance();
+    static MEDIACORE_API Logger::ALogger* GetLogger();
+
+    struct Rendition
+    {
+        std::string url;
+        std::string videoCodec;
+        std::string imageFormat;    // optional, the required input pixel format of the video encoder
+        uint32_t width{0};
+        uint32_t height{0};
+        uint64_t videoBitRate{0};
+        std::vector<MediaEncoder::Option> videoExtraOpts;
+        std::string audioCodec;     // leave it empty if this rendition has no audio
+        uint64_t audioBitRate{0};
+    };
+
+    virtual bool Open(const std::vector<Rendition>& renditions, const Ratio& frameRate,
+            uint32_t audioChannels = 0, uint32_t audioSampleRate = 0) = 0;
+    virtual bool Close() = 0;
+    virtual bool Start() = 0;
+    virtual bool FinishEncoding() = 0;
+    virtual bool EncodeVideoFrame(ImGui::ImMat& vmat, bool wait = true) = 0;
+    virtual bool EncodeAudioSamples(ImGui::ImMat& amat, bool wait = true) = 0;
+
+    virtual bool IsOpened() const = 0;
+    virtual uint32_t GetRenditionCount() const = 0;
+    virtual MediaEncoder::Holder GetRenditionEncoder(uint32_t index) const = 0;
+    virtual std::string GetError() const = 0;
+};
+}
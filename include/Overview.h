@@ -21,6 +21,7 @@
 #include <vector>
 #include "immat.h"
 #include "MediaParser.h"
+#include "PreviewCache.h"
 #include "Logger.h"
 #include "MediaCore.h"
 
@@ -54,6 +55,14 @@ struct Overview
 
     virtual bool IsOpened() const = 0;
     virtual bool IsDone() const = 0;
+    // Generation progress of the snapshots and the waveform, in [0, 1]
+    virtual float GetProgress() const = 0;
+    // True if neither the snapshots nor the waveform can be generated, e.g. no decoder can be opened
+    virtual bool IsFailed() const = 0;
+    // Bytes read from the media by the demuxers of the latest snapshots/waveform generation
+    virtual int64_t GetIoBytesRead() const = 0;
+    // The decoders and the decoding threads are released automatically once the generation is done, after 'IsDone()' turns true
+    virtual bool IsDecodingResourceReleased() const = 0;
     virtual bool HasVideo() const = 0;
     virtual bool HasAudio() const = 0;
     virtual uint32_t GetSnapshotCount() const = 0;
@@ -79,6 +88,22 @@ struct Overview
 
     virtual bool IsHwAccelEnabled() const = 0;
     virtual void EnableHwAccel(bool enable) = 0;
+    // Keyframe snap: only the key frames are demuxed and decoded, and each snapshot shows the key frame nearest to its position.
+    // It's accurate to a GOP, and much faster on long-GOP files. The key frames are looked up in the demuxer's index, a container
+    // without one (e.g. mpegts) gets the key frame before each position, unless it's demuxed sequentially with the audio.
+    // Must be called before 'Open()'.
+    virtual bool IsKeyframeSnapEnabled() const = 0;
+    virtual void EnableKeyframeSnap(bool enable) = 0;
+    // Threads used to scale each snapshot, 0 means 'FFUtils::GetDefaultSwsThreadCount()'. Must be called before 'Open()'.
+    virtual bool SetSwsThreadCount(uint32_t count) = 0;
+    virtual uint32_t GetSwsThreadCount() const = 0;
+    // Threads of the software video decoder, 0 means the default of 'FFUtils::OpenVideoDecoderOptions'. Must be called before 'Open()'.
+    virtual bool SetVideoDecoderThreadCount(uint32_t count) = 0;
+    virtual uint32_t GetVideoDecoderThreadCount() const = 0;
+    // Reuse the snapshots and the waveform stored in the preview cache, and store the newly generated ones into it.
+    // Must be called before 'Open()'.
+    virtual void SetPreviewCache(PreviewCache::Holder hCache) = 0;
+    virtual PreviewCache::Holder GetPreviewCache() const = 0;
     virtual std::string GetError() const = 0;
 };
 }
@@ -0,0 +1,95 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <functional>
+#include "MediaCore.h"
+#include "MediaParser.h"
+#include "Overview.h"
+#include "PreviewCache.h"
+#include "Logger.h"
+
+namespace MediaCore
+{
+// Generate the overviews of many media files, e.g. when a folder is imported. Each 'Overview' runs its own decoders and threads,
+// the service only starts a queued one when the running ones leave enough room under the global limits of decoders, threads
+// and bytes in flight, which are estimated from the media info. The queued overviews are served by priority, then in the
+// request order. An overview keeps its share of the limits until its decoders are released, which happens a while after it is
+// reported as done.
+struct OverviewService
+{
+    using Holder = std::shared_ptr<OverviewService>;
+    static MEDIACORE_API Holder CreateInstance();
+    static MEDIACORE_API Logger::ALogger* GetLogger();
+
+    struct Settings
+    {
+        uint32_t maxRunningOverviews{4};
+        uint32_t maxDecoders{6};                        // video and audio decoders of the running overviews
+        uint32_t maxThreads{16};                        // threads of the running overviews, including the decoders' and the scalers' own
+        uint64_t maxBytesInFlight{256ULL*1024*1024};    // snapshot images and decoded frame queues of the running overviews
+        uint32_t videoDecoderThreads{2};                // threads of each software video decoder, reduced to fit in 'maxThreads'
+        uint32_t swsThreads{1};                         // threads scaling the snapshots of each overview
+        uint32_t maxFinishedOverviews{256};             // done or failed overviews kept for the queries, the oldest are dropped
+        uint32_t snapshotCount{20};
+        uint32_t snapshotWidth{0}, snapshotHeight{0};   // 0 means the size of the video
+        bool keyframeSnap{true};
+        bool useHwAccel{false};
+        PreviewCache::Holder hPreviewCache;
+    };
+
+    enum Priority
+    {
+        PRIORITY_LOW = 0,
+        PRIORITY_NORMAL,
+        PRIORITY_HIGH,                                  // used for the files visible in the bin
+    };
+
+    enum State
+    {
+        OVERVIEW_NONE = 0,
+        OVERVIEW_QUEUED,
+        OVERVIEW_GENERATING,
+        OVERVIEW_DONE,
+        OVERVIEW_FAILED,
+    };
+
+    // Invoked on the service thread when the state changes, or the progress increases by at least 1%
+    using ProgressCallback = std::function<void(const std::string& url, State state, float progress)>;
+
+    virtual bool Initialize(const Settings& settings) = 0;
+    virtual const Settings& GetSettings() const = 0;
+    virtual void SetProgressCallback(ProgressCallback callback) = 0;
+
+    // Queue the overview generation of 'url', or change the priority of a queued one
+    virtual bool RequestOverview(const std::string& url, Priority priority = PRIORITY_NORMAL) = 0;
+    virtual bool RequestOverview(MediaParser::Holder hParser, Priority priority = PRIORITY_NORMAL) = 0;
+    virtual bool SetPriority(const std::string& url, Priority priority) = 0;
+    virtual bool CancelOverview(const std::string& url) = 0;
+    virtual State GetState(const std::string& url) = 0;
+    virtual float GetProgress(const std::string& url) = 0;
+    // Return the overview once its generation is started, otherwise nullptr
+    virtual Overview::Holder GetOverview(const std::string& url) = 0;
+    // Block until all the queued overviews are generated
+    virtual void WaitAllDone() = 0;
+
+    virtual std::string GetError() const = 0;
+};
+}
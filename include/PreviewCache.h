@@ -0,0 +1,66 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "immat.h"
+#include "MediaCore.h"
+#include "Logger.h"
+
+namespace MediaCore
+{
+// Content-addressed on-disk cache for the preview data, like the snapshots and the waveforms generated by 'Overview' and
+// 'Snapshot::Generator'. Each entry is stored in one file named by the hash of its key, the key should contain the media
+// identity (see 'MakeMediaKey()') and all the parameters used to generate the data. Store related data as one entry (e.g. all
+// the snapshots of a GOP), since each entry costs a file. Images are compressed as JPEG.
+// 'PutData()' and 'PutImages()' only queue the entry, it's compressed and written by a background thread, and served from
+// memory until then. When the total size exceeds the limit, the least recently used entries are removed.
+struct PreviewCache
+{
+    using Holder = std::shared_ptr<PreviewCache>;
+    static MEDIACORE_API Holder CreateInstance();
+    static MEDIACORE_API Holder GetDefaultInstance();
+    static MEDIACORE_API Logger::ALogger* GetLogger();
+
+    // Build the identity of a media file from its url, size and modification time. Return empty string if the file can not be accessed.
+    static MEDIACORE_API std::string MakeMediaKey(const std::string& url);
+
+    virtual bool Open(const std::string& cacheDir, uint64_t sizeLimit = 512ULL*1024*1024) = 0;
+    virtual void Close() = 0;
+    virtual bool IsOpened() const = 0;
+    virtual void SetSizeLimit(uint64_t sizeLimit) = 0;
+    virtual uint64_t GetSizeLimit() const = 0;
+    virtual uint64_t GetTotalSize() const = 0;
+    virtual void Clear() = 0;
+    // Wait until all the queued entries are written
+    virtual void Flush() = 0;
+
+    // Return false if the cache is not opened or the write queue is full, the entry is dropped then
+    virtual bool PutData(const std::string& key, const std::vector<uint8_t>& data) = 0;
+    virtual bool GetData(const std::string& key, std::vector<uint8_t>& data) = 0;
+    // Empty mats are kept as placeholders
+    virtual bool PutImages(const std::string& key, const std::vector<ImGui::ImMat>& images) = 0;
+    virtual bool GetImages(const std::string& key, std::vector<ImGui::ImMat>& images) = 0;
+    virtual bool Contains(const std::string& key) = 0;
+    virtual bool Remove(const std::string& key) = 0;
+
+    virtual std::string GetError() const = 0;
+};
+}
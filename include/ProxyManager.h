@@ -0,0 +1,90 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "MediaCore.h"
+#include "MediaParser.h"
+#include "MediaEncoder.h"
+#include "Logger.h"
+
+namespace MediaCore
+{
+// Generate reduced-resolution, intra-only proxies of the video sources in the background, so that seeking on the timeline
+// doesn't need to decode the long GOPs of the originals. Proxies are decoded by 'MediaReader' and encoded by 'MediaEncoder'
+// on a bounded pool of worker threads, the pending requests are served by priority.
+// A 'VideoClip' reads from the proxy when the 'SharedSettings' it's created with has a ProxyManager attached. The settings
+// used for the final export are switched to export mode ('SharedSettings::SetExportMode()'), then the clips read from the
+// original sources even if the settings are cloned from the timeline's.
+struct ProxyManager
+{
+    using Holder = std::shared_ptr<ProxyManager>;
+    static MEDIACORE_API Holder CreateInstance();
+    static MEDIACORE_API Logger::ALogger* GetLogger();
+
+    struct Settings
+    {
+        std::string proxyDir;               // the proxy files are kept in this directory, it's created if it doesn't exist
+        std::string codecName{"mjpeg"};     // an intra-only codec, e.g. 'mjpeg', 'prores_ks' with profile 0 (proxy), 'dnxhd' with profile 'dnxhr_lb'
+        std::string fileExtension{"mov"};
+        std::vector<MediaEncoder::Option> extraOpts;
+        uint32_t maxHeight{540};            // sources not higher than this don't need a proxy
+        uint64_t bitRate{0};                // 0 means about 1 bit per pixel
+        uint32_t workerCount{2};
+        bool autoGenerate{true};            // 'AcquireProxy()' requests the generation if the proxy is not ready
+    };
+
+    enum Priority
+    {
+        PRIORITY_LOW = 0,
+        PRIORITY_NORMAL,
+        PRIORITY_HIGH,                      // used for the clips on the timeline
+    };
+
+    enum State
+    {
+        PROXY_NONE = 0,
+        PROXY_QUEUED,
+        PROXY_GENERATING,
+        PROXY_READY,
+        PROXY_NOT_REQUIRED,                 // the source is small enough
+        PROXY_FAILED,
+    };
+
+    virtual bool Initialize(const Settings& settings) = 0;
+    virtual const Settings& GetSettings() const = 0;
+    virtual void SetProxyEnabled(bool enable) = 0;
+    virtual bool IsProxyEnabled() const = 0;
+
+    // Queue the proxy generation of 'url', or raise the priority of a queued one
+    virtual bool RequestProxy(const std::string& url, Priority priority = PRIORITY_NORMAL) = 0;
+    virtual bool CancelProxy(const std::string& url) = 0;
+    virtual State GetProxyState(const std::string& url) = 0;
+    virtual float GetProxyProgress(const std::string& url) = 0;
+    virtual std::string GetProxyUrl(const std::string& url) = 0;
+    // Return an opened parser of the proxy if it's ready and proxy is enabled, otherwise nullptr.
+    // If 'autoGenerate' is set, a missing proxy is requested with 'priority'.
+    virtual MediaParser::Holder AcquireProxy(const std::string& url, Priority priority = PRIORITY_HIGH) = 0;
+    // Block until all the queued proxies are generated
+    virtual void WaitAllDone() = 0;
+
+    virtual std::string GetError() const = 0;
+};
+}
@@ -6,6 +6,7 @@
 #include "MediaCore.h"
 #include "MediaInfo.h"
 #include "HwaccelManager.h"
+#include "ProxyManager.h"
 #include "immat.h"
 #include "imgui_json.h"
 
@@ -24,6 +25,8 @@ struct SharedSettings
     virtual ImColorFormat VideoOutColorFormat() const = 0;
     virtual ImDataType VideoOutDataType() const = 0;
     virtual HwaccelManager::Holder GetHwaccelManager() const = 0;
+    virtual ProxyManager::Holder GetProxyManager() const = 0;
+    virtual bool IsExportMode() const = 0;
     virtual uint32_t AudioOutChannels() const = 0;
     virtual uint32_t AudioOutSampleRate() const = 0;
     virtual ImDataType AudioOutDataType() const = 0;
@@ -36,6 +39,11 @@ struct SharedSettings
     virtual void SetVideoOutColorFormat(ImColorFormat colorFormat) = 0;
     virtual void SetVideoOutDataType(ImDataType dataType) = 0;
     virtual void SetHwaccelManager(HwaccelManager::Holder hHwaMgr) = 0;
+    // Video clips created with these settings read from the proxies of their sources, unless the settings are in export mode
+    virtual void SetProxyManager(ProxyManager::Holder hProxyMgr) = 0;
+    // Settings in export mode never resolve the proxies, 'GetProxyManager()' returns nullptr for them. 'Clone()' keeps the mode,
+    // so the export settings cloned from the timeline's must be switched to export mode before the clips are created with them.
+    virtual void SetExportMode(bool exportMode) = 0;
     virtual void SetAudioOutChannels(uint32_t channels) = 0;
     virtual void SetAudioOutSampleRate(uint32_t sampleRate) = 0;
     virtual void SetAudioOutDataType(ImDataType dataType) = 0;
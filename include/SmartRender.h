@@ -0,0 +1,79 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "MediaCore.h"
+#include "MediaParser.h"
+#include "MediaEncoder.h"
+#include "MultiTrackVideoReader.h"
+#include "SubtitleTrack.h"
+#include "Logger.h"
+
+namespace MediaCore
+{
+// Smart-render planning: find the parts of a timeline whose output is exactly one untouched source video,
+// so that the exporter can copy the compressed packets (MediaEncoder::CopyVideoPackets()) instead of
+// decoding and re-encoding them. Only whole GOPs are copied, the frames around the GOP boundaries are
+// still rendered and encoded as usual.
+namespace SmartRender
+{
+    struct Segment
+    {
+        int64_t start{0};               // timeline range [start, end) in milliseconds
+        int64_t end{0};
+        bool passthrough{false};
+        // below are only valid for passthrough segments
+        MediaParser::Holder hParser;
+        int64_t srcStartPts{0};         // pts of the first key frame to copy, in the source stream timebase
+        int64_t srcEndPts{0};           // pts of the key frame where copying stops (exclusive)
+    };
+
+    struct VideoExportSettings
+    {
+        std::string codecName;          // encoder name or codec name, e.g. 'libx264' or 'h264'
+        std::string imageFormat;        // the pixel format used by the encoder, e.g. 'yuv420p'
+        uint32_t width{0};
+        uint32_t height{0};
+        Ratio frameRate;
+        std::vector<SubtitleTrackHolder> subtitleTracks;    // subtitle tracks burnt into the output
+        int64_t minPassthroughDuration{2000};               // shorter segments are not worth switching the encoder
+    };
+
+    // Split the timeline of 'hMtvReader' into consecutive segments, each one either needs re-encoding or can be passed through.
+    // The source media must have its seek points parsed (MediaParser::VIDEO_SEEK_POINTS), otherwise the clip is re-encoded.
+    // With 'hEncoder', a source is only passed through if its codec parameters match the encoder's (MediaEncoder::CheckVideoPassthrough()),
+    // the same codec with another profile, level or parameter sets would not decode after the splice points. Without it the plan
+    // only compares the codec, the frame size and the frame rate.
+    MEDIACORE_API std::vector<Segment> PlanVideoSegments(MultiTrackVideoReader::Holder hMtvReader, const VideoExportSettings& settings,
+            MediaEncoder::Holder hEncoder = nullptr);
+
+    // Export the video of 'hMtvReader' into 'hEncoder' by the plan of 'PlanVideoSegments()'. The passthrough segments are copied
+    // by 'MediaEncoder::CopyVideoPackets()', the other segments are read frame by frame from 'hMtvReader' and encoded. 'hEncoder'
+    // must be started with its video stream configured by 'settings', the video EOF is sent to it at the end. The settings of
+    // 'hMtvReader' must be in export mode (SharedSettings::SetExportMode()), so no clip reads from a proxy.
+    // 'pPlan' receives the segments used for the export, and 'errMsg' the reason of a failure.
+    MEDIACORE_API bool ExportVideo(MultiTrackVideoReader::Holder hMtvReader, MediaEncoder::Holder hEncoder, const VideoExportSettings& settings,
+            std::string& errMsg, std::vector<Segment>* pPlan = nullptr);
+
+    MEDIACORE_API Logger::ALogger* GetLogger();
+    MEDIACORE_API std::ostream& operator<<(std::ostream& os, const Segment& seg);
+}
+}
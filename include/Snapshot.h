@@ -18,10 +18,13 @@
 #pragma once
 #include <string>
 #include <memory>
+#include <vector>
+#include <utility>
 #include "immat.h"
 #include "MediaCore.h"
 #include "MediaParser.h"
 #include "Overview.h"
+#include "PreviewCache.h"
 #include "TextureManager.h"
 #include "Logger.h"
 
@@ -83,6 +86,13 @@ namespace Snapshot
         virtual bool HasVideo() const = 0;
         virtual bool ConfigSnapWindow(double& windowSize, double frameCount, bool forceRefresh = false) = 0;
         virtual bool SetCacheFactor(double cacheFactor) = 0;
+        // Each viewer's cache range is extended in its scrolling direction, by the distance it's expected to travel in
+        // 'seconds' at its current speed. The tasks left out of the extended range are cancelled. 0 disables the prefetch.
+        virtual bool SetPrefetchLookahead(double seconds) = 0;
+        // Number of the snapshots requested by 'GetSnapshots()' for the first time, and how many of them were ready then
+        virtual void GetFirstRequestStats(uint64_t& requestCount, uint64_t& readyCount) const = 0;
+        // Bytes of the decoded snapshot images held by this generator, updated by the memory pool in every 100ms
+        virtual uint64_t GetMemoryFootprint() const = 0;
         virtual double GetMinWindowSize() const = 0;
         virtual double GetMaxWindowSize() const = 0;
 
@@ -103,10 +113,34 @@ namespace Snapshot
 
         virtual bool IsHwAccelEnabled() const = 0;
         virtual void EnableHwAccel(bool enable) = 0;
+        // Keyframe snap: only the key frames are demuxed and decoded, each snapshot shows the key frame nearest to its position.
+        // Must be called before 'Open()'.
+        virtual bool IsKeyframeSnapEnabled() const = 0;
+        virtual void EnableKeyframeSnap(bool enable) = 0;
+        // Snapshots are looked up in the preview cache before their GOP is decoded, and the decoded ones are stored into it.
+        // Must be called before 'Open()'.
+        virtual void SetPreviewCache(PreviewCache::Holder hCache) = 0;
+        virtual PreviewCache::Holder GetPreviewCache() const = 0;
+        // Number of the workers demuxing and decoding the GOP tasks in parallel, each has its own demuxer and decoder.
+        // The tasks in the view window are served first. Must be called before 'Open()'.
+        virtual bool SetDecodeWorkerCount(uint32_t count) = 0;
+        virtual uint32_t GetDecodeWorkerCount() const = 0;
+        // Threads used to scale each snapshot, 0 means 'FFUtils::GetDefaultSwsThreadCount()'. Must be called before 'Open()'.
+        virtual bool SetSwsThreadCount(uint32_t count) = 0;
+        virtual uint32_t GetSwsThreadCount() const = 0;
         virtual void SetLogLevel(Logger::Level l) = 0;
         virtual std::string GetError() const = 0;
     };
 
+    // Process-wide byte budget for the snapshot images of all the generators, 0 means unlimited. When it's exceeded, the
+    // snapshots out of the view windows are evicted, the ones far from the view windows and not accessed lately go first.
+    // The evicted snapshots are decoded again when a view window gets close to them.
+    MEDIACORE_API void SetMemoryBudget(uint64_t bytes);
+    MEDIACORE_API uint64_t GetMemoryBudget();
+    MEDIACORE_API uint64_t GetTotalMemoryFootprint();
+    // Footprint of each generator, paired with its url
+    MEDIACORE_API void GetMemoryFootprints(std::vector<std::pair<std::string, uint64_t>>& footprints);
+
     MEDIACORE_API Logger::ALogger* GetLogger();
 }
 }
@@ -19,7 +19,9 @@
 #include <cstdint>
 #include <string>
 #include <memory>
+#include <vector>
 #include "MediaCore.h"
+#include "MediaData.h"
 #include "SubtitleClip.h"
 #include "Logger.h"
 
@@ -71,6 +73,34 @@ struct SubtitleTrack
     virtual bool SetBackColor(const ImVec4& color) = 0;
     virtual bool SetBackgroundColor(const ImVec4& color) = 0;
     virtual void Refresh() = 0;
+    // Style changes made between 'BeginStyleUpdate()' and 'EndStyleUpdate()' are applied with one invalidation of the
+    // rendered images at the end, the calls can be nested
+    virtual void BeginStyleUpdate() = 0;
+    virtual void EndStyleUpdate() = 0;
+    // Limits of the rendered images cached by the track, which are shared by the clips and kept across style changes
+    virtual void SetRenderCacheLimit(uint32_t maxCount, uint64_t maxBytes) = 0;
+    // Maximum count of the renderers rasterizing the clips of this track concurrently, the renderers are created on demand.
+    // Each renderer keeps its own font caches, some megabytes. The default is min(hardware threads, 4).
+    virtual void SetMaxRenderers(uint32_t count) = 0;
+    // Render the images expected in the next 'durationMs' from the play position (backward for reverse play) in a background
+    // thread, so 'SubtitleClip::Image()' finds them rendered. 'frameRate' gives the times of the animation steps, and
+    // 'memoryBudget' limits the bytes rendered ahead of the play position.
+    virtual bool EnablePreRender(bool enable, const Ratio& frameRate = {25, 1}, int64_t durationMs = 3000, uint64_t memoryBudget = 64ULL*1024*1024) = 0;
+    virtual bool IsPreRenderEnabled() const = 0;
+    // Report the play position to the pre-render worker, a jump out of the pre-rendered range is handled as a seek, which
+    // cancels the unfinished pre-rendering
+    virtual void UpdatePreRenderPosition(int64_t pos, bool forward = true) = 0;
+    struct PreRenderStatistics
+    {
+        int64_t playPos{INT64_MIN};                     // the play position the worker renders for
+        bool forward{true};
+        bool idle{true};                                // the duration or the memory budget is filled, or nothing to render
+        int64_t nextFramePos{INT64_MIN};                // position of the next frame to render
+        uint32_t imagesAhead{0};                        // new images rendered ahead of the play position
+        uint64_t bytesAhead{0};
+        uint32_t restartCount{0};                       // restarts caused by the seeks and the content changes
+    };
+    virtual PreRenderStatistics GetPreRenderStatistics() = 0;
 
     // currently supported key-name: Scale, ScaleX, ScaleY, Spacing, Angle, OutlineWidth, ShadowDepth, OffsetH, OffsetV
     virtual bool SetKeyPoints(const ImGui::KeyPointEditor& keyPoints) = 0;
@@ -80,6 +110,8 @@ struct SubtitleTrack
     virtual bool DeleteClip(SubtitleClipHolder hClip) = 0;
     virtual bool ChangeClipTime(SubtitleClipHolder clip, int64_t startTime, int64_t duration) = 0;
     virtual SubtitleClipHolder GetClipByTime(int64_t ms) = 0;
+    // Clips overlapping the time range [startMs, endMs), ordered by their start time
+    virtual std::vector<SubtitleClipHolder> GetClipsByTimeRange(int64_t startMs, int64_t endMs) = 0;
     virtual SubtitleClipHolder GetCurrClip() = 0;
     virtual SubtitleClipHolder GetPrevClip() = 0;
     virtual SubtitleClipHolder GetNextClip() = 0;
@@ -71,6 +71,8 @@ struct VideoClip
     virtual int64_t Id() const = 0;
     virtual int64_t TrackId() const = 0;
     virtual bool IsImage() const = 0;
+    // Whether the frames are read from the proxy of the source (see 'ProxyManager')
+    virtual bool IsUsingProxy() const = 0;
     virtual int64_t Start() const = 0;
     virtual int64_t End() const = 0;
     virtual int64_t StartOffset() const = 0;
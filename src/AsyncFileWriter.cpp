@@ -0,0 +1,390 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+#include "AsyncFileWriter.h"
+#include "ThreadUtils.h"
+
+using namespace std;
+
+namespace MediaCore
+{
+static uint8_t* AllocAlignedBuffer(size_t size)
+{
+#if defined(_WIN32)
+    return (uint8_t*)_aligned_malloc(size, AsyncFileWriter::IO_ALIGNMENT);
+#else
+    void* p = nullptr;
+    if (posix_memalign(&p, AsyncFileWriter::IO_ALIGNMENT, size) != 0)
+        return nullptr;
+    return (uint8_t*)p;
+#endif
+}
+
+static void FreeAlignedBuffer(uint8_t* p)
+{
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static int64_t PositionedWrite(int fd, const uint8_t* data, size_t size, int64_t offset)
+{
+#if defined(_WIN32)
+    if (_lseeki64(fd, offset, SEEK_SET) < 0)
+        return -1;
+    return _write(fd, data, (unsigned int)size);
+#else
+    return pwrite(fd, data, size, offset);
+#endif
+}
+
+static int64_t PositionedRead(int fd, uint8_t* buf, size_t size, int64_t offset)
+{
+#if defined(_WIN32)
+    if (_lseeki64(fd, offset, SEEK_SET) < 0)
+        return -1;
+    return _read(fd, buf, (unsigned int)size);
+#else
+    return pread(fd, buf, size, offset);
+#endif
+}
+
+bool AsyncFileWriter::Open(const string& path, size_t bufferSize, uint32_t bufferCount, bool directIo, const string& threadName)
+{
+    Close();
+
+    if (bufferSize == 0 || bufferCount == 0)
+    {
+        m_errMsg = "INVALID argument! 'bufferSize' and 'bufferCount' must be positive.";
+        return false;
+    }
+    m_bufferSize = (bufferSize+IO_ALIGNMENT-1)/IO_ALIGNMENT*IO_ALIGNMENT;
+
+#if defined(_WIN32)
+    m_fd = _open(path.c_str(), _O_RDWR|_O_CREAT|_O_TRUNC|_O_BINARY, _S_IREAD|_S_IWRITE);
+    m_directIo = false;
+#else
+    int flags = O_RDWR|O_CREAT|O_TRUNC;
+#if defined(O_DIRECT)
+    if (directIo)
+        flags |= O_DIRECT;
+    m_fd = open(path.c_str(), flags, 0644);
+    if (m_fd < 0 && directIo)
+    {
+        // some file systems refuse O_DIRECT, fall back to buffered I/O
+        flags &= ~O_DIRECT;
+        directIo = false;
+        m_fd = open(path.c_str(), flags, 0644);
+    }
+    m_directIo = directIo;
+#else
+    m_fd = open(path.c_str(), flags, 0644);
+    m_directIo = false;
+#endif
+#endif
+    if (m_fd < 0)
+    {
+        ostringstream oss; oss << "FAILED to open file '" << path << "' for writing! errno=" << errno << "(" << strerror(errno) << ").";
+        m_errMsg = oss.str();
+        return false;
+    }
+
+    m_buffers.resize(bufferCount);
+    m_freeQ.Reset();
+    m_writeQ.Reset();
+    m_freeQ.SetMaxSize(bufferCount);
+    m_writeQ.SetMaxSize(bufferCount);
+    for (auto& buf : m_buffers)
+    {
+        buf.data = AllocAlignedBuffer(m_bufferSize);
+        if (!buf.data)
+        {
+            m_errMsg = "FAILED to allocate aligned I/O buffer!";
+            Close();
+            return false;
+        }
+        m_freeQ.Push(&buf);
+    }
+    m_curBuf = nullptr;
+    m_pos = m_fileSize = 0;
+    m_pendingCount = 0;
+    m_ioErr = false;
+    m_waitUs = m_writeUs = m_bytesWritten = 0;
+
+    m_ioThread = thread(&AsyncFileWriter::IoThreadProc, this);
+    if (!threadName.empty())
+        SysUtils::SetThreadName(m_ioThread, threadName);
+    return true;
+}
+
+bool AsyncFileWriter::Close()
+{
+    bool success = true;
+    if (m_fd >= 0)
+    {
+        success = SubmitCurrentBuffer();
+        m_writeQ.Close();
+        if (m_ioThread.joinable())
+            m_ioThread.join();
+        {
+            lock_guard<mutex> lk(m_pendingLock);
+            if (m_ioErr)
+                success = false;
+        }
+#if defined(_WIN32)
+        _close(m_fd);
+#else
+        if (close(m_fd) != 0 && success)
+        {
+            ostringstream oss; oss << "FAILED to close file! errno=" << errno << "(" << strerror(errno) << ").";
+            m_errMsg = oss.str();
+            success = false;
+        }
+#endif
+        m_fd = -1;
+    }
+    m_freeQ.Reset();
+    m_writeQ.Reset();
+    for (auto& buf : m_buffers)
+    {
+        if (buf.data)
+            FreeAlignedBuffer(buf.data);
+    }
+    m_buffers.clear();
+    m_curBuf = nullptr;
+    return success;
+}
+
+bool AsyncFileWriter::Write(const uint8_t* data, size_t size)
+{
+    if (m_fd < 0)
+    {
+        m_errMsg = "This AsyncFileWriter is NOT opened!";
+        return false;
+    }
+    while (size > 0)
+    {
+        if (!m_curBuf)
+        {
+            auto t0 = chrono::steady_clock::now();
+            if (!m_freeQ.Pop(m_curBuf))
+                return false;
+            m_waitUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
+            {
+                lock_guard<mutex> lk(m_pendingLock);
+                if (m_ioErr)
+                {
+                    m_freeQ.Push(m_curBuf);
+                    m_curBuf = nullptr;
+                    return false;
+                }
+            }
+            m_curBuf->size = 0;
+            m_curBuf->offset = m_pos;
+        }
+        const size_t copySize = min(size, m_bufferSize-m_curBuf->size);
+        memcpy(m_curBuf->data+m_curBuf->size, data, copySize);
+        m_curBuf->size += copySize;
+        data += copySize;
+        size -= copySize;
+        m_pos += copySize;
+        if (m_pos > m_fileSize)
+            m_fileSize = m_pos;
+        if (m_curBuf->size >= m_bufferSize && !SubmitCurrentBuffer())
+            return false;
+    }
+    return true;
+}
+
+int64_t AsyncFileWriter::Read(uint8_t* buf, size_t size)
+{
+    if (!Flush())
+        return -1;
+    if (m_directIo)
+        DisableDirectIo();
+    auto readSize = PositionedRead(m_fd, buf, size, m_pos);
+    if (readSize > 0)
+        m_pos += readSize;
+    return readSize;
+}
+
+int64_t AsyncFileWriter::Seek(int64_t offset, int whence)
+{
+    int64_t newPos;
+    if (whence == SEEK_SET)
+        newPos = offset;
+    else if (whence == SEEK_CUR)
+        newPos = m_pos+offset;
+    else if (whence == SEEK_END)
+        newPos = m_fileSize+offset;
+    else
+        return -1;
+    if (newPos < 0)
+        return -1;
+    // each buffer carries its own file offset, so the pending writes don't need to be waited for
+    if (newPos != m_pos && !SubmitCurrentBuffer())
+        return -1;
+    m_pos = newPos;
+    return m_pos;
+}
+
+bool AsyncFileWriter::Flush()
+{
+    if (m_fd < 0)
+        return false;
+    if (!SubmitCurrentBuffer())
+        return false;
+    auto t0 = chrono::steady_clock::now();
+    unique_lock<mutex> lk(m_pendingLock);
+    m_pendingCv.wait(lk, [this] { return m_pendingCount == 0 || m_ioErr; });
+    m_waitUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
+    return !m_ioErr;
+}
+
+int64_t AsyncFileWriter::GetWriteMicrosec() const
+{
+    lock_guard<mutex> lk(m_pendingLock);
+    return m_writeUs;
+}
+
+int64_t AsyncFileWriter::GetBytesWritten() const
+{
+    lock_guard<mutex> lk(m_pendingLock);
+    return m_bytesWritten;
+}
+
+bool AsyncFileWriter::SubmitCurrentBuffer()
+{
+    if (!m_curBuf)
+        return true;
+    auto buf = m_curBuf;
+    m_curBuf = nullptr;
+    if (buf->size == 0)
+    {
+        m_freeQ.Push(buf);
+        return true;
+    }
+    {
+        lock_guard<mutex> lk(m_pendingLock);
+        m_pendingCount++;
+    }
+    // there are never more submitted buffers than the queue size, so this won't block
+    if (!m_writeQ.Push(buf))
+    {
+        lock_guard<mutex> lk(m_pendingLock);
+        m_pendingCount--;
+        m_errMsg = "I/O queue is closed!";
+        return false;
+    }
+    return true;
+}
+
+void AsyncFileWriter::IoThreadProc()
+{
+    _Buffer* buf;
+    while (m_writeQ.Pop(buf))
+    {
+        bool ioErr;
+        {
+            lock_guard<mutex> lk(m_pendingLock);
+            ioErr = m_ioErr;
+        }
+        if (!ioErr)
+            WriteToFile(buf);
+        buf->size = 0;
+        m_freeQ.Push(buf);
+        {
+            lock_guard<mutex> lk(m_pendingLock);
+            m_pendingCount--;
+        }
+        m_pendingCv.notify_all();
+    }
+}
+
+bool AsyncFileWriter::WriteToFile(const _Buffer* buf)
+{
+    // direct I/O requires both the file offset and the length to be aligned, which is not the case for
+    // the tail of the file and the rewritten headers
+    if (m_directIo && ((buf->offset%IO_ALIGNMENT) != 0 || (buf->size%IO_ALIGNMENT) != 0))
+        DisableDirectIo();
+
+    auto t0 = chrono::steady_clock::now();
+    size_t written = 0;
+    while (written < buf->size)
+    {
+        auto ret = PositionedWrite(m_fd, buf->data+written, buf->size-written, buf->offset+written);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL && m_directIo)
+            {
+                DisableDirectIo();
+                continue;
+            }
+            ostringstream oss; oss << "FAILED to write " << buf->size-written << " bytes at offset " << buf->offset+written
+                    << "! errno=" << errno << "(" << strerror(errno) << ").";
+            SetIoError(oss.str());
+            return false;
+        }
+        written += ret;
+    }
+    const auto writeUs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
+    lock_guard<mutex> lk(m_pendingLock);
+    m_writeUs += writeUs;
+    m_bytesWritten += written;
+    return true;
+}
+
+void AsyncFileWriter::DisableDirectIo()
+{
+    // only the thread that clears the flag touches the file status flags
+    if (!m_directIo.exchange(false))
+        return;
+#if !defined(_WIN32) && defined(O_DIRECT)
+    int flags = fcntl(m_fd, F_GETFL);
+    if (flags >= 0)
+        fcntl(m_fd, F_SETFL, flags&~O_DIRECT);
+#endif
+}
+
+void AsyncFileWriter::SetIoError(const string& errMsg)
+{
+    {
+        lock_guard<mutex> lk(m_pendingLock);
+        m_errMsg = errMsg;
+        m_ioErr = true;
+    }
+    m_pendingCv.notify_all();
+}
+}
@@ -0,0 +1,102 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "BoundedQueue.h"
+
+namespace MediaCore
+{
+// Write a file through a few large aligned buffers. The caller fills the buffers and a dedicated I/O thread writes
+// the full ones to the file, so a slow storage only blocks the caller when all the buffers are in flight.
+// Seeking is supported (the muxers rewrite headers on finishing), reading waits for all the pending writes.
+// Other handles opened on the same file (e.g. the mov faststart pass) only see the complete data after Close().
+class AsyncFileWriter
+{
+public:
+    AsyncFileWriter() = default;
+    ~AsyncFileWriter() { Close(); }
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter(AsyncFileWriter&&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    // 'bufferSize' is rounded up to the alignment required by direct I/O. 'directIo' bypasses the page cache (O_DIRECT)
+    // when the platform supports it, unaligned writes fall back to normal buffered I/O.
+    bool Open(const std::string& path, size_t bufferSize, uint32_t bufferCount, bool directIo, const std::string& threadName = "");
+    bool Close();
+    bool IsOpened() const { return m_fd >= 0; }
+
+    bool Write(const uint8_t* data, size_t size);
+    int64_t Read(uint8_t* buf, size_t size);
+    // 'whence' is SEEK_SET, SEEK_CUR or SEEK_END, returns the new position or -1 on failure
+    int64_t Seek(int64_t offset, int whence);
+    // wait until all the data written so far has been handed over to the operating system
+    bool Flush();
+    int64_t Position() const { return m_pos; }
+    int64_t Size() const { return m_fileSize; }
+
+    // statistics
+    int64_t GetWaitMicrosec() const { return m_waitUs; }     // time the caller is blocked by the I/O thread
+    int64_t GetWriteMicrosec() const;                        // time spent in the write system calls
+    int64_t GetBytesWritten() const;
+
+    std::string GetError() const { return m_errMsg; }
+
+    static constexpr size_t IO_ALIGNMENT = 4096;
+
+private:
+    struct _Buffer
+    {
+        uint8_t* data{nullptr};
+        size_t size{0};
+        int64_t offset{0};
+    };
+
+    bool SubmitCurrentBuffer();
+    void IoThreadProc();
+    bool WriteToFile(const _Buffer* buf);
+    void DisableDirectIo();
+    void SetIoError(const std::string& errMsg);
+
+private:
+    std::string m_errMsg;
+    int m_fd{-1};
+    std::atomic<bool> m_directIo{false};    // cleared by the caller thread (Read) and the I/O thread (WriteToFile)
+    size_t m_bufferSize{0};
+    std::vector<_Buffer> m_buffers;
+    BoundedQueue<_Buffer*> m_freeQ;
+    BoundedQueue<_Buffer*> m_writeQ;
+    _Buffer* m_curBuf{nullptr};
+    int64_t m_pos{0};
+    int64_t m_fileSize{0};
+    std::thread m_ioThread;
+    mutable std::mutex m_pendingLock;
+    std::condition_variable m_pendingCv;
+    uint32_t m_pendingCount{0};
+    bool m_ioErr{false};
+    int64_t m_waitUs{0};
+    int64_t m_writeUs{0};
+    int64_t m_bytesWritten{0};
+};
+}
@@ -0,0 +1,180 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+namespace MediaCore
+{
+// A FIFO queue with an upper size limit, producers block while it is full and consumers block while it is empty.
+// 'Close()' marks the end of input: pushing is refused, popping drains the remaining items and then fails.
+// 'Abort()' wakes up all the waiters and makes every following push/pop fail immediately.
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t maxSize = 1) : m_maxSize(maxSize > 0 ? maxSize : 1) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue(BoundedQueue&&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    void SetMaxSize(size_t maxSize)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_maxSize = maxSize > 0 ? maxSize : 1;
+        }
+        m_notFullCv.notify_all();
+    }
+
+    bool Push(const T& item, bool wait = true)
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        if (m_closed || m_aborted)
+            return false;
+        if (m_items.size() >= m_maxSize)
+        {
+            if (!wait)
+                return false;
+            auto t0 = std::chrono::steady_clock::now();
+            m_notFullCv.wait(lk, [this] { return m_items.size() < m_maxSize || m_closed || m_aborted; });
+            m_pushStallUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-t0).count();
+            m_pushStallCount++;
+            if (m_closed || m_aborted)
+                return false;
+        }
+        m_items.push_back(item);
+        UpdateOccupancy();
+        lk.unlock();
+        m_notEmptyCv.notify_one();
+        return true;
+    }
+
+    bool Pop(T& item, bool wait = true)
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        if (wait)
+            m_notEmptyCv.wait(lk, [this] { return !m_items.empty() || m_closed || m_aborted; });
+        if (m_aborted || m_items.empty())
+            return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        lk.unlock();
+        m_notFullCv.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_closed = true;
+        }
+        m_notEmptyCv.notify_all();
+        m_notFullCv.notify_all();
+    }
+
+    void Abort()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_aborted = true;
+        }
+        m_notEmptyCv.notify_all();
+        m_notFullCv.notify_all();
+    }
+
+    // Drop all the items and clear the closed/aborted state, so the queue can be used again
+    void Reset()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_items.clear();
+            m_closed = m_aborted = false;
+            m_pushStallUs = 0;
+            m_pushStallCount = 0;
+            m_occupancySum = 0;
+            m_occupancySamples = 0;
+            m_peakSize = 0;
+        }
+        m_notFullCv.notify_all();
+    }
+
+    // Accept new items again after 'Close()', keeping the statistics
+    void Reopen()
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        m_closed = false;
+    }
+
+    void Clear()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_items.clear();
+        }
+        m_notFullCv.notify_all();
+    }
+
+    size_t Size() const { std::lock_guard<std::mutex> lk(m_lock); return m_items.size(); }
+    size_t MaxSize() const { std::lock_guard<std::mutex> lk(m_lock); return m_maxSize; }
+    bool Empty() const { std::lock_guard<std::mutex> lk(m_lock); return m_items.empty(); }
+    bool Full() const { std::lock_guard<std::mutex> lk(m_lock); return m_items.size() >= m_maxSize; }
+    bool IsClosed() const { std::lock_guard<std::mutex> lk(m_lock); return m_closed; }
+    // closed and all the items are consumed
+    bool IsDrained() const { std::lock_guard<std::mutex> lk(m_lock); return m_closed && m_items.empty(); }
+
+    // statistics
+    int64_t GetPushStallMicrosec() const { std::lock_guard<std::mutex> lk(m_lock); return m_pushStallUs; }
+    uint32_t GetPushStallCount() const { std::lock_guard<std::mutex> lk(m_lock); return m_pushStallCount; }
+    size_t GetPeakSize() const { std::lock_guard<std::mutex> lk(m_lock); return m_peakSize; }
+    double GetAverageSize() const
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        return m_occupancySamples > 0 ? (double)m_occupancySum/m_occupancySamples : 0.;
+    }
+
+private:
+    void UpdateOccupancy()
+    {
+        const auto qsize = m_items.size();
+        if (qsize > m_peakSize)
+            m_peakSize = qsize;
+        m_occupancySum += qsize;
+        m_occupancySamples++;
+    }
+
+private:
+    std::list<T> m_items;
+    size_t m_maxSize;
+    mutable std::mutex m_lock;
+    std::condition_variable m_notEmptyCv;
+    std::condition_variable m_notFullCv;
+    bool m_closed{false};
+    bool m_aborted{false};
+    int64_t m_pushStallUs{0};
+    uint32_t m_pushStallCount{0};
+    uint64_t m_occupancySum{0};
+    uint64_t m_occupancySamples{0};
+    size_t m_peakSize{0};
+};
+}
@@ -20,6 +20,7 @@
 #include <iomanip>
 #include <memory>
 #include <functional>
+#include <thread>
 #include <algorithm>
 #include "Logger.h"
 #include "FFUtils.h"
@@ -905,6 +906,54 @@ bool AVFrameToImMatConverter::SetResizeInterpolateMode(ImInterpolateMode interp)
     return true;
 }
 
+bool AVFrameToImMatConverter::SetSwsThreadCount(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        m_errMsg = "Argument 'threadCount' must be larger than 0!";
+        return false;
+    }
+    if (m_swsThreadCount == threadCount)
+        return true;
+
+    m_swsThreadCount = threadCount;
+
+    if (m_swsCtx)
+    {
+        sws_freeContext(m_swsCtx);
+        m_swsCtx = nullptr;
+        m_passThrough = false;
+    }
+    return true;
+}
+
+static SwsContext* _CreateSwsContext(int srcW, int srcH, AVPixelFormat srcFmt, int dstW, int dstH, AVPixelFormat dstFmt, int flags, uint32_t threads)
+{
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+    if (threads > 1)
+    {
+        SwsContext* swsCtx = sws_alloc_context();
+        if (!swsCtx)
+            return nullptr;
+        av_opt_set_int(swsCtx, "srcw", srcW, 0);
+        av_opt_set_int(swsCtx, "srch", srcH, 0);
+        av_opt_set_int(swsCtx, "src_format", srcFmt, 0);
+        av_opt_set_int(swsCtx, "dstw", dstW, 0);
+        av_opt_set_int(swsCtx, "dsth", dstH, 0);
+        av_opt_set_int(swsCtx, "dst_format", dstFmt, 0);
+        av_opt_set_int(swsCtx, "sws_flags", flags, 0);
+        av_opt_set_int(swsCtx, "threads", threads, 0);
+        if (sws_init_context(swsCtx, nullptr, nullptr) < 0)
+        {
+            sws_freeContext(swsCtx);
+            return nullptr;
+        }
+        return swsCtx;
+    }
+#endif
+    return sws_getContext(srcW, srcH, srcFmt, dstW, dstH, dstFmt, flags, nullptr, nullptr, nullptr);
+}
+
 bool AVFrameToImMatConverter::ConvertImage(const AVFrame* avfrm, ImGui::ImMat& outMat, double timestamp)
 {
     if (m_useVulkanComponents)
@@ -1063,7 +1112,7 @@ bool AVFrameToImMatConverter::ConvertImage(const AVFrame* avfrm, ImGui::ImMat& o
             }
             if (avfrm->width != outWidth || avfrm->height != outHeight || avfrm->format != (int)m_swsOutFormat)
             {
-                m_swsCtx = sws_getContext(avfrm->width, avfrm->height, (AVPixelFormat)avfrm->format, outWidth, outHeight, m_swsOutFormat, m_swsFlags, nullptr, nullptr, nullptr);
+                m_swsCtx = _CreateSwsContext(avfrm->width, avfrm->height, (AVPixelFormat)avfrm->format, outWidth, outHeight, m_swsOutFormat, m_swsFlags, m_swsThreadCount);
                 if (!m_swsCtx)
                 {
                     ostringstream oss;
@@ -1081,6 +1130,7 @@ bool AVFrameToImMatConverter::ConvertImage(const AVFrame* avfrm, ImGui::ImMat& o
                 m_swsInHeight = avfrm->height;
                 m_swsInFormat = (AVPixelFormat)avfrm->format;
                 m_swsClrspc = avfrm->colorspace;
+                m_passThrough = false;
             }
             else
             {
@@ -1109,6 +1159,12 @@ bool AVFrameToImMatConverter::ConvertImage(const AVFrame* avfrm, ImGui::ImMat& o
                 m_errMsg = string("FAILED to invoke 'av_frame_get_buffer()' for 'swsfrm'! fferr = ")+to_string(fferr)+".";
                 return false;
             }
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+            // only the frame api dispatches the slices to the threads
+            if (m_swsThreadCount > 1)
+                fferr = sws_scale_frame(m_swsCtx, pfrm, avfrm);
+            else
+#endif
             fferr = sws_scale(m_swsCtx, avfrm->data, avfrm->linesize, 0, avfrm->height, swsfrm->data, swsfrm->linesize);
             av_frame_copy_props(swsfrm.get(), avfrm);
             avfrm = swsfrm.get();
@@ -2087,9 +2143,13 @@ static bool _OpenSwVideoDecoder(AVCodecPtr codec, const AVCodecParameters *codec
         return false;
     }
 
-    // TODO: decoder multi-thread opts are hardcoded here, should be controlled by FFUtils::OpenVideoDecoderOptions in the future
-    swDecCtx->thread_count = 8;
+    swDecCtx->thread_count = options->threadCount;
     // swDecCtx->thread_type = FF_THREAD_FRAME;
+    if (options->lowres > 0)
+    {
+        swDecCtx->lowres = options->lowres < codec->max_lowres ? options->lowres : codec->max_lowres;
+    }
+    swDecCtx->skip_loop_filter = options->skipLoopFilter;
 
     fferr = avcodec_open2(swDecCtx, codec, nullptr);
     if (fferr < 0)
@@ -2328,6 +2388,186 @@ bool OpenVideoDecoder(const AVFormatContext* pAvfmtCtx, int videoStreamIndex, Op
     return ret;
 }
 
+int CalcLowresForOutputSize(int srcWidth, int srcHeight, uint32_t outWidth, uint32_t outHeight)
+{
+    if (srcWidth <= 0 || srcHeight <= 0 || outWidth == 0 || outHeight == 0)
+        return 0;
+    int lowres = 0;
+    while (lowres < 3)
+    {
+        const int shift = lowres+1;
+        // libavcodec rounds up the picture size with lowres
+        const int w = (srcWidth+(1<<shift)-1)>>shift;
+        const int h = (srcHeight+(1<<shift)-1)>>shift;
+        if (w < (int)outWidth || h < (int)outHeight)
+            break;
+        lowres = shift;
+    }
+    return lowres;
+}
+
+uint32_t GetDefaultSwsThreadCount()
+{
+    const uint32_t coreCount = thread::hardware_concurrency();
+    return min(max(coreCount/4, 1u), 4u);
+}
+
+ImageFileDecoder::~ImageFileDecoder()
+{
+    if (m_decCtx)
+        avcodec_free_context(&m_decCtx);
+    if (m_thumbDecCtx)
+        avcodec_free_context(&m_thumbDecCtx);
+}
+
+SelfFreeAVFramePtr ImageFileDecoder::DecodeFile(const string& filePath)
+{
+    AVFormatContext* avfmtCtx = nullptr;
+    int fferr = avformat_open_input(&avfmtCtx, filePath.c_str(), nullptr, nullptr);
+    if (fferr < 0)
+    {
+        ostringstream oss; oss << "FAILED to invoke 'avformat_open_input()' on file '" << filePath << "'! fferr=" << fferr << ".";
+        m_errMsg = oss.str();
+        return nullptr;
+    }
+
+    SelfFreeAVFramePtr hFrame;
+    do
+    {
+        // the image demuxers tell the codec when the file is opened, probing the stream info decodes the picture once more
+        int stmIdx = av_find_best_stream(avfmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        const bool reuseDecoder = stmIdx >= 0 && m_decCtx && m_decCtx->codec_id == avfmtCtx->streams[stmIdx]->codecpar->codec_id
+                && (avfmtCtx->streams[stmIdx]->codecpar->width <= 0
+                    || avfmtCtx->streams[stmIdx]->codecpar->width == m_decSrcWidth && avfmtCtx->streams[stmIdx]->codecpar->height == m_decSrcHeight);
+        if (!reuseDecoder)
+        {
+            fferr = avformat_find_stream_info(avfmtCtx, nullptr);
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to invoke 'avformat_find_stream_info()' on file '" << filePath << "'! fferr=" << fferr << ".";
+                m_errMsg = oss.str();
+                break;
+            }
+            stmIdx = av_find_best_stream(avfmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+            if (stmIdx < 0)
+            {
+                ostringstream oss; oss << "Can not find any video stream in file '" << filePath << "'!";
+                m_errMsg = oss.str();
+                break;
+            }
+        }
+
+        // use the embedded thumbnail when it's big enough
+        if (m_wantedWidth > 0 && m_wantedHeight > 0)
+        {
+            for (int i = 0; i < (int)avfmtCtx->nb_streams; i++)
+            {
+                const AVStream* pStm = avfmtCtx->streams[i];
+                if ((pStm->disposition&AV_DISPOSITION_ATTACHED_PIC) == 0 || pStm->attached_pic.size <= 0
+                    || pStm->codecpar->width < (int)m_wantedWidth || pStm->codecpar->height < (int)m_wantedHeight)
+                    continue;
+                if (m_thumbDecCtx && (m_thumbDecCtx->codec_id != pStm->codecpar->codec_id
+                    || m_thumbSrcWidth != pStm->codecpar->width || m_thumbSrcHeight != pStm->codecpar->height))
+                    avcodec_free_context(&m_thumbDecCtx);
+                if (!m_thumbDecCtx)
+                {
+                    if (!OpenDecoder(&m_thumbDecCtx, m_thumbDecOpts, avfmtCtx, i))
+                        break;
+                    m_thumbSrcWidth = pStm->codecpar->width;
+                    m_thumbSrcHeight = pStm->codecpar->height;
+                }
+                hFrame = DecodePicture(m_thumbDecCtx, avfmtCtx, i, &pStm->attached_pic);
+                break;
+            }
+            if (hFrame)
+                break;
+        }
+
+        if (!reuseDecoder)
+        {
+            if (m_decCtx)
+                avcodec_free_context(&m_decCtx);
+            const AVCodecParameters* codecpar = avfmtCtx->streams[stmIdx]->codecpar;
+            if (!OpenDecoder(&m_decCtx, m_decOpts, avfmtCtx, stmIdx))
+                break;
+            m_decSrcWidth = codecpar->width;
+            m_decSrcHeight = codecpar->height;
+        }
+        hFrame = DecodePicture(m_decCtx, avfmtCtx, stmIdx, nullptr);
+    } while (false);
+
+    avformat_close_input(&avfmtCtx);
+    return hFrame;
+}
+
+bool ImageFileDecoder::OpenDecoder(AVCodecContext** ppDecCtx, OpenVideoDecoderOptions& decOpts, const AVFormatContext* avfmtCtx, int stmIdx)
+{
+    // each stream is reduced from its own size, a small thumbnail needs less 'lowres' than the main picture
+    const AVCodecParameters* codecpar = avfmtCtx->streams[stmIdx]->codecpar;
+    decOpts.lowres = CalcLowresForOutputSize(codecpar->width, codecpar->height, m_wantedWidth, m_wantedHeight);
+    OpenVideoDecoderResult res;
+    // the options are referred by the decoder context, they must live as long as the decoder
+    if (!OpenVideoDecoder(avfmtCtx, stmIdx, &decOpts, &res, false))
+    {
+        ostringstream oss; oss << "FAILED to open video decoder for file '" << avfmtCtx->url << "'! Error is '" << res.errMsg << "'.";
+        m_errMsg = oss.str();
+        return false;
+    }
+    *ppDecCtx = res.decCtx;
+    return true;
+}
+
+SelfFreeAVFramePtr ImageFileDecoder::DecodePicture(AVCodecContext* decCtx, AVFormatContext* avfmtCtx, int stmIdx, const AVPacket* attachedPic)
+{
+    // the decoder is drained by the previous file
+    avcodec_flush_buffers(decCtx);
+    SelfFreeAVFramePtr hFrame = AllocSelfFreeAVFramePtr();
+    SelfFreeAVPacketPtr hPkt = AllocSelfFreeAVPacketPtr();
+    bool inputEof = false;
+    while (true)
+    {
+        int fferr = avcodec_receive_frame(decCtx, hFrame.get());
+        if (fferr == 0)
+            return hFrame;
+        if (fferr != AVERROR(EAGAIN) || inputEof)
+        {
+            ostringstream oss; oss << "FAILED to decode the picture of file '" << avfmtCtx->url << "'! fferr=" << fferr << ".";
+            m_errMsg = oss.str();
+            return nullptr;
+        }
+
+        if (attachedPic)
+        {
+            avcodec_send_packet(decCtx, attachedPic);
+            avcodec_send_packet(decCtx, nullptr);
+            inputEof = true;
+            continue;
+        }
+        while (true)
+        {
+            av_packet_unref(hPkt.get());
+            fferr = av_read_frame(avfmtCtx, hPkt.get());
+            if (fferr < 0)
+            {
+                avcodec_send_packet(decCtx, nullptr);
+                inputEof = true;
+                break;
+            }
+            if (hPkt->stream_index == stmIdx)
+            {
+                fferr = avcodec_send_packet(decCtx, hPkt.get());
+                if (fferr < 0 && fferr != AVERROR(EAGAIN))
+                {
+                    ostringstream oss; oss << "FAILED to invoke 'avcodec_send_packet()' on file '" << avfmtCtx->url << "'! fferr=" << fferr << ".";
+                    m_errMsg = oss.str();
+                    return nullptr;
+                }
+                break;
+            }
+        }
+    }
+}
+
 uint32_t CopyPcmDataEx(uint8_t channels, uint8_t bytesPerSample, uint32_t copySamples,
     bool isDstPlanar,       uint8_t** ppDst, uint32_t dstOffsetSamples,
     bool isSrcPlanar, const uint8_t** ppSrc, uint32_t srcOffsetSamples)
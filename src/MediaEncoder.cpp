@@ -15,14 +15,28 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <cstring>
+#include <cmath>
+#include <cerrno>
 #include <mutex>
 #include <thread>
 #include <chrono>
 #include <sstream>
 #include <list>
+#include <unordered_map>
 #include <algorithm>
+#include <condition_variable>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "MediaEncoder.h"
 #include "FFUtils.h"
+#include "BoundedQueue.h"
+#include "AsyncFileWriter.h"
 #include "FileSystemUtils.h"
 #include "ThreadUtils.h"
 extern "C"
@@ -30,8 +44,13 @@ extern "C"
     #include "libavutil/avutil.h"
     #include "libavutil/avstring.h"
     #include "libavutil/pixdesc.h"
+    #include "libavutil/imgutils.h"
+    #include "libavutil/opt.h"
     #include "libavformat/avformat.h"
     #include "libavcodec/avcodec.h"
+#if LIBAVCODEC_VERSION_MAJOR >= 59
+    #include "libavcodec/bsf.h"
+#endif
     #include "libavdevice/avdevice.h"
     #include "libavfilter/avfilter.h"
     #include "libavfilter/buffersrc.h"
@@ -43,8 +62,427 @@ extern "C"
 using namespace std;
 using namespace Logger;
 
+#ifndef AV_CODEC_CAP_OTHER_THREADS
+#define AV_CODEC_CAP_OTHER_THREADS AV_CODEC_CAP_AUTO_THREADS
+#endif
+#ifndef AV_PROFILE_UNKNOWN
+#define AV_PROFILE_UNKNOWN FF_PROFILE_UNKNOWN
+#endif
+#ifndef AV_LEVEL_UNKNOWN
+#define AV_LEVEL_UNKNOWN FF_LEVEL_UNKNOWN
+#endif
+
 namespace MediaCore
 {
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+static int AsyncIoWritePacket(void* opaque, const uint8_t* buf, int size)
+#else
+static int AsyncIoWritePacket(void* opaque, uint8_t* buf, int size)
+#endif
+{
+    auto pWriter = (AsyncFileWriter*)opaque;
+    return pWriter->Write(buf, size) ? size : AVERROR(EIO);
+}
+
+static int OpenImageFile(const char* path)
+{
+#if defined(_WIN32)
+    return _open(path, _O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY, _S_IREAD|_S_IWRITE);
+#else
+    return open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+#endif
+}
+
+static bool WriteImageFile(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0)
+    {
+#if defined(_WIN32)
+        auto ret = _write(fd, data, (unsigned int)size);
+#else
+        auto ret = write(fd, data, size);
+#endif
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+static bool CloseImageFile(int fd, bool sync)
+{
+    bool success = true;
+#if defined(_WIN32)
+    if (sync && _commit(fd) != 0)
+        success = false;
+    if (_close(fd) != 0)
+        success = false;
+#else
+    if (sync && fsync(fd) != 0)
+        success = false;
+    if (close(fd) != 0)
+        success = false;
+#endif
+    return success;
+}
+
+static int AsyncIoReadPacket(void* opaque, uint8_t* buf, int size)
+{
+    auto pWriter = (AsyncFileWriter*)opaque;
+    auto readSize = pWriter->Read(buf, size);
+    if (readSize < 0)
+        return AVERROR(EIO);
+    return readSize == 0 ? AVERROR_EOF : (int)readSize;
+}
+
+static int64_t AsyncIoSeek(void* opaque, int64_t offset, int whence)
+{
+    auto pWriter = (AsyncFileWriter*)opaque;
+    if (whence&AVSEEK_SIZE)
+        return pWriter->Size();
+    auto pos = pWriter->Seek(offset, whence&~AVSEEK_FORCE);
+    return pos < 0 ? AVERROR(EIO) : pos;
+}
+
+// The parameter set NAL units (VPS/SPS/PPS) in the extradata of a H.264/HEVC stream, which is either in the AnnexB form
+// (start code prefixed, as the encoders produce it) or in the 'avcC'/'hvcC' form (as mp4/mkv store it)
+static bool IsLengthPrefixedExtradata(const AVCodecParameters* codecpar)
+{
+    return codecpar->extradata_size > 0 && codecpar->extradata[0] == 1;
+}
+
+static bool IsParameterSetNalu(AVCodecID codecId, const uint8_t* nalu, size_t size)
+{
+    if (size < 1)
+        return false;
+    if (codecId == AV_CODEC_ID_H264)
+    {
+        const int type = nalu[0]&0x1f;
+        return type == 7 || type == 8 || type == 13;
+    }
+    const int type = (nalu[0]>>1)&0x3f;
+    return type >= 32 && type <= 34;
+}
+
+static bool GetParameterSets(const AVCodecParameters* codecpar, vector<string>& paramSets)
+{
+    paramSets.clear();
+    const uint8_t* p = codecpar->extradata;
+    const uint8_t* end = p+codecpar->extradata_size;
+    auto addNalu = [&] (const uint8_t* nalu, size_t size) {
+        if (IsParameterSetNalu(codecpar->codec_id, nalu, size))
+            paramSets.push_back(string((const char*)nalu, size));
+    };
+    if (!IsLengthPrefixedExtradata(codecpar))
+    {
+        // AnnexB, the NAL units are separated by 3 or 4-byte start codes
+        const uint8_t* nalu = nullptr;
+        while (p+3 <= end)
+        {
+            if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            {
+                if (nalu)
+                {
+                    const uint8_t* naluEnd = p;
+                    while (naluEnd > nalu && naluEnd[-1] == 0)
+                        naluEnd--;
+                    addNalu(nalu, naluEnd-nalu);
+                }
+                p += 3;
+                nalu = p;
+                continue;
+            }
+            p++;
+        }
+        if (nalu)
+            addNalu(nalu, end-nalu);
+        return true;
+    }
+    auto readNalus = [&] (uint32_t count) {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (p+2 > end)
+                return false;
+            const size_t size = ((size_t)p[0]<<8)|p[1];
+            p += 2;
+            if (p+size > end)
+                return false;
+            addNalu(p, size);
+            p += size;
+        }
+        return true;
+    };
+    if (codecpar->codec_id == AV_CODEC_ID_H264)
+    {
+        // avcC: 5 bytes of header, then the SPS count and the SPSs, then the PPS count and the PPSs
+        if (end-p < 6)
+            return false;
+        p += 5;
+        if (!readNalus(*p++&0x1f) || p >= end)
+            return false;
+        return readNalus(*p++);
+    }
+    // hvcC: 22 bytes of header, then the arrays of NAL units grouped by type
+    if (end-p < 23)
+        return false;
+    p += 22;
+    const uint32_t arrayCount = *p++;
+    for (uint32_t i = 0; i < arrayCount; i++)
+    {
+        if (p+3 > end)
+            return false;
+        const uint32_t naluCount = ((uint32_t)p[1]<<8)|p[2];
+        p += 3;
+        if (!readNalus(naluCount))
+            return false;
+    }
+    return true;
+}
+
+// Packets of 'srcpar' can be written into a stream encoded with 'dstpar' only if they are decodable by the same decoder
+// setup, i.e. the same codec, profile, level and parameter sets. 'reason' tells the mismatch.
+static bool IsPassthroughCompatible(const AVCodecParameters* srcpar, const AVCodecParameters* dstpar, string& reason)
+{
+    ostringstream oss;
+    if (srcpar->codec_id != dstpar->codec_id)
+    {
+        oss << "codec '" << avcodec_get_name(srcpar->codec_id) << "' differs from the encoder's '" << avcodec_get_name(dstpar->codec_id) << "'";
+        reason = oss.str();
+        return false;
+    }
+    if (srcpar->profile != AV_PROFILE_UNKNOWN && dstpar->profile != AV_PROFILE_UNKNOWN && srcpar->profile != dstpar->profile)
+    {
+        oss << "profile " << srcpar->profile << " differs from the encoder's " << dstpar->profile;
+        reason = oss.str();
+        return false;
+    }
+    if (srcpar->level != AV_LEVEL_UNKNOWN && dstpar->level != AV_LEVEL_UNKNOWN && srcpar->level != dstpar->level)
+    {
+        oss << "level " << srcpar->level << " differs from the encoder's " << dstpar->level;
+        reason = oss.str();
+        return false;
+    }
+    if (srcpar->codec_id == AV_CODEC_ID_H264 || srcpar->codec_id == AV_CODEC_ID_HEVC)
+    {
+        // the encoder without a global header puts its parameter sets in-band, they can't be compared before the encoding
+        if (dstpar->extradata_size <= 0)
+        {
+            reason = "the encoder has no parameter sets in its extradata";
+            return false;
+        }
+        // the length prefixed packets can be converted into AnnexB by a bitstream filter, but not the other way around
+        if (IsLengthPrefixedExtradata(dstpar) && !IsLengthPrefixedExtradata(srcpar))
+        {
+            reason = "AnnexB source packets can NOT be written into a length prefixed stream";
+            return false;
+        }
+        vector<string> srcParamSets, dstParamSets;
+        if (!GetParameterSets(srcpar, srcParamSets) || !GetParameterSets(dstpar, dstParamSets))
+        {
+            reason = "the extradata is malformed";
+            return false;
+        }
+        if (srcParamSets.empty() || srcParamSets != dstParamSets)
+        {
+            reason = "the parameter sets (VPS/SPS/PPS) differ from the encoder's";
+            return false;
+        }
+        return true;
+    }
+    if (srcpar->extradata_size != dstpar->extradata_size
+        || (srcpar->extradata_size > 0 && memcmp(srcpar->extradata, dstpar->extradata, srcpar->extradata_size) != 0))
+    {
+        reason = "the extradata differs from the encoder's";
+        return false;
+    }
+    return true;
+}
+
+// Stage throughput measured by the finished exports, keyed by encoder name and frame size, used by the auto-tuned threading
+struct _EncoderThroughputProfile
+{
+    double renderUsPerFrame;        // wall time the render pipeline takes to produce a frame
+    double encodeCpuUsPerFrame;     // encoder busy time per frame multiplied by its thread count
+};
+static mutex s_encProfileLock;
+static unordered_map<string, _EncoderThroughputProfile> s_encProfiles;
+
+static string MakeEncoderProfileKey(const char* codecName, uint32_t width, uint32_t height)
+{
+    ostringstream oss; oss << codecName << "-" << width << "x" << height;
+    return oss.str();
+}
+
+// A fast 64-bit hash for detecting static frames, each 8-byte word goes through an xxHash64 style round
+static inline uint64_t HashRound(uint64_t h, uint64_t w)
+{
+    h += w*0xC2B2AE3D27D4EB4FULL;
+    h = (h<<31)|(h>>33);
+    return h*0x9E3779B185EBCA87ULL;
+}
+
+// The bulk goes through 4 independent lanes of 8-byte words, so the multiplications of a 32-byte stripe overlap instead of
+// waiting for each other, the hashing runs at about the memory bandwidth.
+static uint64_t HashBytes(uint64_t h, const uint8_t* data, size_t size)
+{
+    size_t i = 0;
+    if (size >= 32)
+    {
+        uint64_t lanes[4] = { h+0x9E3779B185EBCA87ULL, h+0xC2B2AE3D27D4EB4FULL, h, h-0x9E3779B185EBCA87ULL };
+        for (; i+32 <= size; i += 32)
+        {
+            uint64_t w[4];
+            memcpy(w, data+i, 32);
+            lanes[0] = HashRound(lanes[0], w[0]);
+            lanes[1] = HashRound(lanes[1], w[1]);
+            lanes[2] = HashRound(lanes[2], w[2]);
+            lanes[3] = HashRound(lanes[3], w[3]);
+        }
+        h = ((lanes[0]<<1)|(lanes[0]>>63))+((lanes[1]<<7)|(lanes[1]>>57))+((lanes[2]<<12)|(lanes[2]>>52))+((lanes[3]<<18)|(lanes[3]>>46));
+        for (int j = 0; j < 4; j++)
+            h = HashRound(h, lanes[j]);
+    }
+    for (; i+8 <= size; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, data+i, 8);
+        h = HashRound(h, w);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data+i, size-i);
+    return HashRound(h, tail^size);
+}
+
+static uint64_t CalcVideoFrameHash(const VideoFrame::NativeData& nativeData)
+{
+    uint64_t h = 0x27D4EB2F165667C5ULL;
+    if (nativeData.eType == VideoFrame::NativeData::MAT)
+    {
+        const ImGui::ImMat* pMat = (const ImGui::ImMat*)nativeData.pData;
+        if (pMat->empty() || pMat->device != IM_DD_CPU)
+            return 0;
+        h = HashRound(h, ((uint64_t)pMat->w<<32)|(uint32_t)pMat->h);
+        // the same bytes in another color format or data type is another image
+        h = HashRound(h, ((uint64_t)pMat->c<<32)|(uint32_t)pMat->type);
+        h = HashRound(h, ((uint64_t)pMat->color_format<<32)|(uint32_t)pMat->elempack);
+        h = HashBytes(h, (const uint8_t*)pMat->data, pMat->total()*pMat->elemsize);
+    }
+    else if (nativeData.eType == VideoFrame::NativeData::AVFRAME || nativeData.eType == VideoFrame::NativeData::AVFRAME_HOLDER)
+    {
+        const AVFrame* pAvfrm = nativeData.eType == VideoFrame::NativeData::AVFRAME ?
+                (const AVFrame*)nativeData.pData : ((SelfFreeAVFramePtr*)nativeData.pData)->get();
+        const AVPixFmtDescriptor* pDesc = av_pix_fmt_desc_get((AVPixelFormat)pAvfrm->format);
+        if (!pDesc || (pDesc->flags&AV_PIX_FMT_FLAG_HWACCEL) || pAvfrm->hw_frames_ctx)
+            return 0;
+        h = HashRound(h, ((uint64_t)pAvfrm->width<<32)|(uint32_t)pAvfrm->height);
+        h = HashRound(h, (uint64_t)pAvfrm->format);
+        for (int i = 0; i < AV_NUM_DATA_POINTERS && pAvfrm->data[i]; i++)
+        {
+            const int rowBytes = av_image_get_linesize((AVPixelFormat)pAvfrm->format, pAvfrm->width, i);
+            if (rowBytes <= 0)
+                break;
+            const int rows = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(pAvfrm->height, pDesc->log2_chroma_h) : pAvfrm->height;
+            for (int j = 0; j < rows; j++)
+                h = HashBytes(h, pAvfrm->data[i]+(int64_t)j*pAvfrm->linesize[i], rowBytes);
+        }
+    }
+    else
+    {
+        return 0;
+    }
+    return h == 0 ? 1 : h;  // 0 means 'unknown'
+}
+
+static int64_t GetVideoFrameMillisec(const VideoFrame::NativeData& nativeData)
+{
+    if (nativeData.eType == VideoFrame::NativeData::MAT)
+        return (int64_t)(((const ImGui::ImMat*)nativeData.pData)->time_stamp*1000);
+    return AV_NOPTS_VALUE;
+}
+
+// Copy audio samples between planar and interleaved layouts of the same sample type. Samples are moved as raw words of
+// 'T', the loops have fixed strides so that they can be vectorized by the compiler.
+template <typename T>
+static void CopyAudioSamples_T(const uint8_t* const* src, bool srcPlanar, uint8_t* const* dst, bool dstPlanar, uint32_t channels, uint32_t count)
+{
+    if (srcPlanar == dstPlanar || channels == 1)
+    {
+        const uint32_t planeCount = srcPlanar ? channels : 1;
+        const size_t planeBytes = (size_t)count*sizeof(T)*(srcPlanar ? 1 : channels);
+        for (uint32_t i = 0; i < planeCount; i++)
+            memcpy(dst[i], src[i], planeBytes);
+    }
+    else if (srcPlanar)
+    {
+        T* pDst = (T*)dst[0];
+        if (channels == 2)
+        {
+            const T* pL = (const T*)src[0];
+            const T* pR = (const T*)src[1];
+            for (uint32_t i = 0; i < count; i++)
+            {
+                pDst[2*i] = pL[i];
+                pDst[2*i+1] = pR[i];
+            }
+        }
+        else
+        {
+            for (uint32_t c = 0; c < channels; c++)
+            {
+                const T* pSrc = (const T*)src[c];
+                T* pOut = pDst+c;
+                for (uint32_t i = 0; i < count; i++)
+                    pOut[(size_t)i*channels] = pSrc[i];
+            }
+        }
+    }
+    else
+    {
+        const T* pSrc = (const T*)src[0];
+        if (channels == 2)
+        {
+            T* pL = (T*)dst[0];
+            T* pR = (T*)dst[1];
+            for (uint32_t i = 0; i < count; i++)
+            {
+                pL[i] = pSrc[2*i];
+                pR[i] = pSrc[2*i+1];
+            }
+        }
+        else
+        {
+            for (uint32_t c = 0; c < channels; c++)
+            {
+                const T* pIn = pSrc+c;
+                T* pDst = (T*)dst[c];
+                for (uint32_t i = 0; i < count; i++)
+                    pDst[i] = pIn[(size_t)i*channels];
+            }
+        }
+    }
+}
+
+static void CopyAudioSamples(const uint8_t* const* src, bool srcPlanar, uint8_t* const* dst, bool dstPlanar,
+        uint32_t channels, uint32_t bytesPerSample, uint32_t count)
+{
+    switch (bytesPerSample)
+    {
+    case 1:
+        CopyAudioSamples_T<uint8_t>(src, srcPlanar, dst, dstPlanar, channels, count); break;
+    case 2:
+        CopyAudioSamples_T<uint16_t>(src, srcPlanar, dst, dstPlanar, channels, count); break;
+    case 4:
+        CopyAudioSamples_T<uint32_t>(src, srcPlanar, dst, dstPlanar, channels, count); break;
+    default:
+        CopyAudioSamples_T<uint64_t>(src, srcPlanar, dst, dstPlanar, channels, count); break;
+    }
+}
+
 class MediaEncoder_Impl : public MediaEncoder
 {
 public:
@@ -59,6 +497,35 @@ public:
 
     virtual ~MediaEncoder_Impl() {}
 
+    bool SetOutputIoOptions(const OutputIoOptions& opts) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (m_opened)
+        {
+            m_errMsg = "This MediaEncoder is already opened!";
+            return false;
+        }
+        if (opts.asyncIo && (opts.bufferSize == 0 || opts.bufferCount == 0))
+        {
+            m_errMsg = "INVALID argument! 'bufferSize' and 'bufferCount' must be positive.";
+            return false;
+        }
+        m_ioOpts = opts;
+        return true;
+    }
+
+    bool SetImageSequenceOptions(const ImageSequenceOptions& opts) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (m_started)
+        {
+            m_errMsg = "This MediaEncoder already started!";
+            return false;
+        }
+        m_imgseqOpts = opts;
+        return true;
+    }
+
     bool Open(const string& url) override
     {
         lock_guard<recursive_mutex> lk(m_apiLock);
@@ -86,8 +553,7 @@ public:
 
         if (m_avfmtCtx)
         {
-            if ((m_avfmtCtx->oformat->flags&AVFMT_NOFILE) == 0)
-                avio_closep(&m_avfmtCtx->pb);
+            CloseOutputIo();
             avformat_free_context(m_avfmtCtx);
             m_avfmtCtx = nullptr;
         }
@@ -96,6 +562,7 @@ public:
         CloseAudioComponents();
 
         m_muxEof = false;
+        m_encErr = false;
         m_started = false;
         m_opened = false;
 
@@ -182,14 +649,28 @@ public:
             m_videncEof = true;
         if (!HasAudio())
             m_audencEof = true;
+        SetupImageSequenceEncoders();
+        const int ofmtFlags = m_avfmtCtx->oformat->flags;
+        m_vidIsVfrOutput = (ofmtFlags&AVFMT_VARIABLE_FPS) != 0 && (ofmtFlags&AVFMT_NOTIMESTAMPS) == 0;
 
-        int fferr = avformat_write_header(m_avfmtCtx, nullptr);
+        AVDictionary* muxOpts = nullptr;
+        if (m_ioOpts.fragmentedMp4)
+        {
+            const string fmtName(m_avfmtCtx->oformat->name);
+            if (fmtName.find("mp4") != string::npos || fmtName.find("mov") != string::npos)
+                av_dict_set(&muxOpts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+            else
+                m_logger->Log(WARN) << "Option 'fragmentedMp4' is ignored for output format '" << fmtName << "'." << endl;
+        }
+        int fferr = avformat_write_header(m_avfmtCtx, &muxOpts);
+        av_dict_free(&muxOpts);
         if (fferr < 0)
         {
             m_errMsg = FFapiFailureMessage("avformat_write_header", fferr);
             return false;
         }
 
+        m_encStartTp = m_encEndTp = chrono::steady_clock::now();
         StartAllThreads();
         m_started = true;
         return true;
@@ -209,28 +690,58 @@ public:
         }
         lock_guard<recursive_mutex> lk(m_apiLock);
 
-        if (HasVideo())
+        if (HasVideo() && !m_vidinpEof)
+        {
             m_vidinpEof = true;
+            m_vidInputEofTp = chrono::steady_clock::now();
+            m_vfrmQ.Close();
+            m_vidCvtTaskQ.Close();
+        }
         if (HasAudio())
+        {
             m_audinpEof = true;
-        while (!m_muxEof)
-            this_thread::sleep_for(chrono::milliseconds(5));
+            m_audfrmQ.Close();
+        }
+        {
+            unique_lock<mutex> lk(m_muxLock);
+            m_muxEofCv.wait(lk, [this] { return m_muxEof; });
+        }
+        m_encEndTp = chrono::steady_clock::now();
 
         bool success = true;
         int fferr;
         if (m_avfmtCtx)
         {
-            fferr = av_write_trailer(m_avfmtCtx);
-            if (fferr < 0)
+            // the mov muxer's faststart pass reopens the output through 'io_open' to move the moov atom, which
+            // bypasses the async writer, so all the data must be on disk and the trailer written through a plain AVIOContext
+            bool ioReady = true;
+            if ((m_avfmtCtx->flags&AVFMT_FLAG_CUSTOM_IO) && IsFaststartEnabled())
+                ioReady = SwitchToPlainOutputIo();
+            if (!ioReady)
             {
-                m_errMsg = FFapiFailureMessage("av_write_trailer", fferr);
                 success = false;
             }
-            if ((m_avfmtCtx->oformat->flags&AVFMT_NOFILE) == 0)
-                avio_closep(&m_avfmtCtx->pb);
+            else
+            {
+                fferr = av_write_trailer(m_avfmtCtx);
+                if (fferr < 0)
+                {
+                    m_errMsg = FFapiFailureMessage("av_write_trailer", fferr);
+                    success = false;
+                }
+            }
+            if (!CloseOutputIo())
+                success = false;
             avformat_free_context(m_avfmtCtx);
             m_avfmtCtx = nullptr;
         }
+        const auto stats = GetStatistics();
+        m_logger->Log(DEBUG) << "Encoding statistics: " << stats << endl;
+        if (HasVideo() && !m_encErr)
+        {
+            ReportStageUtilization(stats);
+            UpdateThroughputProfile(stats);
+        }
 
         return success;
     }
@@ -266,23 +777,26 @@ public:
         if (!hVfrm)
         {
             m_vidinpEof = true;
+            m_vidInputEofTp = chrono::steady_clock::now();
+            m_vfrmQ.Close();
+            m_vidCvtTaskQ.Close();
             return true;
         }
 
-        while (wait && m_vfrmQ.size() >= m_vmatQMaxSize && !m_quit)
-            this_thread::sleep_for(chrono::milliseconds(5));
-        if (m_quit)
-            return false;
-        if (m_vfrmQ.size() >= m_vmatQMaxSize)
+        VideoEncodeTaskHolder hTask(new _VideoEncodeTask());
+        hTask->hVfrm = hVfrm;
+        if (m_vidDedupEnabled)
+            hTask->prevTask = m_vidLastInputTask;
+        if (!m_vfrmQ.Push(hTask, wait))
         {
-            m_errMsg = "Queue full!";
+            if (!m_quit && !m_encErr)
+                m_errMsg = "Queue full!";
             return false;
         }
-
-        {
-            lock_guard<mutex> lk(m_vmatQLock);
-            m_vfrmQ.push_back(hVfrm);
-        }
+        m_vidLastInputTask = hTask;
+        m_vidInputFrameCount++;
+        // a task in the conversion queue is either in the encoding queue or being waited by the encoding thread, so this won't block
+        m_vidCvtTaskQ.Push(hTask);
         return true;
     }
 
@@ -294,7 +808,7 @@ public:
         return EncodeVideoFrame(hVfrm, wait);
     }
 
-    bool EncodeAudioSamples(uint8_t* buf, uint32_t size, bool wait) override
+    bool EncodeRepeatedVideoFrame(int64_t pos, bool wait) override
     {
         if (!m_opened)
         {
@@ -306,132 +820,221 @@ public:
             m_errMsg = "This MediaEncoder has NOT started yet!";
             return false;
         }
-        if (!HasAudio())
+        if (!HasVideo())
         {
             m_errMsg = "This MediaEncoder does NOT have video!";
             return false;
         }
         lock_guard<recursive_mutex> lk(m_apiLock);
-        if (m_audinpEof)
+        if (m_vidinpEof)
         {
-            m_errMsg = "Audio stream has already reaches EOF!";
+            m_errMsg = "Video stream has already reaches EOF!";
             return false;
         }
         if (m_encErr)
         {
             return false;
         }
-
-        if (!buf)
+        if (!m_vidLastInputTask)
         {
-            if (m_audencfrm)
-            {
-                uint32_t bufoffset = m_audencfrmSmpOffset*m_audinpFrameSize;
-                memset(m_audencfrm->data[0]+bufoffset, 0, m_audencfrm->linesize[0]-bufoffset);
-                {
-                    lock_guard<mutex> lk(m_audfrmQLock);
-                    m_audfrmQ.push_back(m_audencfrm);
-                }
-                m_audencfrm = nullptr;
-            }
-            m_audinpEof = true;
-            return true;
+            m_errMsg = "No video frame has been encoded yet, there is nothing to repeat!";
+            return false;
         }
 
-        if (m_audfrmQ.size() >= m_audfrmQMaxSize)
+        // nothing to convert, so the task skips the conversion queue
+        VideoEncodeTaskHolder hTask(new _VideoEncodeTask());
+        hTask->repeated = true;
+        hTask->pts = av_rescale_q(pos, MILLISEC_TIMEBASE, m_videncCtx->time_base);
+        hTask->hashed = true;
+        hTask->converted = true;
+        if (!m_vfrmQ.Push(hTask, wait))
         {
-            if (!wait)
-            {
+            if (!m_quit && !m_encErr)
                 m_errMsg = "Queue full!";
-                return false;
-            }
-            while (m_audfrmQ.size() >= m_audfrmQMaxSize && !m_quit)
-                this_thread::sleep_for(chrono::milliseconds(5));
-            if (m_quit)
-                return false;
+            return false;
+        }
+        m_vidLastInputTask = hTask;
+        m_vidInputFrameCount++;
+        return true;
+    }
+
+    bool EncodeAudioSamples(uint8_t* buf, uint32_t size, bool wait) override
+    {
+        if (!CheckAudioInputState())
+            return false;
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (m_audinpEof)
+        {
+            m_errMsg = "Audio stream has already reaches EOF!";
+            return false;
         }
+        if (m_encErr)
+        {
+            return false;
+        }
+
+        if (!buf)
+            return SendAudioEof();
+
         uint32_t inpSamples = (uint32_t)(size/m_audinpFrameSize);
         if (inpSamples*m_audinpFrameSize != size)
         {
             m_logger->Log(WARN) << "Input audio data size " << size << " is NOT an integral multiply of input-frame-size " << m_audinpFrameSize << "!" << endl;
-            size = inpSamples*m_audinpFrameSize;
         }
+        const uint8_t* inpPlanes[1] = { buf };
+        return EncodeAudioSamples_Internal(inpPlanes, m_audinpSmpfmt, inpSamples, wait);
+    }
 
-        int fferr;
-        uint32_t readSize = 0;
-        uint32_t bufferedSamples = 0;
-        const uint8_t* inpbuf = buf;
-        while ((readSize < size || bufferedSamples > 0) && !m_quit)
+    bool EncodeAudioSamples(ImGui::ImMat& amat, bool wait) override
+    {
+        if (!CheckAudioInputState())
+            return false;
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (m_audinpEof)
         {
-            if (!m_audencfrm)
-            {
-                m_audencfrm = AllocSelfFreeAVFramePtr();
-                if (!m_audencfrm)
-                {
-                    m_errMsg = "FAILED allocate new AVFrame for audio input frame!";
-                    return false;
-                }
-                m_audencfrm->format = m_audencSmpfmt;
-                m_audencfrm->sample_rate = m_audencCtx->sample_rate;
-#if !defined(FF_API_OLD_CHANNEL_LAYOUT) && (LIBAVUTIL_VERSION_MAJOR < 58)
-                m_audencfrm->channels = m_audencCtx->channels;
-                m_audencfrm->channel_layout = m_audencCtx->channel_layout;
-#else
-                m_audencfrm->ch_layout = m_audencCtx->ch_layout;
-#endif
-                m_audencfrm->nb_samples = m_audencFrameSamples;
-                fferr = av_frame_get_buffer(m_audencfrm.get(), 0);
-                if (fferr < 0)
-                {
-                    m_errMsg = FFapiFailureMessage("av_frame_get_buffer(EncodeAudioSamples)", fferr);
-                    return false;
-                }
-                m_audencfrm->pts = m_audfrmPts;
-            }
+            m_errMsg = "Audio stream has already reaches EOF!";
+            return false;
+        }
+        if (m_encErr)
+        {
+            return false;
+        }
 
-            if (m_swrCtx)
-            {
-                fferr = swr_convert(m_swrCtx, m_audencfrm->data, m_audencfrm->nb_samples-m_audencfrmSmpOffset, &inpbuf, inpSamples);
-                if (fferr <= 0)
-                {
-                    m_errMsg = FFapiFailureMessage("swr_convert", fferr);
-                    return false;
-                }
-                readSize += inpSamples*m_audinpFrameSize;
-                m_audencfrmSmpOffset += fferr;
-                inpbuf = nullptr;
-                inpSamples = 0;
-                bufferedSamples = swr_get_out_samples(m_swrCtx, 0);
-            }
-            else
-            {
-                uint32_t copySize = (m_audencfrm->nb_samples-m_audencfrmSmpOffset)*m_audinpFrameSize;
-                if (copySize > size-readSize)
-                    copySize = size-readSize;
-                uint32_t bufoffset = m_audencfrmSmpOffset*m_audinpFrameSize;
-                memcpy(m_audencfrm->data[0]+bufoffset, inpbuf, copySize);
-                m_audencfrmSmpOffset += (uint32_t)(copySize/m_audinpFrameSize);
-                readSize += copySize;
-            }
+        if (amat.empty())
+            return SendAudioEof();
 
-            if (m_audencfrmSmpOffset >= m_audencfrm->nb_samples)
-            {
-                lock_guard<mutex> lk(m_audfrmQLock);
-                m_audfrmQ.push_back(m_audencfrm);
-                m_audfrmPts += m_audencfrm->nb_samples;
-                m_audencfrm = nullptr;
-                m_audencfrmSmpOffset = 0;
-            }
+        if (amat.c != (int)m_audencChannels)
+        {
+            ostringstream oss; oss << "Input audio mat has " << amat.c << " channels, while the encoder requires " << m_audencChannels << "!";
+            m_errMsg = oss.str();
+            return false;
         }
-        if (m_quit)
+        // the layout of audio ImMat: 'w' is sample count, 'c' is channel count, 'elempack' == 1 means planar
+        const bool isPlanar = amat.c > 1 && amat.elempack == 1;
+        const AVSampleFormat inpSmpfmt = GetAVSampleFormatByDataType(amat.type, isPlanar);
+        if (inpSmpfmt == AV_SAMPLE_FMT_NONE)
+        {
+            ostringstream oss; oss << "UNSUPPORTED audio mat data type " << (int)amat.type << "!";
+            m_errMsg = oss.str();
             return false;
+        }
+        vector<const uint8_t*> inpPlanes(isPlanar ? amat.c : 1);
+        const size_t planeSize = (size_t)amat.w*amat.elemsize;
+        for (size_t i = 0; i < inpPlanes.size(); i++)
+            inpPlanes[i] = (const uint8_t*)amat.data+i*planeSize;
+        return EncodeAudioSamples_Internal(inpPlanes.data(), inpSmpfmt, (uint32_t)amat.w, wait);
+    }
 
-        return true;
+    bool CopyVideoPackets(MediaParser::Holder hParser, int64_t srcStartPts, int64_t srcEndPts, int64_t dstStartMts) override
+    {
+        if (!m_opened)
+        {
+            m_errMsg = "This MediaEncoder has NOT opened yet!";
+            return false;
+        }
+        if (!m_started)
+        {
+            m_errMsg = "This MediaEncoder has NOT started yet!";
+            return false;
+        }
+        if (!HasVideo())
+        {
+            m_errMsg = "This MediaEncoder does NOT have video!";
+            return false;
+        }
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (m_vidinpEof)
+        {
+            m_errMsg = "Video stream has already reaches EOF!";
+            return false;
+        }
+        if (m_encErr)
+        {
+            return false;
+        }
+        if (m_imgseqParallel)
+        {
+            m_errMsg = "Packet passthrough is NOT SUPPORTED by the parallel image sequence output!";
+            return false;
+        }
+        if (!hParser || !hParser->IsOpened() || hParser->GetBestVideoStreamIndex() < 0)
+        {
+            m_errMsg = "INVALID argument 'hParser'! It must be opened and has video.";
+            return false;
+        }
+        if (srcEndPts <= srcStartPts)
+        {
+            ostringstream oss; oss << "INVALID source range [" << srcStartPts << ", " << srcEndPts << ")!";
+            m_errMsg = oss.str();
+            return false;
+        }
+
+        // flush all the frames sent before out of the video encoder, the muxing thread keeps running meanwhile
+        {
+            lock_guard<mutex> lk(m_muxLock);
+            m_vidSplicing = true;
+        }
+        m_vfrmQ.Close();
+        m_vidCvtTaskQ.Close();
+        for (auto& worker : m_vidCvtWorkers)
+        {
+            if (worker.th.joinable())
+                worker.th.join();
+        }
+        if (m_videncThread.joinable())
+            m_videncThread.join();
+        {
+            unique_lock<mutex> lk(m_muxLock);
+            m_muxEofCv.wait(lk, [this] { return m_videncEof || m_muxEof || m_encErr; });
+        }
+
+        bool success = !m_muxEof && !m_encErr;
+        if (success)
+            success = CopyVideoPackets_Internal(hParser, srcStartPts, srcEndPts, dstStartMts);
+        if (success)
+            success = ReopenVideoEncoder();
+        if (success)
+        {
+            m_vfrmQ.Reopen();
+            m_vidCvtTaskQ.Reopen();
+            m_videncFull = false;
+            StartVideoThreads();
+        }
+        {
+            lock_guard<mutex> lk(m_muxLock);
+            m_vidSplicing = false;
+        }
+        if (!success && !m_encErr)
+            SetEncodingError(m_errMsg);
+        NotifyMuxer();
+        return success;
     }
 
-    bool EncodeAudioSamples(ImGui::ImMat& amat, bool wait) override
+    bool CheckVideoPassthrough(MediaParser::Holder hParser) override
     {
-        return EncodeAudioSamples((uint8_t*)amat.data, amat.total()*amat.elemsize, wait);
+        if (!m_opened)
+        {
+            m_errMsg = "This MediaEncoder has NOT opened yet!";
+            return false;
+        }
+        if (!HasVideo() || !m_vidAvStm)
+        {
+            m_errMsg = "This MediaEncoder does NOT have video!";
+            return false;
+        }
+        if (!hParser || !hParser->IsOpened() || hParser->GetBestVideoStreamIndex() < 0)
+        {
+            m_errMsg = "INVALID argument 'hParser'! It must be opened and has video.";
+            return false;
+        }
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        AVFormatContext* pSrcFmtCtx = nullptr;
+        int srcStmIdx = -1;
+        if (!OpenPassthroughSource(hParser, pSrcFmtCtx, srcStmIdx))
+            return false;
+        const bool compatible = CheckVideoPassthrough_Internal(pSrcFmtCtx, srcStmIdx);
+        avformat_close_input(&pSrcFmtCtx);
+        return compatible;
     }
 
     bool IsOpened() const override
@@ -466,11 +1069,97 @@ public:
         m_vidPreferUseHw = enable;
     }
 
+    void EnableStaticFrameDedup(bool enable) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (m_started)
+        {
+            m_logger->Log(WARN) << "CANNOT change static frame deduplication after the encoder has started!" << endl;
+            return;
+        }
+        m_vidDedupEnabled = enable;
+    }
+
+    bool SetVideoThreadingOptions(const VideoThreadingOptions& opts) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (HasVideo())
+        {
+            m_errMsg = "Video threading options must be set before 'ConfigureVideoStream()'!";
+            return false;
+        }
+        if (opts.threadType < VideoThreadingOptions::THREAD_TYPE_DEFAULT || opts.threadType > VideoThreadingOptions::THREAD_TYPE_FRAME_SLICE)
+        {
+            ostringstream oss; oss << "INVALID video thread type " << (int)opts.threadType << "!";
+            m_errMsg = oss.str();
+            return false;
+        }
+        m_vidThreadingOpts = opts;
+        return true;
+    }
+
+    void SetVideoConverterThreadCount(uint32_t count) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        m_vidCvtThreadCount = count;
+    }
+
     string GetError() const override
     {
         return m_errMsg;
     }
 
+    Statistics GetStatistics() const override
+    {
+        Statistics stats;
+        stats.vidInputStallMillisec = m_vfrmQ.GetPushStallMicrosec()/1000;
+        stats.vidInputStallCount = m_vfrmQ.GetPushStallCount();
+        stats.vidInputQueueMaxSize = (uint32_t)m_vfrmQ.MaxSize();
+        stats.vidInputQueuePeakSize = (uint32_t)m_vfrmQ.GetPeakSize();
+        stats.vidInputQueueAvgSize = m_vfrmQ.GetAverageSize();
+        stats.audInputStallMillisec = m_audfrmQ.GetPushStallMicrosec()/1000;
+        stats.audInputStallCount = m_audfrmQ.GetPushStallCount();
+        stats.audInputQueueMaxSize = (uint32_t)m_audfrmQ.MaxSize();
+        stats.audInputQueuePeakSize = (uint32_t)m_audfrmQ.GetPeakSize();
+        stats.audInputQueueAvgSize = m_audfrmQ.GetAverageSize();
+        stats.vidConvertWaitMillisec = m_vidCvtWaitUs/1000;
+        stats.vidConverterThreadCount = (uint32_t)m_vidCvtWorkers.size();
+        stats.muxIdleWaitMillisec = m_muxIdleWaitUs/1000;
+        stats.vidPassthroughSegmentCount = m_vidCopySegCount;
+        stats.vidPassthroughPacketCount = m_vidCopyPktCount;
+        stats.vidStaticFrameCount = m_vidStaticFrameCount;
+        stats.vidStaticFrameDropped = m_vidStaticFrameDropped;
+        stats.ioWaitMillisec = m_asyncWriter.GetWaitMicrosec()/1000;
+        stats.ioWriteMillisec = m_asyncWriter.GetWriteMicrosec()/1000;
+        stats.ioBytesWritten = m_asyncWriter.GetBytesWritten();
+        stats.vidImageSeqEncoderCount = m_imgseqParallel ? (uint32_t)m_imgseqWorkers.size() : 0;
+        {
+            lock_guard<mutex> lk(m_imgseqLock);
+            stats.vidImageSeqFileCount = m_imgseqFileCount;
+            stats.vidImageSeqSyncMillisec = m_imgseqSyncUs/1000;
+        }
+        stats.vidEncoderThreadCount = m_videncThreadCount;
+        stats.vidEncoderThreadType = m_videncThreadType;
+        if (m_started)
+        {
+            const auto endTp = m_encEndTp > m_encStartTp ? m_encEndTp : chrono::steady_clock::now();
+            const auto inpEndTp = m_vidinpEof ? m_vidInputEofTp : endTp;
+            const int64_t elapsedUs = chrono::duration_cast<chrono::microseconds>(endTp-m_encStartTp).count();
+            const int64_t inputUs = chrono::duration_cast<chrono::microseconds>(inpEndTp-m_encStartTp).count();
+            stats.elapsedMillisec = elapsedUs/1000;
+            if (elapsedUs > 0)
+            {
+                const int64_t renderUs = inputUs-m_vfrmQ.GetPushStallMicrosec();
+                stats.renderUtilization = HasVideo() ? (float)((double)max(renderUs, (int64_t)0)/elapsedUs) : 0.f;
+                if (!m_vidCvtWorkers.empty())
+                    stats.convertUtilization = (float)((double)m_vidCvtBusyUs/elapsedUs/m_vidCvtWorkers.size());
+                stats.encodeUtilization = (float)((double)m_videncBusyUs/elapsedUs);
+                stats.muxUtilization = (float)((double)max(elapsedUs-m_muxIdleWaitUs, (int64_t)0)/elapsedUs);
+            }
+        }
+        return stats;
+    }
+
     bool CheckHwPixFmt(AVPixelFormat pixfmt)
     {
         return pixfmt == m_videncPixfmt;
@@ -495,16 +1184,108 @@ private:
             return false;
         }
 
-        if ((m_avfmtCtx->oformat->flags&AVFMT_NOFILE) == 0)
+        const bool isLocalFile = url.find("://") == string::npos || url.compare(0, 5, "file:") == 0;
+        if ((m_avfmtCtx->oformat->flags&AVFMT_NOFILE) == 0 && m_ioOpts.asyncIo && isLocalFile)
+        {
+            const string filePath = url.compare(0, 5, "file:") == 0 ? url.substr(5) : url;
+            const string thnName = "EncIo-"+SysUtils::ExtractFileName(filePath);
+            if (!m_asyncWriter.Open(filePath, m_ioOpts.bufferSize, m_ioOpts.bufferCount, m_ioOpts.directIo, thnName))
+            {
+                m_errMsg = m_asyncWriter.GetError();
+                return false;
+            }
+            uint8_t* avioBuf = (uint8_t*)av_malloc(AVIO_BUFFER_SIZE);
+            if (avioBuf)
+                m_avfmtCtx->pb = avio_alloc_context(avioBuf, AVIO_BUFFER_SIZE, 1, &m_asyncWriter, AsyncIoReadPacket, AsyncIoWritePacket, AsyncIoSeek);
+            if (!m_avfmtCtx->pb)
+            {
+                av_free(avioBuf);
+                m_asyncWriter.Close();
+                m_errMsg = "FAILED to allocate AVIOContext by 'avio_alloc_context'!";
+                return false;
+            }
+            m_avfmtCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+        }
+        else if ((m_avfmtCtx->oformat->flags&AVFMT_NOFILE) == 0)
         {
             fferr = avio_open(&m_avfmtCtx->pb, url.c_str(), AVIO_FLAG_WRITE);
             if (fferr < 0)
             {
-                m_errMsg = FFapiFailureMessage("avio_open", fferr);
-                return false;
+                m_errMsg = FFapiFailureMessage("avio_open", fferr);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool IsFaststartEnabled()
+    {
+        if (!m_avfmtCtx->priv_data)
+            return false;
+        uint8_t* movflags = nullptr;
+        if (av_opt_get(m_avfmtCtx->priv_data, "movflags", 0, &movflags) < 0 || !movflags)
+            return false;
+        const bool faststart = strstr((const char*)movflags, "faststart") != nullptr;
+        av_free(movflags);
+        return faststart;
+    }
+
+    // Drain and stop the async writer, then continue writing the output at the same position through 'avio_open2'
+    bool SwitchToPlainOutputIo()
+    {
+        const int64_t pos = avio_tell(m_avfmtCtx->pb);
+        avio_flush(m_avfmtCtx->pb);
+        av_freep(&m_avfmtCtx->pb->buffer);
+        avio_context_free(&m_avfmtCtx->pb);
+        m_avfmtCtx->flags &= ~AVFMT_FLAG_CUSTOM_IO;
+        if (!m_asyncWriter.Close())
+        {
+            m_errMsg = m_asyncWriter.GetError();
+            return false;
+        }
+
+        AVDictionary* ioOpts = nullptr;
+        av_dict_set(&ioOpts, "truncate", "0", 0);
+        int fferr = avio_open2(&m_avfmtCtx->pb, m_avfmtCtx->url, AVIO_FLAG_READ_WRITE, nullptr, &ioOpts);
+        av_dict_free(&ioOpts);
+        if (fferr < 0)
+        {
+            m_errMsg = FFapiFailureMessage("avio_open2", fferr);
+            return false;
+        }
+        // the offset is beyond the range of 'int' for outputs larger than 2GB, only the error codes fit in it
+        const int64_t seekPos = avio_seek(m_avfmtCtx->pb, pos, SEEK_SET);
+        if (seekPos < 0)
+        {
+            m_errMsg = FFapiFailureMessage("avio_seek", (int)seekPos);
+            return false;
+        }
+        m_logger->Log(DEBUG) << "Stopped the async writer at offset " << pos << " for the faststart pass." << endl;
+        return true;
+    }
+
+    bool CloseOutputIo()
+    {
+        bool success = true;
+        if (m_avfmtCtx->flags&AVFMT_FLAG_CUSTOM_IO)
+        {
+            if (m_avfmtCtx->pb)
+            {
+                avio_flush(m_avfmtCtx->pb);
+                av_freep(&m_avfmtCtx->pb->buffer);
+                avio_context_free(&m_avfmtCtx->pb);
+            }
+            if (!m_asyncWriter.Close())
+            {
+                m_errMsg = m_asyncWriter.GetError();
+                success = false;
             }
         }
-        return true;
+        else if ((m_avfmtCtx->oformat->flags&AVFMT_NOFILE) == 0)
+        {
+            avio_closep(&m_avfmtCtx->pb);
+        }
+        return success;
     }
 
     bool ConfigureVideoStream_Internal(const std::string& codecName,
@@ -526,6 +1307,15 @@ private:
         }
 
         const bool bGlobalHeader = (m_avfmtCtx->oformat->flags&AVFMT_GLOBALHEADER) != 0;
+        // keep the arguments, the encoder is reopened after each smart-render passthrough segment
+        m_videncWidth = width;
+        m_videncHeight = height;
+        m_videncFrameRate = frameRate;
+        m_videncBitRate = bitRate;
+        m_videncExtraOpts.clear();
+        if (extraOpts)
+            m_videncExtraOpts = *extraOpts;
+        m_videncReqPixfmt = requiredInputPixfmt;
         AVCodecContext* pTempVidencCtx = nullptr;
         AVBufferRef* pTempHwDevCtx = nullptr;
         m_videnc = avcodec_find_encoder_by_name(codecName.c_str());
@@ -662,24 +1452,34 @@ private:
         m_logger->Log(DEBUG) << "Choose to use video encoder '" << m_videnc->name << "'." << endl;
         m_logger->Log(DEBUG) << "Choose to use encoding pixel-format '" << av_get_pix_fmt_name(m_videncPixfmt) << "'." << endl;
 
-        m_imgCvter.SetUseVulkanConverter(true);
-        if (!m_imgCvter.SetOutSize(width, height))
-        {
-            ostringstream oss;
-            oss << "FAILED to set 'ImMatToAVFrameConverter' with out-size " << width << "x" << height << "!";
-            m_errMsg = oss.str();
-            return false;
-        }
-        if (!m_imgCvter.SetOutPixelFormat(m_videncPixfmt))
+        const uint32_t cvtThreadCount = GetVideoConverterThreadCount();
+        m_vidCvtWorkers.clear();
+        for (uint32_t i = 0; i < cvtThreadCount; i++)
         {
-            ostringstream oss;
-            const char* name = av_get_pix_fmt_name(m_videncPixfmt);
-            oss << "FAILED to set 'ImMatToAVFrameConverter' with pixel-format '" << (name ? name : "(null)") << "'!";
-            m_errMsg = oss.str();
-            return false;
+            m_vidCvtWorkers.emplace_back();
+            auto& imgCvter = m_vidCvtWorkers.back().imgCvter;
+            imgCvter.SetUseVulkanConverter(true);
+            if (!imgCvter.SetOutSize(width, height))
+            {
+                ostringstream oss;
+                oss << "FAILED to set 'ImMatToAVFrameConverter' with out-size " << width << "x" << height << "!";
+                m_errMsg = oss.str();
+                return false;
+            }
+            if (!imgCvter.SetOutPixelFormat(m_videncPixfmt))
+            {
+                ostringstream oss;
+                const char* name = av_get_pix_fmt_name(m_videncPixfmt);
+                oss << "FAILED to set 'ImMatToAVFrameConverter' with pixel-format '" << (name ? name : "(null)") << "'!";
+                m_errMsg = oss.str();
+                return false;
+            }
         }
+        m_logger->Log(DEBUG) << "Use " << cvtThreadCount << " threads for video frame conversion." << endl;
+        RecordVideoEncoderThreading();
 
-        m_vmatQMaxSize = (uint32_t)(((double)m_videncCtx->framerate.num/m_videncCtx->framerate.den)*m_dataQCacheDur);
+        m_vfrmQ.SetMaxSize((size_t)(((double)m_videncCtx->framerate.num/m_videncCtx->framerate.den)*m_dataQCacheDur));
+        m_vidCvtTaskQ.SetMaxSize(m_vfrmQ.MaxSize()+1);
 
         m_vidAvStm = avformat_new_stream(m_avfmtCtx, m_videnc);
         if (!m_vidAvStm)
@@ -862,6 +1662,9 @@ private:
             }
         }
 
+        if ((videnc->capabilities&AV_CODEC_CAP_HARDWARE) == 0)
+            SetupVideoEncoderThreading(videnc, *ppVidencCtx);
+
         if (bGlobalHeader)
             (*ppVidencCtx)->flags |= AV_CODEC_FLAG_GLOBAL_HEADER; 
         fferr = avcodec_open2(*ppVidencCtx, videnc, &encOpts);
@@ -875,6 +1678,131 @@ private:
         return true;
     }
 
+    uint32_t GetVideoConverterThreadCount() const
+    {
+        uint32_t cvtThreadCount = m_vidCvtThreadCount;
+        if (cvtThreadCount == 0)
+        {
+            cvtThreadCount = thread::hardware_concurrency()/4;
+            if (cvtThreadCount < 1) cvtThreadCount = 1;
+            else if (cvtThreadCount > 4) cvtThreadCount = 4;
+        }
+        return cvtThreadCount;
+    }
+
+    // Give the encoder enough threads to keep pace with the render pipeline measured in the previous exports, the other cores
+    // are left to the render pipeline and the conversion threads. Without a measurement, a quarter of the cores is reserved.
+    uint32_t CalcAutoVideoEncoderThreadCount(AVCodecPtr videnc, uint32_t width, uint32_t height)
+    {
+        const int32_t coreCount = max((int32_t)thread::hardware_concurrency(), 1);
+        const int32_t maxCount = max(coreCount-(int32_t)GetVideoConverterThreadCount()-1, 1);
+        int32_t threadCount = max(coreCount-(int32_t)GetVideoConverterThreadCount()-max(coreCount/4, 2), 1);
+        bool profileFound = false;
+        {
+            lock_guard<mutex> lk(s_encProfileLock);
+            auto iter = s_encProfiles.find(MakeEncoderProfileKey(videnc->name, width, height));
+            if (iter != s_encProfiles.end() && iter->second.renderUsPerFrame > 0)
+            {
+                threadCount = (int32_t)ceil(iter->second.encodeCpuUsPerFrame/iter->second.renderUsPerFrame);
+                profileFound = true;
+            }
+        }
+        threadCount = min(max(threadCount, 1), maxCount);
+        m_logger->Log(DEBUG) << "Auto-tuned video encoder thread count is " << threadCount << (profileFound ? " (from the measured throughput)." : " (no measurement).") << endl;
+        return (uint32_t)threadCount;
+    }
+
+    void SetupVideoEncoderThreading(AVCodecPtr videnc, AVCodecContext* pEncCtx)
+    {
+        const auto& opts = m_vidThreadingOpts;
+        uint32_t threadCount = opts.autoTune ? CalcAutoVideoEncoderThreadCount(videnc, pEncCtx->width, pEncCtx->height) : opts.threadCount;
+        if (threadCount > 0)
+            pEncCtx->thread_count = (int)threadCount;
+        int threadType = 0;
+        if (opts.threadType == VideoThreadingOptions::THREAD_TYPE_FRAME)
+            threadType = FF_THREAD_FRAME;
+        else if (opts.threadType == VideoThreadingOptions::THREAD_TYPE_SLICE)
+            threadType = FF_THREAD_SLICE;
+        else if (opts.threadType == VideoThreadingOptions::THREAD_TYPE_FRAME_SLICE)
+            threadType = FF_THREAD_FRAME|FF_THREAD_SLICE;
+        if (threadType != 0)
+        {
+            // encoders with their own threading (AV_CODEC_CAP_OTHER_THREADS) read 'thread_type' directly
+            int supported = FF_THREAD_FRAME|FF_THREAD_SLICE;
+            if ((videnc->capabilities&AV_CODEC_CAP_OTHER_THREADS) == 0)
+            {
+                supported = 0;
+                if (videnc->capabilities&AV_CODEC_CAP_FRAME_THREADS) supported |= FF_THREAD_FRAME;
+                if (videnc->capabilities&AV_CODEC_CAP_SLICE_THREADS) supported |= FF_THREAD_SLICE;
+            }
+            if ((threadType&supported) == 0)
+                m_logger->Log(WARN) << "Encoder '" << videnc->name << "' does NOT support the required thread type " << threadType << ", use its default." << endl;
+            else
+                pEncCtx->thread_type = threadType&supported;
+        }
+    }
+
+    void RecordVideoEncoderThreading()
+    {
+        m_videncThreadCount = 0;
+        m_videncThreadType = "none";
+        if ((m_videnc->capabilities&AV_CODEC_CAP_HARDWARE) != 0)
+            return;
+        m_videncThreadCount = (uint32_t)max(m_videncCtx->thread_count, 0);
+        if ((m_videnc->capabilities&AV_CODEC_CAP_OTHER_THREADS) != 0)
+        {
+            const int threadType = m_videncCtx->thread_type&(FF_THREAD_FRAME|FF_THREAD_SLICE);
+            m_videncThreadType = threadType == FF_THREAD_FRAME ? "frame" : threadType == FF_THREAD_SLICE ? "slice" : "auto";
+        }
+        else
+        {
+            const int threadType = m_videncCtx->active_thread_type;
+            m_videncThreadType = threadType == FF_THREAD_FRAME ? "frame" : threadType == FF_THREAD_SLICE ? "slice"
+                    : threadType == (FF_THREAD_FRAME|FF_THREAD_SLICE) ? "frame+slice" : "none";
+        }
+        m_logger->Log(DEBUG) << "Video encoder uses " << m_videncThreadCount << " threads, thread type is '" << m_videncThreadType << "'." << endl;
+    }
+
+    void ReportStageUtilization(const Statistics& stats)
+    {
+        struct { const char* name; float util; } stages[] = {
+            { "render", stats.renderUtilization },
+            { "convert", stats.convertUtilization },
+            { "encode", stats.encodeUtilization },
+            { "mux", stats.muxUtilization },
+        };
+        const char* bottleneck = stages[0].name;
+        float maxUtil = stages[0].util;
+        for (auto& stage : stages)
+        {
+            if (stage.util > maxUtil)
+            {
+                maxUtil = stage.util;
+                bottleneck = stage.name;
+            }
+        }
+        m_logger->Log(INFO) << "Export finished in " << stats.elapsedMillisec << "ms, " << m_vidInputFrameCount << " video frames. Stage utilization: render "
+                << (int)(stats.renderUtilization*100) << "%, convert " << (int)(stats.convertUtilization*100) << "%(" << stats.vidConverterThreadCount
+                << " threads), encode " << (int)(stats.encodeUtilization*100) << "%(" << stats.vidEncoderThreadCount << " threads, " << stats.vidEncoderThreadType
+                << "), mux " << (int)(stats.muxUtilization*100) << "%. The busiest stage is '" << bottleneck << "'." << endl;
+    }
+
+    void UpdateThroughputProfile(const Statistics& stats)
+    {
+        if (m_imgseqParallel || m_vidCopySegCount > 0 || m_vidInputFrameCount < 30 || (m_videnc->capabilities&AV_CODEC_CAP_HARDWARE) != 0)
+            return;
+        const double frameCount = m_vidInputFrameCount;
+        const double elapsedUs = (double)stats.elapsedMillisec*1000;
+        const uint32_t threadCount = m_videncThreadCount > 0 ? m_videncThreadCount : thread::hardware_concurrency();
+        _EncoderThroughputProfile profile;
+        profile.renderUsPerFrame = stats.renderUtilization*elapsedUs/frameCount;
+        profile.encodeCpuUsPerFrame = (double)m_videncBusyUs/frameCount*max(threadCount, 1u);
+        if (profile.renderUsPerFrame <= 0)
+            return;
+        lock_guard<mutex> lk(s_encProfileLock);
+        s_encProfiles[MakeEncoderProfileKey(m_videnc->name, m_videncWidth, m_videncHeight)] = profile;
+    }
+
     void CloseVideoComponents()
     {
         if (m_videncCtx)
@@ -888,6 +1816,326 @@ private:
         m_vidStmIdx = -1;
         m_vidinpEof = false;
         m_videncEof = false;
+        m_vidCvtWorkers.clear();
+        m_videncThreadCount = 0;
+        m_videncThreadType.clear();
+        ReleaseImageSequenceEncoders();
+    }
+
+    bool ReopenVideoEncoder()
+    {
+        const bool bGlobalHeader = (m_avfmtCtx->oformat->flags&AVFMT_GLOBALHEADER) != 0;
+        const bool isHwEncoder = (m_videnc->capabilities&AV_CODEC_CAP_HARDWARE) != 0;
+        AVCodecContext* pTempVidencCtx = nullptr;
+        AVBufferRef* pTempHwDevCtx = nullptr;
+        if (!OpenVideoEncoder(m_videnc, &pTempVidencCtx, isHwEncoder ? &pTempHwDevCtx : nullptr,
+                m_videncWidth, m_videncHeight, m_videncFrameRate, m_videncBitRate,
+                m_videncExtraOpts.empty() ? nullptr : &m_videncExtraOpts, m_videncReqPixfmt, bGlobalHeader))
+        {
+            if (pTempVidencCtx)
+                avcodec_free_context(&pTempVidencCtx);
+            if (pTempHwDevCtx)
+                av_buffer_unref(&pTempHwDevCtx);
+            return false;
+        }
+        lock_guard<mutex> lk(m_videncLock);
+        avcodec_free_context(&m_videncCtx);
+        m_videncCtx = pTempVidencCtx;
+        m_vidNullFrameSent = false;
+        m_videncEof = false;
+        // the previous input may belong to the old hardware frame context, and a new GOP must not start with a resent frame
+        m_vidLastEncfrm = nullptr;
+        m_vidLastHash = 0;
+        m_vidLastInputTask = nullptr;
+        m_vidStaticTailPts = AV_NOPTS_VALUE;
+        return true;
+    }
+
+    // Use parallel encoders for an image sequence output of an intra-only codec, where every frame is an independent image
+    void SetupImageSequenceEncoders()
+    {
+        m_imgseqParallel = false;
+        if (!HasVideo() || HasAudio() || strcmp(m_avfmtCtx->oformat->name, "image2") != 0)
+            return;
+        if ((m_videnc->capabilities&AV_CODEC_CAP_HARDWARE) != 0 || m_videncCtx->hw_frames_ctx)
+            return;
+        const AVCodecDescriptor* desc = avcodec_descriptor_get(m_videnc->id);
+        if (!desc || (desc->props&AV_CODEC_PROP_INTRA_ONLY) == 0)
+            return;
+        const string pattern(m_avfmtCtx->url);
+        vector<char> fileName(pattern.size()+32);
+        if (av_get_frame_filename2(fileName.data(), (int)fileName.size(), pattern.c_str(), 1, 0) < 0)
+            return;  // single image output
+        uint32_t encCount = m_imgseqOpts.encoderCount;
+        if (encCount == 0)
+            encCount = thread::hardware_concurrency();
+        if (encCount < 2)
+            return;
+
+        // every context encodes one image at a time, the parallelism comes from the workers
+        vector<Option> encOpts;
+        for (auto& opt : m_videncExtraOpts)
+        {
+            if (opt.name != "threads")
+                encOpts.push_back(opt);
+        }
+        encOpts.push_back(Option("threads", Value((int64_t)1)));
+        for (uint32_t i = 0; i < encCount; i++)
+        {
+            AVCodecContext* pEncCtx = nullptr;
+            if (!OpenVideoEncoder(m_videnc, &pEncCtx, nullptr, m_videncWidth, m_videncHeight, m_videncFrameRate, m_videncBitRate,
+                    &encOpts, m_videncPixfmt, false))
+            {
+                if (pEncCtx)
+                    avcodec_free_context(&pEncCtx);
+                m_logger->Log(WARN) << "FAILED to open image encoder #" << i << " for parallel encoding! " << m_errMsg << endl;
+                break;
+            }
+            m_imgseqWorkers.emplace_back();
+            m_imgseqWorkers.back().encCtx = pEncCtx;
+        }
+        if (m_imgseqWorkers.size() < 2)
+        {
+            ReleaseImageSequenceEncoders();
+            return;
+        }
+
+        int64_t startNumber = 1;
+        av_opt_get_int(m_avfmtCtx->priv_data, "start_number", 0, &startNumber);
+        m_imgseqPattern = pattern;
+        m_imgseqNextNumber = (int)startNumber;
+        m_imgseqActiveWorkers = (uint32_t)m_imgseqWorkers.size();
+        m_imgseqTaskQ.Reset();
+        m_imgseqTaskQ.SetMaxSize(m_imgseqWorkers.size()*2);
+        m_imgseqSyncQ.Reset();
+        m_imgseqSyncQ.SetMaxSize(m_imgseqWorkers.size()*4);
+        m_imgseqParallel = true;
+        m_logger->Log(DEBUG) << "Encode image sequence '" << pattern << "' with " << m_imgseqWorkers.size() << " parallel encoders." << endl;
+    }
+
+    void ReleaseImageSequenceEncoders()
+    {
+        for (auto& worker : m_imgseqWorkers)
+        {
+            if (worker.encCtx)
+                avcodec_free_context(&worker.encCtx);
+        }
+        m_imgseqWorkers.clear();
+        m_imgseqParallel = false;
+    }
+
+    // Open the source of a passthrough with its codec parameters probed, some containers only provide them after probing the packets
+    bool OpenPassthroughSource(MediaParser::Holder hParser, AVFormatContext*& pSrcFmtCtx, int& srcStmIdx)
+    {
+        const string url = hParser->GetUrl();
+        srcStmIdx = hParser->GetBestVideoStreamIndex();
+        pSrcFmtCtx = nullptr;
+        int fferr = avformat_open_input(&pSrcFmtCtx, url.c_str(), nullptr, nullptr);
+        if (fferr < 0)
+        {
+            m_errMsg = FFapiFailureMessage("avformat_open_input", fferr);
+            return false;
+        }
+        fferr = avformat_find_stream_info(pSrcFmtCtx, nullptr);
+        if (fferr < 0)
+        {
+            m_errMsg = FFapiFailureMessage("avformat_find_stream_info", fferr);
+            avformat_close_input(&pSrcFmtCtx);
+            return false;
+        }
+        if (srcStmIdx < 0 || srcStmIdx >= (int)pSrcFmtCtx->nb_streams)
+        {
+            ostringstream oss; oss << "Source '" << url << "' does NOT have stream #" << srcStmIdx << "!";
+            m_errMsg = oss.str();
+            avformat_close_input(&pSrcFmtCtx);
+            return false;
+        }
+        return true;
+    }
+
+    bool CheckVideoPassthrough_Internal(AVFormatContext* pSrcFmtCtx, int srcStmIdx)
+    {
+        string reason;
+        if (!IsPassthroughCompatible(pSrcFmtCtx->streams[srcStmIdx]->codecpar, m_vidAvStm->codecpar, reason))
+        {
+            ostringstream oss; oss << "Video of '" << pSrcFmtCtx->url << "' can NOT be passed through, " << reason << "!";
+            m_errMsg = oss.str();
+            return false;
+        }
+        return true;
+    }
+
+    bool CopyVideoPackets_Internal(MediaParser::Holder hParser, int64_t srcStartPts, int64_t srcEndPts, int64_t dstStartMts)
+    {
+        const string url = hParser->GetUrl();
+        AVFormatContext* pSrcFmtCtx = nullptr;
+        int srcStmIdx = -1;
+        if (!OpenPassthroughSource(hParser, pSrcFmtCtx, srcStmIdx))
+            return false;
+        if (!CheckVideoPassthrough_Internal(pSrcFmtCtx, srcStmIdx))
+        {
+            avformat_close_input(&pSrcFmtCtx);
+            return false;
+        }
+        const AVCodecParameters* srcpar = pSrcFmtCtx->streams[srcStmIdx]->codecpar;
+        const AVRational srcTb = pSrcFmtCtx->streams[srcStmIdx]->time_base;
+        const AVRational dstTb = m_vidAvStm->time_base;
+        int fferr = av_seek_frame(pSrcFmtCtx, srcStmIdx, srcStartPts, AVSEEK_FLAG_BACKWARD);
+        if (fferr < 0)
+        {
+            m_errMsg = FFapiFailureMessage("av_seek_frame", fferr);
+            avformat_close_input(&pSrcFmtCtx);
+            return false;
+        }
+
+        // the encoder writes AnnexB packets (the muxer converts them if the container needs), the length prefixed packets of
+        // a mp4/mkv source are converted the same, with the parameter sets repeated in-band before each key frame
+        AVBSFContext* pBsfCtx = nullptr;
+        if ((srcpar->codec_id == AV_CODEC_ID_H264 || srcpar->codec_id == AV_CODEC_ID_HEVC)
+            && IsLengthPrefixedExtradata(srcpar) && !IsLengthPrefixedExtradata(m_vidAvStm->codecpar))
+        {
+            const char* bsfName = srcpar->codec_id == AV_CODEC_ID_H264 ? "h264_mp4toannexb" : "hevc_mp4toannexb";
+            const AVBitStreamFilter* pBsf = av_bsf_get_by_name(bsfName);
+            fferr = pBsf ? av_bsf_alloc(pBsf, &pBsfCtx) : AVERROR_BSF_NOT_FOUND;
+            if (fferr >= 0)
+                fferr = avcodec_parameters_copy(pBsfCtx->par_in, srcpar);
+            if (fferr >= 0)
+            {
+                pBsfCtx->time_base_in = srcTb;
+                fferr = av_bsf_init(pBsfCtx);
+            }
+            if (fferr < 0)
+            {
+                m_errMsg = FFapiFailureMessage(string("av_bsf_init(")+bsfName+")", fferr);
+                av_bsf_free(&pBsfCtx);
+                avformat_close_input(&pSrcFmtCtx);
+                return false;
+            }
+        }
+
+        const int64_t dstOffset = av_rescale_q(dstStartMts, MILLISEC_TIMEBASE, dstTb);
+        uint32_t pktCnt = 0;
+        auto writePacket = [&] (AVPacket* pkt) {
+            pkt->pts = av_rescale_q(pkt->pts-srcStartPts, srcTb, dstTb)+dstOffset;
+            if (pkt->dts != AV_NOPTS_VALUE)
+                pkt->dts = av_rescale_q(pkt->dts-srcStartPts, srcTb, dstTb)+dstOffset;
+            pkt->duration = av_rescale_q(pkt->duration, srcTb, dstTb);
+            pkt->stream_index = m_vidStmIdx;
+            pkt->pos = -1;
+            int ret;
+            {
+                lock_guard<mutex> lk(m_muxWriteLock);
+                if (pkt->dts != AV_NOPTS_VALUE && m_vidLastDts != AV_NOPTS_VALUE && pkt->dts <= m_vidLastDts)
+                {
+                    ostringstream oss; oss << "Passthrough packet dts " << pkt->dts << " is NOT greater than the previous video dts "
+                            << m_vidLastDts << "! Use an encoder configuration without B-frames for smart-render.";
+                    m_errMsg = oss.str();
+                    av_packet_unref(pkt);
+                    return false;
+                }
+                if (pkt->dts != AV_NOPTS_VALUE)
+                    m_vidLastDts = pkt->dts;
+                ret = av_interleaved_write_frame(m_avfmtCtx, pkt);
+            }
+            if (ret < 0)
+            {
+                m_errMsg = FFapiFailureMessage("av_interleaved_write_frame", ret);
+                return false;
+            }
+            pktCnt++;
+            return true;
+        };
+        // send a source packet (or nullptr to flush) through the bitstream filter, and write out what it produces
+        auto filterAndWritePacket = [&] (AVPacket* pkt) {
+            if (!pBsfCtx)
+                return pkt ? writePacket(pkt) : true;
+            int ret = av_bsf_send_packet(pBsfCtx, pkt);
+            if (ret < 0)
+            {
+                m_errMsg = FFapiFailureMessage("av_bsf_send_packet", ret);
+                if (pkt)
+                    av_packet_unref(pkt);
+                return false;
+            }
+            AVPacket* outPkt = av_packet_alloc();
+            bool ok = true;
+            while (ok)
+            {
+                ret = av_bsf_receive_packet(pBsfCtx, outPkt);
+                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                    break;
+                if (ret < 0)
+                {
+                    m_errMsg = FFapiFailureMessage("av_bsf_receive_packet", ret);
+                    ok = false;
+                    break;
+                }
+                ok = writePacket(outPkt);
+                av_packet_unref(outPkt);
+            }
+            av_packet_free(&outPkt);
+            return ok;
+        };
+
+        AVPacket* pkt = av_packet_alloc();
+        bool started = false;
+        bool success = true;
+        while (!m_quit)
+        {
+            fferr = av_read_frame(pSrcFmtCtx, pkt);
+            if (fferr == AVERROR_EOF)
+                break;
+            if (fferr < 0)
+            {
+                m_errMsg = FFapiFailureMessage("av_read_frame", fferr);
+                success = false;
+                break;
+            }
+            if (pkt->stream_index != srcStmIdx || pkt->pts == AV_NOPTS_VALUE)
+            {
+                av_packet_unref(pkt);
+                continue;
+            }
+            const bool isKeyPkt = (pkt->flags&AV_PKT_FLAG_KEY) != 0;
+            if (!started)
+            {
+                if (!isKeyPkt || pkt->pts < srcStartPts)
+                {
+                    av_packet_unref(pkt);
+                    continue;
+                }
+                started = true;
+            }
+            else if (isKeyPkt && pkt->pts >= srcEndPts)
+            {
+                av_packet_unref(pkt);
+                break;
+            }
+            success = filterAndWritePacket(pkt);
+            av_packet_unref(pkt);
+            if (!success)
+                break;
+        }
+        if (success && started)
+            success = filterAndWritePacket(nullptr);
+        av_packet_free(&pkt);
+        if (pBsfCtx)
+            av_bsf_free(&pBsfCtx);
+        avformat_close_input(&pSrcFmtCtx);
+        if (success && !started)
+        {
+            ostringstream oss; oss << "NO key frame is found at pts " << srcStartPts << " in '" << url << "'!";
+            m_errMsg = oss.str();
+            success = false;
+        }
+        if (success)
+        {
+            m_vidCopySegCount++;
+            m_vidCopyPktCount += pktCnt;
+            m_logger->Log(DEBUG) << "Copied " << pktCnt << " video packets from '" << url << "' pts[" << srcStartPts << ", " << srcEndPts
+                    << ") to " << MillisecToString(dstStartMts) << "." << endl;
+        }
+        return success;
     }
 
     bool ConfigureAudioStream_Internal(const std::string& codecName,
@@ -963,47 +2211,226 @@ private:
         m_audinpFrameSize = av_get_bytes_per_sample(m_audinpSmpfmt)*channels;
         m_audencFrameSize = av_get_bytes_per_sample(m_audencSmpfmt)*channels;
 
-        m_audfrmQMaxSize = (uint32_t)(m_dataQCacheDur*sampleRate/m_audencFrameSamples);
+        m_audfrmQ.SetMaxSize((size_t)(m_dataQCacheDur*sampleRate/m_audencFrameSamples));
+
+        m_audAvStm = avformat_new_stream(m_avfmtCtx, m_audenc);
+        if (!m_audAvStm)
+        {
+            m_errMsg = "FAILED to create new stream by 'avformat_new_stream'!";
+            return false;
+        }
+        m_audAvStm->id = m_avfmtCtx->nb_streams-1;
+        if ((m_avfmtCtx->oformat->flags&AVFMT_GLOBALHEADER) != 0)
+            m_audencCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER; 
+        m_audAvStm->time_base = m_audencCtx->time_base;
+        avcodec_parameters_from_context(m_audAvStm->codecpar, m_audencCtx);
+
+        // the buffer pool of the encoder input frames, warm it up with enough buffers to fill the frame queue
+        m_audencChannels = channels;
+        const bool isPlanar = av_sample_fmt_is_planar(m_audencSmpfmt) == 1;
+        m_audencPlaneSize = FFALIGN(m_audencFrameSamples*(isPlanar ? m_audencFrameSize/channels : m_audencFrameSize), 64);
+        m_audfrmPool = av_buffer_pool_init(m_audencPlaneSize*(isPlanar ? channels : 1), nullptr);
+        if (!m_audfrmPool)
+        {
+            m_errMsg = "FAILED to create audio frame buffer pool by 'av_buffer_pool_init'!";
+            return false;
+        }
+        vector<AVBufferRef*> warmupBufs(m_audfrmQ.MaxSize()+2);
+        for (auto& pBuf : warmupBufs)
+            pBuf = av_buffer_pool_get(m_audfrmPool);
+        for (auto& pBuf : warmupBufs)
+            av_buffer_unref(&pBuf);
+
+        return true;
+    }
+
+    bool CheckAudioInputState()
+    {
+        if (!m_opened)
+        {
+            m_errMsg = "This MediaEncoder has NOT opened yet!";
+            return false;
+        }
+        if (!m_started)
+        {
+            m_errMsg = "This MediaEncoder has NOT started yet!";
+            return false;
+        }
+        if (!HasAudio())
+        {
+            m_errMsg = "This MediaEncoder does NOT have audio!";
+            return false;
+        }
+        return true;
+    }
+
+    bool SendAudioEof()
+    {
+        if (m_audencfrm && m_audencfrmSmpOffset > 0)
+        {
+            // pad the last frame with silence
+            const uint32_t padSamples = m_audencFrameSamples-m_audencfrmSmpOffset;
+            av_samples_set_silence(m_audencfrm->extended_data, m_audencfrmSmpOffset, padSamples, m_audencChannels, m_audencSmpfmt);
+            m_audfrmQ.Push(m_audencfrm);
+        }
+        m_audencfrm = nullptr;
+        m_audencfrmSmpOffset = 0;
+        m_audinpEof = true;
+        m_audfrmQ.Close();
+        return true;
+    }
+
+    // Encoder input frames take their buffers from a pool, so the frames are recycled instead of being allocated for each input.
+    // All the planes of a planar frame are in one pooled buffer.
+    SelfFreeAVFramePtr AllocPooledAudioFrame()
+    {
+        SelfFreeAVFramePtr avfrm = AllocSelfFreeAVFramePtr();
+        if (!avfrm)
+        {
+            m_errMsg = "FAILED allocate new AVFrame for audio input frame!";
+            return nullptr;
+        }
+        avfrm->format = m_audencSmpfmt;
+        avfrm->sample_rate = m_audencCtx->sample_rate;
+#if !defined(FF_API_OLD_CHANNEL_LAYOUT) && (LIBAVUTIL_VERSION_MAJOR < 58)
+        avfrm->channels = m_audencCtx->channels;
+        avfrm->channel_layout = m_audencCtx->channel_layout;
+#else
+        av_channel_layout_copy(&avfrm->ch_layout, &m_audencCtx->ch_layout);
+#endif
+        avfrm->nb_samples = m_audencFrameSamples;
+        avfrm->buf[0] = av_buffer_pool_get(m_audfrmPool);
+        if (!avfrm->buf[0])
+        {
+            m_errMsg = "FAILED to get audio frame buffer from the pool!";
+            return nullptr;
+        }
+        const bool isPlanar = av_sample_fmt_is_planar(m_audencSmpfmt) == 1;
+        const int planeCount = isPlanar ? m_audencChannels : 1;
+        if (planeCount > AV_NUM_DATA_POINTERS)
+        {
+            avfrm->extended_data = (uint8_t**)av_calloc(planeCount, sizeof(uint8_t*));
+            if (!avfrm->extended_data)
+            {
+                avfrm->extended_data = avfrm->data;
+                m_errMsg = "FAILED to allocate 'extended_data' for audio frame!";
+                return nullptr;
+            }
+        }
+        else
+        {
+            avfrm->extended_data = avfrm->data;
+        }
+        for (int i = 0; i < planeCount; i++)
+        {
+            uint8_t* pPlane = avfrm->buf[0]->data+(size_t)i*m_audencPlaneSize;
+            avfrm->extended_data[i] = pPlane;
+            if (i < AV_NUM_DATA_POINTERS)
+                avfrm->data[i] = pPlane;
+        }
+        avfrm->linesize[0] = m_audencPlaneSize;
+        return avfrm;
+    }
+
+    bool SetupAudioResampler(AVSampleFormat inpSmpfmt)
+    {
+        if (m_swrCtx && m_swrInpSmpfmt == inpSmpfmt)
+            return true;
+        if (m_swrCtx)
+            swr_free(&m_swrCtx);
+        int fferr;
+#if !defined(FF_API_OLD_CHANNEL_LAYOUT) && (LIBAVUTIL_VERSION_MAJOR < 58)
+        m_swrCtx = swr_alloc_set_opts(nullptr, m_audencCtx->channel_layout, m_audencSmpfmt, m_audencCtx->sample_rate,
+            m_audencCtx->channel_layout, inpSmpfmt, m_audencCtx->sample_rate, 0, nullptr);
+        if (!m_swrCtx)
+#else
+        fferr = swr_alloc_set_opts2(&m_swrCtx, &m_audencCtx->ch_layout, m_audencSmpfmt, m_audencCtx->sample_rate,
+            &m_audencCtx->ch_layout, inpSmpfmt, m_audencCtx->sample_rate, 0, nullptr);
+        if (fferr < 0)
+#endif
+        {
+            m_errMsg = "FAILED to setup SwrContext for audio input format conversion!";
+            return false;
+        }
+        fferr = swr_init(m_swrCtx);
+        if (fferr < 0)
+        {
+            m_errMsg = FFapiFailureMessage("swr_init", fferr);
+            swr_free(&m_swrCtx);
+            return false;
+        }
+        m_swrInpSmpfmt = inpSmpfmt;
+        return true;
+    }
 
-        m_audAvStm = avformat_new_stream(m_avfmtCtx, m_audenc);
-        if (!m_audAvStm)
+    // Append input samples to the frame being assembled, a full frame is queued for the encoder by reference.
+    // Input with the same sample type as the encoder is copied directly, only converting between planar and interleaved layouts.
+    // Other sample types go through swresample, in chunks no larger than the room in the frame so nothing is left inside swr.
+    bool EncodeAudioSamples_Internal(const uint8_t* const* inpPlanes, AVSampleFormat inpSmpfmt, uint32_t inpSamples, bool wait)
+    {
+        if (!wait && m_audfrmQ.Full())
         {
-            m_errMsg = "FAILED to create new stream by 'avformat_new_stream'!";
+            m_errMsg = "Queue full!";
             return false;
         }
-        m_audAvStm->id = m_avfmtCtx->nb_streams-1;
-        if ((m_avfmtCtx->oformat->flags&AVFMT_GLOBALHEADER) != 0)
-            m_audencCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER; 
-        m_audAvStm->time_base = m_audencCtx->time_base;
-        avcodec_parameters_from_context(m_audAvStm->codecpar, m_audencCtx);
+        const bool directCopy = av_get_packed_sample_fmt(inpSmpfmt) == av_get_packed_sample_fmt(m_audencSmpfmt);
+        if (!directCopy && !SetupAudioResampler(inpSmpfmt))
+            return false;
+        const bool inpPlanar = av_sample_fmt_is_planar(inpSmpfmt) == 1;
+        const bool encPlanar = av_sample_fmt_is_planar(m_audencSmpfmt) == 1;
+        const uint32_t inpBps = av_get_bytes_per_sample(inpSmpfmt);
+        const uint32_t encBps = av_get_bytes_per_sample(m_audencSmpfmt);
+        m_audInpPlanePtrs.resize(inpPlanar ? m_audencChannels : 1);
+        m_audEncPlanePtrs.resize(encPlanar ? m_audencChannels : 1);
 
-        if (m_audinpSmpfmt != m_audencSmpfmt)
+        uint32_t consumed = 0;
+        while (consumed < inpSamples && !m_quit)
         {
-#if !defined(FF_API_OLD_CHANNEL_LAYOUT) && (LIBAVUTIL_VERSION_MAJOR < 58)
-            m_swrCtx = swr_alloc_set_opts(nullptr, m_audencCtx->channel_layout, m_audencSmpfmt, m_audencCtx->sample_rate,
-                m_audencCtx->channel_layout, m_audinpSmpfmt, m_audencCtx->sample_rate, 0, nullptr);
-            if (!m_swrCtx)
-#else
-            fferr = swr_alloc_set_opts2(&m_swrCtx, &m_audencCtx->ch_layout, m_audencSmpfmt, m_audencCtx->sample_rate,
-                &m_audencCtx->ch_layout, m_audinpSmpfmt, m_audencCtx->sample_rate, 0, nullptr);
-            if (fferr < 0)
-#endif
+            if (!m_audencfrm)
             {
-                m_errMsg = "FAILED to setup SwrContext for audio input format conversion!";
-                return false;
+                m_audencfrm = AllocPooledAudioFrame();
+                if (!m_audencfrm)
+                    return false;
+                m_audencfrm->pts = m_audfrmPts;
+                m_audencfrmSmpOffset = 0;
             }
-            fferr = swr_init(m_swrCtx);
-            if (fferr < 0)
+
+            const uint32_t copySamples = min(m_audencFrameSamples-m_audencfrmSmpOffset, inpSamples-consumed);
+            const uint32_t inpStride = inpPlanar ? inpBps : inpBps*m_audencChannels;
+            for (size_t i = 0; i < m_audInpPlanePtrs.size(); i++)
+                m_audInpPlanePtrs[i] = inpPlanes[i]+(size_t)consumed*inpStride;
+            const uint32_t encStride = encPlanar ? encBps : encBps*m_audencChannels;
+            for (size_t i = 0; i < m_audEncPlanePtrs.size(); i++)
+                m_audEncPlanePtrs[i] = m_audencfrm->extended_data[i]+(size_t)m_audencfrmSmpOffset*encStride;
+
+            if (directCopy)
             {
-                m_errMsg = FFapiFailureMessage("swr_init", fferr);
-                return false;
+                CopyAudioSamples(m_audInpPlanePtrs.data(), inpPlanar, m_audEncPlanePtrs.data(), encPlanar, m_audencChannels, encBps, copySamples);
+            }
+            else
+            {
+                int fferr = swr_convert(m_swrCtx, m_audEncPlanePtrs.data(), copySamples, m_audInpPlanePtrs.data(), copySamples);
+                if (fferr != (int)copySamples)
+                {
+                    m_errMsg = FFapiFailureMessage("swr_convert", fferr);
+                    return false;
+                }
+            }
+            consumed += copySamples;
+            m_audencfrmSmpOffset += copySamples;
+
+            if (m_audencfrmSmpOffset >= m_audencFrameSamples)
+            {
+                // 'wait' == false only ensures there is room for the first frame, the rest of this input is still enqueued
+                if (!m_audfrmQ.Push(m_audencfrm))
+                    return false;
+                m_audfrmPts += m_audencfrm->nb_samples;
+                m_audencfrm = nullptr;
+                m_audencfrmSmpOffset = 0;
             }
         }
-        else if (m_swrCtx)
-        {
-            swr_free(&m_swrCtx);
-            m_swrCtx = nullptr;
-        }
+        if (m_quit)
+            return false;
 
         return true;
     }
@@ -1029,6 +2456,9 @@ private:
             swr_free(&m_swrCtx);
             m_swrCtx = nullptr;
         }
+        m_swrInpSmpfmt = AV_SAMPLE_FMT_NONE;
+        if (m_audfrmPool)
+            av_buffer_pool_uninit(&m_audfrmPool);
     }
 
     void StartAllThreads()
@@ -1037,11 +2467,7 @@ private:
         ostringstream thnOss;
         m_quit = false;
         if (HasVideo())
-        {
-            m_videncThread = thread(&MediaEncoder_Impl::VideoEncodingThreadProc, this);
-            thnOss << "EncVenc-" << fileName;
-            SysUtils::SetThreadName(m_videncThread, thnOss.str());
-        }
+            StartVideoThreads();
         if (HasAudio())
         {
             m_audencThread = thread(&MediaEncoder_Impl::AudioEncodingThreadProc, this);
@@ -1053,11 +2479,74 @@ private:
         SysUtils::SetThreadName(m_muxThread, thnOss.str());
     }
 
+    void StartVideoThreads()
+    {
+        string fileName = SysUtils::ExtractFileName(m_avfmtCtx->url);
+        ostringstream thnOss;
+        m_videncThread = thread(&MediaEncoder_Impl::VideoEncodingThreadProc, this);
+        thnOss << "EncVenc-" << fileName;
+        SysUtils::SetThreadName(m_videncThread, thnOss.str());
+        int i = 0;
+        for (auto& worker : m_vidCvtWorkers)
+        {
+            worker.th = thread(&MediaEncoder_Impl::VideoConvertThreadProc, this, &worker.imgCvter);
+            thnOss.str(""); thnOss << "EncVcvt" << i++ << "-" << fileName;
+            SysUtils::SetThreadName(worker.th, thnOss.str());
+        }
+        if (m_imgseqParallel)
+        {
+            i = 0;
+            for (auto& worker : m_imgseqWorkers)
+            {
+                worker.th = thread(&MediaEncoder_Impl::ImageSequenceEncodingThreadProc, this, worker.encCtx);
+                thnOss.str(""); thnOss << "EncImg" << i++ << "-" << fileName;
+                SysUtils::SetThreadName(worker.th, thnOss.str());
+            }
+            if (m_imgseqOpts.syncFiles)
+            {
+                m_imgseqSyncThread = thread(&MediaEncoder_Impl::ImageSequenceSyncThreadProc, this);
+                thnOss.str(""); thnOss << "EncImgSync-" << fileName;
+                SysUtils::SetThreadName(m_imgseqSyncThread, thnOss.str());
+            }
+        }
+    }
+
     void TerminateAllThreads()
     {
         m_quit = true;
+        m_vfrmQ.Abort();
+        m_vidCvtTaskQ.Abort();
+        m_audfrmQ.Abort();
+        m_imgseqTaskQ.Abort();
+        {
+            lock_guard<mutex> lk(m_vidCvtLock);
+        }
+        m_vidCvtDoneCv.notify_all();
+        {
+            lock_guard<mutex> lk(m_videncLock);
+        }
+        m_videncCv.notify_all();
+        {
+            lock_guard<mutex> lk(m_audencLock);
+        }
+        m_audencCv.notify_all();
+        NotifyMuxer();
+        for (auto& worker : m_vidCvtWorkers)
+        {
+            if (worker.th.joinable())
+                worker.th.join();
+        }
         if (m_videncThread.joinable())
             m_videncThread.join();
+        for (auto& worker : m_imgseqWorkers)
+        {
+            if (worker.th.joinable())
+                worker.th.join();
+        }
+        // the sync thread is never aborted, it closes all the written files
+        m_imgseqSyncQ.Close();
+        if (m_imgseqSyncThread.joinable())
+            m_imgseqSyncThread.join();
         if (m_audencThread.joinable())
             m_audencThread.join();
         if (m_muxThread.joinable())
@@ -1066,11 +2555,62 @@ private:
 
     void FlushAllQueues()
     {
-        m_vfrmQ.clear();
-        m_audfrmQ.clear();
+        m_vfrmQ.Reset();
+        m_vidCvtTaskQ.Reset();
+        m_audfrmQ.Reset();
+        m_videncFull = m_audencFull = false;
+        m_vidCvtWaitUs = 0;
+        m_vidCvtBusyUs = 0;
+        m_videncBusyUs = 0;
+        m_vidInputFrameCount = 0;
+        m_muxIdleWaitUs = 0;
+        m_vidLastDts = AV_NOPTS_VALUE;
+        m_vidCopySegCount = m_vidCopyPktCount = 0;
+        m_vidLastEncfrm = nullptr;
+        m_vidLastHash = 0;
+        m_vidLastInputTask = nullptr;
+        m_vidStaticTailPts = AV_NOPTS_VALUE;
+        m_vidStaticFrameCount = m_vidStaticFrameDropped = 0;
+        m_vidSplicing = false;
+        m_imgseqTaskQ.Reset();
+        m_imgseqSyncQ.Reset();
+        m_imgseqFileCount = 0;
+        m_imgseqSyncUs = 0;
+    }
+
+    // Wake up the muxing thread after new input has been sent to one of the encoders, or the encoding state has changed
+    void NotifyMuxer()
+    {
+        {
+            lock_guard<mutex> lk(m_muxLock);
+            m_muxInputSeq++;
+        }
+        m_muxCv.notify_one();
+    }
+
+    // called by the muxing thread, 'CopyVideoPackets()' waits for the video encoder being drained
+    void SetVideoEncoderEof()
+    {
+        {
+            lock_guard<mutex> lk(m_muxLock);
+            m_videncEof = true;
+        }
+        m_muxEofCv.notify_all();
     }
 
-    SelfFreeAVFramePtr ConvertImMatToAVFrame(ImGui::ImMat& vmat)
+    void SetEncodingError(const string& errMsg)
+    {
+        m_errMsg = errMsg;
+        m_logger->Log(Error) << m_errMsg << endl;
+        m_encErr = true;
+        m_vfrmQ.Abort();
+        m_vidCvtTaskQ.Abort();
+        m_audfrmQ.Abort();
+        m_imgseqTaskQ.Abort();
+        NotifyMuxer();
+    }
+
+    SelfFreeAVFramePtr ConvertImMatToAVFrame(ImMatToAVFrameConverter& imgCvter, ImGui::ImMat& vmat)
     {
         if (vmat.empty())
             return nullptr;
@@ -1081,10 +2621,110 @@ private:
             return nullptr;
         }
         int64_t pts = av_rescale_q((int64_t)(vmat.time_stamp*1000), MILLISEC_TIMEBASE, m_videncCtx->time_base);
-        m_imgCvter.ConvertImage(vmat, vfrm.get(), pts);
+        imgCvter.ConvertImage(vmat, vfrm.get(), pts);
         return vfrm;
     }
 
+    // Check the converted frame and upload it to the hardware frame context if the encoder requires
+    SelfFreeAVFramePtr PrepareVideoEncodeFrame(SelfFreeAVFramePtr encfrm)
+    {
+        int fferr;
+        if (encfrm->format != m_videncPixfmt)
+        {
+            ostringstream oss; oss << "INVALID encoding AVFrame pixel format, input frame has format " << encfrm->format << "(" << av_get_pix_fmt_name((AVPixelFormat)encfrm->format)
+                    << "), while the required input format is " << m_videncPixfmt << "(" << av_get_pix_fmt_name(m_videncPixfmt) << ")!";
+            m_errMsg = oss.str();
+            throw runtime_error(m_errMsg);
+        }
+        if (m_videncCtx->hw_frames_ctx && m_videncCtx->pix_fmt != (AVPixelFormat)encfrm->format)
+        {
+            SelfFreeAVFramePtr hwfrm = AllocSelfFreeAVFramePtr();
+            if ((fferr = av_hwframe_get_buffer(m_videncCtx->hw_frames_ctx, hwfrm.get(), 0)) < 0)
+            {
+                stringstream oss; oss << "FAILED to allocate buffer for hardware frame, av_hwframe_get_buffer() returns " << fferr << "!";
+                m_errMsg = oss.str();
+                throw runtime_error(m_errMsg);
+            }
+            if ((fferr = av_hwframe_transfer_data(hwfrm.get(), encfrm.get(), 0)) < 0)
+            {
+                stringstream oss; oss << "FAILED to transfer data to hardware frame, av_hwframe_transfer_data() returns " << fferr << "!";
+                m_errMsg = oss.str();
+                throw runtime_error(m_errMsg);
+            }
+            av_frame_copy_props(hwfrm.get(), encfrm.get());
+            encfrm = hwfrm;
+        }
+        return encfrm;
+    }
+
+    // Convert the input 'VideoFrame's to AVFrames in parallel, each worker uses its own converter.
+    // Tasks are picked up in any order, while the encoding thread consumes the results in the input order.
+    void VideoConvertThreadProc(ImMatToAVFrameConverter* pImgCvter)
+    {
+        m_logger->Log(DEBUG) << "Enter VideoConvertThreadProc()..." << endl;
+
+        VideoEncodeTaskHolder hTask;
+        while (!m_quit && m_vidCvtTaskQ.Pop(hTask))
+        {
+            auto t0 = chrono::steady_clock::now();
+            SelfFreeAVFramePtr encfrm;
+            auto tNatvieData = hTask->hVfrm->GetNativeData();
+            bool isStatic = false;
+            if (m_vidDedupEnabled)
+            {
+                // hash the input image before converting it, and compare with the previous input, which was taken by
+                // another worker earlier and is hashed first thing there, so the wait is short
+                const uint64_t hash = CalcVideoFrameHash(tNatvieData);
+                unique_lock<mutex> lk(m_vidCvtLock);
+                hTask->hash = hash;
+                hTask->hashed = true;
+                m_vidCvtDoneCv.notify_all();
+                auto prevTask = hTask->prevTask;
+                hTask->prevTask = nullptr;
+                if (hash != 0 && prevTask)
+                {
+                    m_vidCvtDoneCv.wait(lk, [this, &prevTask] { return prevTask->hashed || m_quit; });
+                    isStatic = prevTask->hashed && prevTask->hash == hash;
+                }
+            }
+            int64_t pts = AV_NOPTS_VALUE;
+            if (isStatic)
+            {
+                // the encoding thread reuses the previous encoder input, only the timestamp is needed
+                if (tNatvieData.eType == VideoFrame::NativeData::AVFRAME)
+                    pts = ((const AVFrame*)tNatvieData.pData)->pts;
+                else if (tNatvieData.eType == VideoFrame::NativeData::AVFRAME_HOLDER)
+                    pts = ((SelfFreeAVFramePtr*)tNatvieData.pData)->get()->pts;
+                else
+                    pts = av_rescale_q(GetVideoFrameMillisec(tNatvieData), MILLISEC_TIMEBASE, m_videncCtx->time_base);
+            }
+            else if (tNatvieData.eType == VideoFrame::NativeData::AVFRAME)
+                encfrm = CloneSelfFreeAVFramePtr((const AVFrame*)tNatvieData.pData);
+            else if (tNatvieData.eType == VideoFrame::NativeData::AVFRAME_HOLDER)
+                encfrm = *((SelfFreeAVFramePtr*)tNatvieData.pData);
+            else if (tNatvieData.eType == VideoFrame::NativeData::MAT)
+                encfrm = ConvertImMatToAVFrame(*pImgCvter, *((ImGui::ImMat*)tNatvieData.pData));
+            else
+                m_logger->Log(Error) << "UNSUPPORTED 'VideoFrame::NativeData::Type' " << (int)tNatvieData.eType << "!" << endl;
+            {
+                lock_guard<mutex> lk(m_vidCvtLock);
+                m_vidCvtBusyUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
+                if (isStatic)
+                {
+                    hTask->repeated = true;
+                    hTask->pts = pts;
+                }
+                hTask->encfrm = encfrm;
+                hTask->hVfrm = nullptr;
+                hTask->converted = true;
+            }
+            m_vidCvtDoneCv.notify_all();
+            hTask = nullptr;
+        }
+
+        m_logger->Log(DEBUG) << "Leave VideoConvertThreadProc()." << endl;
+    }
+
     void VideoEncodingThreadProc()
     {
         m_logger->Log(DEBUG) << "Enter VideoEncodingThreadProc()..." << endl;
@@ -1093,84 +2733,124 @@ private:
         m_vidNullFrameSent = false;
         while (!m_quit)
         {
-            bool idleLoop = true;
             int fferr;
 
             if (!encfrm)
             {
-                if (!m_vfrmQ.empty())
+                VideoEncodeTaskHolder hTask;
+                if (m_vfrmQ.Pop(hTask))
                 {
-                    VideoFrame::Holder hVfrm;
-                    {
-                        lock_guard<mutex> lk(m_vmatQLock);
-                        hVfrm = m_vfrmQ.front();
-                        m_vfrmQ.pop_front();
-                    }
-                    auto tNatvieData = hVfrm->GetNativeData();
-                    if (tNatvieData.eType == VideoFrame::NativeData::AVFRAME)
-                        encfrm = CloneSelfFreeAVFramePtr((const AVFrame*)tNatvieData.pData);
-                    else if (tNatvieData.eType == VideoFrame::NativeData::AVFRAME_HOLDER)
-                        encfrm = *((SelfFreeAVFramePtr*)tNatvieData.pData);
-                    else if (tNatvieData.eType == VideoFrame::NativeData::MAT)
-                        encfrm = ConvertImMatToAVFrame(*((ImGui::ImMat*)tNatvieData.pData));
-                    else
-                        m_logger->Log(Error) << "UNSUPPORTED 'VideoFrame::NativeData::Type' " << (int)tNatvieData.eType << "!" << endl;
-                    if (encfrm && encfrm->format != m_videncPixfmt)
-                    {
-                        ostringstream oss; oss << "INVALID encoding AVFrame pixel format, input frame has format " << encfrm->format << "(" << av_get_pix_fmt_name((AVPixelFormat)encfrm->format)
-                                << "), while the required input format is " << m_videncPixfmt << "(" << av_get_pix_fmt_name(m_videncPixfmt) << ")!";
-                        m_errMsg = oss.str();
-                        throw runtime_error(m_errMsg);
-                    }
-                    if (m_videncCtx->hw_frames_ctx && m_videncCtx->pix_fmt != (AVPixelFormat)encfrm->format)
                     {
-                        SelfFreeAVFramePtr hwfrm = AllocSelfFreeAVFramePtr();
-                        if ((fferr = av_hwframe_get_buffer(m_videncCtx->hw_frames_ctx, hwfrm.get(), 0)) < 0)
+                        unique_lock<mutex> lk(m_vidCvtLock);
+                        if (!hTask->converted)
                         {
-                            stringstream oss; oss << "FAILED to allocate buffer for hardware frame, av_hwframe_get_buffer() returns " << fferr << "!";
-                            m_errMsg = oss.str();
-                            throw runtime_error(m_errMsg);
+                            auto t0 = chrono::steady_clock::now();
+                            m_vidCvtDoneCv.wait(lk, [this, hTask] { return hTask->converted || m_quit; });
+                            m_vidCvtWaitUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
                         }
-                        if ((fferr = av_hwframe_transfer_data(hwfrm.get(), encfrm.get(), 0)) < 0)
+                        if (!hTask->converted)
+                            break;
+                        encfrm = hTask->encfrm;
+                    }
+                    const bool isStatic = hTask->repeated || (hTask->hash != 0 && hTask->hash == m_vidLastHash);
+                    if (isStatic && m_vidLastEncfrm)
+                    {
+                        const int64_t pts = encfrm ? encfrm->pts : hTask->pts;
+                        m_vidStaticFrameCount++;
+                        if (m_vidIsVfrOutput)
                         {
-                            stringstream oss; oss << "FAILED to transfer data to hardware frame, av_hwframe_transfer_data() returns " << fferr << "!";
-                            m_errMsg = oss.str();
-                            throw runtime_error(m_errMsg);
+                            // drop it, the previous frame lasts until the next different one
+                            m_vidStaticTailPts = pts;
+                            m_vidStaticFrameDropped++;
+                            encfrm = nullptr;
+                            continue;
                         }
-                        av_frame_copy_props(hwfrm.get(), encfrm.get());
-                        encfrm = hwfrm;
+                        // resend the previous encoder input, which is already converted and uploaded
+                        encfrm = CloneSelfFreeAVFramePtr(m_vidLastEncfrm.get());
+                        encfrm->pts = pts;
+                    }
+                    else if (encfrm)
+                    {
+                        encfrm = PrepareVideoEncodeFrame(encfrm);
+                        m_vidLastEncfrm = encfrm;
+                        m_vidLastHash = hTask->hash;
+                        m_vidStaticTailPts = AV_NOPTS_VALUE;
                     }
                 }
-                else if (m_vidinpEof)
+                else if (m_quit)
+                {
+                    break;
+                }
+                else if (m_vidStaticTailPts != AV_NOPTS_VALUE && m_vidLastEncfrm)
+                {
+                    // the input ends with dropped static frames, encode the last one to keep the stream duration
+                    encfrm = CloneSelfFreeAVFramePtr(m_vidLastEncfrm.get());
+                    encfrm->pts = m_vidStaticTailPts;
+                    m_vidStaticTailPts = AV_NOPTS_VALUE;
+                }
+                else if (m_imgseqParallel)
+                {
+                    // the image encoders finish the queued frames, then the last one reports EOF
+                    m_imgseqTaskQ.Close();
+                    break;
+                }
+                else
                 {
+                    // input queue is closed and drained, send EOF to the encoder
                     {
-                        lock_guard<mutex> lk(m_videncLock);
-                        avcodec_send_frame(m_videncCtx, NULL);
+                        unique_lock<mutex> lk(m_videncLock);
+                        fferr = avcodec_send_frame(m_videncCtx, NULL);
+                        while (fferr == AVERROR(EAGAIN) && !m_quit)
+                        {
+                            m_videncFull = true;
+                            NotifyMuxer();
+                            m_videncCv.wait(lk, [this] { return !m_videncFull || m_quit; });
+                            fferr = avcodec_send_frame(m_videncCtx, NULL);
+                        }
                         m_vidNullFrameSent = true;
                         // m_logger->Log(DEBUG) << "--> SEND NULL video frame!! fferr=" << fferr << endl;
                     }
+                    NotifyMuxer();
                     if (fferr == 0)
                     {
                         m_logger->Log(DEBUG) << "Sent encode video EOF." << endl;
-                        break;
                     }
                     else if (fferr != AVERROR(EAGAIN))
                     {
                         ostringstream oss; oss << "Video encoder ERROR! avcodec_send_frame(EOF) returns " << fferr << ".";
-                        m_errMsg = oss.str();
-                        m_logger->Log(Error) << m_errMsg << endl;
-                        m_encErr = true;
-                        break;
+                        SetEncodingError(oss.str());
                     }
+                    break;
                 }
             }
 
+            if (encfrm && m_imgseqParallel)
+            {
+                // number the images in the input order, the workers may finish them in any order
+                _ImageSequenceTask task{encfrm, m_imgseqNextNumber++};
+                if (!m_imgseqTaskQ.Push(task))
+                    break;
+                encfrm = nullptr;
+                continue;
+            }
+
             if (encfrm)
             {
                 {
-                    lock_guard<mutex> lk(m_videncLock);
+                    // only the time inside the encoder api counts as busy, not the lock or the wait for the muxing thread
+                    unique_lock<mutex> lk(m_videncLock);
+                    auto t0 = chrono::steady_clock::now();
                     fferr = avcodec_send_frame(m_videncCtx, encfrm.get());
+                    m_videncBusyUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
                     // m_logger->Log(DEBUG) << "--> Encode video frame, mts=" << av_rescale_q(encfrm->pts, m_videncCtx->time_base, MILLISEC_TIMEBASE) << ", fferr=" << fferr << endl;
+                    if (fferr == AVERROR(EAGAIN))
+                    {
+                        // encoder output is full, wait for the muxing thread to receive some packets
+                        m_videncFull = true;
+                        NotifyMuxer();
+                        m_videncCv.wait(lk, [this] { return !m_videncFull || m_quit; });
+                        continue;
+                    }
                 }
                 if (fferr == 0)
                 {
@@ -1178,28 +2858,123 @@ private:
                     //     << MillisecToString(av_rescale_q(encfrm->pts, m_videncCtx->time_base, MILLISEC_TIMEBASE))
                     //     << "(" << encfrm->pts << ")." << endl;
                     encfrm = nullptr;
-                    idleLoop = false;
+                    NotifyMuxer();
                 }
                 else
                 {
-                    if (fferr != AVERROR(EAGAIN))
-                    {
-                        ostringstream oss; oss << "Video encoder ERROR! avcodec_send_frame() returns " << fferr << ".";
-                        m_errMsg = oss.str();
-                        m_logger->Log(Error) << m_errMsg << endl;
-                        m_encErr = true;
-                        break;
-                    }
+                    ostringstream oss; oss << "Video encoder ERROR! avcodec_send_frame() returns " << fferr << ".";
+                    SetEncodingError(oss.str());
+                    break;
                 }
             }
-
-            if (idleLoop)
-                this_thread::sleep_for(chrono::milliseconds(2));
         }
 
         m_logger->Log(DEBUG) << "Leave VideoEncodingThreadProc()." << endl;
     }
 
+    // Encode whole images with an own encoder context and write each one to its numbered file
+    void ImageSequenceEncodingThreadProc(AVCodecContext* pEncCtx)
+    {
+        m_logger->Log(DEBUG) << "Enter ImageSequenceEncodingThreadProc()..." << endl;
+
+        AVPacket* pAvpkt = av_packet_alloc();
+        if (!pAvpkt)
+            SetEncodingError("FAILED to allocate AVPacket by 'av_packet_alloc'!");
+        vector<char> fileName(m_imgseqPattern.size()+32);
+        _ImageSequenceTask task;
+        while (!m_quit && pAvpkt && m_imgseqTaskQ.Pop(task))
+        {
+            int fferr = avcodec_send_frame(pEncCtx, task.encfrm.get());
+            if (fferr == 0)
+                fferr = avcodec_receive_packet(pEncCtx, pAvpkt);
+            task.encfrm = nullptr;
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "Image encoder ERROR! Encoding image #" << task.number << " FAILED with return code " << fferr << ".";
+                SetEncodingError(oss.str());
+                break;
+            }
+            if (av_get_frame_filename2(fileName.data(), (int)fileName.size(), m_imgseqPattern.c_str(), task.number, 0) < 0)
+            {
+                av_packet_unref(pAvpkt);
+                ostringstream oss; oss << "FAILED to make file name for image #" << task.number << " from pattern '" << m_imgseqPattern << "'!";
+                SetEncodingError(oss.str());
+                break;
+            }
+            const int fd = OpenImageFile(fileName.data());
+            const bool written = fd >= 0 && WriteImageFile(fd, pAvpkt->data, pAvpkt->size);
+            const int errnum = errno;
+            av_packet_unref(pAvpkt);
+            if (!written)
+            {
+                if (fd >= 0)
+                    CloseImageFile(fd, false);
+                ostringstream oss; oss << "FAILED to write image file '" << fileName.data() << "'! errno=" << errnum << "(" << strerror(errnum) << ").";
+                SetEncodingError(oss.str());
+                break;
+            }
+            if (m_imgseqOpts.syncFiles)
+            {
+                if (!m_imgseqSyncQ.Push(fd))
+                {
+                    CloseImageFile(fd, false);
+                    break;
+                }
+            }
+            else if (!CloseImageFile(fd, false))
+            {
+                ostringstream oss; oss << "FAILED to close image file '" << fileName.data() << "'! errno=" << errno << "(" << strerror(errno) << ").";
+                SetEncodingError(oss.str());
+                break;
+            }
+            lock_guard<mutex> lk(m_imgseqLock);
+            m_imgseqFileCount++;
+        }
+        if (pAvpkt)
+            av_packet_free(&pAvpkt);
+
+        bool isLastWorker;
+        {
+            lock_guard<mutex> lk(m_imgseqLock);
+            isLastWorker = --m_imgseqActiveWorkers == 0;
+        }
+        if (isLastWorker)
+        {
+            if (m_imgseqOpts.syncFiles)
+                m_imgseqSyncQ.Close();
+            else
+                SetVideoEncoderEof();
+            NotifyMuxer();
+        }
+        m_logger->Log(DEBUG) << "Leave ImageSequenceEncodingThreadProc()." << endl;
+    }
+
+    // Flush the written images to the storage while the following ones are being encoded
+    void ImageSequenceSyncThreadProc()
+    {
+        m_logger->Log(DEBUG) << "Enter ImageSequenceSyncThreadProc()..." << endl;
+
+        int fd;
+        while (m_imgseqSyncQ.Pop(fd))
+        {
+            auto t0 = chrono::steady_clock::now();
+            const bool success = CloseImageFile(fd, true);
+            const int errnum = errno;
+            {
+                lock_guard<mutex> lk(m_imgseqLock);
+                m_imgseqSyncUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
+            }
+            if (!success && !m_encErr)
+            {
+                ostringstream oss; oss << "FAILED to flush image file to the storage! errno=" << errnum << "(" << strerror(errnum) << ").";
+                SetEncodingError(oss.str());
+            }
+        }
+        SetVideoEncoderEof();
+        NotifyMuxer();
+        m_logger->Log(DEBUG) << "Leave ImageSequenceSyncThreadProc()." << endl;
+    }
+
     void AudioEncodingThreadProc()
     {
         m_logger->Log(DEBUG) << "Enter AudioEncodingThreadProc()..." << endl;
@@ -1208,48 +2983,53 @@ private:
         m_audNullFrameSent = false;
         while (!m_quit)
         {
-            bool idleLoop = true;
             int fferr;
 
-            if (!encfrm)
+            if (!encfrm && !m_audfrmQ.Pop(encfrm))
             {
-                if (!m_audfrmQ.empty())
-                {
-                    lock_guard<mutex> lk(m_audfrmQLock);
-                    encfrm = m_audfrmQ.front();
-                    m_audfrmQ.pop_front();
-                }
-                else if (m_audinpEof)
+                if (m_quit)
+                    break;
+                // input queue is closed and drained, send EOF to the encoder
                 {
+                    unique_lock<mutex> lk(m_audencLock);
+                    fferr = avcodec_send_frame(m_audencCtx, NULL);
+                    while (fferr == AVERROR(EAGAIN) && !m_quit)
                     {
-                        lock_guard<mutex> lk(m_audencLock);
+                        m_audencFull = true;
+                        NotifyMuxer();
+                        m_audencCv.wait(lk, [this] { return !m_audencFull || m_quit; });
                         fferr = avcodec_send_frame(m_audencCtx, NULL);
-                        m_audNullFrameSent = true;
-                        // m_logger->Log(DEBUG) << "================> SEND NULL audio frame!! fferr=" << fferr << endl;
-                    }
-                    if (fferr == 0)
-                    {
-                        m_logger->Log(DEBUG) << "Sent encode audio EOF." << endl;
-                        break;
-                    }
-                    else if (fferr != AVERROR(EAGAIN))
-                    {
-                        ostringstream oss; oss << "Audio encoder ERROR! avcodec_send_frame(EOF) returns " << fferr << ".";
-                        m_errMsg = oss.str();
-                        m_logger->Log(Error) << m_errMsg << endl;
-                        m_encErr = true;
-                        break;
                     }
+                    m_audNullFrameSent = true;
+                    // m_logger->Log(DEBUG) << "================> SEND NULL audio frame!! fferr=" << fferr << endl;
                 }
+                NotifyMuxer();
+                if (fferr == 0)
+                {
+                    m_logger->Log(DEBUG) << "Sent encode audio EOF." << endl;
+                }
+                else if (fferr != AVERROR(EAGAIN))
+                {
+                    ostringstream oss; oss << "Audio encoder ERROR! avcodec_send_frame(EOF) returns " << fferr << ".";
+                    SetEncodingError(oss.str());
+                }
+                break;
             }
 
             if (encfrm)
             {
-                int fferr;
                 {
-                    lock_guard<mutex> lk(m_audencLock);
+                    unique_lock<mutex> lk(m_audencLock);
                     fferr = avcodec_send_frame(m_audencCtx, encfrm.get());
                     // m_logger->Log(DEBUG) << "================> Encode audio frame, mts=" << av_rescale_q(encfrm->pts, m_audencCtx->time_base, MILLISEC_TIMEBASE) << ", fferr=" << fferr << endl;
+                    if (fferr == AVERROR(EAGAIN))
+                    {
+                        // encoder output is full, wait for the muxing thread to receive some packets
+                        m_audencFull = true;
+                        NotifyMuxer();
+                        m_audencCv.wait(lk, [this] { return !m_audencFull || m_quit; });
+                        continue;
+                    }
                 }
                 if (fferr == 0)
                 {
@@ -1257,20 +3037,15 @@ private:
                     //     << MillisecToString(av_rescale_q(encfrm->pts, m_audencCtx->time_base, MILLISEC_TIMEBASE))
                     //     << "(" << encfrm->pts << ")." << endl;
                     encfrm = nullptr;
-                    idleLoop = false;
+                    NotifyMuxer();
                 }
-                else if (fferr != AVERROR(EAGAIN))
+                else
                 {
                     ostringstream oss; oss << "Audio encoder ERROR! avcodec_send_frame() returns " << fferr << ".";
-                    m_errMsg = oss.str();
-                    m_logger->Log(Error) << m_errMsg << endl;
-                    m_encErr = true;
+                    SetEncodingError(oss.str());
                     break;
                 }
             }
-
-            if (idleLoop)
-                this_thread::sleep_for(chrono::milliseconds(2));
         }
 
         m_logger->Log(DEBUG) << "Leave AudioEncodingThreadProc()." << endl;
@@ -1287,16 +3062,31 @@ private:
         {
             bool idleLoop = true;
             int fferr;
+            uint64_t inpSeq;
+            bool vidSplicing;
+            {
+                lock_guard<mutex> lk(m_muxLock);
+                inpSeq = m_muxInputSeq;
+                vidSplicing = m_vidSplicing;
+            }
 
             // bool toRecvVidpkt = !m_videncEof && !avpktLoaded && (vidposMts <= audposMts || m_audencEof);
             // m_logger->Log(DEBUG) << "toRecvVidpkt=" << toRecvVidpkt << ", m_videncEof=" << m_videncEof << ", avpktLoaded=" << avpktLoaded << ", vidposMts=" << vidposMts << ", audposMts=" << audposMts << ", m_audencEof=" << m_audencEof << endl;
-            if (!m_videncEof && !avpktLoaded && (vidposMts <= audposMts || m_audencEof))
+            if (!m_videncEof && !m_imgseqParallel && !avpktLoaded && (vidposMts <= audposMts || m_audencEof))
             {
+                bool nullFrameSent;
                 {
                     lock_guard<mutex> lk(m_videncLock);
+                    auto t0 = chrono::steady_clock::now();
                     fferr = avcodec_receive_packet(m_videncCtx, &avpkt);
+                    m_videncBusyUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
+                    nullFrameSent = m_vidNullFrameSent;
+                    if (fferr != AVERROR(EAGAIN))
+                        m_videncFull = false;
                     // m_logger->Log(DEBUG) << "\t\t\t--> Receive video packet, fferr=" << fferr << endl;
                 }
+                if (fferr != AVERROR(EAGAIN))
+                    m_videncCv.notify_one();
                 if (fferr == 0)
                 {
                     avpkt.stream_index = m_vidStmIdx;
@@ -1308,18 +3098,19 @@ private:
                 }
                 else if (fferr == AVERROR_EOF)
                 {
-                    m_videncEof = true;
+                    SetVideoEncoderEof();
                     idleLoop = false;
                 }
                 else if (fferr != AVERROR(EAGAIN))
                 {
-                    m_logger->Log(Error) << "In muxing thread, video 'avcodec_receive_packet' FAILED with return code " << fferr << "!" << endl;
+                    ostringstream oss; oss << "In muxing thread, video 'avcodec_receive_packet' FAILED with return code " << fferr << "!";
+                    SetEncodingError(oss.str());
                     break;
                 }
-                else if (m_vidNullFrameSent)
+                else if (nullFrameSent)
                 {
                     m_logger->Log(WARN) << "WRONG STATE! Video encoder still returns AVERROR(EAGAIN) after NULL frame is sent! Treat it as AVERROR_EOF received." << endl;
-                    m_videncEof = true;
+                    SetVideoEncoderEof();
                     idleLoop = false;
                 }
             }
@@ -1328,11 +3119,17 @@ private:
             // m_logger->Log(DEBUG) << "toRecvAudpkt=" << toRecvAudpkt << ", m_audencEof=" << m_audencEof << ", avpktLoaded=" << avpktLoaded << ", vidposMts=" << vidposMts << ", audposMts=" << audposMts << ", m_videncEof=" << m_videncEof << endl;
             if (!m_audencEof && !avpktLoaded && (audposMts <= vidposMts || m_videncEof))
             {
+                bool nullFrameSent;
                 {
                     lock_guard<mutex> lk(m_audencLock);
                     fferr = avcodec_receive_packet(m_audencCtx, &avpkt);
+                    nullFrameSent = m_audNullFrameSent;
+                    if (fferr != AVERROR(EAGAIN))
+                        m_audencFull = false;
                     // m_logger->Log(DEBUG) << "\t\t\t================> Receive audio packet, fferr=" << fferr << endl;
                 }
+                if (fferr != AVERROR(EAGAIN))
+                    m_audencCv.notify_one();
                 if (fferr == 0)
                 {
                     avpkt.stream_index = m_audStmIdx;
@@ -1349,10 +3146,11 @@ private:
                 }
                 else if (fferr != AVERROR(EAGAIN))
                 {
-                    m_logger->Log(Error) << "In muxing thread, audio 'avcodec_receive_packet' FAILED with return code " << fferr << "!" << endl;
+                    ostringstream oss; oss << "In muxing thread, audio 'avcodec_receive_packet' FAILED with return code " << fferr << "!";
+                    SetEncodingError(oss.str());
                     break;
                 }
-                else if (m_audNullFrameSent)
+                else if (nullFrameSent)
                 {
                     m_logger->Log(WARN) << "WRONG STATE! Audio encoder still returns AVERROR(EAGAIN) after NULL frame is sent! Treat it as AVERROR_EOF received." << endl;
                     m_audencEof = true;
@@ -1362,7 +3160,12 @@ private:
 
             if (avpktLoaded)
             {
-                fferr = av_interleaved_write_frame(m_avfmtCtx, &avpkt);
+                {
+                    lock_guard<mutex> lk(m_muxWriteLock);
+                    if (avpkt.stream_index == m_vidStmIdx && avpkt.dts != AV_NOPTS_VALUE)
+                        m_vidLastDts = avpkt.dts;
+                    fferr = av_interleaved_write_frame(m_avfmtCtx, &avpkt);
+                }
                 if (fferr == 0)
                 {
                     av_packet_unref(&avpkt);
@@ -1371,23 +3174,33 @@ private:
                 }
                 else
                 {
-                    m_logger->Log(Error) << "'av_interleaved_write_frame' FAILED with return code " << fferr << "!" << endl;
+                    ostringstream oss; oss << "'av_interleaved_write_frame' FAILED with return code " << fferr << "!";
+                    SetEncodingError(oss.str());
                     break;
                 }
             }
-            else if (((!HasVideo() || m_videncEof) && (!HasAudio() || m_audencEof)) || m_encErr)
+            else if (((!HasVideo() || (m_videncEof && !vidSplicing)) && (!HasAudio() || m_audencEof)) || m_encErr)
             {
                 break;
             }
 
             if (idleLoop)
-                this_thread::sleep_for(chrono::milliseconds(1));
+            {
+                // wait for new input to the encoders. Use a timeout as a guard against encoders that produce packets asynchronously.
+                unique_lock<mutex> lk(m_muxLock);
+                auto t0 = chrono::steady_clock::now();
+                m_muxCv.wait_for(lk, chrono::milliseconds(THREAD_IDLE_TIME), [this, inpSeq] { return m_muxInputSeq != inpSeq || m_quit; });
+                m_muxIdleWaitUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
+            }
         }
 
-        m_muxEof = true;
+        {
+            lock_guard<mutex> lk(m_muxLock);
+            m_muxEof = true;
+        }
+        m_muxEofCv.notify_all();
         m_logger->Log(DEBUG) << "Leave MuxingThreadProc()." << endl;
     }
-
 private:
     string m_errMsg;
     ALogger* m_logger;
@@ -1398,6 +3211,9 @@ private:
     bool m_started{false};
 
     AVFormatContext* m_avfmtCtx{nullptr};
+    OutputIoOptions m_ioOpts;
+    AsyncFileWriter m_asyncWriter;
+    static constexpr int AVIO_BUFFER_SIZE = 64*1024;
     int m_vidStmIdx{-1};
     int m_audStmIdx{-1};
     AVCodecPtr m_videnc{nullptr};
@@ -1419,34 +3235,117 @@ private:
     SelfFreeAVFramePtr m_audencfrm;
     uint32_t m_audencfrmSmpOffset{0};
     SwrContext* m_swrCtx{nullptr};
-
-    ImMatToAVFrameConverter m_imgCvter;
+    AVSampleFormat m_swrInpSmpfmt{AV_SAMPLE_FMT_NONE};
+    uint32_t m_audencChannels{0};
+    uint32_t m_audencPlaneSize{0};
+    AVBufferPool* m_audfrmPool{nullptr};
+    vector<const uint8_t*> m_audInpPlanePtrs;
+    vector<uint8_t*> m_audEncPlanePtrs;
 
     double m_dataQCacheDur{5};
+    // video conversion threads
+    struct _VideoEncodeTask
+    {
+        VideoFrame::Holder hVfrm;
+        SelfFreeAVFramePtr encfrm;
+        bool converted{false};
+        bool repeated{false};       // hinted by 'EncodeRepeatedVideoFrame()', or found identical to the previous input before conversion
+        uint64_t hash{0};           // content hash for static frame detection, 0 means unknown
+        bool hashed{false};         // 'hash' is ready, guarded by 'm_vidCvtLock'
+        shared_ptr<_VideoEncodeTask> prevTask;  // the previous input, released once the hashes are compared
+        int64_t pts{AV_NOPTS_VALUE};
+    };
+    using VideoEncodeTaskHolder = shared_ptr<_VideoEncodeTask>;
+    struct _VideoConvertWorker
+    {
+        thread th;
+        ImMatToAVFrameConverter imgCvter;
+    };
+    list<_VideoConvertWorker> m_vidCvtWorkers;
+    uint32_t m_vidCvtThreadCount{0};
+    BoundedQueue<VideoEncodeTaskHolder> m_vidCvtTaskQ;
+    mutex m_vidCvtLock;
+    condition_variable m_vidCvtDoneCv;
+    int64_t m_vidCvtWaitUs{0};
+    int64_t m_vidCvtBusyUs{0};
     // video encoding thread
     thread m_videncThread;
-    list<VideoFrame::Holder> m_vfrmQ;
-    uint32_t m_vmatQMaxSize;
-    mutex m_vmatQLock;
+    BoundedQueue<VideoEncodeTaskHolder> m_vfrmQ;
     bool m_vidinpEof{false};
     bool m_vidNullFrameSent{false};
     bool m_videncEof{false};
+    bool m_videncFull{false};
+    condition_variable m_videncCv;
+    VideoThreadingOptions m_vidThreadingOpts;
+    uint32_t m_videncThreadCount{0};
+    string m_videncThreadType;
+    int64_t m_videncBusyUs{0};      // time inside 'avcodec_send_frame' and 'avcodec_receive_packet', guarded by 'm_videncLock'
+    // stage utilization
+    chrono::steady_clock::time_point m_encStartTp;
+    chrono::steady_clock::time_point m_encEndTp;
+    chrono::steady_clock::time_point m_vidInputEofTp;
+    uint32_t m_vidInputFrameCount{0};
     // audio encoding thread
     thread m_audencThread;
-    list<SelfFreeAVFramePtr> m_audfrmQ;
-    uint32_t m_audfrmQMaxSize;
-    mutex m_audfrmQLock;
+    BoundedQueue<SelfFreeAVFramePtr> m_audfrmQ;
     bool m_audinpEof{false};
     bool m_audNullFrameSent{false};
     bool m_audencEof{false};
+    bool m_audencFull{false};
+    condition_variable m_audencCv;
     // muxing thread
     thread m_muxThread;
-    list<AVPacket*> m_vidpktQ;
-    mutex m_vidpktQLock;
-    list<AVPacket*> m_audpktQ;
-    mutex m_audpktQLock;
+    mutex m_muxLock;
+    condition_variable m_muxCv;
+    uint64_t m_muxInputSeq{0};
+    int64_t m_muxIdleWaitUs{0};
     bool m_muxEof{false};
+    condition_variable m_muxEofCv;
     bool m_encErr{false};
+    // smart-render passthrough
+    uint32_t m_videncWidth{0};
+    uint32_t m_videncHeight{0};
+    Ratio m_videncFrameRate;
+    uint64_t m_videncBitRate{0};
+    vector<Option> m_videncExtraOpts;
+    AVPixelFormat m_videncReqPixfmt{AV_PIX_FMT_NONE};
+    bool m_vidSplicing{false};
+    mutex m_muxWriteLock;
+    int64_t m_vidLastDts{AV_NOPTS_VALUE};
+    uint32_t m_vidCopySegCount{0};
+    uint32_t m_vidCopyPktCount{0};
+    // static frame deduplication
+    bool m_vidDedupEnabled{false};
+    bool m_vidIsVfrOutput{false};
+    SelfFreeAVFramePtr m_vidLastEncfrm;
+    uint64_t m_vidLastHash{0};
+    VideoEncodeTaskHolder m_vidLastInputTask;   // guarded by 'm_apiLock'
+    int64_t m_vidStaticTailPts{AV_NOPTS_VALUE};
+    uint32_t m_vidStaticFrameCount{0};
+    uint32_t m_vidStaticFrameDropped{0};
+    // parallel image sequence encoding
+    ImageSequenceOptions m_imgseqOpts;
+    bool m_imgseqParallel{false};
+    string m_imgseqPattern;
+    struct _ImageSequenceTask
+    {
+        SelfFreeAVFramePtr encfrm;
+        int number{0};
+    };
+    struct _ImageSequenceWorker
+    {
+        thread th;
+        AVCodecContext* encCtx{nullptr};
+    };
+    list<_ImageSequenceWorker> m_imgseqWorkers;
+    BoundedQueue<_ImageSequenceTask> m_imgseqTaskQ;
+    BoundedQueue<int> m_imgseqSyncQ;
+    thread m_imgseqSyncThread;
+    int m_imgseqNextNumber{1};
+    mutable mutex m_imgseqLock;
+    uint32_t m_imgseqActiveWorkers{0};
+    uint32_t m_imgseqFileCount{0};
+    int64_t m_imgseqSyncUs{0};
 };
 
 static const auto MEDIA_ENCODER_HOLDER_DELETER = [] (MediaEncoder* p) {
@@ -1533,6 +3432,25 @@ ostream& operator<<(ostream& os, const MediaEncoder::Description& encdesc)
     return os;
 }
 
+ostream& operator<<(ostream& os, const MediaEncoder::Statistics& stats)
+{
+    os << "{ vidInputStall=" << stats.vidInputStallMillisec << "ms(" << stats.vidInputStallCount << " times)"
+        << ", vidInputQueue(peak/avg/max)=" << stats.vidInputQueuePeakSize << "/" << stats.vidInputQueueAvgSize << "/" << stats.vidInputQueueMaxSize
+        << ", audInputStall=" << stats.audInputStallMillisec << "ms(" << stats.audInputStallCount << " times)"
+        << ", audInputQueue(peak/avg/max)=" << stats.audInputQueuePeakSize << "/" << stats.audInputQueueAvgSize << "/" << stats.audInputQueueMaxSize
+        << ", vidConvertWait=" << stats.vidConvertWaitMillisec << "ms(" << stats.vidConverterThreadCount << " threads)"
+        << ", muxIdleWait=" << stats.muxIdleWaitMillisec << "ms"
+        << ", vidPassthrough=" << stats.vidPassthroughPacketCount << " packets(" << stats.vidPassthroughSegmentCount << " segments)"
+        << ", vidStaticFrames=" << stats.vidStaticFrameCount << "(" << stats.vidStaticFrameDropped << " dropped)"
+        << ", ioWait=" << stats.ioWaitMillisec << "ms, ioWrite=" << stats.ioWriteMillisec << "ms(" << stats.ioBytesWritten << " bytes)"
+        << ", vidImageSeq=" << stats.vidImageSeqFileCount << " files(" << stats.vidImageSeqEncoderCount << " encoders, sync "
+        << stats.vidImageSeqSyncMillisec << "ms)"
+        << ", vidEncoderThreads=" << stats.vidEncoderThreadCount << "(" << stats.vidEncoderThreadType << ")"
+        << ", elapsed=" << stats.elapsedMillisec << "ms, utilization(render/convert/encode/mux)=" << stats.renderUtilization << "/"
+        << stats.convertUtilization << "/" << stats.encodeUtilization << "/" << stats.muxUtilization << " }";
+    return os;
+}
+
 static bool ConvertAVOptionToOptionDescription(AVCodecPtr cdcptr, const AVOption* opt, MediaEncoder::Option::Description& optdesc)
 {
     ALogger* logger = MediaEncoder::GetLogger();
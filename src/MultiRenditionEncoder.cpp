@@ -0,0 +1,556 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <list>
+#include <algorithm>
+#include "MultiRenditionEncoder.h"
+#include "FFUtils.h"
+#include "BoundedQueue.h"
+#include "ThreadUtils.h"
+extern "C"
+{
+    #include "libavutil/pixdesc.h"
+    #include "libswscale/swscale.h"
+}
+
+using namespace std;
+using namespace Logger;
+
+namespace MediaCore
+{
+// frames queued ahead of each rendition worker
+static const size_t RENDITION_QUEUE_SIZE = 4;
+
+class MultiRenditionEncoder_Impl : public MultiRenditionEncoder
+{
+public:
+    MultiRenditionEncoder_Impl()
+    {
+        m_logger = MultiRenditionEncoder::GetLogger();
+    }
+
+    MultiRenditionEncoder_Impl(const MultiRenditionEncoder_Impl&) = delete;
+    MultiRenditionEncoder_Impl(MultiRenditionEncoder_Impl&&) = delete;
+    MultiRenditionEncoder_Impl& operator=(const MultiRenditionEncoder_Impl&) = delete;
+
+    virtual ~MultiRenditionEncoder_Impl() {}
+
+    bool Open(const vector<Rendition>& renditions, const Ratio& frameRate, uint32_t audioChannels, uint32_t audioSampleRate) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (m_opened)
+            Close();
+        if (renditions.empty())
+        {
+            m_errMsg = "Rendition list is EMPTY!";
+            return false;
+        }
+        if (!Ratio::IsValid(frameRate))
+        {
+            ostringstream oss; oss << "INVALID argument 'frameRate' " << frameRate << "!";
+            m_errMsg = oss.str();
+            return false;
+        }
+
+        if (!Open_Internal(renditions, frameRate, audioChannels, audioSampleRate))
+        {
+            Close();
+            return false;
+        }
+        m_opened = true;
+        return true;
+    }
+
+    bool Close() override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        m_quit = true;
+        AbortFanout();
+        JoinFanoutThreads();
+        m_vmatQ.Reset();
+        for (auto& rend : m_renditions)
+        {
+            if (rend.hEncoder)
+                rend.hEncoder->Close();
+            if (rend.swsCtx)
+            {
+                sws_freeContext(rend.swsCtx);
+                rend.swsCtx = nullptr;
+            }
+        }
+        m_renditions.clear();
+        m_cascadeOrder.clear();
+        m_hasVideo = m_hasAudio = false;
+        m_fanoutErr = false;
+        m_fanoutErrMsg.clear();
+        m_started = false;
+        m_opened = false;
+        m_quit = false;
+        return true;
+    }
+
+    bool Start() override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (!m_opened)
+        {
+            m_errMsg = "This MultiRenditionEncoder has NOT opened yet!";
+            return false;
+        }
+        if (m_started)
+        {
+            m_errMsg = "This MultiRenditionEncoder already started!";
+            return false;
+        }
+        for (auto& rend : m_renditions)
+        {
+            if (!rend.hEncoder->Start())
+            {
+                ostringstream oss; oss << "FAILED to start encoder for rendition '" << rend.settings.url << "'! Error is '" << rend.hEncoder->GetError() << "'.";
+                m_errMsg = oss.str();
+                return false;
+            }
+        }
+        m_quit = false;
+        if (m_hasVideo)
+        {
+            m_fanoutThread = thread(&MultiRenditionEncoder_Impl::VideoFanoutThreadProc, this);
+            SysUtils::SetThreadName(m_fanoutThread, "MrencFanout");
+            int workerIdx = 0;
+            for (auto pRend : m_cascadeOrder)
+            {
+                pRend->worker = thread(&MultiRenditionEncoder_Impl::RenditionThreadProc, this, pRend);
+                ostringstream oss; oss << "MrencRend" << workerIdx++;
+                SysUtils::SetThreadName(pRend->worker, oss.str());
+            }
+        }
+        m_started = true;
+        return true;
+    }
+
+    bool FinishEncoding() override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (!m_started)
+        {
+            m_errMsg = "This MultiRenditionEncoder has NOT started yet!";
+            return false;
+        }
+        m_vmatQ.Close();
+        JoinFanoutThreads();
+        bool success = true;
+        if (m_fanoutErr)
+        {
+            m_errMsg = GetFanoutError();
+            success = false;
+        }
+        for (auto& rend : m_renditions)
+        {
+            if (rend.hasAudio)
+                rend.hEncoder->EncodeAudioSamples(nullptr, 0);
+            if (!rend.hEncoder->FinishEncoding())
+            {
+                ostringstream oss; oss << "FAILED to finish encoding for rendition '" << rend.settings.url << "'! Error is '" << rend.hEncoder->GetError() << "'.";
+                m_errMsg = oss.str();
+                m_logger->Log(Error) << m_errMsg << endl;
+                success = false;
+            }
+        }
+        return success;
+    }
+
+    bool EncodeVideoFrame(ImGui::ImMat& vmat, bool wait) override
+    {
+        if (!m_started)
+        {
+            m_errMsg = "This MultiRenditionEncoder has NOT started yet!";
+            return false;
+        }
+        if (!m_hasVideo)
+        {
+            m_errMsg = "This MultiRenditionEncoder does NOT have video!";
+            return false;
+        }
+        if (m_fanoutErr)
+        {
+            m_errMsg = GetFanoutError();
+            return false;
+        }
+        if (vmat.empty())
+        {
+            m_vmatQ.Close();
+            return true;
+        }
+        if (!m_vmatQ.Push(vmat, wait))
+        {
+            m_errMsg = m_fanoutErr ? GetFanoutError() : string("Queue full!");
+            return false;
+        }
+        return true;
+    }
+
+    bool EncodeAudioSamples(ImGui::ImMat& amat, bool wait) override
+    {
+        if (!m_started)
+        {
+            m_errMsg = "This MultiRenditionEncoder has NOT started yet!";
+            return false;
+        }
+        if (!m_hasAudio)
+        {
+            m_errMsg = "This MultiRenditionEncoder does NOT have audio!";
+            return false;
+        }
+        for (auto& rend : m_renditions)
+        {
+            if (!rend.hasAudio)
+                continue;
+            if (!rend.hEncoder->EncodeAudioSamples(amat, wait))
+            {
+                ostringstream oss; oss << "FAILED to encode audio samples for rendition '" << rend.settings.url << "'! Error is '" << rend.hEncoder->GetError() << "'.";
+                m_errMsg = oss.str();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool IsOpened() const override
+    {
+        return m_opened;
+    }
+
+    uint32_t GetRenditionCount() const override
+    {
+        return (uint32_t)m_renditions.size();
+    }
+
+    MediaEncoder::Holder GetRenditionEncoder(uint32_t index) const override
+    {
+        if (index >= m_renditions.size())
+            return nullptr;
+        auto iter = m_renditions.begin();
+        advance(iter, index);
+        return iter->hEncoder;
+    }
+
+    string GetError() const override
+    {
+        return m_errMsg;
+    }
+
+private:
+    struct _FanoutFrame
+    {
+        ImGui::ImMat vmat;
+        SelfFreeAVFramePtr srcfrm;
+        int64_t pos{0};
+    };
+
+    struct _Rendition
+    {
+        Rendition settings;
+        MediaEncoder::Holder hEncoder;
+        bool hasVideo{false};
+        bool hasAudio{false};
+        AVPixelFormat pixfmt{AV_PIX_FMT_NONE};
+        // the rendition this one is downscaled from, nullptr means converting from the input ImMat
+        _Rendition* source{nullptr};
+        // the renditions downscaled from this one, they get each converted frame of this rendition
+        vector<_Rendition*> dependents;
+        ImMatToAVFrameConverter imgCvter;
+        SwsContext* swsCtx{nullptr};
+        // input of the worker thread, the ImMat for a converted rendition or the source frame for a downscaled one
+        BoundedQueue<_FanoutFrame> inQ;
+        thread worker;
+    };
+
+    bool Open_Internal(const vector<Rendition>& renditions, const Ratio& frameRate, uint32_t audioChannels, uint32_t audioSampleRate)
+    {
+        m_frameRate = frameRate;
+        for (auto& settings : renditions)
+        {
+            m_renditions.emplace_back();
+            auto& rend = m_renditions.back();
+            rend.settings = settings;
+            rend.hEncoder = MediaEncoder::CreateInstance();
+            // input frames are already converted to the encoder's pixel format, one conversion thread is enough
+            rend.hEncoder->SetVideoConverterThreadCount(1);
+            if (!rend.hEncoder->Open(settings.url))
+            {
+                ostringstream oss; oss << "FAILED to open encoder for rendition '" << settings.url << "'! Error is '" << rend.hEncoder->GetError() << "'.";
+                m_errMsg = oss.str();
+                return false;
+            }
+            if (!settings.videoCodec.empty())
+            {
+                string imageFormat = settings.imageFormat;
+                vector<MediaEncoder::Option> extraOpts = settings.videoExtraOpts;
+                if (!rend.hEncoder->ConfigureVideoStream(settings.videoCodec, imageFormat, settings.width, settings.height,
+                        frameRate, settings.videoBitRate, &extraOpts))
+                {
+                    ostringstream oss; oss << "FAILED to configure video stream for rendition '" << settings.url << "'! Error is '" << rend.hEncoder->GetError() << "'.";
+                    m_errMsg = oss.str();
+                    return false;
+                }
+                rend.pixfmt = av_get_pix_fmt(imageFormat.c_str());
+                rend.imgCvter.SetUseVulkanConverter(true);
+                if (!rend.imgCvter.SetOutSize(settings.width, settings.height) || !rend.imgCvter.SetOutPixelFormat(rend.pixfmt))
+                {
+                    ostringstream oss; oss << "FAILED to setup 'ImMatToAVFrameConverter' for rendition '" << settings.url << "'! Error is '" << rend.imgCvter.GetError() << "'.";
+                    m_errMsg = oss.str();
+                    return false;
+                }
+                rend.hasVideo = true;
+                m_hasVideo = true;
+            }
+            if (!settings.audioCodec.empty() && audioChannels > 0 && audioSampleRate > 0)
+            {
+                string sampleFormat;
+                if (!rend.hEncoder->ConfigureAudioStream(settings.audioCodec, sampleFormat, audioChannels, audioSampleRate, settings.audioBitRate))
+                {
+                    ostringstream oss; oss << "FAILED to configure audio stream for rendition '" << settings.url << "'! Error is '" << rend.hEncoder->GetError() << "'.";
+                    m_errMsg = oss.str();
+                    return false;
+                }
+                rend.hasAudio = true;
+                m_hasAudio = true;
+            }
+        }
+
+        // build the cascading order, larger renditions are processed first
+        for (auto& rend : m_renditions)
+        {
+            if (rend.hasVideo)
+                m_cascadeOrder.push_back(&rend);
+        }
+        sort(m_cascadeOrder.begin(), m_cascadeOrder.end(), [] (const _Rendition* a, const _Rendition* b) {
+            return (uint64_t)a->settings.width*a->settings.height > (uint64_t)b->settings.width*b->settings.height;
+        });
+        for (auto iter = m_cascadeOrder.begin(); iter != m_cascadeOrder.end(); iter++)
+        {
+            auto pRend = *iter;
+            // downscale from the smallest processed rendition with the same pixel format, which is the cheapest source
+            for (auto srcIter = iter; srcIter != m_cascadeOrder.begin(); )
+            {
+                auto pSrc = *(--srcIter);
+                if (pSrc->pixfmt == pRend->pixfmt && pSrc->settings.width >= pRend->settings.width && pSrc->settings.height >= pRend->settings.height)
+                {
+                    pRend->source = pSrc;
+                    pSrc->dependents.push_back(pRend);
+                    break;
+                }
+            }
+            m_logger->Log(DEBUG) << "Rendition '" << pRend->settings.url << "' (" << pRend->settings.width << "x" << pRend->settings.height << ", "
+                    << av_get_pix_fmt_name(pRend->pixfmt) << ") is " << (pRend->source ? "downscaled from '"+pRend->source->settings.url+"'." : "converted from input image.") << endl;
+        }
+
+        m_vmatQ.SetMaxSize((size_t)((double)frameRate.num/frameRate.den));
+        for (auto pRend : m_cascadeOrder)
+            pRend->inQ.SetMaxSize(RENDITION_QUEUE_SIZE);
+        return true;
+    }
+
+    SelfFreeAVFramePtr DownscaleFrame(_Rendition& rend, const AVFrame* srcfrm, string& errMsg)
+    {
+        rend.swsCtx = sws_getCachedContext(rend.swsCtx, srcfrm->width, srcfrm->height, (AVPixelFormat)srcfrm->format,
+                rend.settings.width, rend.settings.height, rend.pixfmt, SWS_AREA, nullptr, nullptr, nullptr);
+        if (!rend.swsCtx)
+        {
+            errMsg = "FAILED to create SwsContext by 'sws_getCachedContext()'!";
+            return nullptr;
+        }
+        SelfFreeAVFramePtr dstfrm = AllocSelfFreeAVFramePtr();
+        dstfrm->format = rend.pixfmt;
+        dstfrm->width = rend.settings.width;
+        dstfrm->height = rend.settings.height;
+        int fferr = av_frame_get_buffer(dstfrm.get(), 0);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FF api 'av_frame_get_buffer' returns error! fferr=" << fferr << ".";
+            errMsg = oss.str();
+            return nullptr;
+        }
+        sws_scale(rend.swsCtx, srcfrm->data, srcfrm->linesize, 0, srcfrm->height, dstfrm->data, dstfrm->linesize);
+        av_frame_copy_props(dstfrm.get(), srcfrm);
+        return dstfrm;
+    }
+
+    // Dispatch the input images to the renditions converted from them, each rendition runs its own worker
+    void VideoFanoutThreadProc()
+    {
+        m_logger->Log(DEBUG) << "Enter VideoFanoutThreadProc()..." << endl;
+
+        ImGui::ImMat vmat;
+        while (!m_quit && m_vmatQ.Pop(vmat))
+        {
+            const int64_t pos = (int64_t)(vmat.time_stamp*1000);
+            for (auto pRend : m_cascadeOrder)
+            {
+                if (!pRend->source && !pRend->inQ.Push({vmat, nullptr, pos}, true))
+                    break;
+            }
+            if (m_fanoutErr)
+                break;
+        }
+
+        // the downscaled renditions are closed by their sources
+        for (auto pRend : m_cascadeOrder)
+        {
+            if (!pRend->source)
+                pRend->inQ.Close();
+        }
+        m_logger->Log(DEBUG) << "Leave VideoFanoutThreadProc()." << endl;
+    }
+
+    void RenditionThreadProc(_Rendition* pRend)
+    {
+        m_logger->Log(DEBUG) << "Enter RenditionThreadProc() for '" << pRend->settings.url << "'..." << endl;
+
+        const AVRational encTimebase = { m_frameRate.den, m_frameRate.num };
+        _FanoutFrame inFrame;
+        while (!m_quit && pRend->inQ.Pop(inFrame))
+        {
+            const int64_t pos = inFrame.pos;
+            SelfFreeAVFramePtr encfrm;
+            string errMsg;
+            if (pRend->source)
+            {
+                encfrm = DownscaleFrame(*pRend, inFrame.srcfrm.get(), errMsg);
+            }
+            else
+            {
+                const int64_t pts = av_rescale_q(pos, MILLISEC_TIMEBASE, encTimebase);
+                encfrm = AllocSelfFreeAVFramePtr();
+                if (!pRend->imgCvter.ConvertImage(inFrame.vmat, encfrm.get(), pts))
+                {
+                    ostringstream oss; oss << "FAILED to convert input image for rendition '" << pRend->settings.url << "'! Error is '" << pRend->imgCvter.GetError() << "'.";
+                    errMsg = oss.str();
+                    encfrm = nullptr;
+                }
+            }
+            inFrame = _FanoutFrame();
+            if (!encfrm)
+            {
+                SetFanoutError(errMsg);
+                break;
+            }
+            // hand the frame to the downscaled renditions before encoding it, so they work in parallel with this encoder.
+            // Each of them gets its own AVFrame referencing the same buffers.
+            bool dispatched = true;
+            for (auto pDep : pRend->dependents)
+            {
+                if (!pDep->inQ.Push({ImGui::ImMat(), CloneSelfFreeAVFramePtr(encfrm.get()), pos}, true))
+                {
+                    dispatched = false;
+                    break;
+                }
+            }
+            if (!dispatched)
+                break;
+            auto hVfrm = FFUtils::CreateVideoFrameFromAVFrame(encfrm, pos);
+            if (!pRend->hEncoder->EncodeVideoFrame(hVfrm, true))
+            {
+                ostringstream oss; oss << "FAILED to encode video frame for rendition '" << pRend->settings.url << "'! Error is '" << pRend->hEncoder->GetError() << "'.";
+                SetFanoutError(oss.str());
+                break;
+            }
+        }
+
+        for (auto pDep : pRend->dependents)
+            pDep->inQ.Close();
+        if (!m_quit && !m_fanoutErr)
+            pRend->hEncoder->EncodeVideoFrame(VideoFrame::Holder(), true);
+        m_logger->Log(DEBUG) << "Leave RenditionThreadProc() for '" << pRend->settings.url << "'." << endl;
+    }
+
+    void SetFanoutError(const string& errMsg)
+    {
+        {
+            lock_guard<mutex> lk(m_fanoutErrLock);
+            if (m_fanoutErrMsg.empty())
+                m_fanoutErrMsg = errMsg;
+        }
+        m_logger->Log(Error) << errMsg << endl;
+        m_fanoutErr = true;
+        AbortFanout();
+    }
+
+    string GetFanoutError()
+    {
+        lock_guard<mutex> lk(m_fanoutErrLock);
+        return m_fanoutErrMsg;
+    }
+
+    void AbortFanout()
+    {
+        m_vmatQ.Abort();
+        for (auto pRend : m_cascadeOrder)
+            pRend->inQ.Abort();
+    }
+
+    void JoinFanoutThreads()
+    {
+        if (m_fanoutThread.joinable())
+            m_fanoutThread.join();
+        for (auto pRend : m_cascadeOrder)
+        {
+            if (pRend->worker.joinable())
+                pRend->worker.join();
+            pRend->inQ.Reset();
+        }
+    }
+
+private:
+    ALogger* m_logger;
+    string m_errMsg;
+    recursive_mutex m_apiLock;
+    bool m_opened{false};
+    bool m_started{false};
+    atomic<bool> m_quit{false};
+    bool m_hasVideo{false};
+    bool m_hasAudio{false};
+    Ratio m_frameRate;
+    list<_Rendition> m_renditions;
+    vector<_Rendition*> m_cascadeOrder;
+    BoundedQueue<ImGui::ImMat> m_vmatQ;
+    thread m_fanoutThread;
+    atomic<bool> m_fanoutErr{false};
+    mutex m_fanoutErrLock;
+    string m_fanoutErrMsg;
+};
+
+static const auto MULTI_RENDITION_ENCODER_HOLDER_DELETER = [] (MultiRenditionEncoder* p) {
+    MultiRenditionEncoder_Impl* ptr = dynamic_cast<MultiRenditionEncoder_Impl*>(p);
+    ptr->Close();
+    delete ptr;
+};
+
+MultiRenditionEncoder::Holder MultiRenditionEncoder::CreateInstance()
+{
+    return MultiRenditionEncoder::Holder(new MultiRenditionEncoder_Impl(), MULTI_RENDITION_ENCODER_HOLDER_DELETER);
+}
+
+ALogger* MultiRenditionEncoder::GetLogger()
+{
+    return Logger::GetLogger("MREncoder");
+}
+}
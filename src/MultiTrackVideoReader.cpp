@@ -778,6 +778,7 @@ public:
         newSubTrack->SetOffsetCompensationV((int32_t)((double)outHeight*0.43));
         newSubTrack->SetOffsetCompensationV(0.43f);
         newSubTrack->EnableFullSizeOutput(false);
+        newSubTrack->EnablePreRender(true, m_hSettings->VideoOutFrameRate());
         lock_guard<mutex> lk(m_subtrkLock);
         if (insertAfterId == -1)
         {
@@ -815,6 +816,7 @@ public:
         newSubTrack->SetOffsetCompensationV((int32_t)((double)outHeight*0.43));
         newSubTrack->SetOffsetCompensationV(0.43f);
         newSubTrack->EnableFullSizeOutput(false);
+        newSubTrack->EnablePreRender(true, m_hSettings->VideoOutFrameRate());
         lock_guard<mutex> lk(m_subtrkLock);
         if (insertAfterId == -1)
         {
@@ -1625,6 +1627,7 @@ private:
             if (!hSubTrack->IsVisible())
                 continue;
 
+            hSubTrack->UpdatePreRenderPosition(pos, m_readForward);
             auto hSubClip = hSubTrack->GetClipByTime(pos);
             if (hSubClip)
             {
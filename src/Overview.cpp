@@ -19,7 +19,10 @@
 #include <thread>
 #include <algorithm>
 #include <list>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <iomanip>
 #include "Overview.h"
 #include "MediaReader.h"
 #include "HwaccelManager.h"
@@ -47,6 +50,49 @@ using namespace Logger;
 
 namespace MediaCore
 {
+// The waveform is stored in the preview cache as 16-bit samples scaled to the peak, delta coded between neighbouring
+// aggregated samples and written as zigzag varints, which takes about a quarter of the float size.
+static void AppendWaveformChannel(vector<uint8_t>& data, const vector<float>& pcm, float scale)
+{
+    int32_t prevQ = 0;
+    for (auto v : pcm)
+    {
+        const int32_t q = (int32_t)lrintf(max(-1.f, min(v/scale, 1.f))*32767.f);
+        const int32_t delta = q-prevQ;
+        uint32_t zz = ((uint32_t)delta<<1)^(uint32_t)(delta>>31);
+        while (zz >= 0x80)
+        {
+            data.push_back((uint8_t)(zz|0x80));
+            zz >>= 7;
+        }
+        data.push_back((uint8_t)zz);
+        prevQ = q;
+    }
+}
+
+static bool ReadWaveformChannel(const vector<uint8_t>& data, size_t& offset, vector<float>& pcm, float scale)
+{
+    int32_t prevQ = 0;
+    for (auto& v : pcm)
+    {
+        uint32_t zz = 0;
+        int shift = 0;
+        while (true)
+        {
+            if (offset >= data.size() || shift > 28)
+                return false;
+            const uint8_t b = data[offset++];
+            zz |= (uint32_t)(b&0x7f)<<shift;
+            if ((b&0x80) == 0)
+                break;
+            shift += 7;
+        }
+        prevQ += (int32_t)(zz>>1)^-(int32_t)(zz&1);
+        v = (float)prevQ/32767.f*scale;
+    }
+    return true;
+}
+
 class Overview_Impl : public Overview
 {
 public:
@@ -80,6 +126,7 @@ public:
             return false;
         }
         m_hParser = hParser;
+        m_mediaCacheKey = m_hPreviewCache && m_hPreviewCache->IsOpened() ? PreviewCache::MakeMediaKey(hParser->GetUrl()) : "";
         m_ssCount = snapshotCount;
         if (m_vidFrmCnt > 0 && m_vidFrmCnt < snapshotCount)
             m_ssCount = m_vidFrmCnt;
@@ -108,6 +155,7 @@ public:
             return false;
         }
         m_hParser = hParser;
+        m_mediaCacheKey = m_hPreviewCache && m_hPreviewCache->IsOpened() ? PreviewCache::MakeMediaKey(hParser->GetUrl()) : "";
         m_ssCount = snapshotCount;
         m_ssIntvMts = (double)m_vidDurMts/m_ssCount;
 
@@ -130,6 +178,9 @@ public:
         m_audStmIdx = -1;
         m_hParser = nullptr;
         m_hMediaInfo = nullptr;
+        m_mediaCacheKey.clear();
+        m_ssFromCache = false;
+        m_wfFromCache = false;
         m_opened = false;
         m_errMsg = "";
     }
@@ -183,6 +234,52 @@ public:
         return m_genSsEof;
     }
 
+    float GetProgress() const override
+    {
+        if (!IsOpened())
+            return 0.f;
+        float progSum = 0.f;
+        int partCnt = 0;
+        if (HasVideo())
+        {
+            partCnt++;
+            if (m_genSsEof)
+                progSum += 1.f;
+            else if (!m_snapshots.empty())
+            {
+                const auto doneCnt = count_if(m_snapshots.begin(), m_snapshots.end(), [](const Snapshot& ss) {
+                    return ss.sameFrame || !ss.img.empty();
+                });
+                progSum += (float)doneCnt/m_snapshots.size();
+            }
+        }
+        if (HasAudio())
+        {
+            partCnt++;
+            auto hWaveform = m_hWaveform;
+            if (m_genWfEof || (hWaveform && hWaveform->parseDone))
+                progSum += 1.f;
+            else if (hWaveform && !hWaveform->pcm.empty() && !hWaveform->pcm[0].empty())
+                progSum += min((float)hWaveform->validSampleCount/hWaveform->pcm[0].size(), 1.f);
+        }
+        return partCnt > 0 ? progSum/partCnt : 0.f;
+    }
+
+    bool IsFailed() const override
+    {
+        return m_prepareFailed;
+    }
+
+    bool IsDecodingResourceReleased() const override
+    {
+        return !m_decodingResHeld;
+    }
+
+    int64_t GetIoBytesRead() const override
+    {
+        return m_vidDemuxIoBytes+m_audDemuxIoBytes;
+    }
+
     bool HasVideo() const override
     {
         return m_vidStmIdx >= 0;
@@ -392,6 +489,72 @@ public:
         m_vidPreferUseHw = enable;
     }
 
+    bool IsKeyframeSnapEnabled() const override
+    {
+        return m_keyframeSnap;
+    }
+
+    void EnableKeyframeSnap(bool enable) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (IsOpened())
+        {
+            m_logger->Log(WARN) << "CANNOT change keyframe snap mode after the Overview is opened!" << endl;
+            return;
+        }
+        m_keyframeSnap = enable;
+    }
+
+    bool SetSwsThreadCount(uint32_t count) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (IsOpened())
+        {
+            m_errMsg = "CANNOT change sws thread count after the Overview is opened!";
+            return false;
+        }
+        m_swsThreadCount = count;
+        return true;
+    }
+
+    uint32_t GetSwsThreadCount() const override
+    {
+        return m_swsThreadCount > 0 ? m_swsThreadCount : FFUtils::GetDefaultSwsThreadCount();
+    }
+
+    bool SetVideoDecoderThreadCount(uint32_t count) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (IsOpened())
+        {
+            m_errMsg = "CANNOT change video decoder thread count after the Overview is opened!";
+            return false;
+        }
+        m_vidDecThreadCount = count;
+        return true;
+    }
+
+    uint32_t GetVideoDecoderThreadCount() const override
+    {
+        return m_vidDecThreadCount > 0 ? m_vidDecThreadCount : FFUtils::OpenVideoDecoderOptions().threadCount;
+    }
+
+    void SetPreviewCache(PreviewCache::Holder hCache) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (IsOpened())
+        {
+            m_logger->Log(WARN) << "CANNOT change preview cache after the Overview is opened!" << endl;
+            return;
+        }
+        m_hPreviewCache = hCache;
+    }
+
+    PreviewCache::Holder GetPreviewCache() const override
+    {
+        return m_hPreviewCache;
+    }
+
     string GetError() const override
     {
         return m_errMsg;
@@ -557,6 +720,15 @@ private:
 
                 m_viddecOpenOpts.onlyUseSoftwareDecoder = !m_vidPreferUseHw;
                 m_viddecOpenOpts.hHwaMgr = HwaccelManager::GetDefaultInstance();
+                // snapshots are small, let the decoder skip the details when it can
+                const auto pVidInfo = GetVideoStream();
+                uint32_t lowresOutW = m_frmCvt.GetOutWidth(), lowresOutH = m_frmCvt.GetOutHeight();
+                if (((int)round(pVidInfo->displayRotation/90.0)&0x1) == 1)
+                    swap(lowresOutW, lowresOutH);
+                m_viddecOpenOpts.lowres = FFUtils::CalcLowresForOutputSize(pVidInfo->width, pVidInfo->height, lowresOutW, lowresOutH);
+                m_viddecOpenOpts.skipLoopFilter = m_keyframeSnap && !m_isImage ? AVDISCARD_ALL : AVDISCARD_NONREF;
+                m_viddecOpenOpts.threadCount = GetVideoDecoderThreadCount();
+                m_frmCvt.SetSwsThreadCount(GetSwsThreadCount());
                 FFUtils::OpenVideoDecoderResult res;
                 if (FFUtils::OpenVideoDecoder(m_avfmtCtx, -1, &m_viddecOpenOpts, &res))
                 {
@@ -573,8 +745,14 @@ private:
                         m_hwDecCtxLock.TurnOn();
 #endif
                     m_logger->Log(INFO) << "Overview for file '" << m_hMediaInfo->url << "' opened a video decoder '" << 
-                        m_viddecCtx->codec->name << "'(" << (res.hwDevType==AV_HWDEVICE_TYPE_NONE ? "SW" : av_hwdevice_get_type_name(res.hwDevType)) << ")." << endl;
+                        m_viddecCtx->codec->name << "'(" << (res.hwDevType==AV_HWDEVICE_TYPE_NONE ? "SW" : av_hwdevice_get_type_name(res.hwDevType)) << "), lowres=" << m_viddecCtx->lowres << "." << endl;
                     openVideoFailed = false;
+                    if (m_keyframeSnap && !m_isImage)
+                    {
+                        // demuxers supporting it don't even read the non-key packets
+                        m_vidAvStm->discard = AVDISCARD_NONKEY;
+                        m_viddecCtx->skip_frame = AVDISCARD_NONKEY;
+                    }
 
                     const auto pVidstm = GetVideoStream();
                     if (pVidstm->displayRotation != 0)
@@ -730,22 +908,152 @@ private:
             ss.img.time_stamp = (m_ssIntvMts*i+m_vidStartMts)/1000.;
             m_snapshots.push_back(ss);
         }
+        m_ssFromCache = LoadSnapshotsFromCache();
+        if (!m_wfFromCache)
+            m_wfFromCache = LoadWaveformFromCache();
         StartAllThreads();
     }
 
+    string MakeSnapshotsCacheKey()
+    {
+        if (m_mediaCacheKey.empty() || !HasVideo())
+            return "";
+        ostringstream oss;
+        oss << m_mediaCacheKey << "|ovwss|" << m_ssCount << "|" << m_frmCvt.GetOutWidth() << "x" << m_frmCvt.GetOutHeight() << "|"
+            << (int)m_frmCvt.GetOutColorFormat() << "|" << (int)m_frmCvt.GetOutDataType() << "|" << (int)m_frmCvt.GetResizeInterpolateMode()
+            << "|" << (m_keyframeSnap ? "key" : "all");
+        return oss.str();
+    }
+
+    string MakeWaveformCacheKey()
+    {
+        if (m_mediaCacheKey.empty() || !HasAudio() || !m_hWaveform)
+            return "";
+        ostringstream oss;
+        oss << m_mediaCacheKey << "|ovwwf2|" << setprecision(17) << m_hWaveform->aggregateSamples << "|" << m_hWaveform->pcm.size()
+            << "|" << m_hWaveform->pcm[0].size();
+        return oss.str();
+    }
+
+    bool LoadSnapshotsFromCache()
+    {
+        m_ssCacheKey = MakeSnapshotsCacheKey();
+        if (m_ssCacheKey.empty())
+            return false;
+        vector<ImGui::ImMat> images;
+        if (!m_hPreviewCache->GetImages(m_ssCacheKey, images) || images.size() != m_snapshots.size())
+            return false;
+        for (uint32_t i = 0; i < images.size(); i++)
+            m_snapshots[i].img = images[i];
+        m_logger->Log(DEBUG) << "Overview snapshots of '" << m_hParser->GetUrl() << "' are loaded from preview cache." << endl;
+        return true;
+    }
+
+    void SaveSnapshotsToCache()
+    {
+        if (m_ssCacheKey.empty())
+            return;
+        vector<ImGui::ImMat> images;
+        bool hasImage = false;
+        for (auto& ss : m_snapshots)
+        {
+            images.push_back(ss.sameFrame ? m_snapshots[ss.sameAsIndex].img : ss.img);
+            if (!images.back().empty())
+                hasImage = true;
+        }
+        if (hasImage && !m_hPreviewCache->PutImages(m_ssCacheKey, images))
+            m_logger->Log(WARN) << "FAILED to save overview snapshots into preview cache! Error is '" << m_hPreviewCache->GetError() << "'." << endl;
+    }
+
+    bool LoadWaveformFromCache()
+    {
+        m_wfCacheKey = MakeWaveformCacheKey();
+        if (m_wfCacheKey.empty())
+            return false;
+        vector<uint8_t> data;
+        if (!m_hPreviewCache->GetData(m_wfCacheKey, data))
+            return false;
+        // layout: minSample, maxSample, validSampleCount, scale, then the compressed pcm of each channel
+        const size_t headerBytes = sizeof(float)*3+sizeof(int64_t);
+        if (data.size() < headerBytes)
+        {
+            m_logger->Log(WARN) << "Cached waveform data is TOO SHORT!" << endl;
+            return false;
+        }
+        float minSample, maxSample, scale;
+        int64_t validSampleCount;
+        const uint8_t* ptr = data.data();
+        memcpy(&minSample, ptr, sizeof(float)); ptr += sizeof(float);
+        memcpy(&maxSample, ptr, sizeof(float)); ptr += sizeof(float);
+        memcpy(&validSampleCount, ptr, sizeof(int64_t)); ptr += sizeof(int64_t);
+        memcpy(&scale, ptr, sizeof(float));
+        size_t offset = headerBytes;
+        vector<vector<float>> pcm(m_hWaveform->pcm.size(), vector<float>(m_hWaveform->pcm[0].size()));
+        for (auto& chpcm : pcm)
+        {
+            if (!ReadWaveformChannel(data, offset, chpcm, scale))
+            {
+                m_logger->Log(WARN) << "Cached waveform data is CORRUPTED!" << endl;
+                return false;
+            }
+        }
+        m_hWaveform->minSample = minSample;
+        m_hWaveform->maxSample = maxSample;
+        m_hWaveform->validSampleCount = validSampleCount;
+        m_hWaveform->pcm = std::move(pcm);
+        m_hWaveform->parseDone = true;
+        m_logger->Log(DEBUG) << "Overview waveform of '" << m_hParser->GetUrl() << "' is loaded from preview cache." << endl;
+        return true;
+    }
+
+    void SaveWaveformToCache()
+    {
+        if (m_wfCacheKey.empty())
+            return;
+        float scale = max(fabs(m_hWaveform->minSample), fabs(m_hWaveform->maxSample));
+        if (scale <= 0)
+            scale = 1.f;
+        vector<uint8_t> data(sizeof(float)*3+sizeof(int64_t));
+        uint8_t* ptr = data.data();
+        memcpy(ptr, &m_hWaveform->minSample, sizeof(float)); ptr += sizeof(float);
+        memcpy(ptr, &m_hWaveform->maxSample, sizeof(float)); ptr += sizeof(float);
+        memcpy(ptr, &m_hWaveform->validSampleCount, sizeof(int64_t)); ptr += sizeof(int64_t);
+        memcpy(ptr, &scale, sizeof(float));
+        for (auto& chpcm : m_hWaveform->pcm)
+            AppendWaveformChannel(data, chpcm, scale);
+        if (!m_hPreviewCache->PutData(m_wfCacheKey, data))
+            m_logger->Log(WARN) << "FAILED to save overview waveform into preview cache! Error is '" << m_hPreviewCache->GetError() << "'." << endl;
+    }
+
     void StartAllThreads()
     {
         string fileName = SysUtils::ExtractFileName(m_hParser->GetUrl());
         ostringstream thnOss;
         m_quit = false;
-        bool startReleaseResourceThread = true;
-        if (HasVideo())
+        bool startReleaseResourceThread = false;
+        m_genSsEof = m_ssFromCache;
+        m_genWfEof = m_wfFromCache;
+        m_vidDemuxIoBytes = 0;
+        m_audDemuxIoBytes = 0;
+        // read the file only once when both the snapshots and the waveform are to be generated
+        const bool singleDemux = HasVideo() && !m_ssFromCache && !m_hParser->IsImageSequence() && !m_isImage && HasAudio() && !m_wfFromCache;
+        if (singleDemux)
+        {
+            m_demuxVidThread = thread(&Overview_Impl::DemuxThreadProc, this);
+            thnOss.str(""); thnOss << "OvwDmx-" << fileName;
+            SysUtils::SetThreadName(m_demuxVidThread, thnOss.str());
+        }
+        if (HasVideo() && !m_ssFromCache)
         {
             if (!m_hParser->IsImageSequence())
             {
-                m_demuxVidThread = thread(&Overview_Impl::DemuxVideoThreadProc, this);
-                thnOss.str(""); thnOss << "OvwVdmx-" << fileName;
-                SysUtils::SetThreadName(m_demuxVidThread, thnOss.str());
+                startReleaseResourceThread = true;
+                if (!singleDemux)
+                {
+                    m_demuxVidThread = thread(&Overview_Impl::DemuxVideoThreadProc, this);
+                    thnOss.str(""); thnOss << "OvwVdmx-" << fileName;
+                    SysUtils::SetThreadName(m_demuxVidThread, thnOss.str());
+                }
                 m_viddecThread = thread(&Overview_Impl::VideoDecodeThreadProc, this);
                 thnOss.str(""); thnOss << "OvwVdc-" << fileName;
                 SysUtils::SetThreadName(m_viddecThread, thnOss.str());
@@ -758,14 +1066,17 @@ private:
                 m_genSsThread = thread(&Overview_Impl::GenerateSsByImgsqThreadProc, this);
                 thnOss.str(""); thnOss << "OvwGss-" << fileName;
                 SysUtils::SetThreadName(m_genSsThread, thnOss.str());
-                startReleaseResourceThread = false;
             }
         }
-        if (HasAudio())
+        if (HasAudio() && !m_wfFromCache)
         {
-            m_demuxAudThread = thread(&Overview_Impl::DemuxAudioThreadProc, this);
-            thnOss.str(""); thnOss << "OvwAdmx-" << fileName;
-            SysUtils::SetThreadName(m_demuxAudThread, thnOss.str());
+            startReleaseResourceThread = true;
+            if (!singleDemux)
+            {
+                m_demuxAudThread = thread(&Overview_Impl::DemuxAudioThreadProc, this);
+                thnOss.str(""); thnOss << "OvwAdmx-" << fileName;
+                SysUtils::SetThreadName(m_demuxAudThread, thnOss.str());
+            }
             m_auddecThread = thread(&Overview_Impl::AudioDecodeThreadProc, this);
             thnOss.str(""); thnOss << "OvwAdc-" << fileName;
             SysUtils::SetThreadName(m_auddecThread, thnOss.str());
@@ -773,6 +1084,8 @@ private:
             thnOss.str(""); thnOss << "OvwGwf-" << fileName;
             SysUtils::SetThreadName(m_genWfThread, thnOss.str());
         }
+        // the image-sequence workers and the cached parts keep no decoder after the generation, nothing to release
+        m_decodingResHeld = startReleaseResourceThread;
         if (startReleaseResourceThread)
             m_releaseThread = thread(&Overview_Impl::ReleaseResourceProc, this);
     }
@@ -851,9 +1164,11 @@ private:
     {
         m_logger->Log(DEBUG) << "Enter DemuxVideoThreadProc()..." << endl;
 
+        const int64_t ioBytesBase = m_avfmtCtx && m_avfmtCtx->pb ? m_avfmtCtx->pb->bytes_read : 0;
         if (!m_prepared && !Prepare())
         {
             m_logger->Log(Error) << "Prepare() FAILED for url '" << m_hParser->GetUrl() << "'! Error is '" << m_errMsg << "'." << endl;
+            m_prepareFailed = true;
             return;
         }
         if (!m_decodeVideo)
@@ -862,6 +1177,12 @@ private:
             return;
         }
 
+        // keyframe snap looks up the demuxer's index, which the container header provides, waiting for the parser to scan
+        // the whole file would delay the first snapshot
+        const bool snapToIndex = m_keyframeSnap && !m_isImage && GetIndexEntryCount(m_vidAvStm) > 0;
+        if (m_keyframeSnap && !m_isImage && !snapToIndex)
+            m_logger->Log(DEBUG) << "NO demuxer index for keyframe snap, use the key frame before each snapshot position." << endl;
+
         AVPacket avpkt = {0};
         bool avpktLoaded = false;
         while (!m_quit)
@@ -880,8 +1201,9 @@ private:
                 int fferr;
                 if (!m_isImage)
                 {
-                    int64_t seekTargetPts = ss.ssFrmPts != INT64_MIN ? ss.ssFrmPts :
-                        av_rescale_q((int64_t)(m_ssIntvMts*ss.index+m_vidStartMts), MILLISEC_TIMEBASE, m_vidAvStm->time_base);
+                    int64_t seekTargetPts = CalcSsTargetPts(ss);
+                    if (snapToIndex)
+                        seekTargetPts = FindNearestIndexedKeyTs(seekTargetPts);
                     fferr = avformat_seek_file(m_avfmtCtx, m_vidStmIdx, INT64_MIN, seekTargetPts, seekTargetPts, 0);
                     if (fferr < 0)
                     {
@@ -898,6 +1220,14 @@ private:
                     if (!avpktLoaded)
                     {
                         int fferr = av_read_frame(m_avfmtCtx, &avpkt);
+                        if (m_avfmtCtx->pb)
+                            m_vidDemuxIoBytes = m_avfmtCtx->pb->bytes_read-ioBytesBase;
+                        if (fferr == 0 && m_keyframeSnap && (avpkt.stream_index != m_vidStmIdx || (avpkt.flags&AV_PKT_FLAG_KEY) == 0))
+                        {
+                            av_packet_unref(&avpkt);
+                            idleLoop = idleLoop2 = false;
+                            continue;
+                        }
                         if (fferr == 0)
                         {
                             avpktLoaded = true;
@@ -949,7 +1279,7 @@ private:
                                 av_packet_unref(&avpkt);
                                 avpktLoaded = false;
                                 idleLoop = idleLoop2 = false;
-                                if (enqpkt->pts > m_vidAvStm->start_time)
+                                if (enqpkt->pts > m_vidAvStm->start_time || m_keyframeSnap)
                                     enqDone = true;
                             }
                         }
@@ -979,6 +1309,175 @@ private:
         m_logger->Log(DEBUG) << "Leave DemuxVideoThreadProc()." << endl;
     }
 
+    int64_t CalcSsTargetPts(const Snapshot& ss)
+    {
+        return ss.ssFrmPts != INT64_MIN ? ss.ssFrmPts :
+            av_rescale_q((int64_t)(m_ssIntvMts*ss.index+m_vidStartMts), MILLISEC_TIMEBASE, m_vidAvStm->time_base);
+    }
+
+    static int GetIndexEntryCount(AVStream* st)
+    {
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+        return avformat_index_get_entries_count(st);
+#else
+        return st->nb_index_entries;
+#endif
+    }
+
+    static int64_t GetIndexEntryTs(AVStream* st, int idx)
+    {
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+        return avformat_index_get_entry(st, idx)->timestamp;
+#else
+        return st->index_entries[idx].timestamp;
+#endif
+    }
+
+    // The key frame in the demuxer's index nearest to 'ts', or 'ts' itself if there's no key frame indexed around it
+    int64_t FindNearestIndexedKeyTs(int64_t ts)
+    {
+        const int prevIdx = av_index_search_timestamp(m_vidAvStm, ts, AVSEEK_FLAG_BACKWARD);
+        const int nextIdx = av_index_search_timestamp(m_vidAvStm, ts, 0);
+        if (prevIdx < 0 && nextIdx < 0)
+            return ts;
+        if (prevIdx < 0)
+            return GetIndexEntryTs(m_vidAvStm, nextIdx);
+        const int64_t prevTs = GetIndexEntryTs(m_vidAvStm, prevIdx);
+        if (nextIdx < 0)
+            return prevTs;
+        const int64_t nextTs = GetIndexEntryTs(m_vidAvStm, nextIdx);
+        return nextTs-ts < ts-prevTs ? nextTs : prevTs;
+    }
+
+    bool EnqueuePacket(list<AVPacket*>& pktQ, mutex& pktQLock, int pktQMaxSize, const AVPacket* avpkt)
+    {
+        while (pktQ.size() >= pktQMaxSize && !m_quit)
+            this_thread::sleep_for(chrono::milliseconds(THREAD_IDLE_TIME));
+        if (m_quit)
+            return false;
+        AVPacket* enqpkt = av_packet_clone(avpkt);
+        if (!enqpkt)
+        {
+            m_logger->Log(Error) << "FAILED to invoke 'av_packet_clone(EnqueuePacket)'!" << endl;
+            return false;
+        }
+        lock_guard<mutex> lk(pktQLock);
+        pktQ.push_back(enqpkt);
+        return true;
+    }
+
+    bool EnqueueSsKeyPacket(Snapshot& ss, const AVPacket* keyPkt, int64_t& lastEnqPts, uint32_t& lastEnqSsIdx)
+    {
+        ss.ssFrmPts = keyPkt->pts;
+        if (keyPkt->pts == lastEnqPts)
+        {
+            ss.sameFrame = true;
+            ss.sameAsIndex = lastEnqSsIdx;
+            return true;
+        }
+        if (!EnqueuePacket(m_vidpktQ, m_vidpktQLock, m_vidpktQMaxSize, keyPkt))
+            return false;
+        lastEnqPts = keyPkt->pts;
+        lastEnqSsIdx = ss.index;
+        return true;
+    }
+
+    // Demux the file sequentially once for both the snapshots and the waveform. Each snapshot takes the key frame at or before
+    // its position, the same frame 'DemuxVideoThreadProc()' gets by seeking, or with keyframe snap the nearer one of the key
+    // frames around its position. All the audio packets go to the audio decoder.
+    void DemuxThreadProc()
+    {
+        m_logger->Log(DEBUG) << "Enter DemuxThreadProc()..." << endl;
+
+        const int64_t ioBytesBase = m_avfmtCtx && m_avfmtCtx->pb ? m_avfmtCtx->pb->bytes_read : 0;
+        if (!m_prepared && !Prepare())
+        {
+            m_logger->Log(Error) << "Prepare() FAILED for url '" << m_hParser->GetUrl() << "'! Error is '" << m_errMsg << "'." << endl;
+            m_prepareFailed = true;
+            return;
+        }
+        bool routeVideo = m_decodeVideo;
+        const bool routeAudio = m_decodeAudio;
+        if (!routeVideo)
+            m_demuxVidEof = true;
+        if (!routeAudio)
+            m_demuxAudEof = true;
+
+        auto ssIter = m_snapshots.begin();
+        // the latest key frame not after the position of the pending snapshot
+        AVPacket* keyCandPkt = nullptr;
+        int64_t lastEnqPts = INT64_MIN;
+        uint32_t lastEnqSsIdx = 0;
+        AVPacket avpkt = {0};
+        bool quitLoop = false;
+        while (!m_quit && !quitLoop && (routeVideo || routeAudio))
+        {
+            int fferr = av_read_frame(m_avfmtCtx, &avpkt);
+            if (m_avfmtCtx->pb)
+                m_vidDemuxIoBytes = m_avfmtCtx->pb->bytes_read-ioBytesBase;
+            if (fferr < 0)
+            {
+                if (fferr != AVERROR_EOF)
+                    m_logger->Log(Error) << "Demuxer ERROR! 'av_read_frame(DemuxThreadProc)' returns " << fferr << "." << endl;
+                break;
+            }
+
+            if (routeAudio && avpkt.stream_index == m_audStmIdx)
+            {
+                if (!EnqueuePacket(m_audpktQ, m_audpktQLock, m_audpktQMaxSize, &avpkt))
+                    quitLoop = true;
+            }
+            else if (routeVideo && avpkt.stream_index == m_vidStmIdx && (avpkt.flags&AV_PKT_FLAG_KEY) != 0 && avpkt.pts != AV_NOPTS_VALUE)
+            {
+                while (ssIter != m_snapshots.end() && avpkt.pts > CalcSsTargetPts(*ssIter))
+                {
+                    // no key frame before the first positions, take the first one
+                    const AVPacket* ssPkt = keyCandPkt ? keyCandPkt : &avpkt;
+                    if (m_keyframeSnap && keyCandPkt)
+                    {
+                        // the key frames on both sides of the position are known here, take the nearer one
+                        const int64_t targetPts = CalcSsTargetPts(*ssIter);
+                        if (avpkt.pts-targetPts < targetPts-keyCandPkt->pts)
+                            ssPkt = &avpkt;
+                    }
+                    if (!EnqueueSsKeyPacket(*ssIter, ssPkt, lastEnqPts, lastEnqSsIdx))
+                    {
+                        quitLoop = true;
+                        break;
+                    }
+                    ssIter++;
+                }
+                if (ssIter == m_snapshots.end())
+                {
+                    routeVideo = false;
+                    m_demuxVidEof = true;
+                }
+                else
+                {
+                    if (!keyCandPkt)
+                        keyCandPkt = av_packet_alloc();
+                    else
+                        av_packet_unref(keyCandPkt);
+                    if (keyCandPkt)
+                        av_packet_ref(keyCandPkt, &avpkt);
+                }
+            }
+            av_packet_unref(&avpkt);
+        }
+        // the positions after the last key frame
+        while (!m_quit && !quitLoop && routeVideo && keyCandPkt && ssIter != m_snapshots.end())
+        {
+            if (!EnqueueSsKeyPacket(*ssIter, keyCandPkt, lastEnqPts, lastEnqSsIdx))
+                break;
+            ssIter++;
+        }
+        if (keyCandPkt)
+            av_packet_free(&keyCandPkt);
+        m_demuxVidEof = true;
+        m_demuxAudEof = true;
+        m_logger->Log(DEBUG) << "Leave DemuxThreadProc(), " << m_vidDemuxIoBytes << " bytes read." << endl;
+    }
+
     void VideoDecodeThreadProc()
     {
         m_logger->Log(DEBUG) << "Enter VideoDecodeThreadProc()..." << endl;
@@ -1245,57 +1744,13 @@ private:
         FillBlankSsByDuplication();
 
         m_genSsEof = true;
+        if (!m_quit)
+            SaveSnapshotsToCache();
         m_logger->Log(DEBUG) << "Leave GenerateSsThreadProc()." << endl;
     }
 
-    struct ImgsqDecodeContext
-    {
-        using Holder = shared_ptr<ImgsqDecodeContext>;
-
-        ImgsqDecodeContext() {}
-        Snapshot* m_pSs{nullptr};
-        int64_t pos;
-        bool isIdle{true};
-        MediaReader::Holder m_hImgsqReader;
-        VideoFrame::Holder m_hVfrm;
-    };
-
-    ImgsqDecodeContext::Holder CreateImgsqDecodeContext()
-    {
-        ImgsqDecodeContext::Holder hImgsqDecCtx(new ImgsqDecodeContext());
-        hImgsqDecCtx->m_hImgsqReader = MediaReader::CreateImageSequenceInstance();
-        auto hImgsqReader = hImgsqDecCtx->m_hImgsqReader;
-        if (!hImgsqReader->Open(m_hParser))
-        {
-            ostringstream oss; oss << "FAILED to open image-sequence reader! Error is '" << hImgsqReader->GetError() << "'.";
-            m_errMsg = oss.str();
-            return nullptr;
-        }
-        const auto outW = m_frmCvt.GetOutWidth();
-        const auto outH = m_frmCvt.GetOutHeight();
-        const auto outClrfmt = m_frmCvt.GetOutColorFormat();
-        const auto outDtype = m_frmCvt.GetOutDataType();
-        const auto rszInterp = m_frmCvt.GetResizeInterpolateMode();
-        if (!hImgsqReader->ConfigVideoReader(outW, outH, outClrfmt, outDtype, rszInterp, HwaccelManager::GetDefaultInstance()))
-        {
-            ostringstream oss; oss << "FAILED to configure image-sequence reader! Error is '" << hImgsqReader->GetError() << "'.";
-            m_errMsg = oss.str();
-            return nullptr;
-        }
-        hImgsqReader->SetCacheFrames(true, 0, 0);
-        return hImgsqDecCtx;
-    }
-
-    void AssignDecodeContextToSs(Snapshot& ss, ImgsqDecodeContext::Holder hImgsqDecCtx)
-    {
-        hImgsqDecCtx->m_pSs = &ss;
-        hImgsqDecCtx->pos = ss.img.time_stamp*1000;
-        hImgsqDecCtx->isIdle = false;
-        hImgsqDecCtx->m_hImgsqReader->SeekTo(hImgsqDecCtx->pos);
-        if (!hImgsqDecCtx->m_hImgsqReader->IsStarted())
-            hImgsqDecCtx->m_hImgsqReader->Start();
-    }
-
+    // Image sequence: each snapshot shows the file at its position, the consecutive snapshots on the same file share one decoded
+    // picture. Only these representative files are decoded, by 'm_maxImgsqDecNum' workers in parallel.
     void GenerateSsByImgsqThreadProc()
     {
         m_logger->Log(DEBUG) << "Enter GenerateSsByImgsqThreadProc()." << endl;
@@ -1305,106 +1760,96 @@ private:
             return;
         }
 
-        list<ImgsqDecodeContext::Holder> imgsqDecCtxList;
-        for (auto i = 0; i < m_maxImgsqDecNum; i++)
-            imgsqDecCtxList.push_back(CreateImgsqDecodeContext());
-
-        auto ssIter = m_snapshots.begin();
-        while (!m_quit && ssIter != m_snapshots.end())
+        const auto pVidstm = GetVideoStream();
+        const AVRational timebase = { pVidstm->timebase.num, pVidstm->timebase.den };
+        const int64_t fileCount = (int64_t)m_hParser->GetImageSequenceIterator()->GetValidFileCount();
+        vector<pair<uint32_t, int64_t>> ssFiles;
+        int64_t prevFileIdx = -1;
+        for (auto& ss : m_snapshots)
         {
-            bool idleLoop = true;
-
-            auto idleDecIter = find_if(imgsqDecCtxList.begin(), imgsqDecCtxList.end(), [] (auto& hImgsqDecCtx) {
-                return hImgsqDecCtx->isIdle;
-            });
+            int64_t fileIdx = av_rescale_q_rnd((int64_t)round(ss.img.time_stamp*1000), MILLISEC_TIMEBASE, timebase, AV_ROUND_NEAR_INF);
+            if (fileIdx >= fileCount) fileIdx = fileCount-1;
+            if (fileIdx < 0) fileIdx = 0;
+            // left blank, it's filled by 'FillBlankSsByDuplication()'
+            if (fileIdx == prevFileIdx)
+                continue;
+            ssFiles.push_back({ ss.index, fileIdx });
+            prevFileIdx = fileIdx;
+        }
+
+        atomic<uint32_t> nextSsFileIdx{0};
+        const uint32_t workerCount = ssFiles.size() < (size_t)m_maxImgsqDecNum ? (uint32_t)ssFiles.size() : (uint32_t)m_maxImgsqDecNum;
+        list<thread> workers;
+        for (uint32_t i = 0; i < workerCount; i++)
+            workers.push_back(thread(&Overview_Impl::DecodeImgsqFilesProc, this, std::cref(ssFiles), std::ref(nextSsFileIdx)));
+        for (auto& worker : workers)
+            worker.join();
+        workers.clear();
 
-            if (idleDecIter != imgsqDecCtxList.end())
-            {
-                AssignDecodeContextToSs(*ssIter++, *idleDecIter);
-                idleLoop = false;
-            }
+        if (!m_quit)
+            FillBlankSsByDuplication();
 
-            for (auto& hImgsqDecCtx : imgsqDecCtxList)
-            {
-                if (!hImgsqDecCtx->m_hVfrm)
-                {
-                    bool eof = false;
-                    auto hVfrm = hImgsqDecCtx->m_hImgsqReader->ReadVideoFrame(hImgsqDecCtx->pos, eof, false);
-                    if (hVfrm)
-                    {
-                        hVfrm->SetAutoConvertToMat(true);
-                        hImgsqDecCtx->m_hVfrm = hVfrm;
-                    }
-                }
-                if (hImgsqDecCtx->m_hVfrm && hImgsqDecCtx->m_hVfrm->IsReady())
-                {
-                    if (hImgsqDecCtx->m_hVfrm->GetMat(hImgsqDecCtx->m_pSs->img))
-                        hImgsqDecCtx->m_pSs->ssFrmPts = hImgsqDecCtx->m_pSs->index;
-                    else
-                        m_logger->Log(WARN) << "FAILED to GetMat for image-sequence at pos " << hImgsqDecCtx->m_pSs->img.time_stamp << "." << endl;
-                    hImgsqDecCtx->isIdle = true;
-                    hImgsqDecCtx->m_hVfrm = nullptr;
-                    idleLoop = false;
-                }
-            }
+        m_genSsEof = true;
+        if (!m_quit)
+            SaveSnapshotsToCache();
+        m_logger->Log(DEBUG) << "Leave GenerateSsByImgsqThreadProc()." << endl;
+    }
 
-            if (idleLoop)
-                this_thread::sleep_for(chrono::milliseconds(THREAD_IDLE_TIME));
+    void DecodeImgsqFilesProc(const vector<pair<uint32_t, int64_t>>& ssFiles, atomic<uint32_t>& nextSsFileIdx)
+    {
+        // each worker has its own file iterator, decoder and converter, the small pictures are decoded by single thread
+        auto hFileIter = m_hParser->GetImageSequenceIterator()->Clone();
+        FFUtils::OpenVideoDecoderOptions decOpts;
+        decOpts.onlyUseSoftwareDecoder = true;
+        decOpts.threadCount = 1;
+        FFUtils::ImageFileDecoder imgDecoder;
+        imgDecoder.SetDecoderOptions(decOpts);
+        imgDecoder.SetWantedSize(m_frmCvt.GetOutWidth(), m_frmCvt.GetOutHeight());
+        AVFrameToImMatConverter frmCvt;
+        if (!frmCvt.SetOutSize(m_frmCvt.GetOutWidth(), m_frmCvt.GetOutHeight()) || !frmCvt.SetOutColorFormat(m_frmCvt.GetOutColorFormat())
+            || !frmCvt.SetOutDataType(m_frmCvt.GetOutDataType()) || !frmCvt.SetResizeInterpolateMode(m_frmCvt.GetResizeInterpolateMode()))
+        {
+            m_logger->Log(Error) << "FAILED to setup the converter for image-sequence! Error is '" << frmCvt.GetError() << "'." << endl;
+            return;
         }
 
-        // wait for all decode context finish
-        while (!m_quit && !imgsqDecCtxList.empty())
+        while (!m_quit)
         {
-            bool idleLoop = true;
-
-            auto decIter = imgsqDecCtxList.begin();
-            while (decIter != imgsqDecCtxList.end())
+            const uint32_t i = nextSsFileIdx++;
+            if (i >= ssFiles.size())
+                break;
+            auto& ss = m_snapshots[ssFiles[i].first];
+            const int64_t fileIdx = ssFiles[i].second;
+            string filePath;
+            if (hFileIter->SeekToValidFile((uint32_t)fileIdx))
+                filePath = hFileIter->GetCurrFilePath();
+            if (filePath.empty())
             {
-                auto& hImgsqDecCtx = *decIter;
-                if (!hImgsqDecCtx->m_hVfrm)
-                {
-                    bool eof = false;
-                    auto hVfrm = hImgsqDecCtx->m_hImgsqReader->ReadVideoFrame(hImgsqDecCtx->pos, eof, false);
-                    if (hVfrm)
-                    {
-                        hVfrm->SetAutoConvertToMat(true);
-                        hImgsqDecCtx->m_hVfrm = hVfrm;
-                    }
-                }
-                if (hImgsqDecCtx->m_hVfrm && hImgsqDecCtx->m_hVfrm->IsReady())
-                {
-                    if (hImgsqDecCtx->m_hVfrm->GetMat(hImgsqDecCtx->m_pSs->img))
-                        hImgsqDecCtx->m_pSs->ssFrmPts = hImgsqDecCtx->m_pSs->index;
-                    else
-                        m_logger->Log(WARN) << "FAILED to GetMat for image-sequence at pos " << hImgsqDecCtx->m_pSs->img.time_stamp << "." << endl;
-                    hImgsqDecCtx->isIdle = true;
-                    hImgsqDecCtx->m_hVfrm = nullptr;
-                    decIter = imgsqDecCtxList.erase(decIter);
-                    idleLoop = false;
-                }
-                else
-                    decIter++;
+                m_logger->Log(WARN) << "FAILED to get the image-sequence file path by index " << fileIdx << "." << endl;
+                continue;
             }
-
-            if (idleLoop)
-                this_thread::sleep_for(chrono::milliseconds(THREAD_IDLE_TIME));
+            filePath = hFileIter->JoinBaseDirPath(filePath);
+            auto hAvfrm = imgDecoder.DecodeFile(filePath);
+            if (!hAvfrm)
+            {
+                m_logger->Log(WARN) << "FAILED to decode image-sequence file '" << filePath << "'! Error is '" << imgDecoder.GetError() << "'." << endl;
+                continue;
+            }
+            if (frmCvt.ConvertImage(hAvfrm.get(), ss.img, ss.img.time_stamp))
+                ss.ssFrmPts = fileIdx;
+            else
+                m_logger->Log(WARN) << "FAILED to convert the image-sequence file '" << filePath << "'! Error is '" << frmCvt.GetError() << "'." << endl;
         }
-
-        if (!m_quit)
-            FillBlankSsByDuplication();
-
-        imgsqDecCtxList.clear();
-        m_genSsEof = true;
-        m_logger->Log(DEBUG) << "Leave GenerateSsByImgsqThreadProc()." << endl;
     }
 
     void DemuxAudioThreadProc()
     {
         m_logger->Log(DEBUG) << "Enter DemuxAudioThreadProc()..." << endl;
 
-        if (!HasVideo() && !m_prepared && !Prepare())
+        if ((!HasVideo() || m_ssFromCache) && !m_prepared && !Prepare())
         {
             m_logger->Log(Error) << "Prepare() FAILED! Error is '" << m_errMsg << "'." << endl;
+            m_prepareFailed = true;
             return;
         }
         else
@@ -1436,6 +1881,8 @@ private:
             if (!avpktLoaded)
             {
                 int fferr = av_read_frame(avfmtCtx, &avpkt);
+                if (avfmtCtx->pb)
+                    m_audDemuxIoBytes = avfmtCtx->pb->bytes_read;
                 if (fferr == 0)
                 {
                     avpktLoaded = true;
@@ -1760,6 +2207,8 @@ private:
         }
         m_hWaveform->parseDone = true;
         m_genWfEof = true;
+        if (!m_quit)
+            SaveWaveformToCache();
         m_logger->Log(DEBUG) << "Leave GenWaveformThreadProc(), " << wfIdx << " samples generated." << endl;
     }
 
@@ -1809,11 +2258,17 @@ private:
 
         m_demuxVidEof = false;
         m_viddecEof = false;
-        m_genSsEof = false;
         m_demuxAudEof = false;
         m_auddecEof = false;
-        m_genWfEof = false;
+        // the auto release happens after the generation is done, which is still reported by 'IsDone()'
+        if (!callFromReleaseProc)
+        {
+            m_genSsEof = false;
+            m_genWfEof = false;
+        }
         m_prepared = false;
+        m_prepareFailed = false;
+        m_decodingResHeld = false;
     }
 
     void ReleaseResourceProc()
@@ -1836,7 +2291,7 @@ private:
                 return;
             }
             lock_guard<recursive_mutex> lk(m_apiLock, adopt_lock);
-            m_logger->Log(DEBUG) << "AUTO RELEASE decoding resources." << endl;
+            m_logger->Log(DEBUG) << "AUTO RELEASE decoding resources. " << GetIoBytesRead() << " bytes were read for the overview of '" << m_hParser->GetUrl() << "'." << endl;
             ReleaseResources(true);
         }
     }
@@ -1853,6 +2308,8 @@ private:
 
     AVFormatContext* m_avfmtCtx{nullptr};
     bool m_prepared{false};
+    atomic<bool> m_prepareFailed{false};
+    atomic<bool> m_decodingResHeld{false};
     int m_vidStmIdx{-1};
     int m_audStmIdx{-1};
     bool m_isImage{false};
@@ -1860,7 +2317,14 @@ private:
     AVStream* m_audAvStm{nullptr};
     bool m_decodeVideo{false};
     bool m_decodeAudio{false};
+    bool m_keyframeSnap{false};
     AVCodecPtr m_auddec{nullptr};
+    PreviewCache::Holder m_hPreviewCache;
+    string m_mediaCacheKey;
+    string m_ssCacheKey;
+    string m_wfCacheKey;
+    bool m_ssFromCache{false};
+    bool m_wfFromCache{false};
     FFUtils::OpenVideoDecoderOptions m_viddecOpenOpts;
     AVCodecContext* m_viddecCtx{nullptr};
     AVCodecContext* m_auddecCtx{nullptr};
@@ -1876,8 +2340,9 @@ private:
     AVChannelLayout m_swrOutChlyt{AV_CHANNEL_ORDER_UNSPEC, 0};
 #endif
 
-    // demux video thread
+    // demux video thread, also the single demux thread for both the video and the audio
     thread m_demuxVidThread;
+    atomic<int64_t> m_vidDemuxIoBytes{0};
     list<AVPacket*> m_vidpktQ;
     int m_vidpktQMaxSize{8};
     mutex m_vidpktQLock;
@@ -1895,6 +2360,7 @@ private:
     FFUtils::FFFilterGraph::Holder m_hTransposeFilter;
     // demux audio thread
     thread m_demuxAudThread;
+    atomic<int64_t> m_audDemuxIoBytes{0};
     list<AVPacket*> m_audpktQ;
     int m_audpktQMaxSize{64};
     mutex m_audpktQLock;
@@ -1942,6 +2408,8 @@ private:
     uint32_t m_u32WantedOutWidth{0}, m_u32WantedOutHeight{0};
     bool m_bKeepAspectRatio{true};
     AVFrameToImMatConverter m_frmCvt;
+    uint32_t m_swsThreadCount{0};
+    uint32_t m_vidDecThreadCount{0};
 };
 
 static const auto OVERVIEW_HOLDER_DELETER = [] (Overview* p) {
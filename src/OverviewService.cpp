@@ -0,0 +1,596 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <list>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+#include <condition_variable>
+#include "OverviewService.h"
+#include "ThreadUtils.h"
+
+using namespace std;
+using namespace Logger;
+
+namespace MediaCore
+{
+class OverviewService_Impl : public OverviewService
+{
+public:
+    OverviewService_Impl()
+    {
+        m_logger = OverviewService::GetLogger();
+    }
+
+    OverviewService_Impl(const OverviewService_Impl&) = delete;
+    OverviewService_Impl(OverviewService_Impl&&) = delete;
+    OverviewService_Impl& operator=(const OverviewService_Impl&) = delete;
+
+    virtual ~OverviewService_Impl()
+    {
+        StopService();
+    }
+
+    bool Initialize(const Settings& settings) override
+    {
+        if (settings.snapshotCount == 0)
+        {
+            m_errMsg = "INVALID argument! 'snapshotCount' must be larger than 0.";
+            return false;
+        }
+
+        StopService();
+        lock_guard<mutex> lk(m_lock);
+        m_settings = settings;
+        if (m_settings.maxRunningOverviews == 0)
+            m_settings.maxRunningOverviews = 1;
+        if (m_settings.swsThreads == 0)
+            m_settings.swsThreads = 1;
+        m_jobs.clear();
+        m_finishedJobs.clear();
+        m_runningCount = 0;
+        m_usedDecoders = 0;
+        m_usedThreads = 0;
+        m_usedBytes = 0;
+        m_quit = false;
+        m_serviceThread = thread(&OverviewService_Impl::ServiceThreadProc, this);
+        SysUtils::SetThreadName(m_serviceThread, "OvwService");
+        m_initialized = true;
+        return true;
+    }
+
+    const Settings& GetSettings() const override
+    {
+        return m_settings;
+    }
+
+    void SetProgressCallback(ProgressCallback callback) override
+    {
+        lock_guard<mutex> lk(m_callbackLock);
+        m_progressCallback = callback;
+    }
+
+    bool RequestOverview(const string& url, Priority priority) override
+    {
+        return RequestOverview(url, nullptr, priority);
+    }
+
+    bool RequestOverview(MediaParser::Holder hParser, Priority priority) override
+    {
+        if (!hParser || !hParser->IsOpened())
+        {
+            m_errMsg = "Argument 'hParser' is nullptr or not opened yet!";
+            return false;
+        }
+        return RequestOverview(hParser->GetUrl(), hParser, priority);
+    }
+
+    bool SetPriority(const string& url, Priority priority) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        auto iter = m_jobs.find(url);
+        if (iter == m_jobs.end())
+        {
+            m_errMsg = "No overview is requested for '"+url+"'!";
+            return false;
+        }
+        iter->second->priority = priority;
+        m_jobCv.notify_one();
+        return true;
+    }
+
+    bool CancelOverview(const string& url) override
+    {
+        Overview::Holder hOverview;
+        {
+            lock_guard<mutex> lk(m_lock);
+            auto iter = m_jobs.find(url);
+            if (iter == m_jobs.end())
+                return true;
+            auto hJob = iter->second;
+            // the admission of a job is done out of the lock, let the service thread drop it
+            if (hJob->admitting)
+            {
+                hJob->cancel = true;
+                return true;
+            }
+            if (hJob->state == OVERVIEW_GENERATING)
+                hOverview = hJob->hOverview;
+            ReleaseBudget_Locked(hJob);
+            m_finishedJobs.remove(hJob);
+            m_jobs.erase(iter);
+            m_jobCv.notify_one();
+        }
+        m_doneCv.notify_all();
+        if (hOverview)
+            hOverview->Close();
+        return true;
+    }
+
+    State GetState(const string& url) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        auto iter = m_jobs.find(url);
+        return iter != m_jobs.end() ? iter->second->state : OVERVIEW_NONE;
+    }
+
+    float GetProgress(const string& url) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        auto iter = m_jobs.find(url);
+        if (iter == m_jobs.end())
+            return 0.f;
+        return iter->second->state == OVERVIEW_DONE ? 1.f : iter->second->progress;
+    }
+
+    Overview::Holder GetOverview(const string& url) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        auto iter = m_jobs.find(url);
+        if (iter == m_jobs.end())
+            return nullptr;
+        auto& hJob = iter->second;
+        return hJob->state == OVERVIEW_GENERATING || hJob->state == OVERVIEW_DONE ? hJob->hOverview : nullptr;
+    }
+
+    void WaitAllDone() override
+    {
+        unique_lock<mutex> lk(m_lock);
+        m_doneCv.wait(lk, [this] {
+            if (m_quit)
+                return true;
+            for (auto& elem : m_jobs)
+            {
+                if (elem.second->state == OVERVIEW_QUEUED || elem.second->state == OVERVIEW_GENERATING)
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    string GetError() const override
+    {
+        return m_errMsg;
+    }
+
+private:
+    struct _OverviewJob
+    {
+        string url;
+        MediaParser::Holder hParser;
+        Overview::Holder hOverview;
+        State state{OVERVIEW_NONE};
+        Priority priority{PRIORITY_NORMAL};
+        uint64_t seq{0};
+        float progress{0.f};
+        float reportedProgress{0.f};
+        bool admitting{false};
+        bool cancel{false};
+        // estimated resource usage, accounted from the start of the generation until the decoders are released
+        uint32_t decoders{0};
+        uint32_t threads{0};
+        uint64_t bytes{0};
+        uint32_t vidDecThreads{0};
+        bool budgetHeld{false};
+    };
+    using OverviewJobHolder = shared_ptr<_OverviewJob>;
+    using ProgressNotice = tuple<string, State, float>;
+
+    bool RequestOverview(const string& url, MediaParser::Holder hParser, Priority priority)
+    {
+        lock_guard<mutex> lk(m_lock);
+        if (!m_initialized)
+        {
+            m_errMsg = "This OverviewService is NOT initialized!";
+            return false;
+        }
+        auto iter = m_jobs.find(url);
+        if (iter != m_jobs.end())
+        {
+            auto& hJob = iter->second;
+            if (hJob->state == OVERVIEW_FAILED)
+            {
+                m_errMsg = "Overview generation of '"+url+"' has FAILED before!";
+                return false;
+            }
+            if (hJob->state == OVERVIEW_QUEUED)
+            {
+                hJob->priority = priority;
+                m_jobCv.notify_one();
+            }
+            return true;
+        }
+        OverviewJobHolder hJob(new _OverviewJob());
+        hJob->url = url;
+        hJob->hParser = hParser;
+        hJob->state = OVERVIEW_QUEUED;
+        hJob->priority = priority;
+        hJob->seq = m_jobSeq++;
+        m_jobs[url] = hJob;
+        m_jobCv.notify_one();
+        m_logger->Log(DEBUG) << "Queued overview generation of '" << url << "', priority=" << (int)priority << "." << endl;
+        return true;
+    }
+
+    void StopService()
+    {
+        {
+            lock_guard<mutex> lk(m_lock);
+            m_quit = true;
+        }
+        m_jobCv.notify_all();
+        m_doneCv.notify_all();
+        if (m_serviceThread.joinable())
+            m_serviceThread.join();
+        m_initialized = false;
+    }
+
+    // The overview opens one decoder for each stream. Its threads are the demux, decode and generation ones of each stream,
+    // sharing one demux thread if both streams are present, plus the one releasing the resources, the scaler's slice threads
+    // and the video decoder's own threads, which get what is left of 'maxThreads'. Bytes in flight are the snapshot images
+    // and the decoded frame queues.
+    void EstimateBudget(OverviewJobHolder hJob)
+    {
+        const auto vidStm = hJob->hParser->GetBestVideoStream();
+        const auto audStm = hJob->hParser->GetBestAudioStream();
+        const bool hasVideo = vidStm && vidStm->width > 0 && vidStm->height > 0;
+        const bool hasAudio = audStm && audStm->sampleRate > 0;
+        hJob->decoders = 0;
+        hJob->threads = 1;
+        hJob->bytes = 0;
+        hJob->vidDecThreads = 0;
+        if (hasAudio)
+        {
+            hJob->decoders += 1;
+            hJob->threads += hasVideo ? 2 : 3;
+            hJob->bytes += 5ULL*audStm->sampleRate*audStm->channels*sizeof(float);
+        }
+        if (hasVideo)
+        {
+            uint64_t ssWidth = m_settings.snapshotWidth > 0 ? m_settings.snapshotWidth : vidStm->width;
+            uint64_t ssHeight = m_settings.snapshotHeight > 0 ? m_settings.snapshotHeight : vidStm->height;
+            hJob->decoders += 1;
+            hJob->threads += 3+m_settings.swsThreads;
+            hJob->bytes += m_settings.snapshotCount*ssWidth*ssHeight*4;
+            hJob->bytes += 4*(uint64_t)vidStm->width*vidStm->height*3/2;
+            const uint32_t leftThreads = m_settings.maxThreads > hJob->threads ? m_settings.maxThreads-hJob->threads : 0;
+            hJob->vidDecThreads = max(min(m_settings.videoDecoderThreads, leftThreads), 1u);
+            hJob->threads += hJob->vidDecThreads;
+        }
+    }
+
+    bool FitsBudget_Locked(OverviewJobHolder hJob)
+    {
+        // always let one overview run, however large it is
+        if (m_runningCount == 0)
+            return true;
+        return m_runningCount < m_settings.maxRunningOverviews
+            && m_usedDecoders+hJob->decoders <= m_settings.maxDecoders
+            && m_usedThreads+hJob->threads <= m_settings.maxThreads
+            && m_usedBytes+hJob->bytes <= m_settings.maxBytesInFlight;
+    }
+
+    void AcquireBudget_Locked(OverviewJobHolder hJob)
+    {
+        m_runningCount++;
+        m_usedDecoders += hJob->decoders;
+        m_usedThreads += hJob->threads;
+        m_usedBytes += hJob->bytes;
+        hJob->budgetHeld = true;
+    }
+
+    void ReleaseBudget_Locked(OverviewJobHolder hJob)
+    {
+        if (!hJob->budgetHeld)
+            return;
+        m_runningCount--;
+        m_usedDecoders -= hJob->decoders;
+        m_usedThreads -= hJob->threads;
+        m_usedBytes -= hJob->bytes;
+        hJob->budgetHeld = false;
+    }
+
+    // Finished jobs are kept for the queries, until there are too many of them
+    void AddFinishedJob_Locked(OverviewJobHolder hJob)
+    {
+        m_finishedJobs.push_back(hJob);
+        while (m_finishedJobs.size() > m_settings.maxFinishedOverviews)
+        {
+            EraseJob_Locked(m_finishedJobs.front());
+            m_finishedJobs.pop_front();
+        }
+    }
+
+    OverviewJobHolder PickQueuedJob_Locked()
+    {
+        // highest priority first, then in the request order
+        OverviewJobHolder hJob;
+        for (auto& elem : m_jobs)
+        {
+            auto& hCand = elem.second;
+            if (hCand->state != OVERVIEW_QUEUED)
+                continue;
+            if (!hJob || hCand->priority > hJob->priority || (hCand->priority == hJob->priority && hCand->seq < hJob->seq))
+                hJob = hCand;
+        }
+        return hJob;
+    }
+
+    void UpdateRunningJobs(list<ProgressNotice>& notices, list<Overview::Holder>& failedOverviews)
+    {
+        lock_guard<mutex> lk(m_lock);
+        // the finished jobs are released after the loop, since they may be erased from 'm_jobs'
+        list<OverviewJobHolder> finishedJobs;
+        for (auto& elem : m_jobs)
+        {
+            auto& hJob = elem.second;
+            if (hJob->admitting)
+                continue;
+            auto& hOverview = hJob->hOverview;
+            if (hJob->state == OVERVIEW_DONE)
+            {
+                if (hJob->budgetHeld && hOverview->IsDecodingResourceReleased())
+                    finishedJobs.push_back(hJob);
+                continue;
+            }
+            if (hJob->state != OVERVIEW_GENERATING)
+                continue;
+            hJob->progress = hOverview->GetProgress();
+            const bool ssDone = !hOverview->HasVideo() || hOverview->IsDone();
+            const auto hWaveform = hOverview->GetWaveform();
+            const bool wfDone = !hOverview->HasAudio() || (hWaveform && hWaveform->parseDone);
+            if (hOverview->IsFailed())
+            {
+                m_logger->Log(Error) << "Overview generation of '" << hJob->url << "' FAILED! " << hOverview->GetError() << endl;
+                hJob->state = OVERVIEW_FAILED;
+                finishedJobs.push_back(hJob);
+                failedOverviews.push_back(hOverview);
+                notices.push_back(ProgressNotice(hJob->url, hJob->state, hJob->progress));
+            }
+            else if (ssDone && wfDone)
+            {
+                // the decoders are released a while after the generation is done, the budget is kept until then
+                hJob->state = OVERVIEW_DONE;
+                hJob->progress = 1.f;
+                if (hOverview->IsDecodingResourceReleased())
+                    finishedJobs.push_back(hJob);
+                notices.push_back(ProgressNotice(hJob->url, hJob->state, hJob->progress));
+            }
+            else if (hJob->progress >= hJob->reportedProgress+0.01f)
+            {
+                hJob->reportedProgress = hJob->progress;
+                notices.push_back(ProgressNotice(hJob->url, hJob->state, hJob->progress));
+            }
+        }
+        for (auto& hJob : finishedJobs)
+        {
+            ReleaseBudget_Locked(hJob);
+            AddFinishedJob_Locked(hJob);
+        }
+    }
+
+    // Start the queued jobs as long as the budget allows. Opening the parsers and the overviews reads the files, which is
+    // done out of the lock.
+    void StartQueuedJobs(list<ProgressNotice>& notices)
+    {
+        while (true)
+        {
+            OverviewJobHolder hJob;
+            {
+                lock_guard<mutex> lk(m_lock);
+                if (m_quit)
+                    return;
+                hJob = PickQueuedJob_Locked();
+                if (!hJob)
+                    return;
+                hJob->admitting = true;
+            }
+
+            bool failed = false;
+            if (!hJob->hParser)
+            {
+                auto hParser = MediaParser::CreateInstance();
+                if (hParser->Open(hJob->url))
+                    hJob->hParser = hParser;
+                else
+                {
+                    m_logger->Log(Error) << "Overview of '" << hJob->url << "': FAILED to open source! " << hParser->GetError() << endl;
+                    failed = true;
+                }
+            }
+            if (!failed)
+                EstimateBudget(hJob);
+
+            bool admitted = false;
+            {
+                lock_guard<mutex> lk(m_lock);
+                hJob->admitting = false;
+                if (hJob->cancel)
+                {
+                    EraseJob_Locked(hJob);
+                    continue;
+                }
+                if (failed)
+                {
+                    hJob->state = OVERVIEW_FAILED;
+                    AddFinishedJob_Locked(hJob);
+                    notices.push_back(ProgressNotice(hJob->url, hJob->state, 0.f));
+                    continue;
+                }
+                if (!FitsBudget_Locked(hJob))
+                    return;
+                hJob->state = OVERVIEW_GENERATING;
+                hJob->progress = hJob->reportedProgress = 0.f;
+                hJob->admitting = true;
+                AcquireBudget_Locked(hJob);
+                admitted = true;
+            }
+
+            Overview::Holder hOverview;
+            if (admitted)
+            {
+                hOverview = Overview::CreateInstance();
+                hOverview->EnableHwAccel(m_settings.useHwAccel);
+                hOverview->EnableKeyframeSnap(m_settings.keyframeSnap);
+                hOverview->SetSwsThreadCount(m_settings.swsThreads);
+                if (hJob->vidDecThreads > 0)
+                    hOverview->SetVideoDecoderThreadCount(hJob->vidDecThreads);
+                if (m_settings.hPreviewCache)
+                    hOverview->SetPreviewCache(m_settings.hPreviewCache);
+                if (m_settings.snapshotWidth > 0 || m_settings.snapshotHeight > 0)
+                    hOverview->SetSnapshotSize(m_settings.snapshotWidth, m_settings.snapshotHeight);
+                if (!hOverview->Open(hJob->hParser, m_settings.snapshotCount))
+                {
+                    m_logger->Log(Error) << "Overview of '" << hJob->url << "': FAILED to open Overview! " << hOverview->GetError() << endl;
+                    failed = true;
+                }
+            }
+
+            bool closeOverview = false;
+            {
+                lock_guard<mutex> lk(m_lock);
+                hJob->admitting = false;
+                if (hJob->cancel || failed)
+                {
+                    ReleaseBudget_Locked(hJob);
+                    closeOverview = true;
+                }
+                if (hJob->cancel)
+                    EraseJob_Locked(hJob);
+                else if (failed)
+                {
+                    hJob->state = OVERVIEW_FAILED;
+                    AddFinishedJob_Locked(hJob);
+                }
+                else
+                    hJob->hOverview = hOverview;
+                if (!hJob->cancel)
+                    notices.push_back(ProgressNotice(hJob->url, hJob->state, 0.f));
+                if (!closeOverview)
+                    m_logger->Log(DEBUG) << "Started overview generation of '" << hJob->url << "', " << m_runningCount << " running." << endl;
+            }
+            if (closeOverview)
+                hOverview->Close();
+        }
+    }
+
+    void EraseJob_Locked(OverviewJobHolder hJob)
+    {
+        auto iter = m_jobs.find(hJob->url);
+        if (iter != m_jobs.end() && iter->second == hJob)
+            m_jobs.erase(iter);
+    }
+
+    void ServiceThreadProc()
+    {
+        m_logger->Log(DEBUG) << "Enter OverviewService::ServiceThreadProc()..." << endl;
+        while (true)
+        {
+            {
+                // the progress of the running overviews is polled
+                unique_lock<mutex> lk(m_lock);
+                m_jobCv.wait_for(lk, chrono::milliseconds(50));
+                if (m_quit)
+                    break;
+            }
+
+            list<ProgressNotice> notices;
+            list<Overview::Holder> failedOverviews;
+            UpdateRunningJobs(notices, failedOverviews);
+            // the threads of a failed overview keep waiting until it's closed
+            for (auto& hOverview : failedOverviews)
+                hOverview->Close();
+            StartQueuedJobs(notices);
+            if (notices.empty())
+                continue;
+
+            ProgressCallback callback;
+            {
+                lock_guard<mutex> lk(m_callbackLock);
+                callback = m_progressCallback;
+            }
+            if (callback)
+            {
+                for (auto& notice : notices)
+                    callback(get<0>(notice), get<1>(notice), get<2>(notice));
+            }
+            m_doneCv.notify_all();
+        }
+        m_logger->Log(DEBUG) << "Leave OverviewService::ServiceThreadProc()." << endl;
+    }
+
+private:
+    ALogger* m_logger;
+    string m_errMsg;
+    Settings m_settings;
+    atomic<bool> m_initialized{false};
+    mutex m_lock;
+    condition_variable m_jobCv;
+    condition_variable m_doneCv;
+    unordered_map<string, OverviewJobHolder> m_jobs;
+    list<OverviewJobHolder> m_finishedJobs;
+    uint64_t m_jobSeq{0};
+    uint32_t m_runningCount{0};
+    uint32_t m_usedDecoders{0};
+    uint32_t m_usedThreads{0};
+    uint64_t m_usedBytes{0};
+    mutex m_callbackLock;
+    ProgressCallback m_progressCallback;
+    thread m_serviceThread;
+    bool m_quit{false};
+};
+
+static const auto OVERVIEW_SERVICE_HOLDER_DELETER = [] (OverviewService* p) {
+    OverviewService_Impl* ptr = dynamic_cast<OverviewService_Impl*>(p);
+    delete ptr;
+};
+
+OverviewService::Holder OverviewService::CreateInstance()
+{
+    return OverviewService::Holder(new OverviewService_Impl(), OVERVIEW_SERVICE_HOLDER_DELETER);
+}
+
+ALogger* OverviewService::GetLogger()
+{
+    return Logger::GetLogger("OvwService");
+}
+}
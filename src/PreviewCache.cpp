@@ -0,0 +1,890 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+#include "PreviewCache.h"
+#include "FFUtils.h"
+#include "BoundedQueue.h"
+#include "ThreadUtils.h"
+extern "C"
+{
+    #include "libavutil/avutil.h"
+    #include "libavcodec/avcodec.h"
+}
+
+using namespace std;
+using namespace Logger;
+
+namespace MediaCore
+{
+static const char* PREVIEW_CACHE_FILE_EXT = ".pvc";
+static const uint32_t PREVIEW_CACHE_MAGIC = 0x5643504d;     // 'MPCV'
+static const uint32_t PREVIEW_CACHE_VERSION = 1;
+static const size_t PREVIEW_CACHE_WRITE_QUEUE_SIZE = 64;
+
+enum _EntryType : uint32_t
+{
+    ENTRY_TYPE_DATA = 0,
+    ENTRY_TYPE_IMAGES,
+};
+
+static bool GetFileStat(const string& path, int64_t& size, int64_t& mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    size = (int64_t)st.st_size;
+    mtime = (int64_t)st.st_mtime;
+    return true;
+}
+
+static bool IsDirectory(const string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    return (st.st_mode&S_IFMT) == S_IFDIR;
+}
+
+static bool MakeDirectory(const string& path)
+{
+#if defined(_WIN32)
+    return _mkdir(path.c_str()) == 0;
+#else
+    return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
+static void TouchFile(const string& path)
+{
+#if defined(_WIN32)
+    _utime(path.c_str(), nullptr);
+#else
+    utime(path.c_str(), nullptr);
+#endif
+}
+
+static void ListFiles(const string& dirPath, const string& fileExt, vector<string>& fileNames)
+{
+#if defined(_WIN32)
+    string pattern = dirPath+"/*"+fileExt;
+    struct _finddata_t fileInfo;
+    intptr_t hFind = _findfirst(pattern.c_str(), &fileInfo);
+    if (hFind == -1)
+        return;
+    do
+    {
+        if ((fileInfo.attrib&_A_SUBDIR) == 0)
+            fileNames.push_back(fileInfo.name);
+    } while (_findnext(hFind, &fileInfo) == 0);
+    _findclose(hFind);
+#else
+    DIR* pDir = opendir(dirPath.c_str());
+    if (!pDir)
+        return;
+    struct dirent* pEnt;
+    while ((pEnt = readdir(pDir)) != nullptr)
+    {
+        const string fileName(pEnt->d_name);
+        if (fileName.size() > fileExt.size() && fileName.compare(fileName.size()-fileExt.size(), fileExt.size(), fileExt) == 0)
+            fileNames.push_back(fileName);
+    }
+    closedir(pDir);
+#endif
+}
+
+// 64-bit FNV-1a
+static uint64_t HashString(const string& str)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto c : str)
+    {
+        h ^= (uint8_t)c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+template<typename T>
+static void AppendValue(vector<uint8_t>& buf, const T& val)
+{
+    const uint8_t* p = (const uint8_t*)&val;
+    buf.insert(buf.end(), p, p+sizeof(T));
+}
+
+template<typename T>
+static bool ReadValue(const vector<uint8_t>& buf, size_t& offset, T& val)
+{
+    if (offset+sizeof(T) > buf.size())
+        return false;
+    memcpy(&val, buf.data()+offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+class PreviewCache_Impl : public PreviewCache
+{
+public:
+    PreviewCache_Impl()
+    {
+        m_logger = PreviewCache::GetLogger();
+        m_mat2frmCvt.SetOutPixelFormat(AV_PIX_FMT_YUV420P);
+        m_mat2frmCvt.SetOutColorRange(AVCOL_RANGE_JPEG);
+        m_frm2matCvt.SetUseVulkanConverter(false);
+        m_writeQ.SetMaxSize(PREVIEW_CACHE_WRITE_QUEUE_SIZE);
+    }
+
+    PreviewCache_Impl(const PreviewCache_Impl&) = delete;
+    PreviewCache_Impl(PreviewCache_Impl&&) = delete;
+    PreviewCache_Impl& operator=(const PreviewCache_Impl&) = delete;
+
+    virtual ~PreviewCache_Impl()
+    {
+        Close();
+        if (m_jpegEncCtx)
+            avcodec_free_context(&m_jpegEncCtx);
+        if (m_jpegDecCtx)
+            avcodec_free_context(&m_jpegDecCtx);
+    }
+
+    bool Open(const string& cacheDir, uint64_t sizeLimit) override
+    {
+        if (cacheDir.empty())
+        {
+            SetError("INVALID argument! 'cacheDir' is EMPTY.");
+            return false;
+        }
+        Close();
+        if (!IsDirectory(cacheDir) && !MakeDirectory(cacheDir))
+        {
+            ostringstream oss; oss << "FAILED to create preview cache directory '" << cacheDir << "'!";
+            SetError(oss.str());
+            return false;
+        }
+
+        // scan the directory without holding the lock, the entries are ordered by the last access time kept in the file mtime
+        struct _ScannedFile { string fileName; uint64_t size; int64_t mtime; };
+        vector<_ScannedFile> scannedFiles;
+        vector<string> fileNames;
+        ListFiles(cacheDir, PREVIEW_CACHE_FILE_EXT, fileNames);
+        for (auto& fileName : fileNames)
+        {
+            int64_t size, mtime;
+            if (GetFileStat(cacheDir+"/"+fileName, size, mtime))
+                scannedFiles.push_back({fileName, (uint64_t)size, mtime});
+        }
+        sort(scannedFiles.begin(), scannedFiles.end(), [] (const _ScannedFile& a, const _ScannedFile& b) {
+            return a.mtime < b.mtime;
+        });
+
+        vector<string> evictedPaths;
+        {
+            lock_guard<mutex> lk(m_apiLock);
+            m_cacheDir = cacheDir;
+            m_sizeLimit = sizeLimit;
+            m_entries.clear();
+            m_lruList.clear();
+            m_totalSize = 0;
+            for (auto& file : scannedFiles)
+                AddEntry_Locked(file.fileName, file.size);
+            m_writeQ.Reset();
+            m_writeThread = thread(&PreviewCache_Impl::WriteThreadProc, this);
+            SysUtils::SetThreadName(m_writeThread, "PvcWrite");
+            m_opened = true;
+            m_logger->Log(DEBUG) << "Preview cache opened at '" << m_cacheDir << "', " << m_entries.size() << " entries, total size " << m_totalSize << " bytes." << endl;
+            EvictIfNeeded_Locked(evictedPaths);
+        }
+        RemoveFiles(evictedPaths);
+        return true;
+    }
+
+    void Close() override
+    {
+        // the queued entries are written before the cache is closed
+        m_writeQ.Close();
+        if (m_writeThread.joinable())
+            m_writeThread.join();
+        lock_guard<mutex> lk(m_apiLock);
+        m_pendingWrites.clear();
+        m_entries.clear();
+        m_lruList.clear();
+        m_totalSize = 0;
+        m_cacheDir.clear();
+        m_opened = false;
+    }
+
+    bool IsOpened() const override
+    {
+        return m_opened;
+    }
+
+    void SetSizeLimit(uint64_t sizeLimit) override
+    {
+        vector<string> evictedPaths;
+        {
+            lock_guard<mutex> lk(m_apiLock);
+            m_sizeLimit = sizeLimit;
+            EvictIfNeeded_Locked(evictedPaths);
+        }
+        RemoveFiles(evictedPaths);
+    }
+
+    uint64_t GetSizeLimit() const override
+    {
+        return m_sizeLimit;
+    }
+
+    uint64_t GetTotalSize() const override
+    {
+        return m_totalSize;
+    }
+
+    void Clear() override
+    {
+        vector<string> removedPaths;
+        {
+            lock_guard<mutex> lk(m_apiLock);
+            for (auto& elem : m_entries)
+                removedPaths.push_back(MakeFilePath(elem.first));
+            m_entries.clear();
+            m_lruList.clear();
+            m_totalSize = 0;
+        }
+        RemoveFiles(removedPaths);
+    }
+
+    void Flush() override
+    {
+        unique_lock<mutex> lk(m_apiLock);
+        m_pendingCv.wait(lk, [this] { return m_pendingWrites.empty(); });
+    }
+
+    bool PutData(const string& key, const vector<uint8_t>& data) override
+    {
+        _WriteTaskHolder hTask(new _WriteTask());
+        hTask->key = key;
+        hTask->type = ENTRY_TYPE_DATA;
+        hTask->data = data;
+        return QueueWriteTask(hTask);
+    }
+
+    bool GetData(const string& key, vector<uint8_t>& data) override
+    {
+        vector<uint8_t> payload;
+        size_t offset;
+        _WriteTaskHolder hPending;
+        if (!ReadEntry(key, ENTRY_TYPE_DATA, payload, offset, hPending))
+            return false;
+        if (hPending)
+        {
+            data = hPending->data;
+            return true;
+        }
+        uint64_t dataSize;
+        if (!ReadValue(payload, offset, dataSize) || offset+dataSize > payload.size())
+        {
+            SetError("Preview cache entry is CORRUPTED!");
+            return false;
+        }
+        data.assign(payload.begin()+offset, payload.begin()+offset+dataSize);
+        return true;
+    }
+
+    bool PutImages(const string& key, const vector<ImGui::ImMat>& images) override
+    {
+        _WriteTaskHolder hTask(new _WriteTask());
+        hTask->key = key;
+        hTask->type = ENTRY_TYPE_IMAGES;
+        hTask->images = images;
+        return QueueWriteTask(hTask);
+    }
+
+    bool GetImages(const string& key, vector<ImGui::ImMat>& images) override
+    {
+        vector<uint8_t> payload;
+        size_t offset;
+        _WriteTaskHolder hPending;
+        if (!ReadEntry(key, ENTRY_TYPE_IMAGES, payload, offset, hPending))
+            return false;
+        if (hPending)
+        {
+            images = hPending->images;
+            return true;
+        }
+        uint32_t imgCnt;
+        if (!ReadValue(payload, offset, imgCnt))
+        {
+            SetError("Preview cache entry is CORRUPTED!");
+            return false;
+        }
+        vector<ImGui::ImMat> result;
+        result.reserve(imgCnt);
+        for (uint32_t i = 0; i < imgCnt; i++)
+        {
+            int32_t w, h, clrfmt, dtype;
+            double ts;
+            uint64_t dataSize;
+            if (!ReadValue(payload, offset, w) || !ReadValue(payload, offset, h) || !ReadValue(payload, offset, clrfmt)
+                || !ReadValue(payload, offset, dtype) || !ReadValue(payload, offset, ts) || !ReadValue(payload, offset, dataSize)
+                || offset+dataSize > payload.size())
+            {
+                SetError("Preview cache entry is CORRUPTED!");
+                return false;
+            }
+            ImGui::ImMat img;
+            if (dataSize > 0 && !DecodeJpeg(payload.data()+offset, dataSize, w, h, (ImColorFormat)clrfmt, (ImDataType)dtype, img))
+                return false;
+            img.time_stamp = ts;
+            result.push_back(img);
+            offset += dataSize;
+        }
+        images = std::move(result);
+        return true;
+    }
+
+    bool Contains(const string& key) override
+    {
+        const string fileName = MakeFileName(key);
+        lock_guard<mutex> lk(m_apiLock);
+        return m_opened && (m_entries.find(fileName) != m_entries.end() || m_pendingWrites.find(fileName) != m_pendingWrites.end());
+    }
+
+    bool Remove(const string& key) override
+    {
+        const string fileName = MakeFileName(key);
+        string filePath;
+        {
+            lock_guard<mutex> lk(m_apiLock);
+            if (!m_opened)
+                return false;
+            auto iter = m_entries.find(fileName);
+            if (iter == m_entries.end())
+                return false;
+            filePath = MakeFilePath(fileName);
+            RemoveEntry_Locked(iter);
+        }
+        remove(filePath.c_str());
+        return true;
+    }
+
+    string GetError() const override
+    {
+        lock_guard<mutex> lk(m_errLock);
+        return m_errMsg;
+    }
+
+private:
+    struct _EntryInfo
+    {
+        uint64_t size;
+        list<string>::iterator lruIter;
+    };
+    using EntryIterator = unordered_map<string, _EntryInfo>::iterator;
+
+    // An entry waiting for the writing thread. The images are compressed there, and the task is served to the readers until it's written.
+    struct _WriteTask
+    {
+        string key;
+        string filePath;
+        uint32_t type;
+        vector<uint8_t> data;
+        vector<ImGui::ImMat> images;
+    };
+    using _WriteTaskHolder = shared_ptr<_WriteTask>;
+
+    void SetError(const string& errMsg)
+    {
+        lock_guard<mutex> lk(m_errLock);
+        m_errMsg = errMsg;
+    }
+
+    string MakeFileName(const string& key) const
+    {
+        ostringstream oss;
+        oss << hex << setw(16) << setfill('0') << HashString(key) << PREVIEW_CACHE_FILE_EXT;
+        return oss.str();
+    }
+
+    string MakeFilePath(const string& fileName) const
+    {
+        return m_cacheDir+"/"+fileName;
+    }
+
+    static void RemoveFiles(const vector<string>& filePaths)
+    {
+        for (auto& filePath : filePaths)
+            remove(filePath.c_str());
+    }
+
+    bool QueueWriteTask(_WriteTaskHolder hTask)
+    {
+        const string fileName = MakeFileName(hTask->key);
+        lock_guard<mutex> lk(m_apiLock);
+        if (!m_opened)
+        {
+            SetError("Preview cache is NOT OPENED!");
+            return false;
+        }
+        hTask->filePath = MakeFilePath(fileName);
+        // never block the caller, the cache is best-effort
+        if (!m_writeQ.Push(hTask, false))
+        {
+            SetError("Preview cache write queue is FULL!");
+            m_logger->Log(DEBUG) << "Preview cache write queue is full, entry '" << fileName << "' is dropped." << endl;
+            return false;
+        }
+        m_pendingWrites[fileName] = hTask;
+        return true;
+    }
+
+    void WriteThreadProc()
+    {
+        m_logger->Log(DEBUG) << "Enter WriteThreadProc()..." << endl;
+        _WriteTaskHolder hTask;
+        while (m_writeQ.Pop(hTask))
+        {
+            vector<uint8_t> payload;
+            bool writeOk = BuildPayload(hTask, payload) && WriteEntryFile(hTask, payload);
+            const string fileName = MakeFileName(hTask->key);
+            vector<string> evictedPaths;
+            {
+                lock_guard<mutex> lk(m_apiLock);
+                auto pendingIter = m_pendingWrites.find(fileName);
+                if (pendingIter != m_pendingWrites.end() && pendingIter->second == hTask)
+                    m_pendingWrites.erase(pendingIter);
+                if (writeOk && m_opened)
+                {
+                    auto iter = m_entries.find(fileName);
+                    if (iter != m_entries.end())
+                        RemoveEntry_Locked(iter);
+                    AddEntry_Locked(fileName, GetWrittenSize(hTask, payload));
+                    EvictIfNeeded_Locked(evictedPaths);
+                }
+            }
+            m_pendingCv.notify_all();
+            RemoveFiles(evictedPaths);
+            hTask = nullptr;
+        }
+        m_logger->Log(DEBUG) << "Leave WriteThreadProc()." << endl;
+    }
+
+    bool BuildPayload(_WriteTaskHolder hTask, vector<uint8_t>& payload)
+    {
+        if (hTask->type == ENTRY_TYPE_DATA)
+        {
+            AppendValue(payload, (uint64_t)hTask->data.size());
+            payload.insert(payload.end(), hTask->data.begin(), hTask->data.end());
+            return true;
+        }
+        AppendValue(payload, (uint32_t)hTask->images.size());
+        vector<uint8_t> jpegData;
+        for (auto& img : hTask->images)
+        {
+            jpegData.clear();
+            if (!img.empty() && !EncodeJpeg(img, jpegData))
+            {
+                m_logger->Log(WARN) << "FAILED to compress preview cache image! Error is '" << GetError() << "'." << endl;
+                return false;
+            }
+            AppendValue(payload, (int32_t)img.w);
+            AppendValue(payload, (int32_t)img.h);
+            AppendValue(payload, (int32_t)img.color_format);
+            AppendValue(payload, (int32_t)img.type);
+            AppendValue(payload, img.time_stamp);
+            AppendValue(payload, (uint64_t)jpegData.size());
+            payload.insert(payload.end(), jpegData.begin(), jpegData.end());
+        }
+        return true;
+    }
+
+    static vector<uint8_t> MakeHeader(const string& key, uint32_t type)
+    {
+        vector<uint8_t> header;
+        AppendValue(header, PREVIEW_CACHE_MAGIC);
+        AppendValue(header, PREVIEW_CACHE_VERSION);
+        AppendValue(header, type);
+        AppendValue(header, (uint32_t)key.size());
+        header.insert(header.end(), key.begin(), key.end());
+        return header;
+    }
+
+    static uint64_t GetWrittenSize(_WriteTaskHolder hTask, const vector<uint8_t>& payload)
+    {
+        return MakeHeader(hTask->key, hTask->type).size()+payload.size();
+    }
+
+    // Called by the writing thread only
+    bool WriteEntryFile(_WriteTaskHolder hTask, const vector<uint8_t>& payload)
+    {
+        const auto header = MakeHeader(hTask->key, hTask->type);
+        // write to a temporary file then rename it, so that a partially written entry is never seen
+        const string& filePath = hTask->filePath;
+        const string tmpPath = filePath+".tmp";
+        FILE* fp = fopen(tmpPath.c_str(), "wb");
+        if (!fp)
+        {
+            ostringstream oss; oss << "FAILED to open file '" << tmpPath << "' for writing!";
+            SetError(oss.str());
+            m_logger->Log(WARN) << oss.str() << endl;
+            return false;
+        }
+        bool writeOk = fwrite(header.data(), 1, header.size(), fp) == header.size();
+        if (writeOk && !payload.empty())
+            writeOk = fwrite(payload.data(), 1, payload.size(), fp) == payload.size();
+        if (fclose(fp) != 0)
+            writeOk = false;
+        if (!writeOk || rename(tmpPath.c_str(), filePath.c_str()) != 0)
+        {
+            remove(tmpPath.c_str());
+            ostringstream oss; oss << "FAILED to write preview cache file '" << filePath << "'!";
+            SetError(oss.str());
+            m_logger->Log(WARN) << oss.str() << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // The file is read without holding the lock. If the entry is still waiting to be written, 'hPending' is returned instead of the payload.
+    bool ReadEntry(const string& key, uint32_t type, vector<uint8_t>& payload, size_t& offset, _WriteTaskHolder& hPending)
+    {
+        const string fileName = MakeFileName(key);
+        string filePath;
+        uint64_t fileSize;
+        {
+            lock_guard<mutex> lk(m_apiLock);
+            if (!m_opened)
+            {
+                SetError("Preview cache is NOT OPENED!");
+                return false;
+            }
+            auto pendingIter = m_pendingWrites.find(fileName);
+            if (pendingIter != m_pendingWrites.end())
+            {
+                if (pendingIter->second->type != type || pendingIter->second->key != key)
+                {
+                    SetError("Preview cache entry NOT FOUND.");
+                    return false;
+                }
+                hPending = pendingIter->second;
+                return true;
+            }
+            auto iter = m_entries.find(fileName);
+            if (iter == m_entries.end())
+            {
+                SetError("Preview cache entry NOT FOUND.");
+                return false;
+            }
+            m_lruList.splice(m_lruList.end(), m_lruList, iter->second.lruIter);
+            filePath = MakeFilePath(fileName);
+            fileSize = iter->second.size;
+        }
+
+        FILE* fp = fopen(filePath.c_str(), "rb");
+        if (!fp)
+        {
+            DropEntry(fileName, filePath, false);
+            SetError("Preview cache entry NOT FOUND.");
+            return false;
+        }
+        payload.resize(fileSize);
+        const bool readOk = fread(payload.data(), 1, payload.size(), fp) == payload.size();
+        fclose(fp);
+
+        offset = 0;
+        uint32_t magic, version, entryType, keyLen;
+        if (!readOk || !ReadValue(payload, offset, magic) || magic != PREVIEW_CACHE_MAGIC || !ReadValue(payload, offset, version)
+            || version != PREVIEW_CACHE_VERSION || !ReadValue(payload, offset, entryType) || !ReadValue(payload, offset, keyLen)
+            || offset+keyLen > payload.size())
+        {
+            m_logger->Log(WARN) << "Preview cache file '" << filePath << "' is INVALID, remove it." << endl;
+            DropEntry(fileName, filePath, true);
+            SetError("Preview cache entry is CORRUPTED!");
+            return false;
+        }
+        // different keys can have the same hash, the full key is stored for verification
+        if (entryType != type || key.compare(0, string::npos, (const char*)payload.data()+offset, keyLen) != 0)
+        {
+            SetError("Preview cache entry NOT FOUND.");
+            return false;
+        }
+        offset += keyLen;
+        TouchFile(filePath);
+        return true;
+    }
+
+    void DropEntry(const string& fileName, const string& filePath, bool removeFile)
+    {
+        {
+            lock_guard<mutex> lk(m_apiLock);
+            auto iter = m_entries.find(fileName);
+            if (iter == m_entries.end())
+                return;
+            RemoveEntry_Locked(iter);
+        }
+        if (removeFile)
+            remove(filePath.c_str());
+    }
+
+    void AddEntry_Locked(const string& fileName, uint64_t size)
+    {
+        auto lruIter = m_lruList.insert(m_lruList.end(), fileName);
+        m_entries[fileName] = { size, lruIter };
+        m_totalSize += size;
+    }
+
+    void RemoveEntry_Locked(EntryIterator iter)
+    {
+        m_totalSize -= iter->second.size;
+        m_lruList.erase(iter->second.lruIter);
+        m_entries.erase(iter);
+    }
+
+    // Take the least recently used entries off the index, the caller removes the returned files after releasing the lock
+    void EvictIfNeeded_Locked(vector<string>& evictedPaths)
+    {
+        if (m_sizeLimit == 0 || m_totalSize <= m_sizeLimit)
+            return;
+        // leave some room to avoid evicting on every write
+        const uint64_t targetSize = m_sizeLimit/10*9;
+        uint32_t evictCnt = 0;
+        while (m_totalSize > targetSize && !m_lruList.empty())
+        {
+            auto iter = m_entries.find(m_lruList.front());
+            evictedPaths.push_back(MakeFilePath(iter->first));
+            RemoveEntry_Locked(iter);
+            evictCnt++;
+        }
+        m_logger->Log(DEBUG) << "Preview cache evicted " << evictCnt << " entries, total size is " << m_totalSize << " bytes now." << endl;
+    }
+
+    // Called by the writing thread only, the encoder is reused while the image size stays the same
+    bool EncodeJpeg(const ImGui::ImMat& img, vector<uint8_t>& jpegData)
+    {
+        auto hAvfrm = AllocSelfFreeAVFramePtr();
+        if (!m_mat2frmCvt.ConvertImage(img, hAvfrm.get(), 0))
+        {
+            SetError(m_mat2frmCvt.GetError());
+            return false;
+        }
+        if (m_jpegEncCtx && (m_jpegEncCtx->width != hAvfrm->width || m_jpegEncCtx->height != hAvfrm->height || m_jpegEncCtx->pix_fmt != (AVPixelFormat)hAvfrm->format))
+            avcodec_free_context(&m_jpegEncCtx);
+        if (!m_jpegEncCtx)
+        {
+            AVCodecPtr encCdc = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+            if (!encCdc)
+            {
+                SetError("FAILED to find encoder for codec 'mjpeg'!");
+                return false;
+            }
+            m_jpegEncCtx = avcodec_alloc_context3(encCdc);
+            if (!m_jpegEncCtx)
+            {
+                SetError("FAILED to invoke 'avcodec_alloc_context3()'!");
+                return false;
+            }
+            m_jpegEncCtx->width = hAvfrm->width;
+            m_jpegEncCtx->height = hAvfrm->height;
+            m_jpegEncCtx->pix_fmt = (AVPixelFormat)hAvfrm->format;
+            m_jpegEncCtx->color_range = AVCOL_RANGE_JPEG;
+            m_jpegEncCtx->time_base = { 1, 25 };
+            m_jpegEncCtx->thread_count = 1;
+            m_jpegEncCtx->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+            m_jpegEncCtx->flags |= AV_CODEC_FLAG_QSCALE;
+            m_jpegEncCtx->global_quality = FF_QP2LAMBDA*m_jpegQscale;
+            int fferr = avcodec_open2(m_jpegEncCtx, encCdc, nullptr);
+            if (fferr < 0)
+            {
+                avcodec_free_context(&m_jpegEncCtx);
+                ostringstream oss; oss << "FAILED to invoke 'avcodec_open2()' for mjpeg encoder! fferr = " << fferr << ".";
+                SetError(oss.str());
+                return false;
+            }
+        }
+        hAvfrm->pts = m_jpegEncPts++;
+        hAvfrm->quality = m_jpegEncCtx->global_quality;
+        hAvfrm->color_range = AVCOL_RANGE_JPEG;
+        auto hAvpkt = AllocSelfFreeAVPacketPtr();
+        int fferr = avcodec_send_frame(m_jpegEncCtx, hAvfrm.get());
+        if (fferr >= 0)
+            fferr = avcodec_receive_packet(m_jpegEncCtx, hAvpkt.get());
+        if (fferr == AVERROR(EAGAIN))
+        {
+            // the encoder holds the frame, drain it, a drained encoder can not be reused
+            fferr = avcodec_send_frame(m_jpegEncCtx, nullptr);
+            if (fferr >= 0)
+                fferr = avcodec_receive_packet(m_jpegEncCtx, hAvpkt.get());
+            avcodec_free_context(&m_jpegEncCtx);
+        }
+        if (fferr < 0)
+        {
+            if (m_jpegEncCtx)
+                avcodec_free_context(&m_jpegEncCtx);
+            ostringstream oss; oss << "FAILED to encode image as JPEG! fferr = " << fferr << ".";
+            SetError(oss.str());
+            return false;
+        }
+        jpegData.assign(hAvpkt->data, hAvpkt->data+hAvpkt->size);
+        return true;
+    }
+
+    bool DecodeJpeg(const uint8_t* data, size_t size, int32_t w, int32_t h, ImColorFormat clrfmt, ImDataType dtype, ImGui::ImMat& img)
+    {
+        lock_guard<mutex> lk(m_decodeLock);
+        if (!m_jpegDecCtx)
+        {
+            AVCodecPtr decCdc = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+            if (!decCdc)
+            {
+                SetError("FAILED to find decoder for codec 'mjpeg'!");
+                return false;
+            }
+            m_jpegDecCtx = avcodec_alloc_context3(decCdc);
+            if (!m_jpegDecCtx)
+            {
+                SetError("FAILED to invoke 'avcodec_alloc_context3()'!");
+                return false;
+            }
+            m_jpegDecCtx->thread_count = 1;
+            int fferr = avcodec_open2(m_jpegDecCtx, decCdc, nullptr);
+            if (fferr < 0)
+            {
+                avcodec_free_context(&m_jpegDecCtx);
+                ostringstream oss; oss << "FAILED to invoke 'avcodec_open2()' for mjpeg decoder! fferr = " << fferr << ".";
+                SetError(oss.str());
+                return false;
+            }
+        }
+        auto hAvpkt = AllocSelfFreeAVPacketPtr();
+        int fferr = av_new_packet(hAvpkt.get(), (int)size);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to invoke 'av_new_packet()'! fferr = " << fferr << ".";
+            SetError(oss.str());
+            return false;
+        }
+        memcpy(hAvpkt->data, data, size);
+        hAvpkt->flags |= AV_PKT_FLAG_KEY;
+        auto hAvfrm = AllocSelfFreeAVFramePtr();
+        fferr = avcodec_send_packet(m_jpegDecCtx, hAvpkt.get());
+        if (fferr >= 0)
+            fferr = avcodec_receive_frame(m_jpegDecCtx, hAvfrm.get());
+        if (fferr == AVERROR(EAGAIN))
+        {
+            fferr = avcodec_send_packet(m_jpegDecCtx, nullptr);
+            if (fferr >= 0)
+                fferr = avcodec_receive_frame(m_jpegDecCtx, hAvfrm.get());
+            avcodec_flush_buffers(m_jpegDecCtx);
+        }
+        if (fferr < 0)
+        {
+            avcodec_flush_buffers(m_jpegDecCtx);
+            ostringstream oss; oss << "FAILED to decode JPEG image! fferr = " << fferr << ".";
+            SetError(oss.str());
+            return false;
+        }
+        if (!m_frm2matCvt.SetOutSize(w, h) || !m_frm2matCvt.SetOutColorFormat(clrfmt) || !m_frm2matCvt.SetOutDataType(dtype)
+            || !m_frm2matCvt.ConvertImage(hAvfrm.get(), img, 0))
+        {
+            SetError(m_frm2matCvt.GetError());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    ALogger* m_logger;
+    string m_errMsg;
+    mutable mutex m_errLock;
+    // guards the index and the pending writes, it's never held across file I/O or image compression
+    mutex m_apiLock;
+    atomic<bool> m_opened{false};
+    string m_cacheDir;
+    atomic<uint64_t> m_sizeLimit{0};
+    atomic<uint64_t> m_totalSize{0};
+    unordered_map<string, _EntryInfo> m_entries;
+    list<string> m_lruList;     // file names, from the least recently used to the most recently used
+    // background writing
+    BoundedQueue<_WriteTaskHolder> m_writeQ;
+    thread m_writeThread;
+    unordered_map<string, _WriteTaskHolder> m_pendingWrites;    // by file name
+    condition_variable m_pendingCv;
+    ImMatToAVFrameConverter m_mat2frmCvt;
+    AVCodecContext* m_jpegEncCtx{nullptr};
+    int64_t m_jpegEncPts{0};
+    int m_jpegQscale{4};
+    // decoding, shared by the reading threads
+    mutex m_decodeLock;
+    AVCodecContext* m_jpegDecCtx{nullptr};
+    AVFrameToImMatConverter m_frm2matCvt;
+};
+
+static const auto PREVIEW_CACHE_HOLDER_DELETER = [] (PreviewCache* p) {
+    PreviewCache_Impl* ptr = dynamic_cast<PreviewCache_Impl*>(p);
+    delete ptr;
+};
+
+PreviewCache::Holder PreviewCache::CreateInstance()
+{
+    return PreviewCache::Holder(new PreviewCache_Impl(), PREVIEW_CACHE_HOLDER_DELETER);
+}
+
+static PreviewCache::Holder _DEFAULT_PREVIEW_CACHE;
+static mutex _DEFAULT_PREVIEW_CACHE_ACCESS_LOCK;
+
+PreviewCache::Holder PreviewCache::GetDefaultInstance()
+{
+    lock_guard<mutex> lk(_DEFAULT_PREVIEW_CACHE_ACCESS_LOCK);
+    if (!_DEFAULT_PREVIEW_CACHE)
+        _DEFAULT_PREVIEW_CACHE = PreviewCache::CreateInstance();
+    return _DEFAULT_PREVIEW_CACHE;
+}
+
+ALogger* PreviewCache::GetLogger()
+{
+    return Logger::GetLogger("PreviewCache");
+}
+
+string PreviewCache::MakeMediaKey(const string& url)
+{
+    int64_t size, mtime;
+    if (!GetFileStat(url, size, mtime))
+        return "";
+    ostringstream oss;
+    oss << url << "|" << size << "|" << mtime;
+    return oss.str();
+}
+}
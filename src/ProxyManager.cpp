@@ -0,0 +1,510 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+#include <condition_variable>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+#include "ProxyManager.h"
+#include "MediaReader.h"
+#include "ThreadUtils.h"
+
+using namespace std;
+using namespace Logger;
+
+namespace MediaCore
+{
+static bool GetFileStat(const string& path, int64_t& size, int64_t& mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    size = (int64_t)st.st_size;
+    mtime = (int64_t)st.st_mtime;
+    return true;
+}
+
+static bool IsDirectory(const string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    return (st.st_mode&S_IFMT) == S_IFDIR;
+}
+
+static bool MakeDirectory(const string& path)
+{
+#if defined(_WIN32)
+    return _mkdir(path.c_str()) == 0;
+#else
+    return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
+// 64-bit FNV-1a
+static uint64_t HashString(const string& str)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto c : str)
+    {
+        h ^= (uint8_t)c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+class ProxyManager_Impl : public ProxyManager
+{
+public:
+    ProxyManager_Impl()
+    {
+        m_logger = ProxyManager::GetLogger();
+    }
+
+    ProxyManager_Impl(const ProxyManager_Impl&) = delete;
+    ProxyManager_Impl(ProxyManager_Impl&&) = delete;
+    ProxyManager_Impl& operator=(const ProxyManager_Impl&) = delete;
+
+    virtual ~ProxyManager_Impl()
+    {
+        StopWorkers();
+    }
+
+    bool Initialize(const Settings& settings) override
+    {
+        if (settings.proxyDir.empty())
+        {
+            m_errMsg = "INVALID argument! 'proxyDir' is EMPTY.";
+            return false;
+        }
+        if (settings.codecName.empty() || settings.fileExtension.empty())
+        {
+            m_errMsg = "INVALID argument! 'codecName' and 'fileExtension' must be specified.";
+            return false;
+        }
+        if (settings.maxHeight < 2)
+        {
+            m_errMsg = "INVALID argument! 'maxHeight' is too small.";
+            return false;
+        }
+        if (!IsDirectory(settings.proxyDir) && !MakeDirectory(settings.proxyDir))
+        {
+            ostringstream oss; oss << "FAILED to create proxy directory '" << settings.proxyDir << "'!";
+            m_errMsg = oss.str();
+            return false;
+        }
+
+        StopWorkers();
+        lock_guard<mutex> lk(m_lock);
+        m_settings = settings;
+        if (m_settings.workerCount == 0)
+            m_settings.workerCount = 1;
+        m_tasks.clear();
+        m_quit = false;
+        for (uint32_t i = 0; i < m_settings.workerCount; i++)
+        {
+            m_workers.push_back(thread(&ProxyManager_Impl::WorkerThreadProc, this));
+            ostringstream thnOss; thnOss << "PxyGen" << i;
+            SysUtils::SetThreadName(m_workers.back(), thnOss.str());
+        }
+        m_initialized = true;
+        return true;
+    }
+
+    const Settings& GetSettings() const override
+    {
+        return m_settings;
+    }
+
+    void SetProxyEnabled(bool enable) override
+    {
+        m_enabled = enable;
+    }
+
+    bool IsProxyEnabled() const override
+    {
+        return m_enabled;
+    }
+
+    bool RequestProxy(const string& url, Priority priority) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        if (!m_initialized)
+        {
+            m_errMsg = "This ProxyManager is NOT initialized!";
+            return false;
+        }
+        auto hTask = GetTask_Locked(url);
+        if (!hTask)
+        {
+            m_errMsg = "FAILED to access source file '"+url+"'!";
+            return false;
+        }
+        if (hTask->state == PROXY_FAILED)
+        {
+            m_errMsg = "Proxy generation of '"+url+"' has FAILED before!";
+            return false;
+        }
+        if (hTask->state == PROXY_NONE)
+        {
+            hTask->state = PROXY_QUEUED;
+            hTask->priority = priority;
+            hTask->seq = m_taskSeq++;
+            m_taskCv.notify_one();
+            m_logger->Log(DEBUG) << "Queued proxy generation of '" << url << "', priority=" << (int)priority << "." << endl;
+        }
+        else if (hTask->state == PROXY_QUEUED && priority > hTask->priority)
+        {
+            hTask->priority = priority;
+        }
+        return true;
+    }
+
+    bool CancelProxy(const string& url) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        auto iter = m_tasks.find(url);
+        if (iter == m_tasks.end())
+            return true;
+        auto hTask = iter->second;
+        if (hTask->state == PROXY_GENERATING)
+            hTask->cancel = true;
+        else if (hTask->state != PROXY_READY)
+            m_tasks.erase(iter);
+        m_doneCv.notify_all();
+        return true;
+    }
+
+    State GetProxyState(const string& url) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        if (!m_initialized)
+            return PROXY_NONE;
+        auto hTask = GetTask_Locked(url);
+        return hTask ? hTask->state : PROXY_NONE;
+    }
+
+    float GetProxyProgress(const string& url) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        auto iter = m_tasks.find(url);
+        if (iter == m_tasks.end())
+            return 0.f;
+        return iter->second->state == PROXY_READY ? 1.f : (float)iter->second->progress;
+    }
+
+    string GetProxyUrl(const string& url) override
+    {
+        lock_guard<mutex> lk(m_lock);
+        if (!m_initialized)
+            return "";
+        auto hTask = GetTask_Locked(url);
+        return hTask && hTask->state == PROXY_READY ? hTask->proxyPath : "";
+    }
+
+    MediaParser::Holder AcquireProxy(const string& url, Priority priority) override
+    {
+        if (!m_enabled || !m_initialized)
+            return nullptr;
+        const auto state = GetProxyState(url);
+        if (state == PROXY_READY)
+        {
+            const string proxyPath = GetProxyUrl(url);
+            auto hParser = MediaParser::CreateInstance();
+            if (hParser->Open(proxyPath) && hParser->HasVideo())
+                return hParser;
+            m_logger->Log(WARN) << "FAILED to open proxy '" << proxyPath << "' of '" << url << "'! " << hParser->GetError() << endl;
+            return nullptr;
+        }
+        if (m_settings.autoGenerate && (state == PROXY_NONE || state == PROXY_QUEUED))
+            RequestProxy(url, priority);
+        return nullptr;
+    }
+
+    void WaitAllDone() override
+    {
+        unique_lock<mutex> lk(m_lock);
+        m_doneCv.wait(lk, [this] {
+            if (m_quit)
+                return true;
+            for (auto& elem : m_tasks)
+            {
+                if (elem.second->state == PROXY_QUEUED || elem.second->state == PROXY_GENERATING)
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    string GetError() const override
+    {
+        return m_errMsg;
+    }
+
+private:
+    struct _ProxyTask
+    {
+        string url;
+        string proxyPath;
+        State state{PROXY_NONE};
+        Priority priority{PRIORITY_NORMAL};
+        uint64_t seq{0};
+        atomic<double> progress{0};
+        atomic<bool> cancel{false};
+    };
+    using ProxyTaskHolder = shared_ptr<_ProxyTask>;
+
+    // The proxy file name is derived from the url, size and modification time of the source, so a modified source gets a new proxy
+    ProxyTaskHolder GetTask_Locked(const string& url)
+    {
+        auto iter = m_tasks.find(url);
+        if (iter != m_tasks.end())
+            return iter->second;
+        int64_t srcSize, srcMtime;
+        if (!GetFileStat(url, srcSize, srcMtime))
+            return nullptr;
+        ostringstream keyOss; keyOss << url << "|" << srcSize << "|" << srcMtime;
+        ostringstream pathOss;
+        pathOss << m_settings.proxyDir;
+        const char lastChar = m_settings.proxyDir.back();
+        if (lastChar != '/' && lastChar != '\\')
+            pathOss << "/";
+        pathOss << SysUtils::ExtractFileBaseName(url) << "_" << hex << setw(16) << setfill('0') << HashString(keyOss.str())
+                << "." << m_settings.fileExtension;
+
+        ProxyTaskHolder hTask(new _ProxyTask());
+        hTask->url = url;
+        hTask->proxyPath = pathOss.str();
+        int64_t proxySize, proxyMtime;
+        if (GetFileStat(hTask->proxyPath, proxySize, proxyMtime) && proxySize > 0)
+            hTask->state = PROXY_READY;
+        m_tasks[url] = hTask;
+        return hTask;
+    }
+
+    void StopWorkers()
+    {
+        {
+            lock_guard<mutex> lk(m_lock);
+            m_quit = true;
+            for (auto& elem : m_tasks)
+                elem.second->cancel = true;
+        }
+        m_taskCv.notify_all();
+        m_doneCv.notify_all();
+        for (auto& th : m_workers)
+        {
+            if (th.joinable())
+                th.join();
+        }
+        m_workers.clear();
+        m_initialized = false;
+    }
+
+    void WorkerThreadProc()
+    {
+        m_logger->Log(DEBUG) << "Enter ProxyManager::WorkerThreadProc()..." << endl;
+        while (true)
+        {
+            ProxyTaskHolder hTask;
+            {
+                unique_lock<mutex> lk(m_lock);
+                m_taskCv.wait(lk, [this, &hTask] {
+                    if (m_quit)
+                        return true;
+                    // highest priority first, then in the request order
+                    for (auto& elem : m_tasks)
+                    {
+                        auto& hCand = elem.second;
+                        if (hCand->state != PROXY_QUEUED)
+                            continue;
+                        if (!hTask || hCand->priority > hTask->priority || (hCand->priority == hTask->priority && hCand->seq < hTask->seq))
+                            hTask = hCand;
+                    }
+                    return (bool)hTask;
+                });
+                if (m_quit)
+                    break;
+                hTask->state = PROXY_GENERATING;
+                hTask->progress = 0;
+            }
+
+            const auto result = GenerateProxy(hTask);
+            {
+                lock_guard<mutex> lk(m_lock);
+                if (hTask->cancel)
+                {
+                    auto iter = m_tasks.find(hTask->url);
+                    if (iter != m_tasks.end() && iter->second == hTask)
+                        m_tasks.erase(iter);
+                    hTask->state = PROXY_NONE;
+                }
+                else
+                {
+                    hTask->state = result;
+                }
+            }
+            m_doneCv.notify_all();
+        }
+        m_logger->Log(DEBUG) << "Leave ProxyManager::WorkerThreadProc()." << endl;
+    }
+
+    State GenerateProxy(ProxyTaskHolder hTask)
+    {
+        auto hParser = MediaParser::CreateInstance();
+        if (!hParser->Open(hTask->url))
+        {
+            m_logger->Log(Error) << "Proxy of '" << hTask->url << "': FAILED to open source! " << hParser->GetError() << endl;
+            return PROXY_FAILED;
+        }
+        auto vidStm = hParser->GetBestVideoStream();
+        if (!vidStm || vidStm->isImage)
+        {
+            m_logger->Log(Error) << "Proxy of '" << hTask->url << "': source has NO video stream!" << endl;
+            return PROXY_FAILED;
+        }
+        if (vidStm->height <= m_settings.maxHeight)
+            return PROXY_NOT_REQUIRED;
+        Ratio frameRate = vidStm->avgFrameRate;
+        if (!Ratio::IsValid(frameRate))
+            frameRate = vidStm->realFrameRate;
+        if (!Ratio::IsValid(frameRate))
+        {
+            m_logger->Log(Error) << "Proxy of '" << hTask->url << "': source has NO valid frame rate!" << endl;
+            return PROXY_FAILED;
+        }
+        const uint32_t outHeight = m_settings.maxHeight&~1U;
+        uint32_t outWidth = (uint32_t)((uint64_t)vidStm->width*outHeight/vidStm->height);
+        outWidth += outWidth&0x1;
+        const int64_t durMts = (int64_t)(vidStm->duration*1000);
+
+        auto hReader = MediaReader::CreateVideoInstance("PxyRdr");
+        if (!hReader->Open(hParser) || !hReader->ConfigVideoReader(outWidth, outHeight, IM_CF_RGBA, IM_DT_INT8, IM_INTERPOLATE_AREA)
+                || !hReader->Start())
+        {
+            m_logger->Log(Error) << "Proxy of '" << hTask->url << "': FAILED to setup MediaReader! " << hReader->GetError() << endl;
+            return PROXY_FAILED;
+        }
+
+        // encode into a temporary file, which is renamed when it's complete
+        const string& proxyPath = hTask->proxyPath;
+        const auto extPos = proxyPath.rfind('.');
+        const string tmpPath = proxyPath.substr(0, extPos)+".part"+proxyPath.substr(extPos);
+        auto hEncoder = MediaEncoder::CreateInstance();
+        uint64_t bitRate = m_settings.bitRate;
+        if (bitRate == 0)
+            bitRate = (uint64_t)outWidth*outHeight*frameRate.num/frameRate.den;
+        auto extraOpts = m_settings.extraOpts;
+        string imageFormat;
+        if (!hEncoder->Open(tmpPath) || !hEncoder->ConfigureVideoStream(m_settings.codecName, imageFormat, outWidth, outHeight,
+                frameRate, bitRate, extraOpts.empty() ? nullptr : &extraOpts) || !hEncoder->Start())
+        {
+            m_logger->Log(Error) << "Proxy of '" << hTask->url << "': FAILED to setup MediaEncoder! " << hEncoder->GetError() << endl;
+            hEncoder->Close();
+            remove(tmpPath.c_str());
+            return PROXY_FAILED;
+        }
+
+        bool success = true;
+        bool eof = false;
+        ImGui::ImMat vmat;
+        for (int64_t frmIdx = 0; !eof && !hTask->cancel; frmIdx++)
+        {
+            const int64_t pos = frmIdx*frameRate.den*1000/frameRate.num;
+            auto hVf = hReader->ReadVideoFrame(pos, eof);
+            if (eof)
+                break;
+            if (!hVf || !hVf->GetMat(vmat) || vmat.empty())
+            {
+                m_logger->Log(Error) << "Proxy of '" << hTask->url << "': FAILED to read frame at " << pos << "ms! " << hReader->GetError() << endl;
+                success = false;
+                break;
+            }
+            vmat.time_stamp = (double)pos/1000;
+            if (!hEncoder->EncodeVideoFrame(vmat))
+            {
+                m_logger->Log(Error) << "Proxy of '" << hTask->url << "': FAILED to encode frame at " << pos << "ms! " << hEncoder->GetError() << endl;
+                success = false;
+                break;
+            }
+            if (durMts > 0)
+                hTask->progress = min((double)pos/durMts, 1.);
+        }
+        hReader->Close();
+        if (success && !hTask->cancel)
+        {
+            vmat.release();
+            success = hEncoder->EncodeVideoFrame(vmat) && hEncoder->FinishEncoding();
+            if (!success)
+                m_logger->Log(Error) << "Proxy of '" << hTask->url << "': FAILED to finish encoding! " << hEncoder->GetError() << endl;
+        }
+        hEncoder->Close();
+        if (!success || hTask->cancel)
+        {
+            remove(tmpPath.c_str());
+            return PROXY_FAILED;
+        }
+        remove(proxyPath.c_str());
+        if (rename(tmpPath.c_str(), proxyPath.c_str()) != 0)
+        {
+            m_logger->Log(Error) << "Proxy of '" << hTask->url << "': FAILED to rename '" << tmpPath << "' to '" << proxyPath << "'!" << endl;
+            remove(tmpPath.c_str());
+            return PROXY_FAILED;
+        }
+        m_logger->Log(INFO) << "Generated proxy '" << proxyPath << "' (" << outWidth << "x" << outHeight << ") for '" << hTask->url << "'." << endl;
+        return PROXY_READY;
+    }
+
+private:
+    ALogger* m_logger;
+    string m_errMsg;
+    Settings m_settings;
+    atomic<bool> m_initialized{false};
+    atomic<bool> m_enabled{true};
+    mutex m_lock;
+    condition_variable m_taskCv;
+    condition_variable m_doneCv;
+    unordered_map<string, ProxyTaskHolder> m_tasks;
+    uint64_t m_taskSeq{0};
+    vector<thread> m_workers;
+    bool m_quit{false};
+};
+
+static const auto PROXY_MANAGER_HOLDER_DELETER = [] (ProxyManager* p) {
+    ProxyManager_Impl* ptr = dynamic_cast<ProxyManager_Impl*>(p);
+    delete ptr;
+};
+
+ProxyManager::Holder ProxyManager::CreateInstance()
+{
+    return ProxyManager::Holder(new ProxyManager_Impl(), PROXY_MANAGER_HOLDER_DELETER);
+}
+
+ALogger* ProxyManager::GetLogger()
+{
+    return Logger::GetLogger("ProxyMgr");
+}
+}
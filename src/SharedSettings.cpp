@@ -47,6 +47,16 @@ class SharedSettings_Impl : public SharedSettings
         return m_hHwaMgr;
     }
 
+    ProxyManager::Holder GetProxyManager() const override
+    {
+        return m_exportMode ? nullptr : m_hProxyMgr;
+    }
+
+    bool IsExportMode() const override
+    {
+        return m_exportMode;
+    }
+
     uint32_t AudioOutChannels() const override
     {
         return m_audOutChannels;
@@ -103,6 +113,16 @@ class SharedSettings_Impl : public SharedSettings
         m_hHwaMgr = hHwaMgr;
     }
 
+    void SetProxyManager(ProxyManager::Holder hProxyMgr) override
+    {
+        m_hProxyMgr = hProxyMgr;
+    }
+
+    void SetExportMode(bool exportMode) override
+    {
+        m_exportMode = exportMode;
+    }
+
     void SetAudioOutChannels(uint32_t channels) override
     {
         m_audOutChannels = channels;
@@ -174,6 +194,8 @@ private:
     ImColorFormat m_vidOutColorFormat{IM_CF_RGBA};
     ImDataType m_vidOutDataType{IM_DT_FLOAT32};
     HwaccelManager::Holder m_hHwaMgr;
+    ProxyManager::Holder m_hProxyMgr;
+    bool m_exportMode{false};
     uint32_t m_audOutChannels{0};
     uint32_t m_audOutSampleRate{0};
     ImDataType m_audOutDataType{IM_DT_FLOAT32};
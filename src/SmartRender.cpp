@@ -0,0 +1,361 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <list>
+#include <unordered_map>
+#include <sstream>
+#include <algorithm>
+#include "SmartRender.h"
+#include "SubtitleClip.h"
+#include "FFUtils.h"
+extern "C"
+{
+    #include "libavcodec/avcodec.h"
+    #include "libavutil/avutil.h"
+}
+
+using namespace std;
+using namespace Logger;
+
+namespace MediaCore
+{
+namespace SmartRender
+{
+using TimeRange = pair<int64_t, int64_t>;
+
+static void SubtractRange(list<TimeRange>& ranges, const TimeRange& cut)
+{
+    auto iter = ranges.begin();
+    while (iter != ranges.end())
+    {
+        if (cut.second <= iter->first || cut.first >= iter->second)
+        {
+            iter++;
+            continue;
+        }
+        const TimeRange r = *iter;
+        iter = ranges.erase(iter);
+        if (r.first < cut.first)
+            ranges.insert(iter, {r.first, cut.first});
+        if (cut.second < r.second)
+            ranges.insert(iter, {cut.second, r.second});
+    }
+}
+
+static bool IsSameCodec(const VideoStream* vidstm, const string& codecName)
+{
+    AVCodecID codecId = AV_CODEC_ID_NONE;
+    auto encoder = avcodec_find_encoder_by_name(codecName.c_str());
+    if (encoder)
+    {
+        codecId = encoder->id;
+    }
+    else
+    {
+        auto desc = avcodec_descriptor_get_by_name(codecName.c_str());
+        if (desc)
+            codecId = desc->id;
+    }
+    auto desc = avcodec_descriptor_get(codecId);
+    if (!desc)
+        return false;
+    // 'VideoStream::codec' stores the long name of the codec descriptor
+    const string name = desc->long_name ? desc->long_name : desc->name ? desc->name : "unknown";
+    return name == vidstm->codec;
+}
+
+static bool IsIdentityTransform(VideoTransformFilter::Holder hTrans, const VideoExportSettings& settings)
+{
+    if (!hTrans)
+        return true;
+    if (hTrans->GetOutWidth() != settings.width || hTrans->GetOutHeight() != settings.height)
+        return false;
+    if (hTrans->IsKeyFramesEnabledOnPosOffset() || hTrans->IsKeyFramesEnabledOnCrop() || hTrans->IsKeyFramesEnabledOnScale()
+            || hTrans->IsKeyFramesEnabledOnRotation() || hTrans->IsKeyFramesEnabledOnOpacity())
+        return false;
+    if (hTrans->GetPosOffsetX() != 0 || hTrans->GetPosOffsetY() != 0)
+        return false;
+    if (hTrans->GetCropL() != 0 || hTrans->GetCropT() != 0 || hTrans->GetCropR() != 0 || hTrans->GetCropB() != 0)
+        return false;
+    if (fabs(hTrans->GetScaleX()-1.f) > 1e-6 || fabs(hTrans->GetScaleY()-1.f) > 1e-6)
+        return false;
+    if (fabs(hTrans->GetRotation()) > 1e-6 || hTrans->GetOpacity() < 1.f)
+        return false;
+    if (hTrans->GetOpacityMaskCount() > 0)
+        return false;
+    return true;
+}
+
+static bool IsClipPassthroughCapable(VideoClip::Holder hClip, const VideoExportSettings& settings)
+{
+    if (hClip->IsImage() || hClip->GetFilter())
+        return false;
+    auto hParser = hClip->GetMediaParser();
+    if (!hParser || hParser->IsImageSequence())
+        return false;
+    auto vidstm = hParser->GetBestVideoStream();
+    if (!vidstm)
+        return false;
+    if (vidstm->width != settings.width || vidstm->height != settings.height || fabs(vidstm->displayRotation) > 1e-6)
+        return false;
+    if (!settings.imageFormat.empty() && settings.imageFormat != vidstm->format)
+        return false;
+    if ((int64_t)vidstm->avgFrameRate.num*settings.frameRate.den != (int64_t)settings.frameRate.num*vidstm->avgFrameRate.den)
+        return false;
+    if (!IsSameCodec(vidstm, settings.codecName))
+        return false;
+    if (!IsIdentityTransform(hClip->GetTransformFilter(), settings))
+        return false;
+    return true;
+}
+
+// Shrink the timeline range covered by 'hClip' to whole GOPs of its source, and check the GOP boundaries fall on the output frame grid
+static bool AlignRangeToGop(VideoClip::Holder hClip, const TimeRange& range, const VideoExportSettings& settings, Segment& seg)
+{
+    auto hParser = hClip->GetMediaParser();
+    auto hSeekPoints = hParser->GetVideoSeekPoints(false);
+    if (!hSeekPoints || hSeekPoints->empty())
+        return false;
+    auto vidstm = hParser->GetBestVideoStream();
+    const AVRational tb = { vidstm->timebase.num, vidstm->timebase.den };
+    const int64_t clipOrigin = hClip->Start()-hClip->StartOffset();
+    const int64_t srcPts0 = vidstm->startPts+av_rescale_q(range.first-clipOrigin, MILLISEC_TIMEBASE, tb);
+    const int64_t srcPts1 = vidstm->startPts+av_rescale_q(range.second-clipOrigin, MILLISEC_TIMEBASE, tb);
+
+    auto& seekPoints = *hSeekPoints;
+    auto iter0 = lower_bound(seekPoints.begin(), seekPoints.end(), srcPts0);
+    auto iter1 = upper_bound(seekPoints.begin(), seekPoints.end(), srcPts1);
+    if (iter0 == seekPoints.end() || iter1 == seekPoints.begin())
+        return false;
+    iter1--;
+    if (*iter1 <= *iter0)
+        return false;
+
+    const int64_t start = clipOrigin+av_rescale_q(*iter0-vidstm->startPts, tb, MILLISEC_TIMEBASE);
+    const int64_t end = clipOrigin+av_rescale_q(*iter1-vidstm->startPts, tb, MILLISEC_TIMEBASE);
+    if (end-start < settings.minPassthroughDuration)
+        return false;
+    // the output frames are produced on the frame grid of the timeline, the copied GOPs must start and end on it
+    const auto& fps = settings.frameRate;
+    for (auto mts : { start, end })
+    {
+        const int64_t frmIdx = (int64_t)llround((double)mts*fps.num/(fps.den*1000.));
+        const int64_t gridMts = (int64_t)llround((double)frmIdx*fps.den*1000./fps.num);
+        if (llabs(gridMts-mts) > 1)
+            return false;
+    }
+
+    seg.start = start;
+    seg.end = end;
+    seg.passthrough = true;
+    seg.hParser = hParser;
+    seg.srcStartPts = *iter0;
+    seg.srcEndPts = *iter1;
+    return true;
+}
+
+vector<Segment> PlanVideoSegments(MultiTrackVideoReader::Holder hMtvReader, const VideoExportSettings& settings, MediaEncoder::Holder hEncoder)
+{
+    vector<Segment> segments;
+    if (!hMtvReader || !Ratio::IsValid(settings.frameRate))
+        return segments;
+    const int64_t duration = hMtvReader->Duration();
+    if (duration <= 0)
+        return segments;
+    auto logger = GetLogger();
+
+    // any visible subtitle needs the frame to be rendered
+    list<TimeRange> subtitleRanges;
+    for (auto& hSubTrack : settings.subtitleTracks)
+    {
+        if (!hSubTrack || !hSubTrack->IsVisible() || hSubTrack->ClipCount() == 0)
+            continue;
+        // take a copy of the clips, iterating the track by 'SeekToIndex()'/'GetNextClip()' would move the player's read position
+        const int64_t subEnd = max(hSubTrack->Duration(), duration)+1;
+        for (auto& hSubClip : hSubTrack->GetClipsByTimeRange(0, subEnd))
+            subtitleRanges.push_back({hSubClip->StartTime(), hSubClip->EndTime()});
+    }
+
+    // tracks at the front of the list are mixed on top of the following ones, a full-frame opaque clip hides everything below it
+    vector<Segment> passthroughSegs;
+    list<VideoTrack::Holder> upperTracks;
+    // the check opens and probes the source, it's done once for each source
+    unordered_map<MediaParser*, bool> encoderCompatible;
+    auto isEncoderCompatible = [&] (MediaParser::Holder hParser) {
+        if (!hEncoder)
+            return true;
+        auto iter = encoderCompatible.find(hParser.get());
+        if (iter != encoderCompatible.end())
+            return iter->second;
+        const bool compatible = hEncoder->CheckVideoPassthrough(hParser);
+        if (!compatible)
+            logger->Log(DEBUG) << "Source '" << hParser->GetUrl() << "' is re-encoded: " << hEncoder->GetError() << endl;
+        encoderCompatible[hParser.get()] = compatible;
+        return compatible;
+    };
+    for (auto trkIter = hMtvReader->TrackListBegin(); trkIter != hMtvReader->TrackListEnd(); trkIter++)
+    {
+        auto hTrack = *trkIter;
+        if (!hTrack->IsVisible())
+            continue;
+        auto clipList = hTrack->GetClipList();
+        auto ovlpList = hTrack->GetOverlapList();
+        for (auto& hClip : clipList)
+        {
+            if (!IsClipPassthroughCapable(hClip, settings) || !isEncoderCompatible(hClip->GetMediaParser()))
+                continue;
+            list<TimeRange> ranges = {{hClip->Start(), hClip->End()}};
+            for (auto& hOvlp : ovlpList)
+                SubtractRange(ranges, {hOvlp->Start(), hOvlp->End()});
+            for (auto& hUpperTrack : upperTracks)
+            {
+                for (auto& hUpperClip : hUpperTrack->GetClipList())
+                    SubtractRange(ranges, {hUpperClip->Start(), hUpperClip->End()});
+            }
+            for (auto& subRange : subtitleRanges)
+                SubtractRange(ranges, subRange);
+
+            for (auto& range : ranges)
+            {
+                Segment seg;
+                if (AlignRangeToGop(hClip, range, settings, seg))
+                    passthroughSegs.push_back(seg);
+            }
+        }
+        upperTracks.push_back(hTrack);
+    }
+    sort(passthroughSegs.begin(), passthroughSegs.end(), [] (const Segment& a, const Segment& b) {
+        return a.start < b.start;
+    });
+
+    // fill the gaps with re-encoding segments
+    int64_t pos = 0;
+    for (auto& seg : passthroughSegs)
+    {
+        if (seg.start > pos)
+        {
+            Segment encSeg;
+            encSeg.start = pos;
+            encSeg.end = seg.start;
+            segments.push_back(encSeg);
+        }
+        segments.push_back(seg);
+        pos = seg.end;
+    }
+    if (pos < duration)
+    {
+        Segment encSeg;
+        encSeg.start = pos;
+        encSeg.end = duration;
+        segments.push_back(encSeg);
+    }
+
+    int64_t passthroughDur = 0;
+    for (auto& seg : passthroughSegs)
+        passthroughDur += seg.end-seg.start;
+    logger->Log(DEBUG) << "Smart-render plan: " << passthroughSegs.size() << " passthrough segment(s) covering "
+            << MillisecToString(passthroughDur) << " of " << MillisecToString(duration) << "." << endl;
+    return segments;
+}
+
+bool ExportVideo(MultiTrackVideoReader::Holder hMtvReader, MediaEncoder::Holder hEncoder, const VideoExportSettings& settings,
+        string& errMsg, vector<Segment>* pPlan)
+{
+    if (!hMtvReader || !hEncoder)
+    {
+        errMsg = "INVALID arguments! Both 'hMtvReader' and 'hEncoder' must be valid.";
+        return false;
+    }
+    // the clips of a reader whose settings resolve the proxies read the low resolution proxies instead of the sources
+    auto hReaderSettings = hMtvReader->GetSharedSettings();
+    if (hReaderSettings && hReaderSettings->GetProxyManager())
+    {
+        errMsg = "The settings of 'hMtvReader' are NOT in export mode, its clips may read from the proxies! Create the export reader with "
+                "the settings switched by 'SharedSettings::SetExportMode(true)'.";
+        return false;
+    }
+    auto segments = PlanVideoSegments(hMtvReader, settings, hEncoder);
+    if (pPlan)
+        *pPlan = segments;
+    if (segments.empty())
+    {
+        errMsg = "The timeline of 'hMtvReader' is EMPTY!";
+        return false;
+    }
+    auto logger = GetLogger();
+
+    for (auto& seg : segments)
+    {
+        logger->Log(DEBUG) << "Export segment " << seg << "." << endl;
+        if (seg.passthrough)
+        {
+            if (!hEncoder->CopyVideoPackets(seg.hParser, seg.srcStartPts, seg.srcEndPts, seg.start))
+            {
+                ostringstream oss; oss << "FAILED to copy the packets of segment " << seg << "! Error is '" << hEncoder->GetError() << "'.";
+                errMsg = oss.str();
+                return false;
+            }
+            continue;
+        }
+        // the passthrough segments start and end on the output frame grid, round to the same frame indices
+        const int64_t endIdx = hMtvReader->MillsecToFrameIndex(seg.end, 1);
+        for (int64_t frmIdx = hMtvReader->MillsecToFrameIndex(seg.start, 1); frmIdx < endIdx; frmIdx++)
+        {
+            ImGui::ImMat vmat;
+            if (!hMtvReader->ReadVideoFrameByIdx(frmIdx, vmat) || vmat.empty())
+            {
+                ostringstream oss; oss << "FAILED to read video frame #" << frmIdx << "! Error is '" << hMtvReader->GetError() << "'.";
+                errMsg = oss.str();
+                return false;
+            }
+            vmat.time_stamp = (double)hMtvReader->FrameIndexToMillsec(frmIdx)/1000;
+            if (!hEncoder->EncodeVideoFrame(vmat))
+            {
+                ostringstream oss; oss << "FAILED to encode video frame #" << frmIdx << "! Error is '" << hEncoder->GetError() << "'.";
+                errMsg = oss.str();
+                return false;
+            }
+        }
+    }
+
+    ImGui::ImMat eofMat;
+    if (!hEncoder->EncodeVideoFrame(eofMat))
+    {
+        errMsg = "FAILED to send video EOF! Error is '"+hEncoder->GetError()+"'.";
+        return false;
+    }
+    return true;
+}
+
+ALogger* GetLogger()
+{
+    return Logger::GetLogger("SmartRender");
+}
+
+ostream& operator<<(ostream& os, const Segment& seg)
+{
+    os << "[" << MillisecToString(seg.start) << " ~ " << MillisecToString(seg.end) << ")";
+    if (seg.passthrough)
+        os << " passthrough '" << (seg.hParser ? seg.hParser->GetUrl() : string("(null)")) << "' pts["
+            << seg.srcStartPts << ", " << seg.srcEndPts << ")";
+    else
+        os << " re-encode";
+    return os;
+}
+}
+}
@@ -22,7 +22,9 @@
 #include <iomanip>
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <cmath>
 #include <algorithm>
@@ -57,12 +59,55 @@ namespace MediaCore
 {
 namespace Snapshot
 {
+class Generator_Impl;
+
+// Process-wide byte budget of the decoded snapshots held by all the Generators
+class _SnapshotMemoryPool
+{
+public:
+    static _SnapshotMemoryPool& GetInstance()
+    {
+        static _SnapshotMemoryPool s_instance;
+        return s_instance;
+    }
+
+    void Register(Generator_Impl* gen);
+    void Unregister(Generator_Impl* gen);
+    // Kept by the pool for 'GetFootprints()', which would otherwise wait for the api lock of a busy Generator
+    void SetUrl(Generator_Impl* gen, const string& url);
+    void SetBudget(uint64_t bytes) { m_budget = bytes; }
+    uint64_t GetBudget() const { return m_budget; }
+    uint64_t GetTotalFootprint() const { return m_totalFootprint; }
+    void GetFootprints(vector<pair<string, uint64_t>>& footprints);
+    // Re-count the footprints, then evict the snapshots with the largest weight until the total is under the budget
+    void Enforce();
+
+private:
+    mutex m_lock;
+    list<Generator_Impl*> m_generators;
+    unordered_map<Generator_Impl*, string> m_urls;
+    atomic<uint64_t> m_budget{0};
+    atomic<uint64_t> m_totalFootprint{0};
+    int64_t m_lastEnforceTick{0};
+};
+
+static int64_t GetSteadyTickMs()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 class Generator_Impl : public Snapshot::Generator
 {
 public:
     Generator_Impl()
     {
         m_logger = Snapshot::GetLogger();
+        _SnapshotMemoryPool::GetInstance().Register(this);
+    }
+
+    virtual ~Generator_Impl()
+    {
+        _SnapshotMemoryPool::GetInstance().Unregister(this);
     }
 
     bool Open(const string& url, const Ratio& ssFrameRate) override
@@ -78,6 +123,7 @@ public:
             return false;
         }
         hParser->EnableParseInfo(MediaParser::VIDEO_SEEK_POINTS);
+        m_mediaCacheKey = m_hPreviewCache && m_hPreviewCache->IsOpened() ? PreviewCache::MakeMediaKey(hParser->GetUrl()) : "";
 
         if (!OpenMedia(hParser, ssFrameRate))
         {
@@ -85,6 +131,7 @@ public:
             return false;
         }
         m_hParser = hParser;
+        _SnapshotMemoryPool::GetInstance().SetUrl(this, hParser->GetUrl());
 
         m_opened = true;
         m_logger->Log(DEBUG) << "Snapshot::Generator for file '" << hParser->GetUrl() << "' is created." << endl;
@@ -103,6 +150,7 @@ public:
 
         if (IsOpened())
             Close();
+        m_mediaCacheKey = m_hPreviewCache && m_hPreviewCache->IsOpened() ? PreviewCache::MakeMediaKey(hParser->GetUrl()) : "";
 
         if (!OpenMedia(hParser, ssFrameRate))
         {
@@ -110,6 +158,7 @@ public:
             return false;
         }
         m_hParser = hParser;
+        _SnapshotMemoryPool::GetInstance().SetUrl(this, hParser->GetUrl());
 
         m_opened = true;
         m_logger->Log(DEBUG) << "Snapshot::Generator for file '" << hParser->GetUrl() << "' is created." << endl;
@@ -121,6 +170,7 @@ public:
         lock_guard<recursive_mutex> lk(m_apiLock);
         WaitAllThreadsQuit();
         FlushAllQueues();
+        ReleaseDecodeWorkers();
 
         if (m_viddecCtx)
         {
@@ -140,8 +190,11 @@ public:
         m_vidStmIdx = -1;
         m_vidStream = nullptr;
         m_hParser = nullptr;
+        _SnapshotMemoryPool::GetInstance().SetUrl(this, "");
+        m_hFileIter = nullptr;
         m_hMediaInfo = nullptr;
         m_hTransposeFilter = nullptr;
+        m_mediaCacheKey.clear();
 
         m_vidStartMts = 0;
         m_vidStartPts = 0;
@@ -184,11 +237,13 @@ public:
 
         snapshots.resize(idx1-idx0+1);
         {
+            const int64_t accessTick = GetSteadyTickMs();
             lock_guard<mutex> readLock(m_goptskListReadLocks[0]);
             for (auto& goptsk : m_goptskList)
             {
                 if (idx0 >= goptsk->TaskRange().SsIdx().second || idx1 < goptsk->TaskRange().SsIdx().first)
                     continue;
+                goptsk->accessTick = accessTick;
                 auto ssIter = goptsk->ssImgList.begin();
                 while (ssIter != goptsk->ssImgList.end())
                 {
@@ -199,6 +254,7 @@ public:
                 }
             }
         }
+        UpdateFirstRequestStats(idx0, snapshots);
 
         if (!m_isOvssComplete && m_hOverview)
         {
@@ -354,6 +410,29 @@ public:
         return true;
     }
 
+    bool SetPrefetchLookahead(double seconds) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (seconds < 0)
+        {
+            m_errMsg = "Argument 'seconds' must NOT be negative!";
+            return false;
+        }
+        m_prefetchLookahead = seconds;
+        return true;
+    }
+
+    void GetFirstRequestStats(uint64_t& requestCount, uint64_t& readyCount) const override
+    {
+        requestCount = m_firstReqCount;
+        readyCount = m_firstReqReadyCount;
+    }
+
+    uint64_t GetMemoryFootprint() const override
+    {
+        return m_ssMemFootprint;
+    }
+
     double GetMinWindowSize() const override
     {
         return CalcMinWindowSize(m_wndFrmCnt);
@@ -505,6 +584,77 @@ public:
         m_vidPreferUseHw = enable;
     }
 
+    bool IsKeyframeSnapEnabled() const override
+    {
+        return m_keyframeSnap;
+    }
+
+    void EnableKeyframeSnap(bool enable) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (IsOpened())
+        {
+            m_logger->Log(WARN) << "CANNOT change keyframe snap mode after the Generator is opened!" << endl;
+            return;
+        }
+        m_keyframeSnap = enable;
+    }
+
+    void SetPreviewCache(PreviewCache::Holder hCache) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (IsOpened())
+        {
+            m_logger->Log(WARN) << "CANNOT change preview cache after the Generator is opened!" << endl;
+            return;
+        }
+        m_hPreviewCache = hCache;
+    }
+
+    PreviewCache::Holder GetPreviewCache() const override
+    {
+        return m_hPreviewCache;
+    }
+
+    bool SetDecodeWorkerCount(uint32_t count) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (count == 0)
+        {
+            m_errMsg = "Argument 'count' must be larger than 0!";
+            return false;
+        }
+        if (IsOpened())
+        {
+            m_errMsg = "CANNOT change decode worker count after the Generator is opened!";
+            return false;
+        }
+        m_decWorkerCount = count;
+        return true;
+    }
+
+    uint32_t GetDecodeWorkerCount() const override
+    {
+        return m_decWorkerCount;
+    }
+
+    bool SetSwsThreadCount(uint32_t count) override
+    {
+        lock_guard<recursive_mutex> lk(m_apiLock);
+        if (IsOpened())
+        {
+            m_errMsg = "CANNOT change sws thread count after the Generator is opened!";
+            return false;
+        }
+        m_swsThreadCount = count;
+        return true;
+    }
+
+    uint32_t GetSwsThreadCount() const override
+    {
+        return m_swsThreadCount > 0 ? m_swsThreadCount : FFUtils::GetDefaultSwsThreadCount();
+    }
+
     void SetLogLevel(Logger::Level l) override
     {
         m_logger->SetShowLevels(l);
@@ -653,6 +803,13 @@ private:
                 m_vidStartPts = m_vidStream->start_time;
                 m_viddecOpenOpts.onlyUseSoftwareDecoder = !m_vidPreferUseHw;
                 m_viddecOpenOpts.hHwaMgr = HwaccelManager::GetDefaultInstance();
+                // snapshots are small, let the decoder skip the details when it can. the decode workers share these options
+                uint32_t lowresOutW = m_frmCvt.GetOutWidth(), lowresOutH = m_frmCvt.GetOutHeight();
+                if (((int)round(m_pVidstm->displayRotation/90.0)&0x1) == 1)
+                    swap(lowresOutW, lowresOutH);
+                m_viddecOpenOpts.lowres = FFUtils::CalcLowresForOutputSize(m_pVidstm->width, m_pVidstm->height, lowresOutW, lowresOutH);
+                m_viddecOpenOpts.skipLoopFilter = m_keyframeSnap ? AVDISCARD_ALL : AVDISCARD_NONREF;
+                m_frmCvt.SetSwsThreadCount(GetSwsThreadCount());
                 FFUtils::OpenVideoDecoderResult res;
                 if (FFUtils::OpenVideoDecoder(m_avfmtCtx, -1, &m_viddecOpenOpts, &res, false))
                 {
@@ -669,7 +826,13 @@ private:
                         m_hwDecCtxLock.TurnOn();
 #endif
                     m_logger->Log(INFO) << "Snapshot::Generator for file '" << m_hMediaInfo->url << "' opened a video decoder '" << 
-                        m_viddecCtx->codec->name << "'(" << (res.hwDevType==AV_HWDEVICE_TYPE_NONE ? "SW" : av_hwdevice_get_type_name(res.hwDevType)) << ")." << endl;
+                        m_viddecCtx->codec->name << "'(" << (res.hwDevType==AV_HWDEVICE_TYPE_NONE ? "SW" : av_hwdevice_get_type_name(res.hwDevType)) << "), lowres=" << m_viddecCtx->lowres << "." << endl;
+                    if (m_keyframeSnap)
+                    {
+                        // demuxers supporting it don't even read the non-key packets
+                        m_vidStream->discard = AVDISCARD_NONKEY;
+                        m_viddecCtx->skip_frame = AVDISCARD_NONKEY;
+                    }
                 }
                 else
                 {
@@ -678,6 +841,12 @@ private:
                     m_errMsg = oss.str();
                     return false;
                 }
+                m_decWorkers[0]->viddecCtx = m_viddecCtx;
+                for (uint32_t i = 1; i < m_decWorkers.size(); i++)
+                {
+                    if (!OpenDecodeWorker(m_decWorkers[i]))
+                        m_logger->Log(WARN) << "FAILED to open decode worker #" << i << "! Error is '" << m_errMsg << "'." << endl;
+                }
 
                 const auto pVidstm = GetVideoStream();
                 if (pVidstm->displayRotation != 0)
@@ -738,16 +907,27 @@ private:
         return true;
     }
 
-    void DemuxThreadProc()
+    void DemuxThreadProc(_DecodeWorker* worker)
     {
-        m_logger->Log(VERBOSE) << "Enter DemuxThreadProc()..." << endl;
+        m_logger->Log(VERBOSE) << "Enter DemuxThreadProc() #" << worker->index << "..." << endl;
 
-        if (!m_prepared && !Prepare())
+        if (worker->index == 0)
         {
-            if (!m_quit)
-                m_logger->Log(Error) << "Prepare() FAILED! Error is '" << m_errMsg << "'." << endl;
-            return;
+            if (!m_prepared && !Prepare())
+            {
+                if (!m_quit)
+                    m_logger->Log(Error) << "Prepare() FAILED! Error is '" << m_errMsg << "'." << endl;
+                return;
+            }
         }
+        else
+        {
+            while (!m_prepared && !m_quit)
+                this_thread::sleep_for(chrono::milliseconds(5));
+            if (m_quit || !worker->avfmtCtx)
+                return;
+        }
+        AVFormatContext* avfmtCtx = worker->avfmtCtx;
 
         AVPacket avpkt = {0};
         bool avpktLoaded = false;
@@ -758,7 +938,12 @@ private:
         {
             bool idleLoop = true;
 
-            UpdateGopDecodeTaskList();
+            // the task list is maintained by the first worker
+            if (worker->index == 0)
+            {
+                UpdateGopDecodeTaskList();
+                _SnapshotMemoryPool::GetInstance().Enforce();
+            }
 
             if (HasVideo())
             {
@@ -767,10 +952,20 @@ private:
                 {
                     if (currTask && currTask->cancel)
                         m_logger->Log(VERBOSE) << "~~~~ Current demux task canceled" << endl;
-                    currTask = FindNextDemuxTask();
+                    {
+                        lock_guard<mutex> lk(m_demuxTaskLock);
+                        currTask = FindNextDemuxTask();
+                        if (currTask)
+                            currTask->demuxing = true;
+                    }
+                    // the task is claimed, so the cached images are decoded without blocking the other workers
+                    if (currTask && LoadTaskFromPreviewCache(currTask))
+                    {
+                        currTask = nullptr;
+                        idleLoop = false;
+                    }
                     if (currTask)
                     {
-                        currTask->demuxing = true;
                         taskChanged = true;
                         lastGopSsPts = INT64_MAX;
                         m_logger->Log(DEBUG) << "--> Change demux task, ssIdxPair=[" << currTask->TaskRange().SsIdx().first << ", " << currTask->TaskRange().SsIdx().second
@@ -792,7 +987,7 @@ private:
                             }
                             const int64_t seekPts0 = currTask->TaskRange().SeekPts().first;
                             m_logger->Log(DEBUG) << "--> Seek to pts=" << seekPts0 << endl;
-                            int fferr = avformat_seek_file(m_avfmtCtx, m_vidStmIdx, INT64_MIN, seekPts0, seekPts0, 0);
+                            int fferr = avformat_seek_file(avfmtCtx, m_vidStmIdx, INT64_MIN, seekPts0, seekPts0, 0);
                             if (fferr < 0)
                             {
                                 m_logger->Log(Error) << "avformat_seek_file() FAILED for seeking to 'currTask->startPts'(" << seekPts0 << ")! fferr = " << fferr << "!" << endl;
@@ -800,7 +995,7 @@ private:
                             }
                             demuxEof = false;
                             int64_t ptsAfterSeek = INT64_MIN;
-                            if (!ReadNextStreamPacket(m_vidStmIdx, &avpkt, &avpktLoaded, &ptsAfterSeek))
+                            if (!ReadNextStreamPacket(avfmtCtx, m_vidStmIdx, &avpkt, &avpktLoaded, &ptsAfterSeek))
                                 break;
                             if (ptsAfterSeek == INT64_MAX)
                                 demuxEof = true;
@@ -813,7 +1008,7 @@ private:
 
                     if (!demuxEof && !avpktLoaded)
                     {
-                        int fferr = av_read_frame(m_avfmtCtx, &avpkt);
+                        int fferr = av_read_frame(avfmtCtx, &avpkt);
                         if (fferr == 0)
                         {
                             avpktLoaded = true;
@@ -831,11 +1026,25 @@ private:
                         }
                     }
 
+                    if (avpktLoaded && m_keyframeSnap && avpkt.stream_index == m_vidStmIdx && (avpkt.flags&AV_PKT_FLAG_KEY) == 0)
+                    {
+                        av_packet_unref(&avpkt);
+                        avpktLoaded = false;
+                        idleLoop = false;
+                    }
                     if (avpktLoaded)
                     {
                         if (avpkt.stream_index == m_vidStmIdx)
                         {
-                            if (avpkt.pts >= currTask->TaskRange().SeekPts().second || avpkt.pts > lastGopSsPts)
+                            const int64_t pktPts = avpkt.pts;
+                            if (m_keyframeSnap)
+                            {
+                                // the key frame starting the next GOP is the last one needed, the snapshots nearer to it than to
+                                // the previous key frame show it
+                                if (pktPts > currTask->TaskRange().SeekPts().second)
+                                    currTask->demuxerEof = true;
+                            }
+                            else if (avpkt.pts >= currTask->TaskRange().SeekPts().second || avpkt.pts > lastGopSsPts)
                             {
                                 bool canReadMore = avpkt.pts < currTask->TaskRange().SeekPts().second+CvtVidMtsToPts(200);
                                 if (!canReadMore)
@@ -881,6 +1090,8 @@ private:
                                 av_packet_unref(&avpkt);
                                 avpktLoaded = false;
                                 idleLoop = false;
+                                if (m_keyframeSnap && pktPts >= currTask->TaskRange().SeekPts().second)
+                                    currTask->demuxerEof = true;
                             }
                         }
                         else
@@ -903,15 +1114,15 @@ private:
             currTask->demuxerEof = true;
         if (avpktLoaded)
             av_packet_unref(&avpkt);
-        m_logger->Log(VERBOSE) << "Leave DemuxThreadProc()." << endl;
+        m_logger->Log(VERBOSE) << "Leave DemuxThreadProc() #" << worker->index << "." << endl;
     }
 
-    bool ReadNextStreamPacket(int stmIdx, AVPacket* avpkt, bool* avpktLoaded, int64_t* pts)
+    bool ReadNextStreamPacket(AVFormatContext* avfmtCtx, int stmIdx, AVPacket* avpkt, bool* avpktLoaded, int64_t* pts)
     {
         *avpktLoaded = false;
         int fferr;
         do {
-            fferr = av_read_frame(m_avfmtCtx, avpkt);
+            fferr = av_read_frame(avfmtCtx, avpkt);
             if (fferr == 0)
             {
                 if (avpkt->stream_index == stmIdx)
@@ -941,12 +1152,15 @@ private:
         return true;
     }
 
-    void VideoDecodeThreadProc()
+    void VideoDecodeThreadProc(_DecodeWorker* worker)
     {
-        m_logger->Log(VERBOSE) << "Enter VideoDecodeThreadProc()..." << endl;
+        m_logger->Log(VERBOSE) << "Enter VideoDecodeThreadProc() #" << worker->index << "..." << endl;
 
         while (!m_prepared && !m_quit)
             this_thread::sleep_for(chrono::milliseconds(5));
+        if (m_quit || !worker->viddecCtx)
+            return;
+        AVCodecContext* viddecCtx = worker->viddecCtx;
 
         GopDecodeTaskHolder currTask;
         AVFrame avfrm = {0};
@@ -964,7 +1178,6 @@ private:
                 currTask = FindNextDecoderTask();
                 if (currTask)
                 {
-                    currTask->decoding = true;
                     m_logger->Log(DEBUG) << "==> Change decoding task to build SS ["
                         << currTask->m_range.SsIdx().first << ", " << currTask->m_range.SsIdx().second << "), pts=["
                         << currTask->m_range.SeekPts().first << "(" << MillisecToString(CvtVidPtsToMts(currTask->m_range.SeekPts().first)) << "), "
@@ -987,7 +1200,7 @@ private:
                     {
                         m_logger->Log(DEBUG) << ">>>--->>> Sending NULL ptr to video decoder <<<---<<<" << endl;
                         lock_guard<ConditionalMutex> lk(m_hwDecCtxLock);
-                        avcodec_send_packet(m_viddecCtx, nullptr);
+                        avcodec_send_packet(viddecCtx, nullptr);
                         sentNullPacket = true;
                     }
                 }
@@ -996,7 +1209,7 @@ private:
             if (needResetDecoder)
             {
                 lock_guard<ConditionalMutex> lk(m_hwDecCtxLock);
-                avcodec_flush_buffers(m_viddecCtx);
+                avcodec_flush_buffers(viddecCtx);
                 needResetDecoder = false;
                 sentNullPacket = false;
             }
@@ -1009,7 +1222,7 @@ private:
                     int fferr;
                     {
                         lock_guard<ConditionalMutex> lk(m_hwDecCtxLock);
-                        fferr = avcodec_receive_frame(m_viddecCtx, &avfrm);
+                        fferr = avcodec_receive_frame(viddecCtx, &avfrm);
                     }
                     if (fferr == 0)
                     {
@@ -1097,7 +1310,7 @@ private:
                     int fferr;
                     {
                         lock_guard<ConditionalMutex> lk(m_hwDecCtxLock);
-                        fferr = avcodec_send_packet(m_viddecCtx, avpkt);
+                        fferr = avcodec_send_packet(viddecCtx, avpkt);
                     }
                     if (fferr == 0)
                     {
@@ -1139,7 +1352,7 @@ private:
             currTask->decoderEof = true;
         if (avfrmLoaded)
             av_frame_unref(&avfrm);
-        m_logger->Log(VERBOSE) << "Leave VideoDecodeThreadProc()." << endl;
+        m_logger->Log(VERBOSE) << "Leave VideoDecodeThreadProc() #" << worker->index << "." << endl;
     }
 
     void UpdateSnapshotThreadProc()
@@ -1204,6 +1417,8 @@ private:
                         idleLoop = false;
                     }
                 }
+                if (currTask->allCandDecoded && !currTask->redoDecoding && !currTask->savedToPreviewCache && currTask->ssAvfrmList.empty())
+                    SaveTaskToPreviewCache(currTask);
             }
 
             if (idleLoop)
@@ -1223,15 +1438,25 @@ private:
             return;
         }
 
+        m_hFileIter = m_hParser->GetImageSequenceIterator()->Clone();
         list<ImgsqDecodeContext::Holder> imgsqDecCtxList;
         for (auto i = 0; i < m_maxImgsqDecNum; i++)
-            imgsqDecCtxList.push_back(CreateImgsqDecodeContext());
+        {
+            auto hImgsqDecCtx = CreateImgsqDecodeContext();
+            if (!hImgsqDecCtx)
+            {
+                m_logger->Log(Error) << "CreateImgsqDecodeContext() FAILED! Error is '" << m_errMsg << "'." << endl;
+                return;
+            }
+            imgsqDecCtxList.push_back(hImgsqDecCtx);
+        }
 
         while (!m_quit)
         {
             bool idleLoop = true;
 
             UpdateImgsqDecodeTaskList();
+            _SnapshotMemoryPool::GetInstance().Enforce();
 
             // find the task to decode
             int32_t distToVwnd = INT32_MAX;
@@ -1253,7 +1478,7 @@ private:
                 }
             }
 
-            // assign imgsq reader
+            // assign imgsq decode context
             if (hTaskToDecode)
             {
                 auto idleDecIter = find_if(imgsqDecCtxList.begin(), imgsqDecCtxList.end(), [] (auto& hImgsqDecCtx) {
@@ -1264,41 +1489,26 @@ private:
                     const int32_t ssIdx = hTaskToDecode->TaskRange().SsIdx().first;
                     _Picture::Holder ss(new _Picture(this, ssIdx, nullptr, 0));
                     ss->img->mTimestampMs = CalcSnapshotMts(ssIdx);
+                    // the snapshot without a file is left empty like the one failed to decode, so its task is not picked again
+                    if (!AssignDecodeContextToSs(ss, *idleDecIter))
+                        m_logger->Log(WARN) << "Snapshot ss-idx=" << ssIdx << " of the image-sequence is left empty." << endl;
                     hTaskToDecode->ssImgList.push_back(ss);
-                    AssignDecodeContextToSs(ss, *idleDecIter);
                     idleLoop = false;
                 }
             }
 
-            // trigger decoding and check decoded mat
+            // check decoded mat
             for (auto& hImgsqDecCtx : imgsqDecCtxList)
             {
-                if (!hImgsqDecCtx->m_hVfrm && hImgsqDecCtx->m_hSs)
-                {
-                    bool eof = false;
-                    auto hVfrm = hImgsqDecCtx->m_hImgsqReader->ReadVideoFrame(hImgsqDecCtx->pos, eof, false);
-                    if (hVfrm)
-                    {
-                        hVfrm->SetAutoConvertToMat(true);
-                        hImgsqDecCtx->m_hVfrm = hVfrm;
-                    }
-                    else if (eof)
-                    {
-                        hImgsqDecCtx->isIdle = true;
-                        hImgsqDecCtx->m_hVfrm = nullptr;
-                        hImgsqDecCtx->m_hSs = nullptr;
-                        idleLoop = false;
-                    }
-                }
-                if (hImgsqDecCtx->m_hVfrm && hImgsqDecCtx->m_hVfrm->IsReady())
+                if (!hImgsqDecCtx->isIdle && hImgsqDecCtx->decodeDone)
                 {
-                    if (!hImgsqDecCtx->m_hVfrm->GetMat(hImgsqDecCtx->m_hSs->img->mImgMat))
-                        m_logger->Log(WARN) << "FAILED to GetMat for image-sequence at ss index@" << hImgsqDecCtx->m_hSs->index << ", pos@" << hImgsqDecCtx->m_hSs->img->mTimestampMs << "." << endl;
-                    m_logger->Log(DEBUG) << "<--- Finished decoding ss-idx=" << hImgsqDecCtx->m_hSs->index << ", pos=" << hImgsqDecCtx->m_hSs->img->mTimestampMs <<
-                            ", mat.timestamp=" << hImgsqDecCtx->m_hSs->img->mImgMat.time_stamp << "." << endl;
-                    hImgsqDecCtx->isIdle = true;
-                    hImgsqDecCtx->m_hVfrm = nullptr;
+                    auto& hSs = hImgsqDecCtx->m_hSs;
+                    hSs->img->mImgMat = hImgsqDecCtx->m_outMat;
+                    m_logger->Log(DEBUG) << "<--- Finished decoding ss-idx=" << hSs->index << ", pos=" << hSs->img->mTimestampMs <<
+                            ", mat.timestamp=" << hSs->img->mImgMat.time_stamp << "." << endl;
+                    hImgsqDecCtx->m_outMat.release();
                     hImgsqDecCtx->m_hSs = nullptr;
+                    hImgsqDecCtx->isIdle = true;
                     idleLoop = false;
                 }
             }
@@ -1317,12 +1527,25 @@ private:
         m_quit = false;
         if (!IsImageSequence())
         {
-            m_demuxThread = thread(&Generator_Impl::DemuxThreadProc, this);
-            thnOss << "SsgDmx-" << fileName;
-            SysUtils::SetThreadName(m_demuxThread, thnOss.str());
-            m_viddecThread = thread(&Generator_Impl::VideoDecodeThreadProc, this);
-            thnOss.str(""); thnOss << "SsgVdc-" << fileName;
-            SysUtils::SetThreadName(m_viddecThread, thnOss.str());
+            // create all the workers before starting any thread, 'Prepare()' opens the demuxers and decoders for them
+            m_decWorkers.clear();
+            for (uint32_t i = 0; i < m_decWorkerCount; i++)
+            {
+                _DecodeWorker::Holder hWorker(new _DecodeWorker());
+                hWorker->index = i;
+                m_decWorkers.push_back(hWorker);
+            }
+            m_decWorkers[0]->avfmtCtx = m_avfmtCtx;
+            m_maxPendingVidfrmCnt = 2*(int32_t)m_decWorkerCount;
+            for (auto& hWorker : m_decWorkers)
+            {
+                hWorker->demuxThread = thread(&Generator_Impl::DemuxThreadProc, this, hWorker.get());
+                thnOss.str(""); thnOss << "SsgDmx" << hWorker->index << "-" << fileName;
+                SysUtils::SetThreadName(hWorker->demuxThread, thnOss.str());
+                hWorker->viddecThread = thread(&Generator_Impl::VideoDecodeThreadProc, this, hWorker.get());
+                thnOss.str(""); thnOss << "SsgVdc" << hWorker->index << "-" << fileName;
+                SysUtils::SetThreadName(hWorker->viddecThread, thnOss.str());
+            }
             m_updateSsThread = thread(&Generator_Impl::UpdateSnapshotThreadProc, this);
             thnOss.str(""); thnOss << "SsgUss-" << fileName;
             SysUtils::SetThreadName(m_updateSsThread, thnOss.str());
@@ -1339,15 +1562,18 @@ private:
     {
         // AutoSection _as("WATQ");
         m_quit = true;
-        if (m_demuxThread.joinable())
+        for (auto& hWorker : m_decWorkers)
         {
-            m_demuxThread.join();
-            m_demuxThread = thread();
-        }
-        if (m_viddecThread.joinable())
-        {
-            m_viddecThread.join();
-            m_viddecThread = thread();
+            if (hWorker->demuxThread.joinable())
+            {
+                hWorker->demuxThread.join();
+                hWorker->demuxThread = thread();
+            }
+            if (hWorker->viddecThread.joinable())
+            {
+                hWorker->viddecThread.join();
+                hWorker->viddecThread = thread();
+            }
         }
         if (m_updateSsThread.joinable())
         {
@@ -1361,6 +1587,72 @@ private:
         // AutoSection _as("FAQ");
         m_goptskPrepareList.clear();
         m_goptskList.clear();
+        ClearGopSsCache();
+    }
+
+    struct _DecodeWorker
+    {
+        using Holder = shared_ptr<_DecodeWorker>;
+
+        uint32_t index{0};
+        AVFormatContext* avfmtCtx{nullptr};
+        AVCodecContext* viddecCtx{nullptr};
+        AVHWDeviceType viddecDevType{AV_HWDEVICE_TYPE_NONE};
+        thread demuxThread;
+        thread viddecThread;
+    };
+
+    bool OpenDecodeWorker(_DecodeWorker::Holder hWorker)
+    {
+        int fferr = avformat_open_input(&hWorker->avfmtCtx, m_hParser->GetUrl().c_str(), nullptr, nullptr);
+        if (fferr < 0)
+        {
+            hWorker->avfmtCtx = nullptr;
+            m_errMsg = FFapiFailureMessage("avformat_open_input", fferr);
+            return false;
+        }
+        fferr = avformat_find_stream_info(hWorker->avfmtCtx, nullptr);
+        if (fferr < 0)
+        {
+            avformat_close_input(&hWorker->avfmtCtx);
+            hWorker->avfmtCtx = nullptr;
+            m_errMsg = FFapiFailureMessage("avformat_find_stream_info", fferr);
+            return false;
+        }
+        FFUtils::OpenVideoDecoderResult res;
+        if (!FFUtils::OpenVideoDecoder(hWorker->avfmtCtx, m_vidStmIdx, &m_viddecOpenOpts, &res, false))
+        {
+            avformat_close_input(&hWorker->avfmtCtx);
+            hWorker->avfmtCtx = nullptr;
+            m_errMsg = res.errMsg;
+            return false;
+        }
+        hWorker->viddecCtx = res.decCtx;
+        hWorker->viddecDevType = res.hwDevType;
+        if (hWorker->viddecDevType != AV_HWDEVICE_TYPE_NONE)
+            m_viddecOpenOpts.hHwaMgr->IncreaseDecoderInstanceCount(av_hwdevice_get_type_name(hWorker->viddecDevType));
+        if (m_keyframeSnap)
+        {
+            hWorker->avfmtCtx->streams[m_vidStmIdx]->discard = AVDISCARD_NONKEY;
+            hWorker->viddecCtx->skip_frame = AVDISCARD_NONKEY;
+        }
+        return true;
+    }
+
+    void ReleaseDecodeWorkers()
+    {
+        // the demuxer and decoder of the first worker are 'm_avfmtCtx' and 'm_viddecCtx'
+        for (uint32_t i = 1; i < m_decWorkers.size(); i++)
+        {
+            auto& hWorker = m_decWorkers[i];
+            if (hWorker->viddecCtx)
+                avcodec_free_context(&hWorker->viddecCtx);
+            if (hWorker->viddecDevType != AV_HWDEVICE_TYPE_NONE)
+                m_viddecOpenOpts.hHwaMgr->DecreaseDecoderInstanceCount(av_hwdevice_get_type_name(hWorker->viddecDevType));
+            if (hWorker->avfmtCtx)
+                avformat_close_input(&hWorker->avfmtCtx);
+        }
+        m_decWorkers.clear();
     }
 
     struct _Picture
@@ -1388,53 +1680,91 @@ private:
         bool fixed{false};
     };
 
+    // Decodes the image file of the assigned snapshot on its own thread, the decoder context is reused across the files
     struct ImgsqDecodeContext
     {
         using Holder = shared_ptr<ImgsqDecodeContext>;
 
-        ImgsqDecodeContext() {}
+        ImgsqDecodeContext(Generator_Impl* _owner) : owner(_owner) {}
+
+        ~ImgsqDecodeContext()
+        {
+            quit = true;
+            if (m_decThread.joinable())
+                m_decThread.join();
+        }
+
+        void DecodeImageProc()
+        {
+            while (!quit)
+            {
+                if (isIdle || decodeDone)
+                {
+                    this_thread::sleep_for(chrono::milliseconds(THREAD_IDLE_TIME));
+                    continue;
+                }
+                auto hAvfrm = m_imgDecoder.DecodeFile(m_filePath);
+                if (!hAvfrm)
+                    owner->m_logger->Log(WARN) << "FAILED to decode image-sequence file '" << m_filePath << "'! Error is '" << m_imgDecoder.GetError() << "'." << endl;
+                else if (!m_frmCvt.ConvertImage(hAvfrm.get(), m_outMat, (double)m_hSs->img->mTimestampMs/1000.))
+                    owner->m_logger->Log(WARN) << "FAILED to convert image-sequence file '" << m_filePath << "'! Error is '" << m_frmCvt.GetError() << "'." << endl;
+                decodeDone = true;
+            }
+        }
+
+        Generator_Impl* owner;
         _Picture::Holder m_hSs;
-        int64_t pos;
-        bool isIdle{true};
-        MediaReader::Holder m_hImgsqReader;
-        VideoFrame::Holder m_hVfrm;
+        string m_filePath;
+        atomic_bool isIdle{true};
+        atomic_bool decodeDone{false};
+        atomic_bool quit{false};
+        FFUtils::ImageFileDecoder m_imgDecoder;
+        AVFrameToImMatConverter m_frmCvt;
+        ImGui::ImMat m_outMat;
+        thread m_decThread;
     };
 
     ImgsqDecodeContext::Holder CreateImgsqDecodeContext()
     {
-        ImgsqDecodeContext::Holder hImgsqDecCtx(new ImgsqDecodeContext());
-        hImgsqDecCtx->m_hImgsqReader = MediaReader::CreateImageSequenceInstance();
-        auto hImgsqReader = hImgsqDecCtx->m_hImgsqReader;
-        if (!hImgsqReader->Open(m_hParser))
-        {
-            ostringstream oss; oss << "FAILED to open image-sequence reader! Error is '" << hImgsqReader->GetError() << "'.";
-            m_errMsg = oss.str();
-            return nullptr;
-        }
-        const auto outW = m_frmCvt.GetOutWidth();
-        const auto outH = m_frmCvt.GetOutHeight();
-        const auto outClrfmt = m_frmCvt.GetOutColorFormat();
-        const auto outDtype = m_frmCvt.GetOutDataType();
-        const auto rszInterp = m_frmCvt.GetResizeInterpolateMode();
-        if (!hImgsqReader->ConfigVideoReader(outW, outH, outClrfmt, outDtype, rszInterp, HwaccelManager::GetDefaultInstance()))
+        ImgsqDecodeContext::Holder hImgsqDecCtx(new ImgsqDecodeContext(this));
+        auto& frmCvt = hImgsqDecCtx->m_frmCvt;
+        if (!frmCvt.SetOutSize(m_frmCvt.GetOutWidth(), m_frmCvt.GetOutHeight()) || !frmCvt.SetOutColorFormat(m_frmCvt.GetOutColorFormat())
+            || !frmCvt.SetOutDataType(m_frmCvt.GetOutDataType()) || !frmCvt.SetResizeInterpolateMode(m_frmCvt.GetResizeInterpolateMode()))
         {
-            ostringstream oss; oss << "FAILED to configure image-sequence reader! Error is '" << hImgsqReader->GetError() << "'.";
+            ostringstream oss; oss << "FAILED to configure the converter for image-sequence! Error is '" << frmCvt.GetError() << "'.";
             m_errMsg = oss.str();
             return nullptr;
         }
-        hImgsqReader->SetCacheFrames(true, 0, 0);
+        // the contexts decode in parallel, each decoder uses one thread
+        FFUtils::OpenVideoDecoderOptions decOpts;
+        decOpts.onlyUseSoftwareDecoder = true;
+        decOpts.threadCount = 1;
+        hImgsqDecCtx->m_imgDecoder.SetDecoderOptions(decOpts);
+        hImgsqDecCtx->m_imgDecoder.SetWantedSize(m_frmCvt.GetOutWidth(), m_frmCvt.GetOutHeight());
+        hImgsqDecCtx->m_decThread = thread(&ImgsqDecodeContext::DecodeImageProc, hImgsqDecCtx.get());
         return hImgsqDecCtx;
     }
 
-    void AssignDecodeContextToSs(_Picture::Holder hSs, ImgsqDecodeContext::Holder hImgsqDecCtx)
+    bool AssignDecodeContextToSs(_Picture::Holder hSs, ImgsqDecodeContext::Holder hImgsqDecCtx)
     {
+        int64_t fileIdx = av_rescale_q_rnd(hSs->img->mTimestampMs, MILLISEC_TIMEBASE, m_vidTimebase, AV_ROUND_NEAR_INF);
+        const int64_t fileCount = (int64_t)m_hFileIter->GetValidFileCount();
+        if (fileIdx >= fileCount) fileIdx = fileCount-1;
+        if (fileIdx < 0) fileIdx = 0;
+        string filePath;
+        if (m_hFileIter->SeekToValidFile((uint32_t)fileIdx))
+            filePath = m_hFileIter->GetCurrFilePath();
+        if (filePath.empty())
+        {
+            m_logger->Log(WARN) << "FAILED to get the image-sequence file path by index " << fileIdx << " for ss-idx=" << hSs->index << "." << endl;
+            return false;
+        }
         hImgsqDecCtx->m_hSs = hSs;
-        hImgsqDecCtx->pos = hSs->img->mTimestampMs;
+        hImgsqDecCtx->m_filePath = m_hFileIter->JoinBaseDirPath(filePath);
+        hImgsqDecCtx->decodeDone = false;
         hImgsqDecCtx->isIdle = false;
-        hImgsqDecCtx->m_hImgsqReader->SeekTo(hImgsqDecCtx->pos);
-        if (!hImgsqDecCtx->m_hImgsqReader->IsStarted())
-            hImgsqDecCtx->m_hImgsqReader->Start();
-        m_logger->Log(DEBUG) << "--> Assign decode context: ss-idx=" << hSs->index << ", pos=" << hImgsqDecCtx->pos << "." << endl;
+        m_logger->Log(DEBUG) << "--> Assign decode context: ss-idx=" << hSs->index << ", file='" << hImgsqDecCtx->m_filePath << "'." << endl;
+        return true;
     }
 
     struct _SnapWindow
@@ -1589,10 +1919,118 @@ private:
         bool allCandDecoded{false};
         bool decoderEof{false};
         bool cancel{false};
+        // the snapshots are dropped to meet the memory budget, it's decoded again when the view window gets closer
+        bool evicted{false};
+        // the snapshots of this task are loaded from or queued into the preview cache
+        bool savedToPreviewCache{false};
+        atomic<int64_t> accessTick{GetSteadyTickMs()};
     };
     using GopDecodeTaskHolder = shared_ptr<_GopDecodeTask>;
 
-    _SnapWindow CreateSnapWindow(double wndpos)
+    struct _GopSsCacheEntry
+    {
+        pair<int64_t, int64_t> seekPts;
+        list<_Picture::Holder> ssList;
+        int64_t accessTick;
+    };
+
+    friend class _SnapshotMemoryPool;
+    struct _EvictionCandidate
+    {
+        Generator_Impl* owner;
+        GopDecodeTaskHolder hTask;      // nullptr for an entry of the GOP snapshot cache
+        pair<int64_t, int64_t> seekPts;
+        uint64_t bytes;
+        double weight;
+    };
+
+    static uint64_t CountSsListBytes(const list<_Picture::Holder>& ssList, unordered_set<const DisplayData*>& counted)
+    {
+        uint64_t bytes = 0;
+        for (auto& ss : ssList)
+        {
+            auto& hDispData = ss->img;
+            if (!hDispData || hDispData->mImgMat.empty() || !counted.insert(hDispData.get()).second)
+                continue;
+            bytes += (uint64_t)hDispData->mImgMat.total()*hDispData->mImgMat.elemsize;
+        }
+        return bytes;
+    }
+
+    // Bytes of the snapshot images held by the task list and the GOP snapshot cache, the shared images are counted once
+    uint64_t UpdateMemoryFootprint()
+    {
+        unordered_set<const DisplayData*> counted;
+        uint64_t bytes = 0;
+        {
+            lock_guard<mutex> lk(m_goptskListReadLocks[0]);
+            for (auto& hTask : m_goptskList)
+                bytes += CountSsListBytes(hTask->ssImgList, counted);
+        }
+        {
+            lock_guard<mutex> lk(m_gopSsCacheLock);
+            for (auto& entry : m_gopSsCache)
+                bytes += CountSsListBytes(entry.ssList, counted);
+        }
+        m_ssMemFootprint = bytes;
+        return bytes;
+    }
+
+    // The weight grows with the idle time, and with the distance to the view window. The cached GOPs of the removed tasks
+    // are out of the cache range, the tasks in view are never evicted.
+    void CollectEvictionCandidates(list<_EvictionCandidate>& candidates, int64_t nowTick)
+    {
+        unordered_set<const DisplayData*> counted;
+        if (m_hParser && !IsImageSequence())
+        {
+            lock_guard<mutex> lk(m_goptskListReadLocks[0]);
+            for (auto& hTask : m_goptskList)
+            {
+                if (hTask->IsInView() || hTask->evicted || hTask->cancel || !hTask->allCandDecoded)
+                    continue;
+                const uint64_t bytes = CountSsListBytes(hTask->ssImgList, counted);
+                if (bytes == 0)
+                    continue;
+                const double idleSecs = (double)(nowTick-hTask->accessTick)/1000.;
+                candidates.push_back({ this, hTask, hTask->TaskRange().SeekPts(), bytes, (1.+idleSecs)*(1.+hTask->DistanceToViewWnd()) });
+            }
+        }
+        lock_guard<mutex> lk(m_gopSsCacheLock);
+        for (auto& entry : m_gopSsCache)
+        {
+            const uint64_t bytes = CountSsListBytes(entry.ssList, counted);
+            if (bytes == 0)
+                continue;
+            const double idleSecs = (double)(nowTick-entry.accessTick)/1000.;
+            candidates.push_back({ this, nullptr, entry.seekPts, bytes, (1.+idleSecs)*(1.+m_maxCacheSize) });
+        }
+    }
+
+    void EvictCandidate(const _EvictionCandidate& candidate)
+    {
+        if (candidate.hTask)
+        {
+            // the task is replaced by the task list maintainer, see 'UpdateGopDecodeTaskList()'
+            candidate.hTask->cancel = true;
+            candidate.hTask->evicted = true;
+        }
+        else
+        {
+            lock_guard<mutex> lk(m_gopSsCacheLock);
+            auto iter = find_if(m_gopSsCache.begin(), m_gopSsCache.end(), [&candidate] (auto& entry) {
+                return entry.seekPts == candidate.seekPts;
+            });
+            if (iter != m_gopSsCache.end())
+                m_gopSsCache.erase(iter);
+        }
+    }
+
+    string GetUrl() const
+    {
+        return m_hParser ? m_hParser->GetUrl() : "";
+    }
+
+    _SnapWindow CreateSnapWindow(double wndpos, double velocity = 0)
     {
         if (!m_prepared)
             return { wndpos, -1, -1, -1, -1, INT64_MIN, INT64_MIN };
@@ -1600,6 +2038,18 @@ private:
         int32_t index1 = CalcSsIndexFromTs(wndpos+m_snapWindowSize);
         int32_t cacheIdx0 = index0-(int32_t)m_prevWndCacheSize;
         int32_t cacheIdx1 = cacheIdx0+(int32_t)m_maxCacheSize-1;
+        // move the cache range towards the scrolling direction, the view window is always kept in it
+        const int32_t prefetchCnt = CalcPrefetchCount(velocity);
+        if (prefetchCnt > 0)
+        {
+            cacheIdx1 += prefetchCnt;
+            cacheIdx0 = min(cacheIdx0+prefetchCnt, index0);
+        }
+        else if (prefetchCnt < 0)
+        {
+            cacheIdx0 += prefetchCnt;
+            cacheIdx1 = max(cacheIdx1+prefetchCnt, index1);
+        }
         pair<int64_t, int64_t> seekPos0, seekPos1;
         if (!IsImageSequence())
         {
@@ -1673,6 +2123,39 @@ private:
         return 0;
     }
 
+    // Snapshots passed in the lookahead time at the scrolling 'velocity'(in seconds of the media per second), the sign is the direction
+    int32_t CalcPrefetchCount(double velocity) const
+    {
+        if (m_prefetchLookahead <= 0 || velocity == 0 || m_ssIntvMts <= 0)
+            return 0;
+        double cnt = velocity*m_prefetchLookahead*1000/m_ssIntvMts;
+        const double maxCnt = (double)m_maxCacheSize;
+        if (cnt > maxCnt) cnt = maxCnt; else if (cnt < -maxCnt) cnt = -maxCnt;
+        return (int32_t)(cnt > 0 ? floor(cnt) : ceil(cnt));
+    }
+
+    void UpdateFirstRequestStats(int32_t idx0, const vector<Image>& snapshots)
+    {
+        if (m_ssRequestedIntvMts != m_ssIntvMts || m_ssRequested.size() != m_vidMaxIndex+1)
+        {
+            // snapshot positions are changed, they are all new ones
+            m_ssRequested.assign(m_vidMaxIndex+1, false);
+            m_ssRequestedIntvMts = m_ssIntvMts;
+        }
+        const int32_t loopCnt = snapshots.size();
+        for (int32_t i = 0; i < loopCnt; i++)
+        {
+            const int32_t idx = idx0+i;
+            if (idx < 0 || idx >= (int32_t)m_ssRequested.size() || m_ssRequested[idx])
+                continue;
+            m_ssRequested[idx] = true;
+            m_firstReqCount++;
+            auto& hDispData = snapshots[i].hDispData;
+            if (hDispData && !hDispData->mImgMat.empty())
+                m_firstReqReadyCount++;
+        }
+    }
+
     int32_t CalcSsIndexFromTs(double ts)
     {
         return (int32_t)floor(ts*1000/m_ssIntvMts);
@@ -1751,6 +2234,8 @@ private:
             for (auto& task : m_goptskPrepareList)
                 task->cancel = true;
             m_goptskPrepareList.clear();
+            // snapshot positions or image settings are changed, the decoded results can not be reused
+            ClearGopSsCache();
 
             m_snapWindowSize = m_setSnapWindowSize;
             m_wndFrmCnt = m_setWndFrmCnt;
@@ -1764,6 +2249,28 @@ private:
             }
         }
 
+        // Release the snapshots of the evicted tasks by replacing them with empty ones, which keep the ranges
+        bool evictedReplaced = false;
+        for (auto& task : m_goptskPrepareList)
+        {
+            if (!task->evicted || task->ssImgList.empty())
+                continue;
+            GopDecodeTaskHolder hPlaceholder(new _GopDecodeTask(this, task->m_range));
+            hPlaceholder->ssCandidates.clear();
+            hPlaceholder->cancel = true;
+            hPlaceholder->evicted = true;
+            task = hPlaceholder;
+            evictedReplaced = true;
+        }
+        if (evictedReplaced)
+        {
+            lock(m_goptskListReadLocks[0], m_goptskListReadLocks[1], m_goptskListReadLocks[2]);
+            lock_guard<mutex> lk0(m_goptskListReadLocks[0], adopt_lock);
+            lock_guard<mutex> lk1(m_goptskListReadLocks[1], adopt_lock);
+            lock_guard<mutex> lk2(m_goptskListReadLocks[2], adopt_lock);
+            m_goptskList = m_goptskPrepareList;
+        }
+
         // Check if view window changed
         bool taskRangeChanged = false;
         for (auto& hViewer : viewers)
@@ -1811,10 +2318,18 @@ private:
             if (iter == totalTaskRanges.end())
             {
                 m_logger->Log(DEBUG) << "~~~~> Erase UNUSED task range [" << (*taskIter)->TaskRange().SsIdx().first << ", " << (*taskIter)->TaskRange().SsIdx().second << ")" << endl;
+                StoreGopSsResult(task);
                 task->cancel = true;
                 taskIter = m_goptskPrepareList.erase(taskIter);
                 updated = true;
             }
+            else if (task->evicted && (iter->IsInView() || iter->DistanceToViewWindow() < task->DistanceToViewWnd()))
+            {
+                // the view window gets closer to an evicted task, it's recreated in step 2
+                m_logger->Log(DEBUG) << "~~~~> Recreate EVICTED task range [" << (*taskIter)->TaskRange().SsIdx().first << ", " << (*taskIter)->TaskRange().SsIdx().second << ")" << endl;
+                taskIter = m_goptskPrepareList.erase(taskIter);
+                updated = true;
+            }
             else
             {
                 m_logger->Log(DEBUG) << "~~~~> Remove DUPLICATED task range [" << (*taskIter)->TaskRange().SsIdx().first << ", " << (*taskIter)->TaskRange().SsIdx().second << ")" << endl;
@@ -1827,6 +2342,7 @@ private:
         for (auto& range : totalTaskRanges)
         {
             GopDecodeTaskHolder hTask(new _GopDecodeTask(this, range));
+            RestoreGopSsResult(hTask);
             m_goptskPrepareList.push_back(hTask);
             updated = true;
         }
@@ -2073,8 +2589,77 @@ private:
         }
     }
 
+    // One preview cache entry per GOP task, holding the snapshots of its candidate indices in ascending order
+    string MakeGopCacheKey(GopDecodeTaskHolder hTask, vector<int32_t>& ssIndices)
+    {
+        ssIndices.clear();
+        for (auto& elem : hTask->ssCandidates)
+            ssIndices.push_back(elem.first);
+        sort(ssIndices.begin(), ssIndices.end());
+        ostringstream oss;
+        oss << m_mediaCacheKey << "|gopss|" << setprecision(17) << m_ssIntvPts << "|" << m_frmCvt.GetOutWidth() << "x" << m_frmCvt.GetOutHeight()
+            << "|" << (int)m_frmCvt.GetOutColorFormat() << "|" << (int)m_frmCvt.GetOutDataType() << "|" << (int)m_frmCvt.GetResizeInterpolateMode()
+            << "|" << (m_keyframeSnap ? "key" : "all") << "|" << hTask->TaskRange().SeekPts().first << "|" << ssIndices.front() << "-" << ssIndices.back();
+        return oss.str();
+    }
+
+    // Fill the task with the cached snapshots of its GOP. Called by a demux worker after it has claimed the task,
+    // without holding 'm_demuxTaskLock', since reading the entry decodes the JPEG images.
+    bool LoadTaskFromPreviewCache(GopDecodeTaskHolder hTask)
+    {
+        if (m_mediaCacheKey.empty() || hTask->ssCandidates.empty())
+            return false;
+        vector<int32_t> ssIndices;
+        const string cacheKey = MakeGopCacheKey(hTask, ssIndices);
+        vector<ImGui::ImMat> images;
+        if (!m_hPreviewCache->GetImages(cacheKey, images) || images.size() != ssIndices.size())
+            return false;
+        list<_Picture::Holder> cachedSsList;
+        for (uint32_t i = 0; i < ssIndices.size(); i++)
+        {
+            if (images[i].empty())
+                return false;
+            const int32_t ssIdx = ssIndices[i];
+            _Picture::Holder ss(new _Picture(this, ssIdx, nullptr, 0));
+            ss->pts = (int64_t)floor(ssIdx*m_ssIntvPts+m_vidStartPts);
+            ss->img->mImgMat = images[i];
+            ss->img->mTimestampMs = CalcSnapshotMts(ssIdx);
+            cachedSsList.push_back(ss);
+        }
+        hTask->savedToPreviewCache = true;
+        MarkTaskAsDecoded(hTask, cachedSsList);
+        m_logger->Log(DEBUG) << "--> Task ssIdxPair=[" << hTask->TaskRange().SsIdx().first << ", " << hTask->TaskRange().SsIdx().second
+                << ") is loaded from preview cache." << endl;
+        return true;
+    }
+
+    // Queue all the snapshots of a finished task as one entry, the preview cache compresses and writes it in the background
+    void SaveTaskToPreviewCache(GopDecodeTaskHolder hTask)
+    {
+        hTask->savedToPreviewCache = true;
+        if (m_mediaCacheKey.empty() || hTask->ssCandidates.empty())
+            return;
+        vector<int32_t> ssIndices;
+        const string cacheKey = MakeGopCacheKey(hTask, ssIndices);
+        vector<ImGui::ImMat> images;
+        images.reserve(ssIndices.size());
+        for (auto ssIdx : ssIndices)
+        {
+            auto imgIter = find_if(hTask->ssImgList.begin(), hTask->ssImgList.end(), [ssIdx] (auto& elem) {
+                return elem->index == ssIdx;
+            });
+            if (imgIter == hTask->ssImgList.end() || (*imgIter)->img->mImgMat.empty())
+                return;
+            images.push_back((*imgIter)->img->mImgMat);
+        }
+        if (!m_hPreviewCache->PutImages(cacheKey, images))
+            m_logger->Log(DEBUG) << "Snapshots of task ssIdxPair=[" << ssIndices.front() << ", " << ssIndices.back()+1
+                    << "] are not saved into preview cache. Error is '" << m_hPreviewCache->GetError() << "'." << endl;
+    }
+
     GopDecodeTaskHolder FindNextDemuxTask()
     {
+        lock_guard<mutex> lk(m_goptskListReadLocks[0]);
         GopDecodeTaskHolder candidateTask = nullptr;
         uint32_t pendingDecodingTaskCnt = 0;
         int32_t shortestDistanceToViewWnd = INT32_MAX;
@@ -2148,6 +2733,9 @@ private:
                 candidateTask->avpktBkupQ.pop_front();
             }
         }
+        // mark it within the lock, so that other decode workers won't pick the same task
+        if (candidateTask)
+            candidateTask->decoding = true;
         return candidateTask;
     }
 
@@ -2166,6 +2754,7 @@ private:
 
     SelfFreeAVFramePtr DoTranspose(SelfFreeAVFramePtr hAvfrm)
     {
+        lock_guard<mutex> lk(m_transposeLock);
         auto hFgInFrm = FFUtils::CreateVideoFrameFromAVFrame(hAvfrm, hAvfrm->pts);
         if (m_hTransposeFilter->SendFrame(hFgInFrm) != MediaCore::Ok)
         {
@@ -2213,7 +2802,12 @@ private:
 
         DisplayData::Holder hDispData;
         auto ssIdxNxt = (int32_t)round((double)(frm->pts+m_vidfrmIntvPts)/m_ssIntvPts);
+        const int32_t ssIdxOrig = ssIdx;
+        if (m_keyframeSnap)
+            CalcKeyframeSsRange(frm->pts, ssIdx, ssIdxNxt);
         do {
+            if (m_keyframeSnap)
+                bias = (uint32_t)floor(abs(m_ssIntvPts*ssIdx-frm->pts));
             _Picture::Holder ss;
             if (hDispData)
                 ss = _Picture::Holder(new _Picture(this, ssIdx, hDispData, frm->pts, bias));
@@ -2221,6 +2815,9 @@ private:
                 ss = _Picture::Holder(new _Picture(this, ssIdx, frm, bias));
             for (auto& t : ssGopTasks)
             {
+                // the neighboring slots of a key frame only go to the tasks they belong to
+                if (ssIdx != ssIdxOrig && m_keyframeSnap && t->ssCandidates.find(ssIdx) == t->ssCandidates.end())
+                    continue;
                 lock_guard<mutex> lk(t->ssAvfrmListLock);
                 bool ssAdopt = false;
                 // m_logger->Log(DEBUG) << "Adding SS#" << ssIdx << "." << endl;
@@ -2271,6 +2868,24 @@ private:
         return true;
     }
 
+    // In keyframe snap mode, a key frame fills all the slots nearer to it than to the neighboring key frames
+    void CalcKeyframeSsRange(int64_t keyPts, int32_t& ssIdxBegin, int32_t& ssIdxEnd)
+    {
+        const auto& keyPtsList = *m_hSeekPoints;
+        auto iter = lower_bound(keyPtsList.begin(), keyPtsList.end(), keyPts);
+        auto nextIter = iter != keyPtsList.end() && *iter == keyPts ? iter+1 : iter;
+        int32_t idx0 = 0;
+        if (iter != keyPtsList.begin())
+            idx0 = (int32_t)ceil((double)(*(iter-1)+keyPts)/2/m_ssIntvPts);
+        int32_t idx1 = (int32_t)m_vidMaxIndex+1;
+        if (nextIter != keyPtsList.end())
+            idx1 = (int32_t)ceil((double)(keyPts+*nextIter)/2/m_ssIntvPts);
+        if (idx0 < 0) idx0 = 0;
+        if (idx1 > (int32_t)m_vidMaxIndex+1) idx1 = (int32_t)m_vidMaxIndex+1;
+        if (idx0 < ssIdxBegin) ssIdxBegin = idx0;
+        if (idx1 > ssIdxEnd) ssIdxEnd = idx1;
+    }
+
     bool IsImageSequence()
     {
         return m_hParser->IsImageSequence();
@@ -2290,6 +2905,7 @@ public:
         bool Seek(double pos) override
         {
             lock_guard<recursive_mutex> lk(m_owner->m_apiLock);
+            UpdateVelocity(pos);
             UpdateSnapwnd(pos);
             return true;
         }
@@ -2303,6 +2919,7 @@ public:
         {
             lock_guard<recursive_mutex> lk(m_owner->m_apiLock);
             // AutoSection _as("GetSs");
+            UpdateVelocity(startPos);
             UpdateSnapwnd(startPos);
             auto res = m_owner->GetSnapshots(startPos, snapshots);
             return res;
@@ -2353,6 +2970,24 @@ public:
 
         bool IsTaskRangeChanged() const { return m_taskRangeChanged; }
 
+        void UpdateVelocity(double wndpos)
+        {
+            const auto now = chrono::steady_clock::now();
+            if (m_velocityInited)
+            {
+                const double dt = chrono::duration<double>(now-m_lastMoveTp).count();
+                // e.g. 'Seek()' and 'GetSnapshots()' in the same UI frame
+                if (dt < 0.001)
+                    return;
+                const double instVelocity = (wndpos-m_lastMovePos)/dt;
+                // smooth over the UI frames, restart after a long pause
+                m_velocity = dt > 0.5 ? instVelocity : m_velocity*0.5+instVelocity*0.5;
+            }
+            m_lastMovePos = wndpos;
+            m_lastMoveTp = now;
+            m_velocityInited = true;
+        }
+
         list<_GopDecodeTask::Range> CheckTaskRanges()
         {
             lock_guard<mutex> lk(m_taskRangeLock);
@@ -2366,8 +3001,9 @@ public:
             // AutoSection _as("UpdSnapWnd");
             bool taskRangeChanged = false;
             list<_GopDecodeTask::Range> taskRanges;
-            _SnapWindow snapwnd = m_owner->CreateSnapWindow(wndpos);
-            if ((force || snapwnd.viewIdx0 != m_snapwnd.viewIdx0 || snapwnd.viewIdx1 != m_snapwnd.viewIdx1) &&
+            _SnapWindow snapwnd = m_owner->CreateSnapWindow(wndpos, m_velocity);
+            if ((force || snapwnd.viewIdx0 != m_snapwnd.viewIdx0 || snapwnd.viewIdx1 != m_snapwnd.viewIdx1 ||
+                    snapwnd.cacheIdx0 != m_snapwnd.cacheIdx0 || snapwnd.cacheIdx1 != m_snapwnd.cacheIdx1) &&
                 (snapwnd.seekPos00 != INT64_MIN || snapwnd.seekPos10 != INT64_MIN))
             {
                 if (!m_owner->IsImageSequence())
@@ -2443,6 +3079,11 @@ public:
         list<_GopDecodeTask::Range> m_taskRanges;
         mutex m_taskRangeLock;
         bool m_taskRangeChanged{false};
+        // scrolling speed in seconds of the media per second
+        double m_velocity{0};
+        double m_lastMovePos{0};
+        chrono::steady_clock::time_point m_lastMoveTp;
+        bool m_velocityInited{false};
     };
 
 private:
@@ -2468,15 +3109,19 @@ private:
     AVHWDeviceType m_viddecDevType{AV_HWDEVICE_TYPE_NONE};
     FFUtils::OpenVideoDecoderOptions m_viddecOpenOpts;
     ConditionalMutex m_hwDecCtxLock;
-
-    // demuxing thread
-    thread m_demuxThread;
+    bool m_keyframeSnap{false};
+    PreviewCache::Holder m_hPreviewCache;
+    string m_mediaCacheKey;
+
+    // demuxing and video decoding threads of the workers
+    uint32_t m_decWorkerCount{1};
+    vector<_DecodeWorker::Holder> m_decWorkers;
+    mutex m_demuxTaskLock;
     uint32_t m_maxPendingTaskCountForDecoding = 8;
-    // video decoding thread
-    thread m_viddecThread;
     // update snapshots thread
     thread m_updateSsThread;
     FFUtils::FFFilterGraph::Holder m_hTransposeFilter;
+    mutex m_transposeLock;
 
     int64_t m_vidStartMts{0};
     int64_t m_vidStartPts{0};
@@ -2496,21 +3141,33 @@ private:
     double m_ssMinIntvMts{0};
     uint32_t m_maxCacheSize{0};
     uint32_t m_prevWndCacheSize;
+    double m_prefetchLookahead{1.0};
+    vector<bool> m_ssRequested;
+    double m_ssRequestedIntvMts{0};
+    atomic<uint64_t> m_firstReqCount{0};
+    atomic<uint64_t> m_firstReqReadyCount{0};
+    atomic<uint64_t> m_ssMemFootprint{0};
     list<Viewer::Holder> m_viewers;
     mutex m_viewerListLock;
     list<GopDecodeTaskHolder> m_goptskPrepareList;
     list<GopDecodeTaskHolder> m_goptskList;
     mutex m_goptskListReadLocks[3];
+    // decoded snapshots of the removed tasks, keyed by GOP seek pts range, most recently used first
+    list<_GopSsCacheEntry> m_gopSsCache;
+    uint32_t m_maxGopSsCacheSize{64};
+    mutex m_gopSsCacheLock;
     atomic_int32_t m_pendingVidfrmCnt{0};
     int32_t m_maxPendingVidfrmCnt{2};
     Overview::Holder m_hOverview;
     list<DisplayData::Holder> m_ovssimgs;
     bool m_isOvssComplete{false};
     int32_t m_maxImgsqDecNum{4};
+    SysUtils::FileIterator::Holder m_hFileIter;
 
     bool m_useRszFactor{false};
     float m_ssWFacotr{1.f}, m_ssHFacotr{1.f};
     AVFrameToImMatConverter m_frmCvt;
+    uint32_t m_swsThreadCount{0};
 
     static const DisplayData::Holder S_NULL_DISPLAY_DATA;
 };
@@ -2533,6 +3190,118 @@ Viewer::Holder Generator_Impl::CreateViewer(double pos)
     return hViewer;
 }
 
+void _SnapshotMemoryPool::Register(Generator_Impl* gen)
+{
+    lock_guard<mutex> lk(m_lock);
+    m_generators.push_back(gen);
+}
+
+void _SnapshotMemoryPool::Unregister(Generator_Impl* gen)
+{
+    lock_guard<mutex> lk(m_lock);
+    m_generators.remove(gen);
+    m_urls.erase(gen);
+    uint64_t total = 0;
+    for (auto g : m_generators)
+        total += g->m_ssMemFootprint;
+    m_totalFootprint = total;
+}
+
+void _SnapshotMemoryPool::SetUrl(Generator_Impl* gen, const string& url)
+{
+    lock_guard<mutex> lk(m_lock);
+    if (url.empty())
+        m_urls.erase(gen);
+    else
+        m_urls[gen] = url;
+}
+
+void _SnapshotMemoryPool::GetFootprints(vector<pair<string, uint64_t>>& footprints)
+{
+    footprints.clear();
+    lock_guard<mutex> lk(m_lock);
+    for (auto g : m_generators)
+    {
+        auto iter = m_urls.find(g);
+        footprints.push_back({ iter != m_urls.end() ? iter->second : "", g->m_ssMemFootprint });
+    }
+}
+
+void _SnapshotMemoryPool::Enforce()
+{
+    // called by the task list maintainers of all the Generators, one of them does the job in every 100ms
+    unique_lock<mutex> lk(m_lock, try_to_lock);
+    if (!lk.owns_lock())
+        return;
+    const int64_t nowTick = GetSteadyTickMs();
+    if (nowTick-m_lastEnforceTick < 100)
+        return;
+    m_lastEnforceTick = nowTick;
+
+    // a Generator in an api call (e.g. being closed) keeps its last footprint, and is skipped in this round
+    list<unique_lock<recursive_mutex>> apiLocks;
+    list<Generator_Impl*> lockedGenerators;
+    uint64_t total = 0;
+    for (auto g : m_generators)
+    {
+        unique_lock<recursive_mutex> apiLk(g->m_apiLock, try_to_lock);
+        if (apiLk.owns_lock())
+        {
+            total += g->UpdateMemoryFootprint();
+            apiLocks.push_back(std::move(apiLk));
+            lockedGenerators.push_back(g);
+        }
+        else
+        {
+            total += g->m_ssMemFootprint;
+        }
+    }
+    m_totalFootprint = total;
+    const uint64_t budget = m_budget;
+    if (budget == 0 || total <= budget)
+        return;
+
+    list<Generator_Impl::_EvictionCandidate> candidates;
+    for (auto g : lockedGenerators)
+        g->CollectEvictionCandidates(candidates, nowTick);
+    candidates.sort([] (const Generator_Impl::_EvictionCandidate& a, const Generator_Impl::_EvictionCandidate& b) {
+        return a.weight > b.weight;
+    });
+    // evict to 90% of the budget, to avoid evicting again right after the next snapshot is decoded
+    const uint64_t target = budget/10*9;
+    uint32_t evictCnt = 0;
+    for (auto& cand : candidates)
+    {
+        if (total <= target)
+            break;
+        cand.owner->EvictCandidate(cand);
+        total = total > cand.bytes ? total-cand.bytes : 0;
+        evictCnt++;
+    }
+    GetLogger()->Log(DEBUG) << "[SnapshotMemoryPool] Footprint " << m_totalFootprint << " bytes exceeds the budget " << budget
+            << " bytes, evicted " << evictCnt << " snapshot group(s)." << endl;
+}
+
+void SetMemoryBudget(uint64_t bytes)
+{
+    _SnapshotMemoryPool::GetInstance().SetBudget(bytes);
+}
+
+uint64_t GetMemoryBudget()
+{
+    return _SnapshotMemoryPool::GetInstance().GetBudget();
+}
+
+uint64_t GetTotalMemoryFootprint()
+{
+    return _SnapshotMemoryPool::GetInstance().GetTotalFootprint();
+}
+
+void GetMemoryFootprints(vector<pair<string, uint64_t>>& footprints)
+{
+    _SnapshotMemoryPool::GetInstance().GetFootprints(footprints);
+}
+
 Generator::Holder Generator::CreateInstance()
 {
     return Generator::Holder(static_cast<Generator*>(new Generator_Impl()), [] (Generator* p) {
@@ -23,12 +23,28 @@ using namespace std;
 using namespace MediaCore;
 using namespace Logger;
 
-SubtitleClip_AssImpl::SubtitleClip_AssImpl(ASS_Event* assEvent, ASS_Track* assTrack, AssRenderCallback renderCb)
-    : m_type(SubtitleType::ASS), m_assEvent(assEvent), m_assTrack(assTrack), m_renderCb(renderCb)
-    , m_readOrder(assEvent->ReadOrder), m_trackStyle(assTrack->styles[assEvent->Style].Name)
+SubtitleClip_AssImpl::SubtitleClip_AssImpl(ASS_Event* assEvent, ASS_Track* assTrack, AssRenderCallback renderCb, recursive_mutex* renderLock, shared_timed_mutex* assTrackLock,
+        AssClipChangedCallback changedCb)
+    : m_type(SubtitleType::ASS), m_assEvent(assEvent), m_assTrack(assTrack), m_renderCb(renderCb), m_renderLock(renderLock), m_assTrackLock(assTrackLock)
+    , m_changedCb(changedCb), m_readOrder(assEvent->ReadOrder), m_trackStyle(assTrack->styles[assEvent->Style].Name)
     , m_text(string(assEvent->Text))
 {}
 
+// All the changes are made under the track's render lock, so the clip is never rendered half changed
+unique_lock<recursive_mutex> SubtitleClip_AssImpl::LockRender()
+{
+    return m_renderLock ? unique_lock<recursive_mutex>(*m_renderLock) : unique_lock<recursive_mutex>();
+}
+
+// Drop the rendered images, and let the track restart its pre-rendering with the new content
+void SubtitleClip_AssImpl::OnContentChanged()
+{
+    m_renderedImages.clear();
+    m_imageGeneration++;
+    if (m_changedCb)
+        m_changedCb(this);
+}
+
 SubtitleImage SubtitleClip_AssImpl::Image(int64_t timeOffset)
 {
     if (!m_assEvent || !m_renderCb)
@@ -36,79 +52,97 @@ SubtitleImage SubtitleClip_AssImpl::Image(int64_t timeOffset)
     if (timeOffset < 0 || timeOffset >= Duration())
         return SubtitleImage();
 
+    unique_lock<recursive_mutex> lk;
+    if (m_renderLock)
+        lk = unique_lock<recursive_mutex>(*m_renderLock);
     auto iter = m_renderedImages.find(timeOffset);
-    if (iter == m_renderedImages.end())
+    if (iter != m_renderedImages.end())
+        return iter->second;
+
+    bool x_absolute = false;
+    bool y_absolute = false;
+    int64_t pos = timeOffset;
+    for (int i = 0; i < m_keyPoints.GetCurveCount(); i++)
     {
-        bool x_absolute = false;
-        bool y_absolute = false;
-        int64_t pos = timeOffset;
-        for (int i = 0; i < m_keyPoints.GetCurveCount(); i++)
+        auto name = m_keyPoints.GetCurveName(i);
+        auto value = m_keyPoints.GetValueByDim(i, pos, ImGui::ImCurveEdit::DIM_X);
+        if (name == "Scale")
         {
-            auto name = m_keyPoints.GetCurveName(i);
-            auto value = m_keyPoints.GetValueByDim(i, pos, ImGui::ImCurveEdit::DIM_X);
-            if (name == "Scale")
-            {
-                _SetScaleX(value, false);
-                _SetScaleY(value, false);
-            }
-            else if (name == "ScaleX")
-                _SetScaleX(value, false);
-            else if (name == "ScaleY")
-                _SetScaleY(value, false);
-            else if (name == "Spacing")
-                _SetSpacing(value, false);
-            else if (name == "OutlineWidth" || name == "BorderWidth")
-                _SetBorderWidth(value, false);
-            else if (name == "ShadowDepth")
-                _SetShadowDepth(value, false);
-            else if (name == "AngleX" || name == "RotationX")
-                _SetRotationX(value, false);
-            else if (name == "AngleY" || name == "RotationY")
-                _SetRotationY(value, false);
-            else if (name == "AngleZ" || name == "RotationZ")
-                _SetRotationZ(value, false);
-            else if (name == "OffsetH")
-            {
-                _SetOffsetH(value, false);
-                x_absolute = true;
-            }
-            else if (name == "OffsetV")
-            {
-                _SetOffsetV(value, false);
-                y_absolute = true;
-            }
-            else
-                Log(WARN) << "[SubtitleClip_AssImpl] UNKNOWN curve name '" << name << "', value=" << value << "." << endl;
+            _SetScaleX(value, false);
+            _SetScaleY(value, false);
         }
-        if (m_styledTextNeedUpdate)
+        else if (name == "ScaleX")
+            _SetScaleX(value, false);
+        else if (name == "ScaleY")
+            _SetScaleY(value, false);
+        else if (name == "Spacing")
+            _SetSpacing(value, false);
+        else if (name == "OutlineWidth" || name == "BorderWidth")
+            _SetBorderWidth(value, false);
+        else if (name == "ShadowDepth")
+            _SetShadowDepth(value, false);
+        else if (name == "AngleX" || name == "RotationX")
+            _SetRotationX(value, false);
+        else if (name == "AngleY" || name == "RotationY")
+            _SetRotationY(value, false);
+        else if (name == "AngleZ" || name == "RotationZ")
+            _SetRotationZ(value, false);
+        else if (name == "OffsetH")
         {
-            if (m_assEvent->Text)
-                free(m_assEvent->Text);
-            if (!m_useTrackStyle)
-                GenerateStyledText();
-            string& assText = m_useTrackStyle ? m_text : m_styledText;
-            int len = assText.size();
-            m_assEvent->Text = (char*)malloc(len+1);
-            memcpy(m_assEvent->Text, assText.c_str(), len);
-            m_assEvent->Text[len] = 0;
-            m_styledTextNeedUpdate = false;
+            _SetOffsetH(value, false);
+            x_absolute = true;
         }
-        m_renderedImages[timeOffset] = m_renderCb(this, timeOffset, x_absolute, y_absolute);
+        else if (name == "OffsetV")
+        {
+            _SetOffsetV(value, false);
+            y_absolute = true;
+        }
+        else
+            Log(WARN) << "[SubtitleClip_AssImpl] UNKNOWN curve name '" << name << "', value=" << value << "." << endl;
+    }
+    if (m_styledTextNeedUpdate)
+    {
+        unique_lock<shared_timed_mutex> trkLk;
+        if (m_assTrackLock)
+            trkLk = unique_lock<shared_timed_mutex>(*m_assTrackLock);
+        if (m_assEvent->Text)
+            free(m_assEvent->Text);
+        if (!m_useTrackStyle)
+            GenerateStyledText();
+        string& assText = m_useTrackStyle ? m_text : m_styledText;
+        int len = assText.size();
+        m_assEvent->Text = (char*)malloc(len+1);
+        memcpy(m_assEvent->Text, assText.c_str(), len);
+        m_assEvent->Text[len] = 0;
+        m_styledTextNeedUpdate = false;
     }
-    return m_renderedImages[timeOffset];
+    // the ASS_Event of a clip animated by its own key points changes with the time offset, so it is rendered under the
+    // lock. The others are rasterized concurrently by the track's renderers.
+    const uint32_t imageGeneration = m_imageGeneration;
+    if (m_keyPoints.GetCurveCount() <= 0 && lk.owns_lock())
+        lk.unlock();
+    SubtitleImage image = m_renderCb(this, timeOffset, x_absolute, y_absolute);
+    if (m_renderLock && !lk.owns_lock())
+        lk.lock();
+    // the clip may be changed while it's rendered out of the lock, the image of the old content is not kept
+    if (m_imageGeneration == imageGeneration)
+        m_renderedImages[timeOffset] = image;
+    return image;
 }
 
 void SubtitleClip_AssImpl::EnableUsingTrackStyle(bool enable)
 {
+    auto lk = LockRender();
     if (m_useTrackStyle == enable)
         return;
     m_useTrackStyle = enable;
     m_styledTextNeedUpdate = true;
-    m_renderedImages.clear();
+    OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::SetTrackStyle(const std::string& name)
 {
+    auto lk = LockRender();
     if (!m_assEvent || m_trackStyle == name)
         return;
 
@@ -136,11 +170,12 @@ void SubtitleClip_AssImpl::SetTrackStyle(const std::string& name)
         m_trackStyle = "Default";
 
     if (m_useTrackStyle)
-        m_renderedImages.clear();
+        OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::SyncStyle(const SubtitleStyle& style)
 {
+    auto lk = LockRender();
     m_font = style.Font();
     m_scaleX = style.ScaleX();
     m_scaleY = style.ScaleY();
@@ -168,19 +203,20 @@ void SubtitleClip_AssImpl::SyncStyle(const SubtitleStyle& style)
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetFont(const std::string& font)
 {
+    auto lk = LockRender();
     if (m_font == font)
         return;
     m_font = font;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
@@ -193,6 +229,7 @@ void SubtitleClip_AssImpl::SetFont(const std::string& font)
 
 void SubtitleClip_AssImpl::SetScaleX(double value)
 {
+    auto lk = LockRender();
     return _SetScaleX(value, true);
 }
 
@@ -205,12 +242,13 @@ void SubtitleClip_AssImpl::_SetScaleX(double value, bool clearCache)
     {
         m_styledTextNeedUpdate = true;
         if (clearCache)
-            m_renderedImages.clear();
+            OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetScaleY(double value)
 {
+    auto lk = LockRender();
     return _SetScaleY(value, true);
 }
 
@@ -223,12 +261,13 @@ void SubtitleClip_AssImpl::_SetScaleY(double value, bool clearCache)
     {
         m_styledTextNeedUpdate = true;
         if (clearCache)
-            m_renderedImages.clear();
+            OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetSpacing(double value)
 {
+    auto lk = LockRender();
     return _SetSpacing(value, true);
 }
 
@@ -241,12 +280,13 @@ void SubtitleClip_AssImpl::_SetSpacing(double value, bool clearCache)
     {
         m_styledTextNeedUpdate = true;
         if (clearCache)
-            m_renderedImages.clear();
+            OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetBorderWidth(double value)
 {
+    auto lk = LockRender();
     return _SetBorderWidth(value, true);
 }
 
@@ -259,12 +299,13 @@ void SubtitleClip_AssImpl::_SetBorderWidth(double value, bool clearCache)
     {
         m_styledTextNeedUpdate = true;
         if (clearCache)
-            m_renderedImages.clear();
+            OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetShadowDepth(double value)
 {
+    auto lk = LockRender();
     return _SetShadowDepth(value, true);
 }
 
@@ -277,12 +318,13 @@ void SubtitleClip_AssImpl::_SetShadowDepth(double value, bool clearCache)
     {
         m_styledTextNeedUpdate = true;
         if (clearCache)
-            m_renderedImages.clear();
+            OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetRotationX(double value)
 {
+    auto lk = LockRender();
     return _SetRotationX(value, true);
 }
 
@@ -296,12 +338,13 @@ void SubtitleClip_AssImpl::_SetRotationX(double value, bool clearCache)
     {
         m_styledTextNeedUpdate = true;
         if (clearCache)
-            m_renderedImages.clear();
+            OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetRotationY(double value)
 {
+    auto lk = LockRender();
     return _SetRotationY(value, true);
 }
 
@@ -315,12 +358,13 @@ void SubtitleClip_AssImpl::_SetRotationY(double value, bool clearCache)
     {
         m_styledTextNeedUpdate = true;
         if (clearCache)
-            m_renderedImages.clear();
+            OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetRotationZ(double value)
 {
+    auto lk = LockRender();
     return _SetRotationZ(value, true);
 }
 
@@ -334,12 +378,13 @@ void SubtitleClip_AssImpl::_SetRotationZ(double value, bool clearCache)
     {
         m_styledTextNeedUpdate = true;
         if (clearCache)
-            m_renderedImages.clear();
+            OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetOffsetH(int32_t value)
 {
+    auto lk = LockRender();
     return _SetOffsetH(value, true);
 }
 
@@ -349,11 +394,12 @@ void SubtitleClip_AssImpl::_SetOffsetH(int32_t value, bool clearCache)
         return;
     m_offsetH = value;
     if (!m_useTrackStyle && clearCache)
-        m_renderedImages.clear();
+        OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::SetOffsetV(int32_t value)
 {
+    auto lk = LockRender();
     return _SetOffsetV(value, true);
 }
 
@@ -363,11 +409,12 @@ void SubtitleClip_AssImpl::_SetOffsetV(int32_t value, bool clearCache)
         return;
     m_offsetV = value;
     if (!m_useTrackStyle && clearCache)
-        m_renderedImages.clear();
+        OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::SetOffsetH(float value)
 {
+    auto lk = LockRender();
     return _SetOffsetH(value, true);
 }
 
@@ -377,11 +424,12 @@ void SubtitleClip_AssImpl::_SetOffsetH(float value, bool clearCache)
         return;
     m_foffsetH = value;
     if (!m_useTrackStyle && clearCache)
-        m_renderedImages.clear();
+        OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::SetOffsetV(float value)
 {
+    auto lk = LockRender();
     return _SetOffsetV(value, true);
 }
 
@@ -391,65 +439,70 @@ void SubtitleClip_AssImpl::_SetOffsetV(float value, bool clearCache)
         return;
     m_foffsetV = value;
     if (!m_useTrackStyle && clearCache)
-        m_renderedImages.clear();
+        OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::SetPrimaryColor(const SubtitleColor& color)
 {
+    auto lk = LockRender();
     if (m_primaryColor == color)
         return;
     m_primaryColor = color;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetSecondaryColor(const SubtitleColor& color)
 {
+    auto lk = LockRender();
     if (m_secondaryColor == color)
         return;
     m_secondaryColor = color;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetOutlineColor(const SubtitleColor& color)
 {
+    auto lk = LockRender();
     if (m_outlineColor == color)
         return;
     m_outlineColor = color;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetBackColor(const SubtitleColor& color)
 {
+    auto lk = LockRender();
     if (m_backColor == color)
         return;
     m_backColor = color;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetBackgroundColor(const SubtitleColor& color)
 {
+    auto lk = LockRender();
     if (m_bgColor == color)
         return;
     m_bgColor = color;
     if (!m_useTrackStyle)
     {
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
@@ -485,66 +538,72 @@ void SubtitleClip_AssImpl::SetBackgroundColor(const ImVec4& color)
 
 void SubtitleClip_AssImpl::SetBold(bool enable)
 {
+    auto lk = LockRender();
     if (m_bold == enable)
         return;
     m_bold = enable;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetItalic(bool enable)
 {
+    auto lk = LockRender();
     if (m_italic == enable)
         return;
     m_italic = enable;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetUnderLine(bool enable)
 {
+    auto lk = LockRender();
     if (m_underline == enable)
         return;
     m_underline = enable;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetStrikeOut(bool enable)
 {
+    auto lk = LockRender();
     if (m_strikeout == enable)
         return;
     m_strikeout = enable;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetBlurEdge(bool enable) 
 {
+    auto lk = LockRender();
     if (m_blurEdge == enable)
         return;
     m_blurEdge = enable;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetAlignment(uint32_t value)
 {
+    auto lk = LockRender();
     if (m_alignment == value)
         return;
     value = value<1 ? 1 : (value>9 ? 9 : value);
@@ -552,31 +611,34 @@ void SubtitleClip_AssImpl::SetAlignment(uint32_t value)
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetKeyPoints(const ImGui::KeyPointEditor& keyPoints)
 {
+    auto lk = LockRender();
     m_keyPoints = keyPoints;
     if (!m_useTrackStyle)
     {
         m_styledTextNeedUpdate = true;
-        m_renderedImages.clear();
+        OnContentChanged();
     }
 }
 
 void SubtitleClip_AssImpl::SetText(const std::string& text)
 {
+    auto lk = LockRender();
     if (m_text == text)
         return;
     m_text = text;
     m_styledTextNeedUpdate = true;
-    m_renderedImages.clear();
+    OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::CloneStyle(SubtitleClipHolder from, double wRatio, double hRatio)
 {
+    auto lk = LockRender();
     m_useTrackStyle = from->IsUsingTrackStyle();
     SetTrackStyle(from->TrackStyle());
     SetFont(from->Font());
@@ -606,11 +668,13 @@ void SubtitleClip_AssImpl::CloneStyle(SubtitleClipHolder from, double wRatio, do
 
 void SubtitleClip_AssImpl::InvalidateImage()
 {
-    m_renderedImages.clear();
+    auto lk = LockRender();
+    OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::ResyncAssEventPtr(ASS_Event* assEvent)
 {
+    auto lk = LockRender();
     if (assEvent->ReadOrder != m_readOrder)
         throw runtime_error("Ass event readorder does NOT MATCH!");
     m_assEvent = assEvent;
@@ -618,18 +682,20 @@ void SubtitleClip_AssImpl::ResyncAssEventPtr(ASS_Event* assEvent)
 
 void SubtitleClip_AssImpl::SetStartTime(int64_t startTime)
 {
+    auto lk = LockRender();
     if (!m_assEvent)
         return;
     m_assEvent->Start = startTime;
-    m_renderedImages.clear();
+    OnContentChanged();
 }
 
 void SubtitleClip_AssImpl::SetDuration(int64_t duration)
 {
+    auto lk = LockRender();
     if (!m_assEvent)
         return;
     m_assEvent->Duration = duration;
-    m_renderedImages.clear();
+    OnContentChanged();
 }
 
 string SubtitleClip_AssImpl::GenerateAssChunk()
@@ -699,6 +765,7 @@ string SubtitleClip_AssImpl::GetAssText()
 
 void SubtitleClip_AssImpl::UpdateImageAreaX(int32_t bias)
 {
+    auto lk = LockRender();
     for (auto& elem : m_renderedImages)
     {
         auto& image = elem.second;
@@ -710,6 +777,7 @@ void SubtitleClip_AssImpl::UpdateImageAreaX(int32_t bias)
 
 void SubtitleClip_AssImpl::UpdateImageAreaY(int32_t bias)
 {
+    auto lk = LockRender();
     for (auto& elem : m_renderedImages)
     {
         auto& image = elem.second;
@@ -721,7 +789,9 @@ void SubtitleClip_AssImpl::UpdateImageAreaY(int32_t bias)
 
 void SubtitleClip_AssImpl::InvalidateClip()
 {
+    auto lk = LockRender();
     m_assTrack = nullptr;
     m_assEvent = nullptr;
     m_renderedImages.clear();
+    m_imageGeneration++;
 }
@@ -17,6 +17,8 @@
 
 #pragma once
 #include <map>
+#include <mutex>
+#include <shared_mutex>
 #include "ass/ass_types.h"
 #include "SubtitleClip.h"
 
@@ -24,11 +26,14 @@ namespace MediaCore
 {
     class SubtitleClip_AssImpl;
     using AssRenderCallback = std::function<SubtitleImage(SubtitleClip_AssImpl*, int64_t, bool, bool)>;
+    // Invoked under the render lock after a change of the rendered content
+    using AssClipChangedCallback = std::function<void(SubtitleClip_AssImpl*)>;
 
     class SubtitleClip_AssImpl : public SubtitleClip
     {
     public:
-        SubtitleClip_AssImpl(ASS_Event* assEvent, ASS_Track* assTrack, AssRenderCallback renderCb);
+        SubtitleClip_AssImpl(ASS_Event* assEvent, ASS_Track* assTrack, AssRenderCallback renderCb, std::recursive_mutex* renderLock = nullptr, std::shared_timed_mutex* assTrackLock = nullptr,
+                AssClipChangedCallback changedCb = nullptr);
 
         SubtitleClip_AssImpl(const SubtitleClip_AssImpl&) = delete;
         SubtitleClip_AssImpl(SubtitleClip_AssImpl&&) = delete;
@@ -124,6 +129,8 @@ namespace MediaCore
         void InvalidateClip();
 
     private:
+        std::unique_lock<std::recursive_mutex> LockRender();
+        void OnContentChanged();
         void _SetScaleX(double value, bool clearCache = true);
         void _SetScaleY(double value, bool clearCache = true);
         void _SetSpacing(double value, bool clearCache = true);
@@ -171,10 +178,17 @@ namespace MediaCore
         std::string m_styledText;
         bool m_styledTextNeedUpdate{false};
         std::map<int64_t, SubtitleImage> m_renderedImages;
+        // increased whenever 'm_renderedImages' is cleared
+        uint32_t m_imageGeneration{0};
 
         ASS_Track* m_assTrack{nullptr};
         ASS_Event* m_assEvent{nullptr};
         int m_readOrder;
         AssRenderCallback m_renderCb;
+        // owned by the track, serializes the rendering with the track's pre-render worker
+        std::recursive_mutex* m_renderLock;
+        // owned by the track, held exclusively while the ASS_Event is changed and shared by the renderers reading it
+        std::shared_timed_mutex* m_assTrackLock;
+        AssClipChangedCallback m_changedCb;
     };
 }
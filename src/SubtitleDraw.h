@@ -0,0 +1,104 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SUBTITLE_DRAW_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SUBTITLE_DRAW_NEON
+#include <arm_neon.h>
+#endif
+
+// Composition of the libass bitmaps into the subtitle images, shared with the unit tests
+namespace MediaCore
+{
+// x/255 for x in [0, 65534], in fixed-point
+inline uint32_t Div255(uint32_t x)
+{
+    x++;
+    return (x+(x>>8))>>8;
+}
+
+// Draw one row of an ASS_Image bitmap, each pixel covered by the bitmap is set to 'color' with the alpha 'b*baseAlpha/255',
+// 'b' is the coverage value of the bitmap. The uncovered pixels are left unchanged.
+inline void DrawAssBitmapRow(uint32_t* dst, const uint8_t* bitmap, int width, uint32_t color, uint32_t baseAlpha)
+{
+    int j = 0;
+#if defined(SUBTITLE_DRAW_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one16 = _mm_set1_epi16(1);
+    const __m128i baseAlpha16 = _mm_set1_epi16((short)baseAlpha);
+    const __m128i color32 = _mm_set1_epi32((int)color);
+    for (; j+16 <= width; j += 16)
+    {
+        const __m128i b8 = _mm_loadu_si128((const __m128i*)(bitmap+j));
+        const __m128i keep8 = _mm_cmpeq_epi8(b8, zero);
+        if (_mm_movemask_epi8(keep8) == 0xffff)
+            continue;
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b8, zero), baseAlpha16), one16);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b8, zero), baseAlpha16), one16);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        const __m128i a8 = _mm_packus_epi16(lo, hi);
+        // expand the alpha values to the top byte of 32-bit pixels, and the 'keep' masks to 32-bit lanes
+        const __m128i a16[2] = { _mm_unpacklo_epi8(zero, a8), _mm_unpackhi_epi8(zero, a8) };
+        const __m128i keep16[2] = { _mm_unpacklo_epi8(keep8, keep8), _mm_unpackhi_epi8(keep8, keep8) };
+        for (int k = 0; k < 4; k++)
+        {
+            const __m128i a32 = (k&1) ? _mm_unpackhi_epi16(zero, a16[k>>1]) : _mm_unpacklo_epi16(zero, a16[k>>1]);
+            const __m128i keep32 = (k&1) ? _mm_unpackhi_epi16(keep16[k>>1], keep16[k>>1]) : _mm_unpacklo_epi16(keep16[k>>1], keep16[k>>1]);
+            __m128i* p = (__m128i*)(dst+j+k*4);
+            const __m128i pixels = _mm_or_si128(a32, color32);
+            _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(keep32, _mm_loadu_si128(p)), _mm_andnot_si128(keep32, pixels)));
+        }
+    }
+#elif defined(SUBTITLE_DRAW_NEON)
+    const uint8x8_t baseAlpha8 = vdup_n_u8((uint8_t)baseAlpha);
+    const uint16x8_t one16 = vdupq_n_u16(1);
+    const uint8x16_t zero8 = vdupq_n_u8(0);
+    uint8x16_t color8[3];
+    for (int c = 0; c < 3; c++)
+        color8[c] = vdupq_n_u8((uint8_t)(color>>(c*8)));
+    for (; j+16 <= width; j += 16)
+    {
+        const uint8x16_t b8 = vld1q_u8(bitmap+j);
+        if (vmaxvq_u8(b8) == 0)
+            continue;
+        uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(b8), baseAlpha8), one16);
+        uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(b8), baseAlpha8), one16);
+        lo = vshrq_n_u16(vaddq_u16(lo, vshrq_n_u16(lo, 8)), 8);
+        hi = vshrq_n_u16(vaddq_u16(hi, vshrq_n_u16(hi, 8)), 8);
+        const uint8x16_t a8 = vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+        const uint8x16_t keep8 = vceqq_u8(b8, zero8);
+        // pixels are stored as R,G,B,A bytes
+        uint8x16x4_t pixels = vld4q_u8((const uint8_t*)(dst+j));
+        for (int c = 0; c < 3; c++)
+            pixels.val[c] = vbslq_u8(keep8, pixels.val[c], color8[c]);
+        pixels.val[3] = vbslq_u8(keep8, pixels.val[3], a8);
+        vst4q_u8((uint8_t*)(dst+j), pixels);
+    }
+#endif
+    for (; j < width; j++)
+    {
+        const uint32_t b = bitmap[j];
+        if (b > 0)
+            dst[j] = color | (Div255(b*baseAlpha)<<24);
+    }
+}
+}
@@ -19,9 +19,12 @@
 #include <algorithm>
 #include <vector>
 #include <cstring>
+#include <chrono>
 #include "SubtitleTrack_AssImpl.h"
 #include "SubtitleClip_AssImpl.h"
+#include "SubtitleDraw.h"
 #include "FFUtils.h"
+#include "ThreadUtils.h"
 extern "C"
 {
     #include "libavutil/avutil.h"
@@ -266,15 +269,16 @@ SubtitleTrack_AssImpl::SubtitleTrack_AssImpl(int64_t id)
 {
     m_logger = GetSubtitleTrackLogger();
     m_currIter = m_clips.begin();
+    m_maxAssRenderers = std::max(std::min(thread::hardware_concurrency(), 4u), 1u);
 }
 
 SubtitleTrack_AssImpl::~SubtitleTrack_AssImpl()
 {
-    if (m_assrnd)
-    {
-        ass_renderer_done(m_assrnd);
-        m_assrnd = nullptr;
-    }
+    StopPreRender();
+    for (auto& slot : m_assRenderers)
+        DestroyAssRendererSlot(slot.get());
+    m_assRenderers.clear();
+    m_idleAssRenderers.clear();
     if (m_asstrk)
     {
         ass_free_track(m_asstrk);
@@ -290,14 +294,15 @@ bool SubtitleTrack_AssImpl::InitAss()
         m_errMsg = "ASS library has NOT been INITIALIZED!";
         return false;
     }
-    m_assrnd = ass_renderer_init(s_asslib);
-    if (!m_assrnd)
+    ASS_Renderer* assrnd = CreateAssRenderer();
+    if (!assrnd)
     {
         m_errMsg = "FAILED to initialize ASS renderer!";
         return false;
     }
-    ass_set_fonts(m_assrnd, NULL, NULL, ASS_FONTPROVIDER_AUTODETECT, NULL, 1);
-    ass_set_pixel_aspect(m_assrnd, 1);
+    m_assRenderers.push_back(unique_ptr<AssRendererSlot>(new AssRendererSlot()));
+    m_assRenderers.back()->assrnd = assrnd;
+    m_idleAssRenderers.push_back(m_assRenderers.back().get());
     m_asstrk = ass_new_track(s_asslib);
     if (!m_asstrk)
     {
@@ -309,7 +314,8 @@ bool SubtitleTrack_AssImpl::InitAss()
 
 bool SubtitleTrack_AssImpl::SetFrameSize(uint32_t width, uint32_t height)
 {
-    ass_set_frame_size(m_assrnd, width, height);
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    // the renderers take the new size on their next rendering
     m_frmW = width;
     m_frmH = height;
     return true;
@@ -317,6 +323,7 @@ bool SubtitleTrack_AssImpl::SetFrameSize(uint32_t width, uint32_t height)
 
 bool SubtitleTrack_AssImpl::EnableFullSizeOutput(bool enable)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_outputFullSize == enable)
         return true;
     m_outputFullSize = enable;
@@ -326,19 +333,19 @@ bool SubtitleTrack_AssImpl::EnableFullSizeOutput(bool enable)
 
 bool SubtitleTrack_AssImpl::SetFont(const std::string& font)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.Font() == font)
         return true;
     m_logger->Log(DEBUG) << "Set font '" << font << "'" << endl;
     m_overrideStyle.SetFont(font);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetScaleX(double value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetScaleX(value);
 }
 
@@ -348,9 +355,7 @@ bool SubtitleTrack_AssImpl::_SetScaleX(double value, bool clearCache)
         return true;
     m_logger->Log(DEBUG) << "Set scaleX '" << value << "'" << endl;
     m_overrideStyle.SetScaleX(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     if (clearCache)
         ClearRenderCache();
     return true;
@@ -358,6 +363,7 @@ bool SubtitleTrack_AssImpl::_SetScaleX(double value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetScaleY(double value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetScaleY(value);
 }
 
@@ -367,9 +373,7 @@ bool SubtitleTrack_AssImpl::_SetScaleY(double value, bool clearCache)
         return true;
     m_logger->Log(DEBUG) << "Set scaleY '" << value << "'" << endl;
     m_overrideStyle.SetScaleY(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     if (clearCache)
         ClearRenderCache();
     return true;
@@ -377,6 +381,7 @@ bool SubtitleTrack_AssImpl::_SetScaleY(double value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetSpacing(double value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetSpacing(value);
 }
 
@@ -386,9 +391,7 @@ bool SubtitleTrack_AssImpl::_SetSpacing(double value, bool clearCache)
         return true;
     m_logger->Log(DEBUG) << "Set spacing '" << value << "'" << endl;
     m_overrideStyle.SetSpacing(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     if (clearCache)
         ClearRenderCache();
     return true;
@@ -396,6 +399,7 @@ bool SubtitleTrack_AssImpl::_SetSpacing(double value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetAngle(double value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetAngle(value);
 }
 
@@ -405,9 +409,7 @@ bool SubtitleTrack_AssImpl::_SetAngle(double value, bool clearCache)
         return true;
     m_logger->Log(DEBUG) << "Set angle '" << value << "'" << endl;
     m_overrideStyle.SetAngle(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     if (clearCache)
         ClearRenderCache();
     return true;
@@ -415,6 +417,7 @@ bool SubtitleTrack_AssImpl::_SetAngle(double value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetOutlineWidth(double value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetOutlineWidth(value);
 }
 
@@ -424,9 +427,7 @@ bool SubtitleTrack_AssImpl::_SetOutlineWidth(double value, bool clearCache)
         return true;
     m_logger->Log(DEBUG) << "Set outline '" << value << "'" << endl;
     m_overrideStyle.SetOutlineWidth(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     if (clearCache)
         ClearRenderCache();
     return true;
@@ -434,6 +435,7 @@ bool SubtitleTrack_AssImpl::_SetOutlineWidth(double value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetShadowDepth(double value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetShadowDepth(value);
 }
 
@@ -443,9 +445,7 @@ bool SubtitleTrack_AssImpl::_SetShadowDepth(double value, bool clearCache)
         return true;
     m_logger->Log(DEBUG) << "Set shadow depth '" << value << "'" << endl;
     m_overrideStyle.SetShadowDepth(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     if (clearCache)
         ClearRenderCache();
     return true;
@@ -453,32 +453,31 @@ bool SubtitleTrack_AssImpl::_SetShadowDepth(double value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetBorderStyle(int value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.BorderStyle() == value)
         return true;
     m_logger->Log(DEBUG) << "Set border style '" << value << "'" << endl;
     m_overrideStyle.SetBorderStyle(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetAlignment(int value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.Alignment() == value)   
         return true;
     m_logger->Log(DEBUG) << "Set alignment '" << value << "'" << endl;
     m_overrideStyle.SetAlignment(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetOffsetH(int value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetOffsetH(value);
 }
 
@@ -507,6 +506,7 @@ bool SubtitleTrack_AssImpl::_SetOffsetH(int value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetOffsetV(int value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetOffsetV(value);
 }
 
@@ -535,6 +535,7 @@ bool SubtitleTrack_AssImpl::_SetOffsetV(int value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetOffsetH(float value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetOffsetH(value);
 }
 
@@ -563,6 +564,7 @@ bool SubtitleTrack_AssImpl::_SetOffsetH(float value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetOffsetV(float value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     return _SetOffsetV(value);
 }
 
@@ -591,6 +593,7 @@ bool SubtitleTrack_AssImpl::_SetOffsetV(float value, bool clearCache)
 
 bool SubtitleTrack_AssImpl::SetOffsetCompensationV(int32_t value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_offsetCompensationV == value)
         return true;
     m_logger->Log(DEBUG) << "Set offsetCompensationV '" << value << "'" << endl;
@@ -611,6 +614,7 @@ bool SubtitleTrack_AssImpl::SetOffsetCompensationV(int32_t value)
 
 bool SubtitleTrack_AssImpl::SetOffsetCompensationV(float value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_foffsetCompensationV == value)
         return true;
     m_logger->Log(DEBUG) << "Set offsetCompensationV Scale'" << value << "'" << endl;
@@ -631,110 +635,103 @@ bool SubtitleTrack_AssImpl::SetOffsetCompensationV(float value)
 
 bool SubtitleTrack_AssImpl::SetItalic(int value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.Italic() == value)
         return true;
     m_logger->Log(DEBUG) << "Set italic '" << value << "'" << endl;
     m_overrideStyle.SetItalic(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetBold(int value)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.Bold() == value)
         return true;
     m_logger->Log(DEBUG) << "Set bold '" << value << "'" << endl;
     m_overrideStyle.SetBold(value);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetUnderLine(bool enable)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.UnderLine() == enable)
         return true;
     m_logger->Log(DEBUG) << "Set underline '" << enable << "'" << endl;
     m_overrideStyle.SetUnderLine(enable);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetStrikeOut(bool enable)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.StrikeOut() == enable)
         return true;
     m_logger->Log(DEBUG) << "Set strikeout '" << enable << "'" << endl;
     m_overrideStyle.SetStrikeOut(enable);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetPrimaryColor(const SubtitleColor& color)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.PrimaryColor() == color)
         return true;
     m_logger->Log(DEBUG) << "Set primary color as { r(" << color.r << "), g(" << color.g << "), b(" << color.b << "), a(" << color.a << ") }" << endl;
     m_overrideStyle.SetPrimaryColor(color);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetSecondaryColor(const SubtitleColor& color)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.SecondaryColor() == color)
         return true;
     m_logger->Log(DEBUG) << "Set secondary color as { r(" << color.r << "), g(" << color.g << "), b(" << color.b << "), a(" << color.a << ") }" << endl;
     m_overrideStyle.SetSecondaryColor(color);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetOutlineColor(const SubtitleColor& color)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.OutlineColor() == color)
         return true;
     m_logger->Log(DEBUG) << "Set outline color as { r(" << color.r << "), g(" << color.g << "), b(" << color.b << "), a(" << color.a << ") }" << endl;
     m_overrideStyle.SetOutlineColor(color);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetBackColor(const SubtitleColor& color)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.BackColor() == color)
         return true;
     m_logger->Log(DEBUG) << "Set back color as { r(" << color.r << "), g(" << color.g << "), b(" << color.b << "), a(" << color.a << ") }" << endl;
     m_overrideStyle.SetBackColor(color);
-    ass_set_selective_style_override(m_assrnd, m_overrideStyle.GetAssStylePtr());
-    if (!m_useOverrideStyle)
-        ToggleOverrideStyle();
+    UpdateStyleOverride();
     ClearRenderCache();
     return true;
 }
 
 bool SubtitleTrack_AssImpl::SetBackgroundColor(const SubtitleColor& color)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     if (m_overrideStyle.BackgroundColor() == color)
         return true;
     m_logger->Log(DEBUG) << "Set background color as { r(" << color.r << "), g(" << color.g << "), b(" << color.b << "), a(" << color.a << ") }" << endl;
@@ -775,11 +772,288 @@ bool SubtitleTrack_AssImpl::SetBackgroundColor(const ImVec4& color)
 
 void SubtitleTrack_AssImpl::Refresh()
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    ClearSharedRenderCache();
     ClearRenderCache();
 }
 
+void SubtitleTrack_AssImpl::BeginStyleUpdate()
+{
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    m_styleUpdateDepth++;
+}
+
+void SubtitleTrack_AssImpl::EndStyleUpdate()
+{
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    if (m_styleUpdateDepth <= 0)
+    {
+        m_logger->Log(WARN) << "'EndStyleUpdate()' is called without a matching 'BeginStyleUpdate()'!" << endl;
+        return;
+    }
+    m_styleUpdateDepth--;
+    if (m_styleUpdateDepth > 0)
+        return;
+    if (m_styleOverridePending)
+        ApplyStyleOverride();
+    if (m_renderCacheClearPending)
+        ClearRenderCache();
+}
+
+void SubtitleTrack_AssImpl::SetRenderCacheLimit(uint32_t maxCount, uint64_t maxBytes)
+{
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    m_renderCacheMaxCount = maxCount;
+    m_renderCacheMaxBytes = maxBytes;
+    ShrinkRenderCache();
+}
+
+void SubtitleTrack_AssImpl::SetMaxRenderers(uint32_t count)
+{
+    if (count < 1)
+        count = 1;
+    lock_guard<mutex> lk(m_assRendererPoolLock);
+    m_maxAssRenderers = count;
+    // release the idle renderers over the limit, the busy ones are released when they are returned
+    while (m_assRenderers.size() > m_maxAssRenderers && !m_idleAssRenderers.empty())
+    {
+        AssRendererSlot* slot = m_idleAssRenderers.back();
+        m_idleAssRenderers.pop_back();
+        auto iter = find_if(m_assRenderers.begin(), m_assRenderers.end(), [slot] (const unique_ptr<AssRendererSlot>& a) {
+            return a.get() == slot;
+        });
+        DestroyAssRendererSlot(slot);
+        m_assRenderers.erase(iter);
+    }
+    m_assRendererPoolCv.notify_all();
+}
+
+bool SubtitleTrack_AssImpl::EnablePreRender(bool enable, const Ratio& frameRate, int64_t durationMs, uint64_t memoryBudget)
+{
+    if (!enable)
+    {
+        StopPreRender();
+        return true;
+    }
+    if (frameRate.num <= 0 || frameRate.den <= 0)
+    {
+        m_errMsg = "INVALID argument 'frameRate'! Both 'num' and 'den' must be positive.";
+        return false;
+    }
+    if (durationMs <= 0)
+    {
+        m_errMsg = "INVALID argument 'durationMs'! It must be positive.";
+        return false;
+    }
+    {
+        lock_guard<mutex> lk(m_preRenderStateLock);
+        m_preRenderFrameRate = frameRate;
+        m_preRenderDuration = durationMs;
+        m_preRenderMemBudget = memoryBudget;
+        m_preRenderSeekCount++;
+    }
+    if (!m_preRenderThread.joinable())
+    {
+        m_quitPreRender = false;
+        m_preRenderThread = thread(&SubtitleTrack_AssImpl::PreRenderProc, this);
+        ostringstream thnOss;
+        thnOss << "SubPrerndTh-" << m_id;
+        SysUtils::SetThreadName(m_preRenderThread, thnOss.str());
+    }
+    m_preRenderCv.notify_all();
+    return true;
+}
+
+void SubtitleTrack_AssImpl::UpdatePreRenderPosition(int64_t pos, bool forward)
+{
+    if (!m_preRenderThread.joinable())
+        return;
+    lock_guard<mutex> lk(m_preRenderStateLock);
+    if (pos == m_preRenderPos && forward == m_preRenderForward)
+        return;
+    bool isSeek = m_preRenderPos == INT64_MIN || forward != m_preRenderForward;
+    if (!isSeek)
+    {
+        const int64_t moved = forward ? pos-m_preRenderPos : m_preRenderPos-pos;
+        isSeek = moved < 0 || moved > m_preRenderDuration;
+    }
+    m_preRenderPos = pos;
+    m_preRenderForward = forward;
+    if (isSeek)
+        m_preRenderSeekCount++;
+    m_preRenderCv.notify_all();
+}
+
+SubtitleTrack::PreRenderStatistics SubtitleTrack_AssImpl::GetPreRenderStatistics()
+{
+    lock_guard<mutex> lk(m_preRenderStateLock);
+    return m_preRenderStats;
+}
+
+void SubtitleTrack_AssImpl::StopPreRender()
+{
+    if (!m_preRenderThread.joinable())
+        return;
+    {
+        lock_guard<mutex> lk(m_preRenderStateLock);
+        m_quitPreRender = true;
+    }
+    m_preRenderCv.notify_all();
+    m_preRenderThread.join();
+    m_quitPreRender = false;
+    lock_guard<mutex> lk(m_preRenderStateLock);
+    m_preRenderStats = PreRenderStatistics();
+}
+
+void SubtitleTrack_AssImpl::RestartPreRender()
+{
+    if (!m_preRenderThread.joinable())
+        return;
+    lock_guard<mutex> lk(m_preRenderStateLock);
+    m_preRenderSeekCount++;
+    m_preRenderCv.notify_all();
+}
+
+// A clip is changed by its own setters, the images rendered ahead may show its old content
+void SubtitleTrack_AssImpl::OnClipChanged(SubtitleClip_AssImpl* clip)
+{
+    RestartPreRender();
+}
+
+void SubtitleTrack_AssImpl::PreRenderProc()
+{
+    m_logger->Log(DEBUG) << "Enter PreRenderProc()..." << endl;
+    uint32_t seekCount = 0;
+    bool started = false;
+    int64_t nextFrameIdx = 0;
+    // the positions and sizes of the images rendered ahead of the play position
+    list<pair<int64_t, uint64_t>> renderedAhead;
+    uint64_t bytesAhead = 0;
+    unordered_map<SubtitleClip*, void*> renderedData;
+    uint32_t restartCount = 0;
+    while (!m_quitPreRender)
+    {
+        int64_t pos, duration;
+        bool forward;
+        Ratio frameRate;
+        uint64_t memBudget;
+        {
+            lock_guard<mutex> lk(m_preRenderStateLock);
+            pos = m_preRenderPos;
+            forward = m_preRenderForward;
+            duration = m_preRenderDuration;
+            frameRate = m_preRenderFrameRate;
+            memBudget = m_preRenderMemBudget;
+        }
+        const uint32_t currSeekCount = m_preRenderSeekCount.load();
+        // use the same timestamps as the video frames, 'MultiTrackVideoReader' derives the position from them
+        auto frameIndexToPos = [frameRate] (int64_t idx) {
+            const double ts = (double)idx*frameRate.den/frameRate.num;
+            return (int64_t)(ts*1000);
+        };
+        auto firstFrameIndexFrom = [&] (int64_t fromPos) {
+            int64_t idx = (int64_t)((double)fromPos*frameRate.num/frameRate.den/1000);
+            while (idx > 0 && frameIndexToPos(idx) > fromPos)
+                idx--;
+            if (forward)
+            {
+                while (frameIndexToPos(idx) < fromPos)
+                    idx++;
+            }
+            return idx;
+        };
+
+        bool idle = pos == INT64_MIN;
+        if (!idle)
+        {
+            if (!started || currSeekCount != seekCount)
+            {
+                // a seek or an invalidation happened, restart from the play position
+                started = true;
+                seekCount = currSeekCount;
+                restartCount++;
+                nextFrameIdx = firstFrameIndexFrom(pos);
+                renderedAhead.clear();
+                bytesAhead = 0;
+                renderedData.clear();
+            }
+            while (!renderedAhead.empty() && (forward ? renderedAhead.front().first < pos : renderedAhead.front().first > pos))
+            {
+                bytesAhead -= renderedAhead.front().second;
+                renderedAhead.pop_front();
+            }
+            int64_t framePos = frameIndexToPos(nextFrameIdx);
+            if (forward ? framePos < pos : framePos > pos)
+            {
+                // the play position has overtaken the pre-rendering
+                nextFrameIdx = firstFrameIndexFrom(pos);
+                framePos = frameIndexToPos(nextFrameIdx);
+            }
+            idle = nextFrameIdx < 0 || (forward ? framePos >= pos+duration : framePos <= pos-duration) || bytesAhead >= memBudget;
+            if (!idle)
+            {
+                const int64_t bytes = PreRenderFrameAt(framePos, seekCount, renderedData);
+                if (bytes < 0)
+                    continue;
+                if (bytes > 0)
+                {
+                    renderedAhead.push_back({framePos, (uint64_t)bytes});
+                    bytesAhead += bytes;
+                }
+                nextFrameIdx += forward ? 1 : -1;
+            }
+        }
+        {
+            lock_guard<mutex> lk(m_preRenderStateLock);
+            m_preRenderStats.playPos = pos;
+            m_preRenderStats.forward = forward;
+            m_preRenderStats.idle = idle;
+            m_preRenderStats.nextFramePos = pos == INT64_MIN ? INT64_MIN : frameIndexToPos(nextFrameIdx);
+            m_preRenderStats.imagesAhead = renderedAhead.size();
+            m_preRenderStats.bytesAhead = bytesAhead;
+            m_preRenderStats.restartCount = restartCount;
+        }
+        if (idle)
+        {
+            unique_lock<mutex> lk(m_preRenderStateLock);
+            m_preRenderCv.wait_for(lk, chrono::milliseconds(100), [&] {
+                return m_quitPreRender || m_preRenderPos != pos || m_preRenderForward != forward || m_preRenderSeekCount.load() != seekCount;
+            });
+        }
+    }
+    m_logger->Log(DEBUG) << "Leave PreRenderProc()." << endl;
+}
+
+// Render the image shown at 'pos' through 'SubtitleClip::Image()', so it is cached by the clip and the track.
+// Return the bytes of the newly rendered image, or -1 if the pre-rendering is restarted.
+int64_t SubtitleTrack_AssImpl::PreRenderFrameAt(int64_t pos, uint32_t seekCount, unordered_map<SubtitleClip*, void*>& renderedData)
+{
+    unique_lock<recursive_mutex> lk(m_renderLock);
+    if (m_preRenderSeekCount.load() != seekCount)
+        return -1;
+    auto clipIter = FindClipIterByTime(pos);
+    if (clipIter == m_clips.end())
+        return 0;
+    auto hClip = *clipIter;
+    if (hClip->StartTime() > pos || hClip->EndTime() <= pos)
+        return 0;
+    // the clip takes the lock itself, so the rasterization runs beside the foreground rendering
+    lk.unlock();
+    auto subImage = hClip->Image(pos-hClip->StartTime());
+    auto vmat = subImage.Vmat();
+    if (vmat.empty())
+        return 0;
+    // a static clip returns the same image at all the time offsets
+    auto& lastData = renderedData[hClip.get()];
+    if (lastData == vmat.data)
+        return 0;
+    lastData = vmat.data;
+    return (int64_t)vmat.total()*vmat.elemsize;
+}
+
 bool SubtitleTrack_AssImpl::SetKeyPoints(const ImGui::KeyPointEditor& keyPoints)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
     m_overrideStyle.SetKeyPoints(keyPoints);
     return true;
 }
@@ -791,25 +1065,21 @@ ImGui::KeyPointEditor* SubtitleTrack_AssImpl::GetKeyPoints()
 
 bool SubtitleTrack_AssImpl::ChangeClipTime(SubtitleClipHolder clip, int64_t startTime, int64_t duration)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    lock_guard<shared_timed_mutex> trkLk(m_assTrackLock);
+    RestartPreRender();
     if (!clip)
     {
         m_errMsg = "Argument 'clip' CANNOT be NULL!";
         return false;
     }
-    int32_t idx = 0;
-    auto iter = m_clips.begin();
-    while (iter != m_clips.end())
-    {
-        if (*iter == clip)
-            break;
-        idx++;
-        iter++;
-    }
-    if (iter == m_clips.end())
+    auto idxIter = FindClipIndexEntry(clip);
+    if (idxIter == m_clipIndex.end())
     {
         m_errMsg = "Can NOT FIND the target clip in the clip list!";
         return false;
     }
+    auto iter = idxIter->second;
     if (clip->StartTime() == startTime && clip->Duration() == duration)
     {
         // does not change anything
@@ -859,15 +1129,20 @@ bool SubtitleTrack_AssImpl::ChangeClipTime(SubtitleClipHolder clip, int64_t star
     }
 
     // update the clip time information and insert it at new position
+    RemoveFromClipIndex(idxIter);
     SubtitleClip_AssImpl* assClip = dynamic_cast<SubtitleClip_AssImpl*>(clip.get());
     assClip->SetStartTime(startTime);
     assClip->SetDuration(duration);
 
     if (posOffset != 0)
     {
+        const bool updateCurrIter = m_currIter == iter;
         m_clips.erase(iter);
-        m_clips.insert(iter2, clip);
+        iter = m_clips.insert(iter2, clip);
+        if (updateCurrIter)
+            m_currIter = iter;
     }
+    AddToClipIndex(iter);
 
     // invalidate the clips affected by inserting the target clip to its new position
     while (iter2 != m_clips.end())
@@ -896,37 +1171,7 @@ SubtitleClipHolder SubtitleTrack_AssImpl::GetClipByTime(int64_t ms)
     if (m_currIter != m_clips.end() && (*m_currIter)->StartTime() <= ms && (*m_currIter)->EndTime() > ms)
         return *m_currIter;
 
-    if (m_currIter == m_clips.end() || (*m_currIter)->StartTime() > ms)
-    {
-        auto iter = m_currIter;
-        while (iter != m_clips.begin())
-        {
-            iter--;
-            if ((*iter)->EndTime() <= ms)
-            {
-                iter++;
-                break;
-            }
-            else if ((*iter)->StartTime() <= ms)
-            {
-                break;
-            }
-        }
-        m_currIter = iter;
-    }
-    else
-    {
-        auto iter = m_currIter;
-        iter++;
-        while (iter != m_clips.end())
-        {
-            if ((*iter)->EndTime() > ms)
-                break;
-            iter++;
-        }
-        m_currIter = iter;
-    }
-
+    m_currIter = FindClipIterByTime(ms);
     if (m_currIter == m_clips.end())
         return nullptr;
     if ((*m_currIter)->StartTime() <= ms && (*m_currIter)->EndTime() > ms)
@@ -934,6 +1179,22 @@ SubtitleClipHolder SubtitleTrack_AssImpl::GetClipByTime(int64_t ms)
     return nullptr;
 }
 
+vector<SubtitleClipHolder> SubtitleTrack_AssImpl::GetClipsByTimeRange(int64_t startMs, int64_t endMs)
+{
+    vector<SubtitleClipHolder> clips;
+    if (endMs <= startMs || m_clipIndex.empty())
+        return clips;
+    // the clips starting before 'endMs' and ending after 'startMs'
+    const auto& intervals = GetClipIntervals();
+    const size_t count = lower_bound(intervals.starts.begin(), intervals.starts.end(), endMs)-intervals.starts.begin();
+    vector<size_t> indices;
+    intervals.CollectEndingAfter(count, startMs, indices);
+    clips.reserve(indices.size());
+    for (auto idx : indices)
+        clips.push_back(*intervals.clips[idx]);
+    return clips;
+}
+
 SubtitleClipHolder SubtitleTrack_AssImpl::GetCurrClip()
 {
     if (m_currIter == m_clips.end())
@@ -994,17 +1255,7 @@ uint32_t SubtitleTrack_AssImpl::GetCurrIndex() const
 bool SubtitleTrack_AssImpl::SeekToTime(int64_t ms)
 {
     m_readPos = ms;
-    auto iter = find_if(m_clips.begin(), m_clips.end(), [ms] (SubtitleClipHolder clip) {
-        return clip->StartTime() > ms;
-    });
-    m_currIter = iter;
-    if (iter != m_clips.begin())
-    {
-        iter--;
-        if ((*iter)->EndTime() > ms)
-            m_currIter = iter;
-    }
-
+    m_currIter = FindClipIterByTime(ms);
     return true;
 }
 
@@ -1031,12 +1282,12 @@ bool SubtitleTrack_AssImpl::SeekToIndex(uint32_t index)
 
 SubtitleClipHolder SubtitleTrack_AssImpl::NewClip(int64_t startTime, int64_t duration)
 {
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    lock_guard<shared_timed_mutex> trkLk(m_assTrackLock);
+    RestartPreRender();
     // find the insert position
-    auto iter = m_clips.begin();
-    while (iter != m_clips.end() && (*iter)->StartTime() <= startTime)
-    {
-        iter++;
-    }
+    auto idxIter = m_clipIndex.upper_bound(startTime);
+    auto iter = idxIter == m_clipIndex.end() ? m_clips.end() : idxIter->second;
 
     ASS_Event* orgPtr = m_asstrk->events;
     int eid = ass_alloc_event(m_asstrk);
@@ -1061,9 +1312,10 @@ SubtitleClipHolder SubtitleTrack_AssImpl::NewClip(int64_t startTime, int64_t dur
         }
     }
 
-    SubtitleClip_AssImpl* newAssClip = new SubtitleClip_AssImpl(assEvent, m_asstrk, bind(&SubtitleTrack_AssImpl::RenderSubtitleClip, this, _1, _2, std::placeholders::_3, std::placeholders::_4));
+    SubtitleClip_AssImpl* newAssClip = new SubtitleClip_AssImpl(assEvent, m_asstrk, bind(&SubtitleTrack_AssImpl::RenderSubtitleClip, this, _1, _2, std::placeholders::_3, std::placeholders::_4), &m_renderLock, &m_assTrackLock,
+        bind(&SubtitleTrack_AssImpl::OnClipChanged, this, _1));
     SubtitleClipHolder hNewClip(newAssClip);
-    m_clips.insert(iter, hNewClip);
+    AddToClipIndex(m_clips.insert(iter, hNewClip));
 
     // update duration
     if (hNewClip->EndTime() > m_duration)
@@ -1077,12 +1329,17 @@ SubtitleClipHolder SubtitleTrack_AssImpl::NewClip(int64_t startTime, int64_t dur
 
 bool SubtitleTrack_AssImpl::DeleteClip(SubtitleClipHolder hClip)
 {
-    auto iter = find(m_clips.begin(), m_clips.end(), hClip);
-    if (iter == m_clips.end())
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    lock_guard<shared_timed_mutex> trkLk(m_assTrackLock);
+    RestartPreRender();
+    auto idxIter = FindClipIndexEntry(hClip);
+    if (idxIter == m_clipIndex.end())
     {
         m_errMsg = "CANNOT find target 'hClip'!";
         return false;
     }
+    auto iter = idxIter->second;
+    RemoveFromClipIndex(idxIter);
     SubtitleClip_AssImpl* assClip = dynamic_cast<SubtitleClip_AssImpl*>(hClip.get());
     list<SubtitleClip_AssImpl*> updateAssClips;
     auto iter2 = m_clips.begin();
@@ -1277,6 +1534,7 @@ SubtitleTrackHolder SubtitleTrack_AssImpl::Clone(uint32_t frmW, uint32_t frmH, b
 {
     SubtitleTrackHolder hSubTrk = NewEmptyTrack(m_id);
     SubtitleTrack_AssImpl* newTrk = dynamic_cast<SubtitleTrack_AssImpl*>(hSubTrk.get());
+    newTrk->BeginStyleUpdate();
     newTrk->SetFrameSize(frmW, frmH);
     newTrk->SetAlignment(m_overrideStyle.Alignment());
     if (useScale)
@@ -1308,6 +1566,7 @@ SubtitleTrackHolder SubtitleTrack_AssImpl::Clone(uint32_t frmW, uint32_t frmH, b
     newTrk->SetOffsetH(trkStyle.OffsetHScale());
     newTrk->SetOffsetV(trkStyle.OffsetVScale());
     newTrk->SetKeyPoints(*(m_overrideStyle.GetKeyPoints()));
+    newTrk->EndStyleUpdate();
 
     for (auto c : m_clips)
     {
@@ -1594,7 +1853,8 @@ bool SubtitleTrack_AssImpl::ReadFile(const string& path)
         {
             ASS_Event* e = m_asstrk->events+i;
             e->ReadOrder = i;
-            SubtitleClip_AssImpl* assClip = new SubtitleClip_AssImpl(e, m_asstrk, bind(&SubtitleTrack_AssImpl::RenderSubtitleClip, this, _1, _2, std::placeholders::_3, std::placeholders::_4));
+            SubtitleClip_AssImpl* assClip = new SubtitleClip_AssImpl(e, m_asstrk, bind(&SubtitleTrack_AssImpl::RenderSubtitleClip, this, _1, _2, std::placeholders::_3, std::placeholders::_4), &m_renderLock, &m_assTrackLock,
+                bind(&SubtitleTrack_AssImpl::OnClipChanged, this, _1));
             SubtitleClipHolder hSubClip(assClip);
             m_clips.push_back(hSubClip);
             if (assClip->EndTime() > m_duration)
@@ -1602,6 +1862,11 @@ bool SubtitleTrack_AssImpl::ReadFile(const string& path)
                 m_duration = assClip->EndTime();
             }
         }
+        // the events are in read order, the clip list is ordered by start time
+        m_clips.sort([] (const SubtitleClipHolder& a, const SubtitleClipHolder& b) {
+            return a->StartTime() < b->StartTime();
+        });
+        RebuildClipIndex();
         m_currIter = m_clips.begin();
     }
     return success;
@@ -1621,52 +1886,408 @@ void SubtitleTrack_AssImpl::ReleaseFFContext()
     }
 }
 
-template <typename T>
-class WrapperAlloc: public allocator<T>
+// Fill the output image with the background color, a transparent background is cleared with a single memset.
+static void FillPixels(uint32_t* dst, size_t count, uint32_t color)
 {
-public:
-    WrapperAlloc(void* buf=0) throw(): allocator<T>(), m_buf(buf) {}
-    WrapperAlloc(const WrapperAlloc& a) throw(): allocator<T>(a) { m_buf = a.m_buf; }
-    ~WrapperAlloc() {}
-
-    typedef size_t size_type;
-    typedef T* pointer;
-    typedef const T* const_pointer;
+    if (color == 0)
+        memset(dst, 0, count*sizeof(uint32_t));
+    else
+        fill_n(dst, count, color);
+}
 
-    template<typename _Tp1>
-    struct rebind
-    {
-        typedef WrapperAlloc<_Tp1> other;
-    };
+// 64-bit FNV-1a
+static const uint64_t HASH_SEED = 0xcbf29ce484222325ULL;
 
-    pointer allocate(size_type n, const void* hint=0)
+static void HashBytes(uint64_t& h, const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
     {
-        char* p = new (m_buf) char[n*sizeof(T)];
-        return (T*)p;
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
     }
+}
+
+template <typename T>
+static void HashValue(uint64_t& h, const T& value)
+{
+    HashBytes(h, &value, sizeof(value));
+}
 
-    void deallocate(pointer p, size_type n) {}
+static void HashCString(uint64_t& h, const char* str)
+{
+    if (str)
+        HashBytes(h, str, strlen(str));
+    HashValue(h, (uint8_t)0);
+}
 
-private:
-    void* m_buf;
-};
+static void HashColor(uint64_t& h, const SubtitleColor& c)
+{
+    HashValue(h, c.r); HashValue(h, c.g); HashValue(h, c.b); HashValue(h, c.a);
+}
+
+static void HashAssStyle(uint64_t& h, const ASS_Style* s)
+{
+    HashCString(h, s->FontName);
+    HashValue(h, s->FontSize);
+    HashValue(h, s->PrimaryColour); HashValue(h, s->SecondaryColour);
+    HashValue(h, s->OutlineColour); HashValue(h, s->BackColour);
+    HashValue(h, s->Bold); HashValue(h, s->Italic);
+    HashValue(h, s->Underline); HashValue(h, s->StrikeOut);
+    HashValue(h, s->ScaleX); HashValue(h, s->ScaleY);
+    HashValue(h, s->Spacing); HashValue(h, s->Angle);
+    HashValue(h, s->BorderStyle); HashValue(h, s->Outline); HashValue(h, s->Shadow);
+    HashValue(h, s->Alignment);
+    HashValue(h, s->MarginL); HashValue(h, s->MarginR); HashValue(h, s->MarginV);
+    HashValue(h, s->Encoding); HashValue(h, s->treat_fontname_as_pattern);
+    HashValue(h, s->Blur);
+}
+
+static void HashAssEvent(uint64_t& h, const ASS_Event* e)
+{
+    HashValue(h, e->Duration);
+    HashValue(h, e->Layer);
+    HashValue(h, e->Style);
+    HashValue(h, e->MarginL); HashValue(h, e->MarginR); HashValue(h, e->MarginV);
+    HashCString(h, e->Effect);
+    HashCString(h, e->Text);
+}
+
+// Whether the rendered image of an event changes over its duration, with an effect or animated override tags,
+// like '\t(...)', '\fad(...)', '\fade(...)', '\move(...)' and the karaoke tags.
+static bool IsAnimatedAssEvent(const ASS_Event* e)
+{
+    if (e->Effect && e->Effect[0])
+        return true;
+    const char* text = e->Text;
+    if (!text)
+        return false;
+    static const char* const s_animTags[] = { "\\t(", "\\fad", "\\move", "\\k", "\\K" };
+    for (auto tag : s_animTags)
+    {
+        if (strstr(text, tag))
+            return true;
+    }
+    return false;
+}
 
 SubtitleImage SubtitleTrack_AssImpl::RenderSubtitleClip(SubtitleClip* clip, int64_t timeOffset, bool absolutePosX, bool absolutePosY)
 {
     int64_t pos = clip->StartTime()+timeOffset;
+    RenderParams params;
+    unique_lock<recursive_mutex> lk(m_renderLock);
     UpdateTrackStyleByKeyPoints(pos);
+    // the style override may be deferred by an unfinished style update
+    if (m_styleOverridePending)
+        ApplyStyleOverride();
+    MakeRenderParams(clip, absolutePosX, absolutePosY, params);
+
+    const auto cacheKey = MakeRenderCacheKey(clip, pos, absolutePosX, absolutePosY);
+    auto cacheIter = m_renderCacheMap.find(cacheKey);
+    if (cacheIter != m_renderCacheMap.end())
+    {
+        auto entryIter = cacheIter->second;
+        m_renderCache.splice(m_renderCache.begin(), m_renderCache, entryIter);
+        if (entryIter->vmat.empty())
+            return SubtitleImage(entryIter->vmat, {0});
+        return SubtitleImage(entryIter->vmat, CalcDisplayBox(params, entryIter->assBox));
+    }
+
+    // rasterize without 'm_renderLock', the events are kept unchanged by 'm_assTrackLock' since the cache key is made
+    ImGui::ImMat vmat;
+    SubtitleImage::Rect assBox;
+    {
+        shared_lock<shared_timed_mutex> trkReadLk(m_assTrackLock);
+        lk.unlock();
+
+        AssRendererSlot* slot = AcquireAssRenderer();
+        if (!slot)
+        {
+            m_logger->Log(Error) << "NO ASS renderer is available to render the subtitle at " << pos << "!" << endl;
+            return SubtitleImage();
+        }
+        if (SyncAssTrackReplica(slot, pos))
+            vmat = RenderAssImage(slot, params, pos, cacheKey.styleHash, assBox);
+        ReleaseAssRenderer(slot);
+    }
 
+    lk.lock();
+    AddToRenderCache(cacheKey, vmat, assBox);
+    if (vmat.empty())
+        return SubtitleImage(vmat, {0});
+    return SubtitleImage(vmat, CalcDisplayBox(params, assBox));
+}
+
+void SubtitleTrack_AssImpl::MakeRenderParams(SubtitleClip* clip, bool absolutePosX, bool absolutePosY, RenderParams& params)
+{
     SubtitleClip_AssImpl* assClip = dynamic_cast<SubtitleClip_AssImpl*>(clip);
+    params.readOrder = assClip->ReadOrder();
+    params.frmW = m_frmW;
+    params.frmH = m_frmH;
+    params.outputFullSize = m_outputFullSize;
+    params.useOverrideStyle = m_useOverrideStyle;
+    // libass copies the strings of the override style when it is set to a renderer, keep them until then
+    params.overrideStyle = *m_overrideStyle.GetAssStylePtr();
+    params.overrideStyleName = params.overrideStyle.Name ? string(params.overrideStyle.Name) : string();
+    params.overrideFontName = params.overrideStyle.FontName ? string(params.overrideStyle.FontName) : string();
+    params.overrideStyle.Name = (char*)params.overrideStyleName.c_str();
+    params.overrideStyle.FontName = (char*)params.overrideFontName.c_str();
+    params.overrideStyleHash = HASH_SEED;
+    HashAssStyle(params.overrideStyleHash, &params.overrideStyle);
+    //const int32_t offsetH = clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetH() : clip->OffsetH();
+    //const int32_t offsetV = clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetV() : clip->OffsetV();
+    params.offsetH = clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetHScale() : clip->OffsetHScale();
+    params.offsetV = clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetVScale() : clip->OffsetVScale();
+    params.offsetCompensationV = m_foffsetCompensationV;
+    params.absolutePosX = absolutePosX;
+    params.absolutePosY = absolutePosY;
+    params.bgColor = clip->IsUsingTrackStyle() ? m_overrideStyle.BackgroundColor() : clip->BackgroundColor();
+}
+
+SubtitleImage::Rect SubtitleTrack_AssImpl::CalcDisplayBox(const RenderParams& params, const SubtitleImage::Rect& assBox)
+{
+    SubtitleImage::Rect dispBox{assBox};
+    if (params.absolutePosX)
+        dispBox.x = params.offsetH * params.frmW;
+    else
+        dispBox.x += params.offsetH * params.frmW;
+
+    if (params.absolutePosY)
+        dispBox.y = params.offsetV * params.frmH;
+    else
+        dispBox.y += params.offsetV * params.frmH + params.offsetCompensationV * params.frmH;
+    return dispBox;
+}
+
+// Each renderer sets up its own font provider and caches, which cost some megabytes and a font scan. They are only created
+// when the renderers in the pool are all busy.
+ASS_Renderer* SubtitleTrack_AssImpl::CreateAssRenderer()
+{
+    ASS_Renderer* assrnd = ass_renderer_init(s_asslib);
+    if (!assrnd)
+        return nullptr;
+    ass_set_fonts(assrnd, NULL, NULL, ASS_FONTPROVIDER_AUTODETECT, NULL, 1);
+    ass_set_pixel_aspect(assrnd, 1);
+    return assrnd;
+}
+
+SubtitleTrack_AssImpl::AssRendererSlot* SubtitleTrack_AssImpl::AcquireAssRenderer()
+{
+    unique_lock<mutex> lk(m_assRendererPoolLock);
+    while (true)
+    {
+        if (!m_idleAssRenderers.empty())
+        {
+            AssRendererSlot* slot = m_idleAssRenderers.back();
+            m_idleAssRenderers.pop_back();
+            return slot;
+        }
+        if (m_assRenderers.size() < m_maxAssRenderers)
+        {
+            ASS_Renderer* assrnd = CreateAssRenderer();
+            if (assrnd)
+            {
+                m_assRenderers.push_back(unique_ptr<AssRendererSlot>(new AssRendererSlot()));
+                m_assRenderers.back()->assrnd = assrnd;
+                m_logger->Log(DEBUG) << "Create ASS renderer #" << m_assRenderers.size() << " for subtitle track " << m_id << "." << endl;
+                return m_assRenderers.back().get();
+            }
+            m_logger->Log(WARN) << "FAILED to create more ASS renderer, " << m_assRenderers.size() << " renderer(s) are used." << endl;
+            if (m_assRenderers.empty())
+                return nullptr;
+            m_maxAssRenderers = m_assRenderers.size();
+        }
+        m_assRendererPoolCv.wait(lk);
+    }
+}
+
+void SubtitleTrack_AssImpl::ReleaseAssRenderer(AssRendererSlot* slot)
+{
+    lock_guard<mutex> lk(m_assRendererPoolLock);
+    if (m_assRenderers.size() > m_maxAssRenderers)
+    {
+        auto iter = find_if(m_assRenderers.begin(), m_assRenderers.end(), [slot] (const unique_ptr<AssRendererSlot>& a) {
+            return a.get() == slot;
+        });
+        DestroyAssRendererSlot(slot);
+        m_assRenderers.erase(iter);
+        return;
+    }
+    m_idleAssRenderers.push_back(slot);
+    m_assRendererPoolCv.notify_one();
+}
+
+void SubtitleTrack_AssImpl::DestroyAssRendererSlot(AssRendererSlot* slot)
+{
+    ass_renderer_done(slot->assrnd);
+    slot->assrnd = nullptr;
+    if (slot->asstrk)
+    {
+        ass_free_track(slot->asstrk);
+        slot->asstrk = nullptr;
+    }
+}
+
+static uint64_t HashAssTrackStyles(const ASS_Track* trk)
+{
+    uint64_t h = HASH_SEED;
+    HashValue(h, trk->track_type);
+    HashValue(h, trk->PlayResX); HashValue(h, trk->PlayResY);
+#if LIBASS_VERSION >= 0x01700000
+    HashValue(h, trk->LayoutResX); HashValue(h, trk->LayoutResY);
+#endif
+    HashValue(h, trk->Timer); HashValue(h, trk->WrapStyle);
+    HashValue(h, trk->ScaledBorderAndShadow); HashValue(h, trk->Kerning);
+    HashValue(h, trk->YCbCrMatrix); HashCString(h, trk->Language);
+    HashValue(h, trk->default_style);
+    HashValue(h, trk->n_styles);
+    for (int i = 0; i < trk->n_styles; i++)
+    {
+        HashCString(h, trk->styles[i].Name);
+        HashAssStyle(h, trk->styles+i);
+    }
+    return h;
+}
+
+static inline bool IsAssEventShownAt(const ASS_Event* e, int64_t pos)
+{
+    return e->Start <= pos && pos < e->Start+e->Duration;
+}
+
+static inline char* DupCString(const char* str)
+{
+    return str ? strdup(str) : nullptr;
+}
+
+// Copy the header and the styles of the track into the renderer's replica, then the events shown at 'pos'. The replica is
+// only rebuilt when the hashes differ, so a renderer keeps the render state of its events across the frames of one clip.
+bool SubtitleTrack_AssImpl::SyncAssTrackReplica(AssRendererSlot* slot, int64_t pos)
+{
+    if (!slot->asstrk)
+    {
+        slot->asstrk = ass_new_track(s_asslib);
+        if (!slot->asstrk)
+        {
+            m_logger->Log(Error) << "FAILED to create the ASS track replica for subtitle track " << m_id << "!" << endl;
+            return false;
+        }
+        slot->trackStylesHash = 0;
+        slot->trackEventsHash = 0;
+    }
+    ASS_Track* dst = slot->asstrk;
+
+    const uint64_t stylesHash = HashAssTrackStyles(m_asstrk);
+    if (slot->trackStylesHash != stylesHash)
+    {
+        for (int i = 0; i < dst->n_styles; i++)
+            ass_free_style(dst, i);
+        dst->n_styles = 0;
+        dst->track_type = m_asstrk->track_type;
+        dst->PlayResX = m_asstrk->PlayResX;
+        dst->PlayResY = m_asstrk->PlayResY;
+#if LIBASS_VERSION >= 0x01700000
+        dst->LayoutResX = m_asstrk->LayoutResX;
+        dst->LayoutResY = m_asstrk->LayoutResY;
+#endif
+        dst->Timer = m_asstrk->Timer;
+        dst->WrapStyle = m_asstrk->WrapStyle;
+        dst->ScaledBorderAndShadow = m_asstrk->ScaledBorderAndShadow;
+        dst->Kerning = m_asstrk->Kerning;
+        dst->YCbCrMatrix = m_asstrk->YCbCrMatrix;
+        free(dst->Language);
+        dst->Language = DupCString(m_asstrk->Language);
+        for (int i = 0; i < m_asstrk->n_styles; i++)
+        {
+            const int sid = ass_alloc_style(dst);
+            if (sid < 0)
+            {
+                m_logger->Log(Error) << "FAILED to copy the ASS styles into the track replica!" << endl;
+                slot->trackStylesHash = 0;
+                return false;
+            }
+            ASS_Style* s = dst->styles+sid;
+            *s = m_asstrk->styles[i];
+            s->Name = DupCString(m_asstrk->styles[i].Name);
+            s->FontName = DupCString(m_asstrk->styles[i].FontName);
+        }
+        dst->default_style = m_asstrk->default_style;
+        slot->trackStylesHash = stylesHash;
+        // the events refer to the styles by index, copy them again
+        slot->trackEventsHash = 0;
+    }
+
+    uint64_t eventsHash = HASH_SEED;
+    for (int i = 0; i < m_asstrk->n_events; i++)
+    {
+        const ASS_Event* e = m_asstrk->events+i;
+        if (!IsAssEventShownAt(e, pos))
+            continue;
+        HashValue(eventsHash, e->Start);
+        HashValue(eventsHash, e->ReadOrder);
+        HashCString(eventsHash, e->Name);
+        HashAssEvent(eventsHash, e);
+    }
+    if (slot->trackEventsHash == eventsHash)
+        return true;
+
+    for (int i = 0; i < dst->n_events; i++)
+        ass_free_event(dst, i);
+    dst->n_events = 0;
+    slot->trackEventsHash = 0;
+    for (int i = 0; i < m_asstrk->n_events; i++)
+    {
+        const ASS_Event* e = m_asstrk->events+i;
+        if (!IsAssEventShownAt(e, pos))
+            continue;
+        const int eid = ass_alloc_event(dst);
+        if (eid < 0)
+        {
+            m_logger->Log(Error) << "FAILED to copy the ASS events into the track replica!" << endl;
+            return false;
+        }
+        ASS_Event* d = dst->events+eid;
+        *d = *e;
+        d->Name = DupCString(e->Name);
+        d->Effect = DupCString(e->Effect);
+        d->Text = DupCString(e->Text);
+        d->render_priv = nullptr;
+    }
+    slot->trackEventsHash = eventsHash;
+    return true;
+}
+
+ImGui::ImMat SubtitleTrack_AssImpl::RenderAssImage(AssRendererSlot* slot, const RenderParams& params, int64_t pos, uint64_t styleHash, SubtitleImage::Rect& assBox)
+{
+    // a renderer could be configured by other renderings, apply the settings of this one
+    if (slot->frmW != params.frmW || slot->frmH != params.frmH)
+    {
+        ass_set_frame_size(slot->assrnd, params.frmW, params.frmH);
+        slot->frmW = params.frmW;
+        slot->frmH = params.frmH;
+    }
+    if (params.useOverrideStyle && slot->overrideStyleHash != params.overrideStyleHash)
+    {
+        ass_set_selective_style_override(slot->assrnd, const_cast<ASS_Style*>(&params.overrideStyle));
+        slot->overrideStyleHash = params.overrideStyleHash;
+    }
+    if (slot->useOverrideStyle != params.useOverrideStyle)
+    {
+        ass_set_selective_style_override_enabled(slot->assrnd, params.useOverrideStyle ? ASS_OVERRIDE_FULL_STYLE : ASS_OVERRIDE_DEFAULT);
+        slot->useOverrideStyle = params.useOverrideStyle;
+    }
+
+    // each renderer rasterizes its own track replica, the returned images belong to the renderer until its next rendering
     int detectChange = 0;
-    ASS_Image* renderRes = ass_render_frame(m_assrnd, m_asstrk, pos, &detectChange);
-    m_logger->Log(DEBUG) << "Render subtitle '" << assClip->GetAssText() << "', ASS_Image ptr=" << renderRes << ", detectChanged=" << detectChange << "." << endl;
+    ASS_Image* renderRes = ass_render_frame(slot->assrnd, slot->asstrk, pos, &detectChange);
+    m_logger->Log(DEBUG) << "Render subtitle (readOrder=" << params.readOrder << "), ASS_Image ptr=" << renderRes << ", detectChanged=" << detectChange << "." << endl;
     ImGui::ImMat vmat;
+    assBox = SubtitleImage::Rect();
     if (!renderRes)
-        return SubtitleImage(vmat, {0});
+        return vmat;
 
     // calculate the containing box
     ASS_Image* assImage = renderRes;
-    SubtitleImage::Rect assBox{assImage->dst_x, assImage->dst_y, assImage->w, assImage->h};
+    assBox = {assImage->dst_x, assImage->dst_y, assImage->w, assImage->h};
     assImage = assImage->next;
     while (assImage)
     {
@@ -1691,9 +2312,11 @@ SubtitleImage SubtitleTrack_AssImpl::RenderSubtitleClip(SubtitleClip* clip, int6
         assImage = assImage->next;
     }
 
-    int frmW = (int)m_frmW;
-    int frmH = (int)m_frmH;
-    if (!m_outputFullSize)
+    const uint32_t fullW = params.frmW;
+    const uint32_t fullH = params.frmH;
+    int frmW = (int)fullW;
+    int frmH = (int)fullH;
+    if (!params.outputFullSize)
     {
         frmW = assBox.w;
         frmH = assBox.h;
@@ -1702,47 +2325,30 @@ SubtitleImage SubtitleTrack_AssImpl::RenderSubtitleClip(SubtitleClip* clip, int6
     vmat.color_format = IM_CF_ABGR;
 
     // calculate the final display box
-    SubtitleImage::Rect dispBox{assBox};
-    //const int32_t offsetH = clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetH() : clip->OffsetH();
-    //const int32_t offsetV = clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetV() : clip->OffsetV();
-    const float offsetH = clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetHScale() : clip->OffsetHScale();
-    const float offsetV = clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetVScale() : clip->OffsetVScale();
-    if (absolutePosX)
-        dispBox.x = offsetH * m_frmW;
-    else
-        dispBox.x += offsetH * m_frmW;
-    
-    if (absolutePosY)
-        dispBox.y = offsetV * m_frmH;
-    else
-        dispBox.y += offsetV * m_frmH + m_foffsetCompensationV * m_frmH;
+    const SubtitleImage::Rect dispBox = CalcDisplayBox(params, assBox);
+    const float offsetH = params.offsetH;
+    const float offsetV = params.offsetV;
 
     m_logger->Log(DEBUG) << "--> assBox:{" << assBox.x << "," << assBox.y << "," << assBox.w << "," << assBox.h
             << "}, dispBox:{" << dispBox.x << "," << dispBox.y
             << "} offsetH/V=( " << offsetH << ", " << offsetV << ")." << endl;
 
     // if ASS_Image's content is not changed && only output text image, then return previous rendered image
-    if (!m_outputFullSize && (detectChange == 0 || detectChange == 1))
-    {
-        auto prevMat = m_prevRenderedImage.Vmat();
-        return SubtitleImage(prevMat, dispBox);
-    }
+    if (!params.outputFullSize && (detectChange == 0 || detectChange == 1) && !slot->prevVmat.empty() && slot->prevStyleHash == styleHash)
+        return slot->prevVmat;
 
     uint32_t color;
     // fill the image with background color
-    const SubtitleColor bgColor = clip->IsUsingTrackStyle() ? m_overrideStyle.BackgroundColor() : clip->BackgroundColor();
+    const SubtitleColor& bgColor = params.bgColor;
     color = ((uint32_t)(bgColor.a*255)<<24) | ((uint32_t)(bgColor.b*255)<<16) | ((uint32_t)(bgColor.g*255)<<8) | (uint32_t)(bgColor.r*255);
-    WrapperAlloc<uint32_t> wrapperAlloc((uint32_t*)vmat.data);
-    vector<uint32_t, WrapperAlloc<uint32_t>> mapary(wrapperAlloc);
-    mapary.resize(vmat.total()/4);
-    fill(mapary.begin(), mapary.end(), color);
+    FillPixels((uint32_t*)vmat.data, (size_t)vmat.w*vmat.h, color);
 
     // if subtitle is outside of the visible area, then return blank picture
-    if (m_outputFullSize &&
+    if (params.outputFullSize &&
        (dispBox.x+dispBox.w <= 0 || dispBox.y+dispBox.h <= 0 ||
-        dispBox.x >= m_frmW || dispBox.y >= m_frmH))
+        dispBox.x >= (int32_t)fullW || dispBox.y >= (int32_t)fullH))
     {
-        return SubtitleImage(vmat, dispBox);
+        return vmat;
     }
 
     // draw ASS_Image list
@@ -1750,18 +2356,18 @@ SubtitleImage SubtitleTrack_AssImpl::RenderSubtitleClip(SubtitleClip* clip, int6
     while (assImage)
     {
         color = assImage->color;
-        float baseAlpha = (float)(255-(color&0xff))/255;
+        const uint32_t baseAlpha = 255-(color&0xff);
         color = ((color&0xff00)<<8) | ((color>>8)&0xff00) | ((color>>24)&0xff);
 
         SubtitleImage::Rect drawBox{assImage->dst_x, assImage->dst_y, assImage->w, assImage->h};
         uint32_t* imgPtr;
         unsigned char* assPtr;
-        if (m_outputFullSize)
+        if (params.outputFullSize)
         {
-            drawBox.x += offsetH * m_frmW;
-            drawBox.y += offsetV * m_frmH;
+            drawBox.x += offsetH * fullW;
+            drawBox.y += offsetV * fullH;
             if (drawBox.x+drawBox.w <= 0 || drawBox.y+dispBox.h <= 0 ||
-                drawBox.x >= m_frmW || drawBox.y >= m_frmH)
+                drawBox.x >= (int32_t)fullW || drawBox.y >= (int32_t)fullH)
             {
                 assImage = assImage->next;
                 continue;
@@ -1780,10 +2386,10 @@ SubtitleImage SubtitleTrack_AssImpl::RenderSubtitleClip(SubtitleClip* clip, int6
                 drawBox.h += drawBox.y;
                 drawBox.y = 0;
             }
-            if (drawBox.x+drawBox.w > m_frmW)
-                drawBox.w = m_frmW-drawBox.x;
-            if (drawBox.y+drawBox.h > m_frmH)
-                drawBox.h = m_frmH-drawBox.y;
+            if (drawBox.x+drawBox.w > (int32_t)fullW)
+                drawBox.w = fullW-drawBox.x;
+            if (drawBox.y+drawBox.h > (int32_t)fullH)
+                drawBox.h = fullH-drawBox.y;
 
             imgPtr = (uint32_t*)(vmat.data)+drawBox.y*frmW+drawBox.x;
             assPtr = assImage->bitmap+drawOffsetY*assImage->stride+drawOffsetX;
@@ -1795,43 +2401,259 @@ SubtitleImage SubtitleTrack_AssImpl::RenderSubtitleClip(SubtitleClip* clip, int6
         }
         for (int i = 0; i < drawBox.h; i++)
         {
-            for (int j = 0; j < drawBox.w; j++)
-            {
-                const unsigned char b = assPtr[j];
-                if (b > 0)
-                {
-                    uint32_t alpha = (uint32_t)(baseAlpha*b);
-                    imgPtr[j] = color | (alpha<<24);
-                }
-            }
+            DrawAssBitmapRow(imgPtr, assPtr, drawBox.w, color, baseAlpha);
             imgPtr += vmat.w;
             assPtr += assImage->stride;
         }
         assImage = assImage->next;
     }
 
-    m_prevRenderedImage = SubtitleImage(vmat, dispBox);
-    return m_prevRenderedImage;
+    slot->prevVmat = vmat;
+    slot->prevStyleHash = styleHash;
+    return vmat;
+}
+
+SubtitleTrack_AssImpl::ClipIndex::iterator SubtitleTrack_AssImpl::FindClipIndexEntry(const SubtitleClipHolder& hClip)
+{
+    if (!hClip)
+        return m_clipIndex.end();
+    auto range = m_clipIndex.equal_range(hClip->StartTime());
+    auto idxIter = find_if(range.first, range.second, [&hClip] (const ClipIndex::value_type& elem) {
+        return *elem.second == hClip;
+    });
+    return idxIter == range.second ? m_clipIndex.end() : idxIter;
+}
+
+// Return the latest started clip which is active at 'ms', if there is none, return the first clip starting after 'ms'
+SubtitleTrack_AssImpl::ClipIterator SubtitleTrack_AssImpl::FindClipIterByTime(int64_t ms)
+{
+    const auto& intervals = GetClipIntervals();
+    const size_t count = upper_bound(intervals.starts.begin(), intervals.starts.end(), ms)-intervals.starts.begin();
+    const int32_t activeIdx = intervals.FindLastEndingAfter(count, ms);
+    if (activeIdx >= 0)
+        return intervals.clips[activeIdx];
+    return count < intervals.clips.size() ? intervals.clips[count] : m_clips.end();
+}
+
+void SubtitleTrack_AssImpl::AddToClipIndex(ClipIterator clipIter)
+{
+    // keep the same order as 'm_clips' for the clips starting at the same time
+    auto nextClipIter = clipIter; nextClipIter++;
+    auto hint = nextClipIter == m_clips.end() ? m_clipIndex.end() : FindClipIndexEntry(*nextClipIter);
+    m_clipIndex.emplace_hint(hint, (*clipIter)->StartTime(), clipIter);
+    m_clipIntervalsDirty = true;
+}
+
+void SubtitleTrack_AssImpl::RemoveFromClipIndex(ClipIndex::iterator idxIter)
+{
+    m_clipIndex.erase(idxIter);
+    m_clipIntervalsDirty = true;
+}
+
+void SubtitleTrack_AssImpl::RebuildClipIndex()
+{
+    m_clipIndex.clear();
+    for (auto iter = m_clips.begin(); iter != m_clips.end(); iter++)
+        m_clipIndex.emplace_hint(m_clipIndex.end(), (*iter)->StartTime(), iter);
+    m_clipIntervalsDirty = true;
+}
+
+// The edits only mark the interval index dirty, a batch of them costs one rebuild
+const SubtitleTrack_AssImpl::ClipIntervals& SubtitleTrack_AssImpl::GetClipIntervals()
+{
+    lock_guard<recursive_mutex> lk(m_renderLock);
+    if (m_clipIntervalsDirty)
+    {
+        m_clipIntervals.Build(m_clipIndex);
+        m_clipIntervalsDirty = false;
+    }
+    return m_clipIntervals;
+}
+
+void SubtitleTrack_AssImpl::ClipIntervals::Build(const ClipIndex& clipIndex)
+{
+    clips.clear();
+    starts.clear();
+    clips.reserve(clipIndex.size());
+    starts.reserve(clipIndex.size());
+    for (auto& elem : clipIndex)
+    {
+        clips.push_back(elem.second);
+        starts.push_back(elem.first);
+    }
+    leafBase = 1;
+    while (leafBase < clips.size())
+        leafBase <<= 1;
+    maxEnds.assign(2*leafBase, INT64_MIN);
+    for (size_t i = 0; i < clips.size(); i++)
+        maxEnds[leafBase+i] = (*clips[i])->EndTime();
+    for (size_t node = leafBase-1; node > 0; node--)
+        maxEnds[node] = max(maxEnds[2*node], maxEnds[2*node+1]);
+}
+
+int32_t SubtitleTrack_AssImpl::ClipIntervals::FindLastEndingAfter(size_t count, int64_t ms) const
+{
+    if (count == 0 || clips.empty())
+        return -1;
+    return FindLastEndingAfter(1, 0, leafBase, count, ms);
+}
+
+int32_t SubtitleTrack_AssImpl::ClipIntervals::FindLastEndingAfter(size_t node, size_t nodeBegin, size_t nodeEnd, size_t count, int64_t ms) const
+{
+    if (nodeBegin >= count || maxEnds[node] <= ms)
+        return -1;
+    if (node >= leafBase)
+        return (int32_t)nodeBegin;
+    const size_t nodeMid = (nodeBegin+nodeEnd)/2;
+    const int32_t idx = FindLastEndingAfter(2*node+1, nodeMid, nodeEnd, count, ms);
+    return idx >= 0 ? idx : FindLastEndingAfter(2*node, nodeBegin, nodeMid, count, ms);
+}
+
+void SubtitleTrack_AssImpl::ClipIntervals::CollectEndingAfter(size_t count, int64_t ms, vector<size_t>& indices) const
+{
+    if (count == 0 || clips.empty())
+        return;
+    CollectEndingAfter(1, 0, leafBase, count, ms, indices);
+}
+
+void SubtitleTrack_AssImpl::ClipIntervals::CollectEndingAfter(size_t node, size_t nodeBegin, size_t nodeEnd, size_t count, int64_t ms, vector<size_t>& indices) const
+{
+    if (nodeBegin >= count || maxEnds[node] <= ms)
+        return;
+    if (node >= leafBase)
+    {
+        indices.push_back(nodeBegin);
+        return;
+    }
+    const size_t nodeMid = (nodeBegin+nodeEnd)/2;
+    CollectEndingAfter(2*node, nodeBegin, nodeMid, count, ms, indices);
+    CollectEndingAfter(2*node+1, nodeMid, nodeEnd, count, ms, indices);
+}
+
+SubtitleTrack_AssImpl::RenderCacheKey SubtitleTrack_AssImpl::MakeRenderCacheKey(SubtitleClip* clip, int64_t pos, bool absolutePosX, bool absolutePosY)
+{
+    RenderCacheKey key{HASH_SEED, -1, HASH_SEED};
+    // all the events shown at 'pos' are rendered together. The content is identified by the events rather than the clip,
+    // so the clips with the same text reuse the same image. A static event renders the same image over its duration,
+    // it has only one time bucket.
+    auto activeClips = GetClipsByTimeRange(pos, pos+1);
+    const bool overlapped = activeClips.size() > 1;
+    for (auto& hClip : activeClips)
+    {
+        SubtitleClip_AssImpl* assClip = dynamic_cast<SubtitleClip_AssImpl*>(hClip.get());
+        const ASS_Event* assEvent = assClip->AssEventPtr();
+        if (!assEvent)
+            continue;
+        HashAssEvent(key.contentHash, assEvent);
+        if (overlapped)
+            HashValue(key.contentHash, assEvent->ReadOrder);
+        if (IsAnimatedAssEvent(assEvent))
+        {
+            const int64_t timeOffset = pos-hClip->StartTime();
+            if (hClip.get() == clip)
+                key.timeBucket = timeOffset;
+            else
+                HashValue(key.contentHash, timeOffset);
+        }
+    }
+
+    // the effective style, key-point animations are already applied to 'm_overrideStyle'
+    HashValue(key.styleHash, m_useOverrideStyle);
+    if (m_useOverrideStyle)
+        HashAssStyle(key.styleHash, m_overrideStyle.GetAssStylePtr());
+    HashValue(key.styleHash, m_frmW);
+    HashValue(key.styleHash, m_frmH);
+    HashValue(key.styleHash, m_outputFullSize);
+    HashColor(key.styleHash, clip->IsUsingTrackStyle() ? m_overrideStyle.BackgroundColor() : clip->BackgroundColor());
+    if (m_outputFullSize)
+    {
+        // the offsets only move the display box of a text image, but they are drawn into a full size image
+        HashValue(key.styleHash, clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetHScale() : clip->OffsetHScale());
+        HashValue(key.styleHash, clip->IsUsingTrackStyle() ? m_overrideStyle.OffsetVScale() : clip->OffsetVScale());
+        HashValue(key.styleHash, m_foffsetCompensationV);
+        HashValue(key.styleHash, absolutePosX);
+        HashValue(key.styleHash, absolutePosY);
+    }
+    return key;
+}
+
+void SubtitleTrack_AssImpl::AddToRenderCache(const RenderCacheKey& key, ImGui::ImMat& vmat, const SubtitleImage::Rect& assBox)
+{
+    const uint64_t bytes = vmat.empty() ? 0 : (uint64_t)vmat.total()*vmat.elemsize;
+    if (m_renderCacheMaxCount == 0 || bytes > m_renderCacheMaxBytes)
+        return;
+    auto cacheIter = m_renderCacheMap.find(key);
+    if (cacheIter != m_renderCacheMap.end())
+    {
+        m_renderCacheBytes -= cacheIter->second->bytes;
+        m_renderCache.erase(cacheIter->second);
+        m_renderCacheMap.erase(cacheIter);
+    }
+    m_renderCache.push_front({key, vmat, assBox, bytes});
+    m_renderCacheMap[key] = m_renderCache.begin();
+    m_renderCacheBytes += bytes;
+    ShrinkRenderCache();
+}
+
+void SubtitleTrack_AssImpl::ShrinkRenderCache()
+{
+    while (!m_renderCache.empty() && (m_renderCache.size() > m_renderCacheMaxCount || m_renderCacheBytes > m_renderCacheMaxBytes))
+    {
+        auto& entry = m_renderCache.back();
+        m_renderCacheBytes -= entry.bytes;
+        m_renderCacheMap.erase(entry.key);
+        m_renderCache.pop_back();
+    }
+}
+
+void SubtitleTrack_AssImpl::ClearSharedRenderCache()
+{
+    m_renderCacheMap.clear();
+    m_renderCache.clear();
+    m_renderCacheBytes = 0;
 }
 
 void SubtitleTrack_AssImpl::ClearRenderCache()
 {
+    if (m_styleUpdateDepth > 0)
+    {
+        m_renderCacheClearPending = true;
+        return;
+    }
+    m_renderCacheClearPending = false;
     for (auto clip : m_clips)
         clip->InvalidateImage();
+    RestartPreRender();
+}
+
+void SubtitleTrack_AssImpl::UpdateStyleOverride()
+{
+    if (m_styleUpdateDepth > 0)
+        m_styleOverridePending = true;
+    else
+        ApplyStyleOverride();
+}
+
+void SubtitleTrack_AssImpl::ApplyStyleOverride()
+{
+    // the renderers take 'm_overrideStyle' on their next rendering
+    m_styleOverridePending = false;
+    if (!m_useOverrideStyle)
+        ToggleOverrideStyle();
 }
 
 void SubtitleTrack_AssImpl::ToggleOverrideStyle()
 {
-    int bit = ASS_OVERRIDE_DEFAULT;
     m_useOverrideStyle = !m_useOverrideStyle;
-    if (m_useOverrideStyle)
-        bit = ASS_OVERRIDE_FULL_STYLE;
-    ass_set_selective_style_override_enabled(m_assrnd, bit);
 }
 
 void SubtitleTrack_AssImpl::UpdateTrackStyleByKeyPoints(int64_t pos)
 {
     auto keyPoints = m_overrideStyle.GetKeyPoints();
+    if (keyPoints->GetCurveCount() <= 0)
+        return;
+    // set all the animated values before applying the style override once
+    BeginStyleUpdate();
     for (int i = 0; i < keyPoints->GetCurveCount(); i++)
     {
         auto name = keyPoints->GetCurveName(i);
@@ -1860,6 +2682,7 @@ void SubtitleTrack_AssImpl::UpdateTrackStyleByKeyPoints(int64_t pos)
         else
             Log(WARN) << "[SubtitleTrack_AssImpl] UNKNOWN curve name '" << name << "', value=" << value << "." << endl;
     }
+    EndStyleUpdate();
 }
 
 SubtitleTrackHolder SubtitleTrack_AssImpl::BuildFromFile(int64_t id, const string& url)
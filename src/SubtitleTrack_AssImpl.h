@@ -17,6 +17,14 @@
 
 #pragma once
 #include <list>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
 #include "SubtitleTrack.h"
 extern "C"
 {
@@ -157,6 +165,14 @@ namespace MediaCore
         bool SetBackColor(const ImVec4& color) override;
         bool SetBackgroundColor(const ImVec4& color) override;
         void Refresh() override;
+        void BeginStyleUpdate() override;
+        void EndStyleUpdate() override;
+        void SetRenderCacheLimit(uint32_t maxCount, uint64_t maxBytes) override;
+        void SetMaxRenderers(uint32_t count) override;
+        bool EnablePreRender(bool enable, const Ratio& frameRate, int64_t durationMs, uint64_t memoryBudget) override;
+        bool IsPreRenderEnabled() const override { return m_preRenderThread.joinable(); }
+        void UpdatePreRenderPosition(int64_t pos, bool forward) override;
+        PreRenderStatistics GetPreRenderStatistics() override;
         bool SetKeyPoints(const ImGui::KeyPointEditor& keyPoints) override;
         ImGui::KeyPointEditor* GetKeyPoints() override;
 
@@ -164,6 +180,7 @@ namespace MediaCore
         bool DeleteClip(SubtitleClipHolder hClip) override;
         bool ChangeClipTime(SubtitleClipHolder clip, int64_t startTime, int64_t duration) override;
         SubtitleClipHolder GetClipByTime(int64_t ms) override;
+        std::vector<SubtitleClipHolder> GetClipsByTimeRange(int64_t startMs, int64_t endMs) override;
         SubtitleClipHolder GetCurrClip() override;
         SubtitleClipHolder GetPrevClip() override;
         SubtitleClipHolder GetNextClip() override;
@@ -198,11 +215,119 @@ namespace MediaCore
         bool _SetOffsetV(float value, bool clearCache = true);
         bool ReadFile(const std::string& path);
         void ReleaseFFContext();
+        // Settings of one rendering, taken from the track and the clip under 'm_renderLock', so the rasterization can run
+        // without the lock
+        struct RenderParams
+        {
+            int readOrder;
+            uint32_t frmW, frmH;
+            bool outputFullSize;
+            bool useOverrideStyle;
+            ASS_Style overrideStyle;
+            std::string overrideStyleName;
+            std::string overrideFontName;
+            uint64_t overrideStyleHash;
+            float offsetH, offsetV;
+            float offsetCompensationV;
+            bool absolutePosX, absolutePosY;
+            SubtitleColor bgColor;
+        };
+        // A libass renderer with the settings it was last configured with
+        struct AssRendererSlot
+        {
+            ASS_Renderer* assrnd{nullptr};
+            // the replica of 'm_asstrk' rasterized by this renderer, it holds the styles and the events shown at the last
+            // rendered position, since 'ass_render_frame()' updates the render state kept in the events of a track
+            ASS_Track* asstrk{nullptr};
+            uint64_t trackStylesHash{0};
+            uint64_t trackEventsHash{0};
+            uint32_t frmW{0}, frmH{0};
+            bool useOverrideStyle{false};
+            uint64_t overrideStyleHash{0};
+            // the last image rendered by this renderer, reused if libass reports no change of the content
+            ImGui::ImMat prevVmat;
+            uint64_t prevStyleHash{0};
+        };
+
         SubtitleImage RenderSubtitleClip(SubtitleClip* clip, int64_t timeOffset, bool absolutePosX, bool absolutePosY);
+        void MakeRenderParams(SubtitleClip* clip, bool absolutePosX, bool absolutePosY, RenderParams& params);
+        bool SyncAssTrackReplica(AssRendererSlot* slot, int64_t pos);
+        ImGui::ImMat RenderAssImage(AssRendererSlot* slot, const RenderParams& params, int64_t pos, uint64_t styleHash, SubtitleImage::Rect& assBox);
+        static SubtitleImage::Rect CalcDisplayBox(const RenderParams& params, const SubtitleImage::Rect& assBox);
+        ASS_Renderer* CreateAssRenderer();
+        AssRendererSlot* AcquireAssRenderer();
+        void ReleaseAssRenderer(AssRendererSlot* slot);
+        static void DestroyAssRendererSlot(AssRendererSlot* slot);
         void ClearRenderCache();
+        void UpdateStyleOverride();
+        void ApplyStyleOverride();
         void ToggleOverrideStyle();
         void UpdateTrackStyleByKeyPoints(int64_t pos);
 
+        using ClipIterator = std::list<SubtitleClipHolder>::iterator;
+        using ClipIndex = std::multimap<int64_t, ClipIterator>;
+        ClipIndex::iterator FindClipIndexEntry(const SubtitleClipHolder& hClip);
+        ClipIterator FindClipIterByTime(int64_t ms);
+        void AddToClipIndex(ClipIterator clipIter);
+        void RemoveFromClipIndex(ClipIndex::iterator idxIter);
+        void RebuildClipIndex();
+
+        // The indexed clips in start time order, with a segment tree of their max end time. The clips active in a time range
+        // are found by descending only into the subtrees ending after the range start, no matter how long the other clips are.
+        struct ClipIntervals
+        {
+            std::vector<ClipIterator> clips;
+            std::vector<int64_t> starts;
+            std::vector<int64_t> maxEnds;       // node 1 is the root, the leaves start at 'leafBase'
+            size_t leafBase{0};
+
+            void Build(const ClipIndex& clipIndex);
+            // Index of the last clip among the first 'count' ones which ends after 'ms', or -1
+            int32_t FindLastEndingAfter(size_t count, int64_t ms) const;
+            // Indices of the clips among the first 'count' ones which end after 'ms', in start time order
+            void CollectEndingAfter(size_t count, int64_t ms, std::vector<size_t>& indices) const;
+
+        private:
+            int32_t FindLastEndingAfter(size_t node, size_t nodeBegin, size_t nodeEnd, size_t count, int64_t ms) const;
+            void CollectEndingAfter(size_t node, size_t nodeBegin, size_t nodeEnd, size_t count, int64_t ms, std::vector<size_t>& indices) const;
+        };
+        const ClipIntervals& GetClipIntervals();
+
+        // Rendered images shared by all the clips, the same content rendered with the same effective style at the same time
+        // bucket is reused across the clips, the seeks and the style changes
+        struct RenderCacheKey
+        {
+            uint64_t contentHash;
+            int64_t timeBucket;
+            uint64_t styleHash;
+
+            bool operator==(const RenderCacheKey& a) const
+            { return contentHash == a.contentHash && timeBucket == a.timeBucket && styleHash == a.styleHash; }
+        };
+        struct RenderCacheKeyHash
+        {
+            size_t operator()(const RenderCacheKey& key) const
+            { return (size_t)(key.contentHash ^ (key.styleHash*31) ^ ((uint64_t)key.timeBucket*0x9e3779b97f4a7c15ULL)); }
+        };
+        struct RenderCacheEntry
+        {
+            RenderCacheKey key;
+            ImGui::ImMat vmat;
+            SubtitleImage::Rect assBox;
+            uint64_t bytes;
+        };
+        using RenderCacheList = std::list<RenderCacheEntry>;
+        RenderCacheKey MakeRenderCacheKey(SubtitleClip* clip, int64_t pos, bool absolutePosX, bool absolutePosY);
+        void AddToRenderCache(const RenderCacheKey& key, ImGui::ImMat& vmat, const SubtitleImage::Rect& assBox);
+        void ShrinkRenderCache();
+        void ClearSharedRenderCache();
+
+        void PreRenderProc();
+        int64_t PreRenderFrameAt(int64_t pos, uint32_t seekCount, std::unordered_map<SubtitleClip*, void*>& renderedData);
+        void StopPreRender();
+        void RestartPreRender();
+        void OnClipChanged(SubtitleClip_AssImpl* clip);
+
     private:
         Logger::ALogger* m_logger;
         std::string m_errMsg;
@@ -211,17 +336,52 @@ namespace MediaCore
         int64_t m_readPos{0};
         std::list<SubtitleClipHolder> m_clips;
         std::list<SubtitleClipHolder>::iterator m_currIter;
+        // 'm_clips' keyed by start time, and the interval index built from it on the first query after a change
+        ClipIndex m_clipIndex;
+        ClipIntervals m_clipIntervals;
+        bool m_clipIntervalsDirty{true};
         int64_t m_duration{-1};
         ASS_Track* m_asstrk{nullptr};
         int m_defaultStyleIdx{-1};
-        ASS_Renderer* m_assrnd{nullptr};
+        // renderers sharing 's_asslib', each rasterizes one frame at a time. 'm_assRenderers' owns them, the idle ones are
+        // also in 'm_idleAssRenderers'.
+        std::vector<std::unique_ptr<AssRendererSlot>> m_assRenderers;
+        std::vector<AssRendererSlot*> m_idleAssRenderers;
+        uint32_t m_maxAssRenderers{1};
+        std::mutex m_assRendererPoolLock;
+        std::condition_variable m_assRendererPoolCv;
+        // held exclusively to change 'm_asstrk', shared by the renderers copying it into their replicas
+        std::shared_timed_mutex m_assTrackLock;
         uint32_t m_frmW{0}, m_frmH{0};
         int32_t m_offsetCompensationV{0};
         float m_foffsetCompensationV{0};
         bool m_outputFullSize{true};
         bool m_useOverrideStyle{false};
         SubtitleTrackStyle_AssImpl m_overrideStyle;
-        SubtitleImage m_prevRenderedImage;
+        int m_styleUpdateDepth{0};
+        bool m_styleOverridePending{false};
+        bool m_renderCacheClearPending{false};
+        // front is the most recently used
+        RenderCacheList m_renderCache;
+        std::unordered_map<RenderCacheKey, RenderCacheList::iterator, RenderCacheKeyHash> m_renderCacheMap;
+        uint64_t m_renderCacheBytes{0};
+        uint32_t m_renderCacheMaxCount{512};
+        uint64_t m_renderCacheMaxBytes{128ULL*1024*1024};
+        std::recursive_mutex m_renderLock;
+
+        std::thread m_preRenderThread;
+        std::atomic<bool> m_quitPreRender{false};
+        std::mutex m_preRenderStateLock;
+        std::condition_variable m_preRenderCv;
+        Ratio m_preRenderFrameRate;
+        int64_t m_preRenderDuration{3000};
+        uint64_t m_preRenderMemBudget{0};
+        int64_t m_preRenderPos{INT64_MIN};
+        bool m_preRenderForward{true};
+        // increased by a seek or an invalidation of the rendered images, the worker restarts from the play position
+        std::atomic<uint32_t> m_preRenderSeekCount{0};
+        // published by the worker under 'm_preRenderStateLock'
+        PreRenderStatistics m_preRenderStats;
 
         AVFormatContext* m_pAvfmtCtx{nullptr};
         AVCodecContext* m_pAvCdcCtx{nullptr};
@@ -99,41 +99,15 @@ public:
         if (vidStm->isImage)
             throw invalid_argument("This video stream is an IMAGE, it should be instantiated with a 'VideoClip_ImageImpl' instance!");
         loggerNameOss.str(""); loggerNameOss << "VRdr-" << fileName.substr(0, 4) << "-" << idstr;
-        if (hParser->IsImageSequence())
-            m_hReader = MediaReader::CreateImageSequenceInstance(loggerNameOss.str());
-        else
-            m_hReader = MediaReader::CreateVideoInstance(loggerNameOss.str());
-        // m_hReader->SetLogLevel(DEBUG);
-        m_hReader->EnableHwAccel(VideoClip::USE_HWACCEL);
-        if (!m_hReader->Open(hParser))
-            throw runtime_error(m_hReader->GetError());
-        const auto outWidth = hSettings->VideoOutWidth();
-        const auto outHeight = hSettings->VideoOutHeight();
-        const auto frameRate = hSettings->VideoOutFrameRate();
-        uint32_t readerWidth, readerHeight;
-        if (outWidth*vidStm->height > outHeight*vidStm->width)
-        {
-            readerHeight = outHeight;
-            readerWidth = vidStm->width*outHeight/vidStm->height;
-        }
-        else
-        {
-            readerWidth = outWidth;
-            readerHeight = vidStm->height*outWidth/vidStm->width;
-        }
-        readerWidth += readerWidth&0x1;
-        readerHeight += readerHeight&0x1;
-        ImInterpolateMode interpMode = IM_INTERPOLATE_BICUBIC;
-        if (readerWidth*readerHeight < vidStm->width*vidStm->height)
-            interpMode = IM_INTERPOLATE_AREA;
+        m_readerLoggerName = loggerNameOss.str();
+        m_hParser = hParser;
         m_outClrfmt = hSettings->VideoOutColorFormat();
         m_outDtype = hSettings->VideoOutDataType();
-        if (!m_hReader->ConfigVideoReader(readerWidth, readerHeight, m_outClrfmt, m_outDtype, interpMode, hSettings->GetHwaccelManager()))
-            throw runtime_error(m_hReader->GetError());
+        const auto frameRate = hSettings->VideoOutFrameRate();
         if (frameRate.num <= 0 || frameRate.den <= 0)
             throw invalid_argument("Invalid argument value for 'frameRate'!");
         m_frameRate = frameRate;
-        m_srcDuration = static_cast<int64_t>(m_hReader->GetVideoStream()->duration*1000);
+        m_srcDuration = static_cast<int64_t>(vidStm->duration*1000);
         if (startOffset < 0)
             throw invalid_argument("Argument 'startOffset' can NOT be NEGATIVE!");
         if (endOffset < 0)
@@ -143,14 +117,29 @@ public:
         m_startOffset = startOffset;
         m_endOffset = endOffset;
         m_padding = (end-start)+startOffset+endOffset-m_srcDuration;
-        m_hReader->SetDirection(forward);
         auto seekPos = startOffset;
         if (seekPos >= m_srcDuration) seekPos = m_srcDuration;
-        if (!m_hReader->SeekTo(seekPos))
-            throw runtime_error(m_hReader->GetError());
         bool suspend = readpos < -m_wakeupRange || readpos > Duration()+m_wakeupRange;
-        if (!m_hReader->Start(suspend))
-            throw runtime_error(m_hReader->GetError());
+        string errMsg;
+        m_hProxyMgr = hSettings->GetProxyManager();
+        if (m_hProxyMgr && !hParser->IsImageSequence())
+        {
+            auto hProxyParser = m_hProxyMgr->AcquireProxy(hParser->GetUrl(), ProxyManager::PRIORITY_HIGH);
+            if (hProxyParser)
+            {
+                m_hReader = OpenReader(hProxyParser, forward, seekPos, suspend, errMsg);
+                if (m_hReader)
+                    m_usingProxy = true;
+                else
+                    m_logger->Log(WARN) << "FAILED to read from the proxy of '" << hParser->GetUrl() << "'! " << errMsg << endl;
+            }
+        }
+        if (!m_hReader)
+        {
+            m_hReader = OpenReader(hParser, forward, seekPos, suspend, errMsg);
+            if (!m_hReader)
+                throw runtime_error(errMsg);
+        }
         m_hWarpFilter = VideoTransformFilter::CreateInstance();
         if (!m_hWarpFilter->Initialize(hSettings))
             throw runtime_error(m_hWarpFilter->GetError());
@@ -165,7 +154,7 @@ public:
 
     MediaParser::Holder GetMediaParser() const override
     {
-        return m_hReader->GetMediaParser();
+        return m_hParser;
     }
 
     int64_t Id() const override
@@ -183,6 +172,11 @@ public:
         return false;
     }
 
+    bool IsUsingProxy() const override
+    {
+        return m_usingProxy;
+    }
+
     int64_t Start() const override
     {
         return m_start;
@@ -395,7 +389,11 @@ public:
         else if (pos > Duration()) pos = Duration();
         auto seekPos = pos+m_startOffset;
         if (seekPos > m_srcDuration) seekPos = m_srcDuration;
-        if (seekPos != m_hReader->GetReadPos())
+        if (TrySwitchToProxy(seekPos))
+        {
+            m_eof = false;
+        }
+        else if (seekPos != m_hReader->GetReadPos())
         {
             m_logger->Log(DEBUG) << "-> VidClip.SeekTo(" << seekPos << ")" << endl;
             if (!m_hReader->SeekTo(seekPos))
@@ -463,10 +461,28 @@ public:
 
     void UpdateSettings(SharedSettings::Holder hSettings) override
     {
-        auto outWidth = hSettings->VideoOutWidth();
-        auto outHeight = hSettings->VideoOutHeight();
-        auto vidStm = m_hReader->GetVideoStream();
         uint32_t readerWidth, readerHeight;
+        ImInterpolateMode interpMode;
+        CalcReaderOutputSize(hSettings, m_hReader->GetVideoStream(), readerWidth, readerHeight, interpMode);
+        m_hReader->ChangeVideoOutputSize(readerWidth, readerHeight, interpMode);
+        if (m_hFilter)
+            m_hFilter = m_hFilter->Clone(hSettings);
+        m_hWarpFilter = m_hWarpFilter->Clone(hSettings);
+    }
+
+    void SetLogLevel(Level l) override
+    {
+        m_logger->SetShowLevels(l);
+    }
+
+private:
+    // The output size is derived from the source stream, so a proxy reader produces frames of the same size as the original one
+    void CalcReaderOutputSize(SharedSettings::Holder hSettings, const VideoStream* readStm,
+            uint32_t& readerWidth, uint32_t& readerHeight, ImInterpolateMode& interpMode)
+    {
+        const auto outWidth = hSettings->VideoOutWidth();
+        const auto outHeight = hSettings->VideoOutHeight();
+        auto vidStm = m_hParser->GetBestVideoStream();
         if (outWidth*vidStm->height > outHeight*vidStm->width)
         {
             readerHeight = outHeight;
@@ -479,18 +495,63 @@ public:
         }
         readerWidth += readerWidth&0x1;
         readerHeight += readerHeight&0x1;
-        ImInterpolateMode interpMode = IM_INTERPOLATE_BICUBIC;
-        if (readerWidth*readerHeight < vidStm->width*vidStm->height)
+        interpMode = IM_INTERPOLATE_BICUBIC;
+        if (readerWidth*readerHeight < readStm->width*readStm->height)
             interpMode = IM_INTERPOLATE_AREA;
-        m_hReader->ChangeVideoOutputSize(readerWidth, readerHeight, interpMode);
-        if (m_hFilter)
-            m_hFilter = m_hFilter->Clone(hSettings);
-        m_hWarpFilter = m_hWarpFilter->Clone(hSettings);
     }
 
-    void SetLogLevel(Level l) override
+    MediaReader::Holder OpenReader(MediaParser::Holder hReaderParser, bool forward, int64_t seekPos, bool suspend, string& errMsg)
     {
-        m_logger->SetShowLevels(l);
+        MediaReader::Holder hReader;
+        if (hReaderParser->IsImageSequence())
+            hReader = MediaReader::CreateImageSequenceInstance(m_readerLoggerName);
+        else
+            hReader = MediaReader::CreateVideoInstance(m_readerLoggerName);
+        // hReader->SetLogLevel(DEBUG);
+        hReader->EnableHwAccel(VideoClip::USE_HWACCEL);
+        if (!hReader->Open(hReaderParser))
+        {
+            errMsg = hReader->GetError();
+            return nullptr;
+        }
+        uint32_t readerWidth, readerHeight;
+        ImInterpolateMode interpMode;
+        CalcReaderOutputSize(m_hSettings, hReader->GetVideoStream(), readerWidth, readerHeight, interpMode);
+        if (!hReader->ConfigVideoReader(readerWidth, readerHeight, m_outClrfmt, m_outDtype, interpMode, m_hSettings->GetHwaccelManager()))
+        {
+            errMsg = hReader->GetError();
+            return nullptr;
+        }
+        hReader->SetDirection(forward);
+        if (!hReader->SeekTo(seekPos) || !hReader->Start(suspend))
+        {
+            errMsg = hReader->GetError();
+            return nullptr;
+        }
+        return hReader;
+    }
+
+    // A proxy generated after this clip is created is taken on the next seek, which runs on the same thread as the reading
+    bool TrySwitchToProxy(int64_t seekPos)
+    {
+        if (m_usingProxy || !m_hProxyMgr || m_hParser->IsImageSequence())
+            return false;
+        if (m_hProxyMgr->GetProxyState(m_hParser->GetUrl()) != ProxyManager::PROXY_READY)
+            return false;
+        auto hProxyParser = m_hProxyMgr->AcquireProxy(m_hParser->GetUrl(), ProxyManager::PRIORITY_HIGH);
+        if (!hProxyParser)
+            return false;
+        string errMsg;
+        auto hReader = OpenReader(hProxyParser, m_hReader->IsDirectionForward(), seekPos, m_hReader->IsSuspended(), errMsg);
+        if (!hReader)
+        {
+            m_logger->Log(WARN) << "FAILED to switch to the proxy of '" << m_hParser->GetUrl() << "'! " << errMsg << endl;
+            return false;
+        }
+        m_hReader = hReader;
+        m_usingProxy = true;
+        m_logger->Log(DEBUG) << "Switched to read from proxy '" << hProxyParser->GetUrl() << "'." << endl;
+        return true;
     }
 
 private:
@@ -499,7 +560,11 @@ private:
     int64_t m_trackId{-1};
     SharedSettings::Holder m_hSettings;
     MediaInfo::Holder m_hInfo;
+    MediaParser::Holder m_hParser;
     MediaReader::Holder m_hReader;
+    string m_readerLoggerName;
+    ProxyManager::Holder m_hProxyMgr;
+    bool m_usingProxy{false};
     int64_t m_srcDuration;
     int64_t m_start;
     int64_t m_startOffset;
@@ -532,7 +597,7 @@ VideoClip::Holder VideoClip::CreateVideoInstance(
 VideoClip::Holder VideoClip_VideoImpl::Clone(SharedSettings::Holder hSettings) const
 {
     VideoClip_VideoImpl* newInstance = new VideoClip_VideoImpl(
-        m_id, m_hReader->GetMediaParser(), hSettings, m_start, End(), m_startOffset, m_endOffset, 0, true);
+        m_id, m_hParser, hSettings, m_start, End(), m_startOffset, m_endOffset, 0, true);
     if (m_hFilter) newInstance->SetFilter(m_hFilter->Clone(hSettings));
     newInstance->m_hWarpFilter = m_hWarpFilter->Clone(hSettings);
     newInstance->m_hWarpFilter->ApplyTo(newInstance);
@@ -616,6 +681,11 @@ public:
         return true;
     }
 
+    bool IsUsingProxy() const override
+    {
+        return false;
+    }
+
     int64_t Start() const override
     {
         return m_start;
@@ -203,6 +203,7 @@ int main(int argc, const char* argv[])
         }
     }
     hEncoder->FinishEncoding();
+    Log(INFO) << "Encoding statistics: " << hEncoder->GetStatistics() << endl;
     hEncoder->Close();
 
     return 0;
@@ -1,6 +1,13 @@
 #include <string>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
 #include "DebugHelper.h"
 #include "Logger.h"
 
@@ -8,6 +15,18 @@ using namespace std;
 using namespace Logger;
 using namespace MediaCore;
 
+static bool g_unitTestFailed = false;
+
+static bool UnitCheck(bool cond, const string& desc)
+{
+    if (!cond)
+    {
+        Log(Error) << "CHECK FAILED: " << desc << endl;
+        g_unitTestFailed = true;
+    }
+    return cond;
+}
+
 #include "MediaReader.h"
 static void Unit_CreateVideoReaderInstance()
 {
@@ -15,13 +34,873 @@ static void Unit_CreateVideoReaderInstance()
     auto hVideoReader = MediaReader::CreateVideoInstance();
 }
 
+#include "MediaParser.h"
+#include "MultiRenditionEncoder.h"
+static ImGui::ImMat MakeTestPatternImage(uint32_t width, uint32_t height, uint32_t frameIndex)
+{
+    ImGui::ImMat vmat;
+    vmat.create_type(width, height, 4, IM_DT_INT8);
+    vmat.color_format = IM_CF_ABGR;
+    uint8_t* p = (uint8_t*)vmat.data;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++, p += 4)
+        {
+            p[0] = (uint8_t)(x+frameIndex*4);
+            p[1] = (uint8_t)(y+frameIndex*2);
+            p[2] = (uint8_t)(x^y);
+            p[3] = 255;
+        }
+    }
+    return vmat;
+}
+
+static const VideoStream* FindVideoStream(MediaInfo::Holder hInfo)
+{
+    if (!hInfo)
+        return nullptr;
+    for (auto& hStm : hInfo->streams)
+    {
+        if (hStm->type == MediaType::VIDEO)
+            return dynamic_cast<const VideoStream*>(hStm.get());
+    }
+    return nullptr;
+}
+
+static void Unit_MultiRenditionEncoderFanout()
+{
+    AutoSection _as("MultiRenditionEncoderFanout");
+    const Ratio frameRate(25, 1);
+    const uint32_t frameCount = 50;
+    // two renditions converted from the input and two downscaled ones, they all run on their own workers
+    vector<MultiRenditionEncoder::Rendition> renditions(4);
+    const uint32_t sizes[4][2] = {{640, 360}, {480, 270}, {320, 180}, {160, 90}};
+    for (int i = 0; i < 4; i++)
+    {
+        // the 2nd rendition uses another pixel format, so it can't be downscaled from the 1st one
+        const bool isMjpeg = i == 1;
+        ostringstream oss; oss << "/tmp/mrenc_fanout_" << i << (isMjpeg ? ".mov" : ".mp4");
+        renditions[i].url = oss.str();
+        renditions[i].videoCodec = isMjpeg ? "mjpeg" : "mpeg4";
+        renditions[i].imageFormat = isMjpeg ? "yuvj422p" : "yuv420p";
+        renditions[i].width = sizes[i][0];
+        renditions[i].height = sizes[i][1];
+        renditions[i].videoBitRate = 1000*1000;
+    }
+
+    auto hEncoder = MultiRenditionEncoder::CreateInstance();
+    if (!UnitCheck(hEncoder->Open(renditions, frameRate), "Open MultiRenditionEncoder: "+hEncoder->GetError()))
+        return;
+    if (!UnitCheck(hEncoder->Start(), "Start MultiRenditionEncoder: "+hEncoder->GetError()))
+        return;
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        auto vmat = MakeTestPatternImage(640, 360, i);
+        vmat.time_stamp = (double)i*frameRate.den/frameRate.num;
+        if (!UnitCheck(hEncoder->EncodeVideoFrame(vmat), "EncodeVideoFrame: "+hEncoder->GetError()))
+            break;
+    }
+    ImGui::ImMat eofMat;
+    hEncoder->EncodeVideoFrame(eofMat);
+    UnitCheck(hEncoder->FinishEncoding(), "FinishEncoding: "+hEncoder->GetError());
+    hEncoder->Close();
+
+    for (int i = 0; i < 4; i++)
+    {
+        auto hParser = MediaParser::CreateInstance();
+        if (!UnitCheck(hParser->Open(renditions[i].url), "Open output '"+renditions[i].url+"'"))
+            continue;
+        auto pVidStm = FindVideoStream(hParser->GetMediaInfo());
+        if (!UnitCheck(pVidStm != nullptr, "Video stream of '"+renditions[i].url+"'"))
+            continue;
+        UnitCheck(pVidStm->width == renditions[i].width && pVidStm->height == renditions[i].height, "Video size of '"+renditions[i].url+"'");
+        UnitCheck(pVidStm->frameNum == frameCount, "Video frame count of '"+renditions[i].url+"'");
+    }
+}
+
+#include "MediaEncoder.h"
+#include "MultiTrackVideoReader.h"
+#include "SmartRender.h"
+static bool EncodeTestPatternVideo(const string& url, uint32_t width, uint32_t height, const Ratio& frameRate, uint32_t frameCount, uint32_t gopSize,
+        const MediaEncoder::VideoThreadingOptions* pThdOpts = nullptr, MediaEncoder::Statistics* pStats = nullptr,
+        const string& codecName = "mpeg4", const vector<MediaEncoder::Option>& codecOpts = {})
+{
+    auto hEncoder = MediaEncoder::CreateInstance();
+    if (!UnitCheck(hEncoder->Open(url), "Open encoder '"+url+"': "+hEncoder->GetError()))
+        return false;
+    if (pThdOpts && !UnitCheck(hEncoder->SetVideoThreadingOptions(*pThdOpts), "Set threading options: "+hEncoder->GetError()))
+        return false;
+    string imageFormat = "yuv420p";
+    vector<MediaEncoder::Option> extraOpts = {{ "g", Value((int64_t)gopSize) }};
+    extraOpts.insert(extraOpts.end(), codecOpts.begin(), codecOpts.end());
+    if (!UnitCheck(hEncoder->ConfigureVideoStream(codecName, imageFormat, width, height, frameRate, 2*1000*1000, &extraOpts), "Configure encoder: "+hEncoder->GetError()))
+        return false;
+    if (!UnitCheck(hEncoder->Start(), "Start encoder: "+hEncoder->GetError()))
+        return false;
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        auto vmat = MakeTestPatternImage(width, height, i);
+        vmat.time_stamp = (double)i*frameRate.den/frameRate.num;
+        if (!UnitCheck(hEncoder->EncodeVideoFrame(vmat), "Encode test pattern: "+hEncoder->GetError()))
+            return false;
+    }
+    ImGui::ImMat eofMat;
+    hEncoder->EncodeVideoFrame(eofMat);
+    const bool success = UnitCheck(hEncoder->FinishEncoding(), "Finish encoding: "+hEncoder->GetError());
+    if (pStats)
+        *pStats = hEncoder->GetStatistics();
+    hEncoder->Close();
+    return success;
+}
+
+static void Unit_EncoderThreadAutoTune()
+{
+    AutoSection _as("EncoderThreadAutoTune");
+    const string url = "/tmp/autotune_enc.mp4";
+    const uint32_t width = 640, height = 360;
+    const Ratio frameRate(25, 1);
+    const uint32_t frameCount = 60;     // enough for the encoder to record a throughput profile
+    const int32_t coreCount = max((int32_t)thread::hardware_concurrency(), 1);
+
+    MediaEncoder::VideoThreadingOptions fixedOpts;
+    fixedOpts.threadCount = 2;
+    MediaEncoder::Statistics stats;
+    if (!EncodeTestPatternVideo(url, width, height, frameRate, frameCount, 25, &fixedOpts, &stats))
+        return;
+    UnitCheck(stats.vidEncoderThreadCount == 2, "Fixed encoder thread count is applied");
+
+    MediaEncoder::VideoThreadingOptions autoOpts;
+    autoOpts.threadCount = 64;          // ignored by 'autoTune'
+    autoOpts.autoTune = true;
+    // the first export has no measurement, the second one is tuned by the profile recorded by the first
+    for (int i = 0; i < 2; i++)
+    {
+        if (!EncodeTestPatternVideo(url, width, height, frameRate, frameCount, 25, &autoOpts, &stats))
+            return;
+        ostringstream oss; oss << "Auto-tuned export #" << i << " uses " << stats.vidEncoderThreadCount << " encoder threads, "
+                << stats.vidConverterThreadCount << " conversion threads, encode utilization " << stats.encodeUtilization;
+        Log(INFO) << oss.str() << endl;
+        const int32_t maxCount = max(coreCount-(int32_t)stats.vidConverterThreadCount-1, 1);
+        UnitCheck(stats.vidEncoderThreadCount >= 1 && (int32_t)stats.vidEncoderThreadCount <= maxCount, "Auto-tuned thread count is in range: "+oss.str());
+        UnitCheck(stats.encodeUtilization > 0 && stats.encodeUtilization <= 1.f, "Encode utilization is a fraction of the elapsed time: "+oss.str());
+    }
+}
+
+// Export a timeline of the whole 'srcUrl' by smart-render, with the output encoder configured by 'codecName' and 'extraOpts'
+static bool SmartRenderExportFile(const string& srcUrl, const string& dstUrl, uint32_t width, uint32_t height, const Ratio& frameRate,
+        uint32_t frameCount, const string& codecName, vector<MediaEncoder::Option> extraOpts, vector<SmartRender::Segment>& plan,
+        MediaEncoder::Statistics& stats)
+{
+    auto hParser = MediaParser::CreateInstance();
+    if (!UnitCheck(hParser->Open(srcUrl), "Open source: "+hParser->GetError()))
+        return false;
+    hParser->EnableParseInfo(MediaParser::VIDEO_SEEK_POINTS);
+    auto hSeekPoints = hParser->GetVideoSeekPoints(true);
+    UnitCheck(hSeekPoints && hSeekPoints->size() >= 6, "Seek points of the source");
+
+    auto hMtvReader = MultiTrackVideoReader::CreateInstance();
+    if (!UnitCheck(hMtvReader->Configure(width, height, frameRate, IM_DT_INT8), "Configure MultiTrackVideoReader: "+hMtvReader->GetError()))
+        return false;
+    hMtvReader->Start();
+    auto hTrack = hMtvReader->AddTrack(1);
+    const int64_t clipDur = (int64_t)frameCount*1000*frameRate.den/frameRate.num;
+    auto hClip = VideoClip::CreateVideoInstance(2, hParser, hMtvReader->GetSharedSettings(), 0, clipDur, 0, 0, 0, true);
+    hTrack->InsertClip(hClip);
+    hMtvReader->Refresh();
+
+    auto hEncoder = MediaEncoder::CreateInstance();
+    if (!UnitCheck(hEncoder->Open(dstUrl), "Open output encoder: "+hEncoder->GetError()))
+        return false;
+    SmartRender::VideoExportSettings settings;
+    settings.codecName = codecName;
+    settings.imageFormat = "yuv420p";
+    settings.width = width;
+    settings.height = height;
+    settings.frameRate = frameRate;
+    string imageFormat = settings.imageFormat;
+    if (!UnitCheck(hEncoder->ConfigureVideoStream(settings.codecName, imageFormat, width, height, frameRate, 2*1000*1000, &extraOpts), "Configure output encoder: "+hEncoder->GetError()))
+        return false;
+    hEncoder->Start();
+    string errMsg;
+    bool success = UnitCheck(SmartRender::ExportVideo(hMtvReader, hEncoder, settings, errMsg, &plan), "ExportVideo: "+errMsg);
+    success &= UnitCheck(hEncoder->FinishEncoding(), "Finish output encoding: "+hEncoder->GetError());
+    stats = hEncoder->GetStatistics();
+    hEncoder->Close();
+    hMtvReader->Close();
+
+    int64_t planEnd = 0;
+    for (auto& seg : plan)
+    {
+        Log(INFO) << "Smart-render segment " << seg << endl;
+        UnitCheck(seg.start == planEnd, "Segments are consecutive");
+        planEnd = seg.end;
+    }
+    UnitCheck(planEnd == clipDur, "Segments cover the timeline");
+    return success;
+}
+
+// Decode all the frames of 'url', the frames not decodable are not counted
+static uint32_t CountDecodedFrames(const string& url, uint32_t width, uint32_t height)
+{
+    auto hReader = MediaReader::CreateVideoInstance();
+    if (!UnitCheck(hReader->Open(url), "Open '"+url+"' for decoding: "+hReader->GetError()))
+        return 0;
+    hReader->EnableHwAccel(false);
+    if (!UnitCheck(hReader->ConfigVideoReader(width, height), "Configure the reader of '"+url+"': "+hReader->GetError()) || !hReader->Start())
+        return 0;
+    uint32_t count = 0;
+    bool eof = false;
+    while (!eof)
+    {
+        auto hVfrm = hReader->ReadNextVideoFrame(eof);
+        if (hVfrm)
+            count++;
+    }
+    hReader->Close();
+    return count;
+}
+
+static void Unit_SmartRenderExport()
+{
+    AutoSection _as("SmartRenderExport");
+    const string srcUrl = "/tmp/smartrender_src.mp4";
+    const string dstUrl = "/tmp/smartrender_dst.mp4";
+    const uint32_t width = 320, height = 240;
+    const Ratio frameRate(25, 1);
+    const uint32_t frameCount = 150;
+    if (!EncodeTestPatternVideo(srcUrl, width, height, frameRate, frameCount, 25))
+        return;
+
+    vector<SmartRender::Segment> plan;
+    MediaEncoder::Statistics stats;
+    if (!SmartRenderExportFile(srcUrl, dstUrl, width, height, frameRate, frameCount, "mpeg4", {{ "g", Value((int64_t)25) }}, plan, stats))
+        return;
+    const bool hasPassthrough = any_of(plan.begin(), plan.end(), [] (const SmartRender::Segment& seg) { return seg.passthrough; });
+    UnitCheck(hasPassthrough, "Plan has a passthrough segment");
+    UnitCheck(stats.vidPassthroughSegmentCount > 0, "Encoder copied the passthrough segments");
+
+    auto hOutParser = MediaParser::CreateInstance();
+    if (!UnitCheck(hOutParser->Open(dstUrl), "Open export output"))
+        return;
+    auto pVidStm = FindVideoStream(hOutParser->GetMediaInfo());
+    if (UnitCheck(pVidStm != nullptr, "Video stream of the export output"))
+        UnitCheck(pVidStm->frameNum == frameCount, "Frame count of the export output");
+}
+
+static void Unit_SmartRenderH264Params()
+{
+    AutoSection _as("SmartRenderH264Params");
+    vector<MediaEncoder::Description> encDescs;
+    if (!MediaEncoder::FindEncoder("libx264", encDescs) || encDescs.empty())
+    {
+        Log(WARN) << "Encoder 'libx264' is NOT available, skip the test." << endl;
+        return;
+    }
+    const string srcUrl = "/tmp/smartrender_h264_src.mp4";
+    const uint32_t width = 320, height = 240;
+    const Ratio frameRate(25, 1);
+    const uint32_t frameCount = 150;
+    const vector<MediaEncoder::Option> srcOpts = {{ "bf", Value((int64_t)0) }, { "profile", Value("high") }};
+    if (!EncodeTestPatternVideo(srcUrl, width, height, frameRate, frameCount, 25, nullptr, nullptr, "libx264", srcOpts))
+        return;
+
+    // the export encoder uses another profile, its SPS/PPS differ from the source's, so nothing is passed through
+    {
+        const string dstUrl = "/tmp/smartrender_h264_main.mp4";
+        vector<SmartRender::Segment> plan;
+        MediaEncoder::Statistics stats;
+        vector<MediaEncoder::Option> dstOpts = {{ "g", Value((int64_t)25) }, { "bf", Value((int64_t)0) }, { "profile", Value("main") }};
+        if (SmartRenderExportFile(srcUrl, dstUrl, width, height, frameRate, frameCount, "libx264", dstOpts, plan, stats))
+        {
+            const bool hasPassthrough = any_of(plan.begin(), plan.end(), [] (const SmartRender::Segment& seg) { return seg.passthrough; });
+            UnitCheck(!hasPassthrough, "Source encoded with other parameter sets is NOT passed through");
+            UnitCheck(stats.vidPassthroughSegmentCount == 0, "Encoder copied no packet");
+            UnitCheck(CountDecodedFrames(dstUrl, width, height) == frameCount, "All the frames of the re-encoded output are decodable");
+        }
+    }
+
+    // the same encoder settings, the length prefixed source packets are spliced with the encoded ones
+    {
+        const string dstUrl = "/tmp/smartrender_h264_high.mp4";
+        vector<SmartRender::Segment> plan;
+        MediaEncoder::Statistics stats;
+        vector<MediaEncoder::Option> dstOpts = {{ "g", Value((int64_t)25) }};
+        dstOpts.insert(dstOpts.end(), srcOpts.begin(), srcOpts.end());
+        if (SmartRenderExportFile(srcUrl, dstUrl, width, height, frameRate, frameCount, "libx264", dstOpts, plan, stats))
+        {
+            const bool hasPassthrough = any_of(plan.begin(), plan.end(), [] (const SmartRender::Segment& seg) { return seg.passthrough; });
+            UnitCheck(hasPassthrough, "Source encoded with the same parameter sets is passed through");
+            UnitCheck(stats.vidPassthroughSegmentCount > 0, "Encoder copied the passthrough segments");
+            UnitCheck(CountDecodedFrames(dstUrl, width, height) == frameCount, "All the frames of the spliced output are decodable");
+        }
+    }
+}
+
+#include "ProxyManager.h"
+static void Unit_ProxyExportMode()
+{
+    AutoSection _as("ProxyExportMode");
+    const string srcUrl = "/tmp/proxy_export_src.mp4";
+    const uint32_t width = 320, height = 240;
+    const Ratio frameRate(25, 1);
+    const uint32_t frameCount = 50;
+    if (!EncodeTestPatternVideo(srcUrl, width, height, frameRate, frameCount, 25))
+        return;
+
+    // the source is higher than 'maxHeight', so it gets a proxy
+    auto hProxyMgr = ProxyManager::CreateInstance();
+    ProxyManager::Settings proxySettings;
+    proxySettings.proxyDir = "/tmp/proxy_export_test";
+    proxySettings.maxHeight = 120;
+    proxySettings.workerCount = 1;
+    if (!UnitCheck(hProxyMgr->Initialize(proxySettings), "Initialize ProxyManager: "+hProxyMgr->GetError()))
+        return;
+    hProxyMgr->RequestProxy(srcUrl, ProxyManager::PRIORITY_HIGH);
+    hProxyMgr->WaitAllDone();
+    if (!UnitCheck(hProxyMgr->GetProxyState(srcUrl) == ProxyManager::PROXY_READY, "Proxy of the source is generated: "+hProxyMgr->GetError()))
+        return;
+
+    auto hParser = MediaParser::CreateInstance();
+    if (!UnitCheck(hParser->Open(srcUrl), "Open source: "+hParser->GetError()))
+        return;
+    auto hPlaySettings = SharedSettings::CreateInstance();
+    hPlaySettings->SetVideoOutWidth(width);
+    hPlaySettings->SetVideoOutHeight(height);
+    hPlaySettings->SetVideoOutFrameRate(frameRate);
+    hPlaySettings->SetVideoOutColorFormat(IM_CF_RGBA);
+    hPlaySettings->SetVideoOutDataType(IM_DT_INT8);
+    hPlaySettings->SetProxyManager(hProxyMgr);
+    auto hPlayReader = MultiTrackVideoReader::CreateInstance();
+    if (!UnitCheck(hPlayReader->Configure(hPlaySettings), "Configure the playback reader: "+hPlayReader->GetError()))
+        return;
+    hPlayReader->Start();
+    auto hTrack = hPlayReader->AddTrack(1);
+    const int64_t clipDur = (int64_t)frameCount*1000*frameRate.den/frameRate.num;
+    auto hClip = VideoClip::CreateVideoInstance(2, hParser, hPlaySettings, 0, clipDur, 0, 0, 0, true);
+    hTrack->InsertClip(hClip);
+    hPlayReader->Refresh();
+    UnitCheck(hClip->IsUsingProxy(), "Playback clip reads from the proxy");
+
+    // the export settings are cloned from the timeline's, the proxy manager comes along but is not resolved
+    auto hExportSettings = hPlaySettings->Clone();
+    hExportSettings->SetExportMode(true);
+    UnitCheck(!hExportSettings->GetProxyManager(), "Export settings resolve no proxy");
+    UnitCheck(hPlaySettings->GetProxyManager() == hProxyMgr, "Timeline settings still resolve the proxies");
+    auto hExportReader = hPlayReader->CloneAndConfigure(hExportSettings);
+    if (UnitCheck(hExportReader != nullptr, "Clone the export reader: "+hPlayReader->GetError()))
+    {
+        int clipCount = 0;
+        for (auto trkIter = hExportReader->TrackListBegin(); trkIter != hExportReader->TrackListEnd(); trkIter++)
+        {
+            for (auto& hExportClip : (*trkIter)->GetClipList())
+            {
+                clipCount++;
+                UnitCheck(!hExportClip->IsUsingProxy(), "Export clip reads from the source");
+            }
+        }
+        UnitCheck(clipCount == 1, "Export reader has the clip");
+        ImGui::ImMat vmat;
+        UnitCheck(hExportReader->ReadVideoFrameByIdx(10, vmat) && !vmat.empty(), "Read a frame of the export: "+hExportReader->GetError());
+        hExportReader->Close();
+    }
+
+    // exporting through the playback reader is refused
+    auto hEncoder = MediaEncoder::CreateInstance();
+    if (UnitCheck(hEncoder->Open("/tmp/proxy_export_dst.mp4"), "Open output encoder: "+hEncoder->GetError()))
+    {
+        SmartRender::VideoExportSettings settings;
+        settings.codecName = "mpeg4";
+        settings.imageFormat = "yuv420p";
+        settings.width = width;
+        settings.height = height;
+        settings.frameRate = frameRate;
+        string imageFormat = settings.imageFormat;
+        if (UnitCheck(hEncoder->ConfigureVideoStream(settings.codecName, imageFormat, width, height, frameRate, 2*1000*1000), "Configure output encoder: "+hEncoder->GetError())
+            && UnitCheck(hEncoder->Start(), "Start output encoder: "+hEncoder->GetError()))
+        {
+            string errMsg;
+            UnitCheck(!SmartRender::ExportVideo(hPlayReader, hEncoder, settings, errMsg), "Export through the proxy-reading settings is refused");
+        }
+        hEncoder->Close();
+    }
+    hPlayReader->Close();
+}
+
+#include "Snapshot.h"
+// Wait until all the snapshots in the view window are decoded, return them ordered by the snapshot index
+static bool CollectSnapshots(const string& url, uint32_t workerCount, double windowSize, double windowFrames, vector<Snapshot::Image>& snapshots)
+{
+    auto hParser = MediaParser::CreateInstance();
+    if (!UnitCheck(hParser->Open(url), "Open snapshot source: "+hParser->GetError()))
+        return false;
+    auto hGenerator = Snapshot::Generator::CreateInstance();
+    hGenerator->EnableHwAccel(false);
+    hGenerator->SetSnapshotSize(160, 120);
+    if (!UnitCheck(hGenerator->SetDecodeWorkerCount(workerCount), "Set decode worker count: "+hGenerator->GetError()))
+        return false;
+    if (!UnitCheck(hGenerator->Open(hParser), "Open snapshot generator: "+hGenerator->GetError()))
+        return false;
+    UnitCheck(hGenerator->GetDecodeWorkerCount() == workerCount, "Decode worker count is kept");
+    auto hViewer = hGenerator->CreateViewer(0);
+    hGenerator->ConfigSnapWindow(windowSize, windowFrames, true);
+    bool allReady = false;
+    const auto t0 = chrono::steady_clock::now();
+    while (!allReady && chrono::steady_clock::now()-t0 < chrono::seconds(20))
+    {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        snapshots.clear();
+        if (!hViewer->GetSnapshots(0, snapshots) || snapshots.empty())
+            continue;
+        allReady = all_of(snapshots.begin(), snapshots.end(), [] (const Snapshot::Image& img) {
+            return img.hDispData && !img.hDispData->mImgMat.empty();
+        });
+    }
+    hGenerator->ReleaseViewer(hViewer);
+    hGenerator->Close();
+    ostringstream oss; oss << "All the snapshots are decoded by " << workerCount << " workers";
+    if (!UnitCheck(allReady, oss.str()))
+        return false;
+    sort(snapshots.begin(), snapshots.end(), [] (const Snapshot::Image& a, const Snapshot::Image& b) {
+        return a.ssIndex < b.ssIndex;
+    });
+    return true;
+}
+
+static void Unit_SnapshotDecodeWorkers()
+{
+    AutoSection _as("SnapshotDecodeWorkers");
+    const string url = "/tmp/snapshot_workers_src.mp4";
+    const Ratio frameRate(25, 1);
+    if (!EncodeTestPatternVideo(url, 320, 240, frameRate, 250, 25))
+        return;
+
+    // the same snapshots are produced no matter how many workers decode the GOPs
+    vector<Snapshot::Image> refSnapshots;
+    if (!CollectSnapshots(url, 1, 10., 20., refSnapshots))
+        return;
+    for (uint32_t workerCount : {2u, 4u})
+    {
+        vector<Snapshot::Image> snapshots;
+        if (!CollectSnapshots(url, workerCount, 10., 20., snapshots))
+            continue;
+        ostringstream oss; oss << workerCount << " workers";
+        if (!UnitCheck(snapshots.size() == refSnapshots.size(), "Snapshot count with "+oss.str()))
+            continue;
+        for (size_t i = 0; i < snapshots.size(); i++)
+        {
+            const auto& a = refSnapshots[i].hDispData->mImgMat;
+            const auto& b = snapshots[i].hDispData->mImgMat;
+            ostringstream oss2; oss2 << "Snapshot #" << refSnapshots[i].ssIndex << " with " << oss.str();
+            UnitCheck(snapshots[i].ssIndex == refSnapshots[i].ssIndex && snapshots[i].ssTimestampMs == refSnapshots[i].ssTimestampMs, oss2.str()+" has the same position");
+            UnitCheck(a.w == b.w && a.h == b.h && a.total()*a.elemsize == b.total()*b.elemsize
+                    && memcmp(a.data, b.data, a.total()*a.elemsize) == 0, oss2.str()+" has the same image");
+        }
+    }
+}
+
+#include "PreviewCache.h"
+// mean absolute difference of the smooth gradient channels, JPEG keeps them close
+static double CalcGradientChannelsDiff(const ImGui::ImMat& a, const ImGui::ImMat& b)
+{
+    const uint8_t* pa = (const uint8_t*)a.data;
+    const uint8_t* pb = (const uint8_t*)b.data;
+    double diffSum = 0;
+    const size_t pixCnt = (size_t)a.w*a.h;
+    for (size_t i = 0; i < pixCnt; i++, pa += 4, pb += 4)
+        diffSum += abs((int)pa[0]-(int)pb[0])+abs((int)pa[1]-(int)pb[1]);
+    return diffSum/(pixCnt*2);
+}
+
+static void Unit_PreviewCache()
+{
+    AutoSection _as("PreviewCache");
+    const string cacheDir = "/tmp/pvc_unittest";
+    auto hCache = PreviewCache::CreateInstance();
+    if (!UnitCheck(hCache->Open(cacheDir, 0), "Open preview cache: "+hCache->GetError()))
+        return;
+    hCache->Clear();
+
+    // the entries are served from memory right after queued, and from the file after written
+    vector<ImGui::ImMat> images;
+    for (uint32_t i = 0; i < 3; i++)
+        images.push_back(MakeTestPatternImage(160, 90, i));
+    images.push_back(ImGui::ImMat());
+    const string imgKey = "unittest|images";
+    UnitCheck(hCache->PutImages(imgKey, images), "Put images: "+hCache->GetError());
+    vector<ImGui::ImMat> loaded;
+    UnitCheck(hCache->GetImages(imgKey, loaded) && loaded.size() == images.size(), "Get queued images");
+    hCache->Flush();
+    UnitCheck(hCache->Contains(imgKey), "Images entry is written");
+    loaded.clear();
+    if (UnitCheck(hCache->GetImages(imgKey, loaded) && loaded.size() == images.size(), "Get written images: "+hCache->GetError()))
+    {
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            ostringstream oss; oss << "Image #" << i;
+            if (!UnitCheck(loaded[i].w == images[i].w && loaded[i].h == images[i].h && loaded[i].color_format == images[i].color_format
+                    && loaded[i].type == images[i].type, oss.str()+" keeps its format"))
+                continue;
+            const double diff = CalcGradientChannelsDiff(images[i], loaded[i]);
+            oss << " differs by " << diff << " on average";
+            UnitCheck(diff < 6., oss.str());
+        }
+        UnitCheck(loaded[3].empty(), "Empty image is kept as placeholder");
+    }
+
+    vector<uint8_t> data(10000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i*7);
+    const string dataKey = "unittest|data";
+    UnitCheck(hCache->PutData(dataKey, data), "Put data: "+hCache->GetError());
+    hCache->Flush();
+    vector<uint8_t> loadedData;
+    UnitCheck(hCache->GetData(dataKey, loadedData) && loadedData == data, "Get written data");
+    UnitCheck(!hCache->GetData("unittest|missing", loadedData), "Missing entry is not found");
+    UnitCheck(!hCache->GetData(imgKey, loadedData), "Entry type is checked");
+
+    // entries persist across instances
+    hCache->Close();
+    hCache = PreviewCache::CreateInstance();
+    if (!UnitCheck(hCache->Open(cacheDir, 0), "Reopen preview cache: "+hCache->GetError()))
+        return;
+    UnitCheck(hCache->Contains(imgKey) && hCache->Contains(dataKey), "Entries persist after reopening");
+
+    // the least recently used entries are evicted
+    hCache->Clear();
+    const uint64_t sizeLimit = 5*data.size();
+    hCache->SetSizeLimit(sizeLimit);
+    for (int i = 0; i < 10; i++)
+    {
+        ostringstream oss; oss << "unittest|evict|" << i;
+        UnitCheck(hCache->PutData(oss.str(), data), "Put data for eviction: "+hCache->GetError());
+        hCache->Flush();
+        if (i == 1)
+            hCache->GetData("unittest|evict|0", loadedData);    // keep #0 recently used
+    }
+    UnitCheck(hCache->GetTotalSize() <= sizeLimit, "Total size is within the limit");
+    UnitCheck(hCache->Contains("unittest|evict|9"), "The latest entry is kept");
+    UnitCheck(!hCache->Contains("unittest|evict|1"), "The least recently used entry is evicted");
+    hCache->Clear();
+    hCache->Close();
+}
+
+#include "OverviewService.h"
+static void Unit_OverviewService()
+{
+    AutoSection _as("OverviewService");
+    vector<string> urls;
+    for (int i = 0; i < 3; i++)
+    {
+        ostringstream oss; oss << "/tmp/ovw_service_src" << i << ".mp4";
+        if (!EncodeTestPatternVideo(oss.str(), 320, 240, Ratio(25, 1), 50, 10))
+            return;
+        urls.push_back(oss.str());
+    }
+
+    // only one overview fits in the thread budget, the video decoder gets the threads left by the others
+    OverviewService::Settings settings;
+    settings.maxRunningOverviews = 4;
+    settings.maxThreads = 8;
+    settings.videoDecoderThreads = 8;
+    settings.swsThreads = 1;
+    settings.maxFinishedOverviews = 1;
+    settings.snapshotCount = 5;
+    auto hService = OverviewService::CreateInstance();
+    if (!UnitCheck(hService->Initialize(settings), "Initialize overview service: "+hService->GetError()))
+        return;
+
+    // a new overview is started only after the decoders of the done ones are released
+    mutex doneLock;
+    vector<Overview::Holder> doneOverviews;
+    unordered_set<string> startedUrls;
+    hService->SetProgressCallback([&] (const string& url, OverviewService::State state, float progress) {
+        lock_guard<mutex> lk(doneLock);
+        if (state == OverviewService::OVERVIEW_GENERATING && startedUrls.insert(url).second)
+        {
+            for (auto& hOverview : doneOverviews)
+                UnitCheck(hOverview->IsDecodingResourceReleased(), "Decoders of the done overviews are released before starting '"+url+"'");
+            auto hOverview = hService->GetOverview(url);
+            if (UnitCheck(hOverview != nullptr, "Overview of '"+url+"' is available once started"))
+            {
+                UnitCheck(hOverview->GetVideoDecoderThreadCount() == 3, "Video decoder threads are capped to the budget");
+                UnitCheck(hOverview->GetSwsThreadCount() == 1, "Scaler threads are set");
+            }
+        }
+        else if (state == OverviewService::OVERVIEW_DONE)
+        {
+            auto hOverview = hService->GetOverview(url);
+            if (UnitCheck(hOverview != nullptr, "Overview of '"+url+"' is available once done"))
+                doneOverviews.push_back(hOverview);
+        }
+        else if (state == OverviewService::OVERVIEW_FAILED)
+            UnitCheck(false, "Overview of '"+url+"' is generated");
+    });
+    for (auto& url : urls)
+        UnitCheck(hService->RequestOverview(url), "Request overview: "+hService->GetError());
+    hService->WaitAllDone();
+    UnitCheck(startedUrls.size() == urls.size(), "All the overviews are started");
+
+    // the oldest finished jobs are dropped once the last one releases its decoders
+    bool pruned = false;
+    for (int i = 0; i < 100 && !pruned; i++)
+    {
+        pruned = hService->GetState(urls[0]) == OverviewService::OVERVIEW_NONE && hService->GetState(urls[1]) == OverviewService::OVERVIEW_NONE;
+        if (!pruned)
+            this_thread::sleep_for(chrono::milliseconds(50));
+    }
+    UnitCheck(pruned, "Oldest finished overviews are dropped");
+    UnitCheck(hService->GetState(urls[2]) == OverviewService::OVERVIEW_DONE, "Latest finished overview is kept");
+    hService->SetProgressCallback(nullptr);
+}
+
+#include "SubtitleDraw.h"
+// Rows shaped like rendered text: blank gaps, anti-aliased edges and solid strokes
+static vector<uint8_t> MakeGlyphLikeBitmap(int width, int height)
+{
+    vector<uint8_t> bitmap((size_t)width*height, 0);
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t* row = bitmap.data()+(size_t)i*width;
+        int j = (i*7)%23;
+        while (j < width)
+        {
+            const int stroke = 3+(i+j)%9;
+            for (int k = 0; k < 2 && j < width; k++, j++)
+                row[j] = (uint8_t)(80*(k+1));
+            for (int k = 0; k < stroke && j < width; k++, j++)
+                row[j] = 255;
+            for (int k = 0; k < 2 && j < width; k++, j++)
+                row[j] = (uint8_t)(160-80*k);
+            j += 5+(i*3+j)%17;
+        }
+    }
+    return bitmap;
+}
+
+static void Unit_SubtitleDrawBenchmark()
+{
+    AutoSection _as("SubtitleDrawBenchmark");
+    const int width = 1920, height = 120;
+    const auto bitmap = MakeGlyphLikeBitmap(width, height);
+    const uint32_t color = 0x00336699, bgColor = 0x80101010;
+
+    // the drawn rows match the plain per-pixel composition, for the widths not multiple of the vector size too
+    for (uint32_t baseAlpha : {255u, 128u, 1u})
+    {
+        for (int w : {width, 37, 15})
+        {
+            vector<uint32_t> pixels((size_t)w*height, bgColor), refPixels((size_t)w*height, bgColor);
+            for (int i = 0; i < height; i++)
+            {
+                const uint8_t* row = bitmap.data()+(size_t)i*width;
+                DrawAssBitmapRow(pixels.data()+(size_t)i*w, row, w, color, baseAlpha);
+                for (int j = 0; j < w; j++)
+                    if (row[j] > 0)
+                        refPixels[(size_t)i*w+j] = color | ((row[j]*baseAlpha/255)<<24);
+            }
+            ostringstream oss; oss << "Drawn rows with width=" << w << ", baseAlpha=" << baseAlpha << " match the reference";
+            UnitCheck(pixels == refPixels, oss.str());
+        }
+    }
+
+    // only the composition is timed, no libass rendering nor track state is involved
+    vector<uint32_t> pixels((size_t)width*height, bgColor);
+    const int passes = 200;
+    const auto t0 = chrono::steady_clock::now();
+    for (int n = 0; n < passes; n++)
+    {
+        for (int i = 0; i < height; i++)
+            DrawAssBitmapRow(pixels.data()+(size_t)i*width, bitmap.data()+(size_t)i*width, width, color+n, 255);
+    }
+    const double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now()-t0).count();
+    const double pixelCount = (double)passes*width*height;
+    Log(INFO) << "[SubtitleDrawBenchmark] Drew " << passes << " images of " << width << "x" << height << " in " << totalMs << "ms, "
+        << (totalMs*1e6/pixelCount) << "ns per pixel." << endl;
+}
+
+#include "SubtitleTrack.h"
+// Wait for the pre-render worker to fill the range at 'pos', after 'minRestarts' restarts
+static bool WaitPreRenderIdle(SubtitleTrackHolder hTrack, int64_t pos, bool forward, uint32_t minRestarts, SubtitleTrack::PreRenderStatistics& stats)
+{
+    for (int i = 0; i < 500; i++)
+    {
+        stats = hTrack->GetPreRenderStatistics();
+        if (stats.idle && stats.playPos == pos && stats.forward == forward && stats.restartCount >= minRestarts)
+            return true;
+        this_thread::sleep_for(chrono::milliseconds(20));
+    }
+    return false;
+}
+
+static void Unit_SubtitlePreRender()
+{
+    AutoSection _as("SubtitlePreRender");
+    if (!UnitCheck(InitializeSubtitleLibrary(), "Initialize subtitle library"))
+        return;
+    auto hTrack = SubtitleTrack::NewEmptyTrack(0);
+    hTrack->SetFrameSize(640, 360);
+    vector<SubtitleClipHolder> clips;
+    for (int i = 0; i < 20; i++)
+    {
+        auto hClip = hTrack->NewClip(i*1000, 900);
+        ostringstream oss; oss << "Subtitle line #" << i;
+        hClip->SetText(oss.str());
+        clips.push_back(hClip);
+    }
+
+    // forward run, the images of the next 2 seconds are rendered
+    const Ratio frameRate(25, 1);
+    const int64_t frameMs = 40;
+    SubtitleTrack::PreRenderStatistics stats;
+    UnitCheck(hTrack->EnablePreRender(true, frameRate, 2000, 64ULL*1024*1024), "Enable pre-rendering: "+hTrack->GetError());
+    hTrack->UpdatePreRenderPosition(0, true);
+    if (UnitCheck(WaitPreRenderIdle(hTrack, 0, true, 1, stats), "Forward pre-rendering finishes"))
+    {
+        UnitCheck(stats.nextFramePos >= 2000 && stats.nextFramePos < 2000+frameMs, "Forward pre-rendering stops at the end of the duration");
+        UnitCheck(stats.imagesAhead == 2 && stats.bytesAhead > 0, "Forward pre-rendering renders the images of the clips ahead");
+    }
+
+    // reverse run, the images of the previous 2 seconds are rendered
+    uint32_t restarts = stats.restartCount;
+    hTrack->UpdatePreRenderPosition(15500, false);
+    if (UnitCheck(WaitPreRenderIdle(hTrack, 15500, false, restarts+1, stats), "Reverse pre-rendering finishes"))
+    {
+        UnitCheck(stats.nextFramePos <= 13500 && stats.nextFramePos > 13500-frameMs, "Reverse pre-rendering stops at the end of the duration");
+        UnitCheck(stats.imagesAhead == 3 && stats.bytesAhead > 0, "Reverse pre-rendering renders the images of the clips behind");
+    }
+
+    // a seek cancels the unfinished pre-rendering, which restarts from the new position
+    restarts = stats.restartCount;
+    hTrack->UpdatePreRenderPosition(5000, true);
+    hTrack->UpdatePreRenderPosition(12000, true);
+    if (UnitCheck(WaitPreRenderIdle(hTrack, 12000, true, restarts+1, stats), "Pre-rendering after the seeks finishes"))
+    {
+        UnitCheck(stats.nextFramePos >= 14000 && stats.nextFramePos < 14000+frameMs, "Pre-rendering continues from the last seek");
+        UnitCheck(stats.imagesAhead == 2, "Only the images after the last seek are counted");
+    }
+
+    // changing a clip ahead restarts the pre-rendering
+    restarts = stats.restartCount;
+    clips[13]->SetText("Changed subtitle line");
+    if (UnitCheck(WaitPreRenderIdle(hTrack, 12000, true, restarts+1, stats), "Pre-rendering restarts after a clip is changed"))
+        UnitCheck(stats.imagesAhead == 2, "Changed clip is rendered again");
+
+    // the memory budget stops the pre-rendering before the end of the duration
+    UnitCheck(hTrack->EnablePreRender(true, frameRate, 10000, 1), "Change the pre-rendering budget: "+hTrack->GetError());
+    restarts = stats.restartCount;
+    hTrack->UpdatePreRenderPosition(0, true);
+    if (UnitCheck(WaitPreRenderIdle(hTrack, 0, true, restarts+1, stats), "Pre-rendering within the memory budget finishes"))
+    {
+        UnitCheck(stats.imagesAhead == 1 && stats.bytesAhead > 0, "Pre-rendering stops once the memory budget is used up");
+        UnitCheck(stats.nextFramePos < 10000, "Pre-rendering stops before the end of the duration");
+    }
+    hTrack->EnablePreRender(false);
+    UnitCheck(!hTrack->IsPreRenderEnabled(), "Pre-rendering is stopped");
+    hTrack = nullptr;
+    ReleaseSubtitleLibrary();
+}
+
+// Animated clips, so every frame is rendered by libass instead of hitting the render cache
+static SubtitleTrackHolder MakeAnimatedSubtitleTrack(uint32_t maxRenderers, vector<SubtitleClipHolder>& clips)
+{
+    auto hTrack = SubtitleTrack::NewEmptyTrack(0);
+    hTrack->SetFrameSize(640, 360);
+    hTrack->SetMaxRenderers(maxRenderers);
+    for (int i = 0; i < 8; i++)
+    {
+        auto hClip = hTrack->NewClip(i*1000, 1000);
+        ostringstream oss; oss << "{\\move(20,40,420,300)}Moving subtitle line #" << i;
+        hClip->SetText(oss.str());
+        clips.push_back(hClip);
+    }
+    return hTrack;
+}
+
+static bool IsSameSubtitleImage(SubtitleImage a, SubtitleImage b)
+{
+    if (a.Valid() != b.Valid())
+        return false;
+    if (!a.Valid())
+        return true;
+    const auto ra = a.Area(), rb = b.Area();
+    if (ra.x != rb.x || ra.y != rb.y || ra.w != rb.w || ra.h != rb.h)
+        return false;
+    auto ma = a.Vmat(), mb = b.Vmat();
+    if (ma.w != mb.w || ma.h != mb.h || ma.c != mb.c || ma.elemsize != mb.elemsize)
+        return false;
+    return memcmp(ma.data, mb.data, ma.total()*ma.elemsize) == 0;
+}
+
+static void Unit_SubtitleRendererPool()
+{
+    AutoSection _as("SubtitleRendererPool");
+    if (!UnitCheck(InitializeSubtitleLibrary(), "Initialize subtitle library"))
+        return;
+    const int64_t frameMs = 40;
+    vector<pair<int, int64_t>> frames;
+    for (int i = 0; i < 8; i++)
+        for (int64_t offset = 0; offset < 1000; offset += frameMs)
+            frames.push_back({i, offset});
+
+    // the frames rendered one by one with a single renderer are the reference
+    vector<SubtitleClipHolder> refClips;
+    auto hRefTrack = MakeAnimatedSubtitleTrack(1, refClips);
+    vector<SubtitleImage> refImages;
+    for (auto& f : frames)
+        refImages.push_back(refClips[f.first]->Image(f.second));
+
+    // the same frames rendered concurrently by the pooled renderers
+    const int threadCount = 4;
+    vector<SubtitleClipHolder> clips;
+    auto hTrack = MakeAnimatedSubtitleTrack(threadCount, clips);
+    vector<SubtitleImage> images(frames.size());
+    vector<thread> threads;
+    for (int t = 0; t < threadCount; t++)
+    {
+        threads.push_back(thread([&, t] () {
+            for (size_t i = t; i < frames.size(); i += threadCount)
+                images[i] = clips[frames[i].first]->Image(frames[i].second);
+        }));
+    }
+    for (auto& th : threads)
+        th.join();
+
+    int validCount = 0, mismatchCount = 0;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        if (refImages[i].Valid())
+            validCount++;
+        if (!IsSameSubtitleImage(refImages[i], images[i]))
+            mismatchCount++;
+    }
+    UnitCheck(validCount == (int)frames.size(), "All the frames are rendered");
+    ostringstream oss; oss << "Images of the pooled renderers are the same as the single renderer's, " << mismatchCount << " differ";
+    UnitCheck(mismatchCount == 0, oss.str());
+    clips.clear();
+    refClips.clear();
+    hTrack = nullptr;
+    hRefTrack = nullptr;
+    ReleaseSubtitleLibrary();
+}
+
 struct TestCase
 {
     function<void (void)> testProc;
 };
 
 static unordered_map<string, TestCase> g_TestUnits = {
-    {"CreateVideoReaderInstance", {Unit_CreateVideoReaderInstance}}
+    {"CreateVideoReaderInstance", {Unit_CreateVideoReaderInstance}},
+    {"MultiRenditionEncoderFanout", {Unit_MultiRenditionEncoderFanout}},
+    {"SmartRenderExport", {Unit_SmartRenderExport}},
+    {"SmartRenderH264Params", {Unit_SmartRenderH264Params}},
+    {"ProxyExportMode", {Unit_ProxyExportMode}},
+    {"EncoderThreadAutoTune", {Unit_EncoderThreadAutoTune}},
+    {"PreviewCache", {Unit_PreviewCache}},
+    {"SnapshotDecodeWorkers", {Unit_SnapshotDecodeWorkers}},
+    {"OverviewService", {Unit_OverviewService}},
+    {"SubtitleDrawBenchmark", {Unit_SubtitleDrawBenchmark}},
+    {"SubtitlePreRender", {Unit_SubtitlePreRender}},
+    {"SubtitleRendererPool", {Unit_SubtitleRendererPool}},
 };
 
 int main(int argc, char* argv[])
@@ -55,5 +934,5 @@ int main(int argc, char* argv[])
         hPa->End();
         hPa->LogAndClearStatistics(INFO);
     }
-    return 0;
+    return g_unitTestFailed ? 1 : 0;
 }
\ No newline at end of file